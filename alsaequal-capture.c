@@ -0,0 +1,532 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+/* alsaequal-capture records what goes into and comes out of the
+   equalizer to WAV files, for when something sounds wrong. It follows
+   the audio tap of a PCM (see tap.h), so the audio thread never waits
+   for it. Recording runs while the "Tap Switch" is on and SIGUSR1 flips
+   the switch. A copier keeps up with the tap and a writer thread puts
+   the audio on disk in large blocks; frames the tap overwrote before
+   they were copied, or that found the writer's ring full, are counted
+   as dropped. */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "ladspa_utils.h"
+#include "ringbuffer.h"
+#include "tap.h"
+
+/* Frames copied from the tap at a time */
+#define CAPTURE_CHUNK 4096
+
+/* Frames the writer can fall behind by, about 10 s at 48 kHz */
+#define CAPTURE_RING_FRAMES (1 << 19)
+
+/* The tap is checked this often, well within the half of it that can
+   be read */
+#define CAPTURE_POLL_US 20000
+
+/* Files are written in blocks of this size, a multiple of the page size
+   for O_DIRECT */
+#define CAPTURE_BLOCK (1 << 20)
+
+/* The header takes a whole page so that the audio stays aligned */
+#define CAPTURE_HEADER 4096
+
+/* Files are rolled over before their sizes overflow the header */
+#define CAPTURE_MAX_BYTES (2u << 30)
+
+enum {
+	CAPTURE_START,
+	CAPTURE_AUDIO,
+	CAPTURE_STOP
+};
+
+/* What the copier hands the writer through the ring, an audio record is
+   followed by frames of pre-EQ and then frames of post-EQ samples */
+typedef struct capture_record {
+	uint32_t type;
+	uint32_t frames;
+	uint32_t rate;
+	uint32_t channels;
+} capture_record_t;
+
+typedef struct capture_file {
+	int fd;
+	int direct;
+	char *buf;		/* CAPTURE_BLOCK bytes, page aligned */
+	size_t fill;
+	uint64_t bytes;		/* Audio bytes written, including buf */
+	char *header;		/* CAPTURE_HEADER bytes, page aligned */
+} capture_file_t;
+
+static const char *prefix = "alsaequal-capture";
+static equal_ring_t *ring;
+static sem_t ring_wake;
+static volatile sig_atomic_t quit;
+static volatile sig_atomic_t toggle;
+static int writer_done;
+static uint64_t writer_dropped;
+
+static void capture_signal(int sig)
+{
+	if(sig == SIGUSR1) {
+		toggle = 1;
+	} else {
+		quit = 1;
+	}
+}
+
+static void put_le32(char *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static void put_le16(char *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+/* 32 bit float WAV header, padded with a JUNK chunk to CAPTURE_HEADER */
+static void capture_header(char *h, unsigned int rate, unsigned int channels,
+		uint64_t bytes)
+{
+	unsigned int frame = channels*sizeof(float);
+
+	memset(h, 0, CAPTURE_HEADER);
+	memcpy(h, "RIFF", 4);
+	put_le32(h + 4, CAPTURE_HEADER - 8 + bytes);
+	memcpy(h + 8, "WAVE", 4);
+	memcpy(h + 12, "fmt ", 4);
+	put_le32(h + 16, 18);
+	put_le16(h + 20, 3);		/* WAVE_FORMAT_IEEE_FLOAT */
+	put_le16(h + 22, channels);
+	put_le32(h + 24, rate);
+	put_le32(h + 28, rate*frame);
+	put_le16(h + 32, frame);
+	put_le16(h + 34, 32);
+	put_le16(h + 36, 0);
+	memcpy(h + 38, "fact", 4);
+	put_le32(h + 42, 4);
+	put_le32(h + 46, bytes/frame);
+	memcpy(h + 50, "JUNK", 4);
+	put_le32(h + 54, CAPTURE_HEADER - 8 - 58);
+	memcpy(h + CAPTURE_HEADER - 8, "data", 4);
+	put_le32(h + CAPTURE_HEADER - 4, bytes);
+}
+
+static int capture_open(capture_file_t *f, const char *name,
+		unsigned int rate, unsigned int channels)
+{
+	f->fill = 0;
+	f->bytes = 0;
+	f->direct = 1;
+	f->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+	if(f->fd < 0 && errno == EINVAL) {
+		/* The filesystem doesn't do O_DIRECT, e.g. tmpfs */
+		f->direct = 0;
+		f->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+	if(f->fd < 0) {
+		fprintf(stderr, "Can't create %s: %s\n", name, strerror(errno));
+		return -1;
+	}
+	capture_header(f->header, rate, channels, 0);
+	if(write(f->fd, f->header, CAPTURE_HEADER) != CAPTURE_HEADER) {
+		fprintf(stderr, "Can't write %s: %s\n", name, strerror(errno));
+		close(f->fd);
+		f->fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+/* Write out a full block and bring the header up to date, so that a file
+   is readable even if the capture is killed */
+static int capture_flush(capture_file_t *f, unsigned int rate,
+		unsigned int channels)
+{
+	if(write(f->fd, f->buf, CAPTURE_BLOCK) != CAPTURE_BLOCK) {
+		return -1;
+	}
+	f->fill = 0;
+	capture_header(f->header, rate, channels, f->bytes);
+	if(pwrite(f->fd, f->header, CAPTURE_HEADER, 0) != CAPTURE_HEADER) {
+		return -1;
+	}
+	return 0;
+}
+
+static int capture_write(capture_file_t *f, const char *src, size_t bytes,
+		unsigned int rate, unsigned int channels)
+{
+	size_t n;
+
+	while(bytes > 0) {
+		n = CAPTURE_BLOCK - f->fill;
+		if(n > bytes) {
+			n = bytes;
+		}
+		memcpy(f->buf + f->fill, src, n);
+		f->fill += n;
+		f->bytes += n;
+		src += n;
+		bytes -= n;
+		if(f->fill == CAPTURE_BLOCK && capture_flush(f, rate, channels) < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* The tail isn't a whole block, so it goes out without O_DIRECT */
+static void capture_close(capture_file_t *f, unsigned int rate,
+		unsigned int channels)
+{
+	if(f->fd < 0) {
+		return;
+	}
+	if(f->direct) {
+		fcntl(f->fd, F_SETFL, fcntl(f->fd, F_GETFL) & ~O_DIRECT);
+	}
+	if(f->fill > 0 && write(f->fd, f->buf, f->fill) != (ssize_t)f->fill) {
+		fprintf(stderr, "Can't write the end of a capture: %s\n",
+				strerror(errno));
+	}
+	capture_header(f->header, rate, channels, f->bytes);
+	if(pwrite(f->fd, f->header, CAPTURE_HEADER, 0) != CAPTURE_HEADER) {
+		fprintf(stderr, "Can't finish a capture header: %s\n",
+				strerror(errno));
+	}
+	close(f->fd);
+	f->fd = -1;
+}
+
+static int capture_open_pair(capture_file_t *f, unsigned int index,
+		unsigned int rate, unsigned int channels)
+{
+	char name[4096];
+
+	snprintf(name, sizeof(name), "%s-%03u-pre.wav", prefix, index);
+	if(capture_open(&f[EQUAL_TAP_PRE], name, rate, channels) < 0) {
+		return -1;
+	}
+	printf("Recording %s", name);
+	snprintf(name, sizeof(name), "%s-%03u-post.wav", prefix, index);
+	if(capture_open(&f[EQUAL_TAP_POST], name, rate, channels) < 0) {
+		capture_close(&f[EQUAL_TAP_PRE], rate, channels);
+		printf("\n");
+		return -1;
+	}
+	printf(" and %s at %u Hz\n", name, rate);
+	fflush(stdout);
+	return 0;
+}
+
+static void capture_ring_read(void *dst, size_t bytes)
+{
+	size_t n = 0;
+
+	while(n < bytes) {
+		n += equal_ring_read(ring, (char *)dst + n, bytes - n);
+	}
+}
+
+/* Takes records off the ring and writes them out, the only thread that
+   touches the files */
+static void *capture_writer(void *arg)
+{
+	capture_file_t f[2];
+	capture_record_t rec;
+	unsigned int rate = 0, channels = 0, index = 0;
+	size_t side_bytes;
+	char *audio = NULL;
+	int active = 0, failed, s;
+
+	(void)arg;
+	for(s = 0; s < 2; s++) {
+		f[s].fd = -1;
+		if(posix_memalign((void **)&f[s].buf, 4096, CAPTURE_BLOCK) != 0 ||
+				posix_memalign((void **)&f[s].header, 4096,
+				CAPTURE_HEADER) != 0) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+	}
+
+	for(;;) {
+		if(equal_ring_read_space(ring) < sizeof(rec)) {
+			if(__atomic_load_n(&writer_done, __ATOMIC_ACQUIRE) &&
+					equal_ring_read_space(ring) == 0) {
+				break;
+			}
+			while(sem_wait(&ring_wake) < 0 && errno == EINTR);
+			continue;
+		}
+		/* A record is put on the ring in one go, so its audio is
+		   there too */
+		capture_ring_read(&rec, sizeof(rec));
+		switch(rec.type) {
+		case CAPTURE_START:
+			rate = rec.rate;
+			channels = rec.channels;
+			audio = realloc(audio, 2*CAPTURE_CHUNK*channels*sizeof(float));
+			if(audio == NULL) {
+				fprintf(stderr, "Out of memory\n");
+				exit(1);
+			}
+			active = capture_open_pair(f, index++, rate, channels) == 0;
+			break;
+		case CAPTURE_AUDIO:
+			side_bytes = rec.frames*channels*sizeof(float);
+			capture_ring_read(audio, 2*side_bytes);
+			if(!active) {
+				__atomic_add_fetch(&writer_dropped, rec.frames,
+						__ATOMIC_RELAXED);
+				break;
+			}
+			if(f[0].bytes + side_bytes > CAPTURE_MAX_BYTES) {
+				capture_close(&f[0], rate, channels);
+				capture_close(&f[1], rate, channels);
+				active = capture_open_pair(f, index++, rate, channels) == 0;
+				if(!active) {
+					__atomic_add_fetch(&writer_dropped, rec.frames,
+							__ATOMIC_RELAXED);
+					break;
+				}
+			}
+			failed = 0;
+			for(s = 0; s < 2; s++) {
+				failed |= capture_write(&f[s], audio + s*side_bytes,
+						side_bytes, rate, channels) < 0;
+			}
+			if(failed) {
+				fprintf(stderr, "Can't write the capture: %s, stopping it\n",
+						strerror(errno));
+				capture_close(&f[0], rate, channels);
+				capture_close(&f[1], rate, channels);
+				active = 0;
+			}
+			break;
+		case CAPTURE_STOP:
+			if(active) {
+				capture_close(&f[0], rate, channels);
+				capture_close(&f[1], rate, channels);
+				active = 0;
+			}
+			break;
+		}
+	}
+
+	if(active) {
+		capture_close(&f[0], rate, channels);
+		capture_close(&f[1], rate, channels);
+	}
+	free(audio);
+	return NULL;
+}
+
+/* Hand a record to the writer, unless it is too far behind to take it */
+static int capture_push(capture_record_t *rec, size_t bytes)
+{
+	if(equal_ring_write_space(ring) < bytes) {
+		return -1;
+	}
+	equal_ring_write(ring, rec, bytes);
+	sem_post(&ring_wake);
+	return 0;
+}
+
+static void capture_control(uint32_t type, unsigned int rate,
+		unsigned int channels)
+{
+	capture_record_t rec = { type, 0, rate, channels };
+	/* Start and stop must get through, the writer drains the ring */
+	while(capture_push(&rec, sizeof(rec)) < 0) {
+		usleep(CAPTURE_POLL_US);
+	}
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-o prefix] [controls]\n"
+			"  -o  start of the file names, the default is "
+			"alsaequal-capture\n"
+			"Records while the \"Capture Switch\" is on, SIGUSR1 "
+			"flips it.\n",
+			name);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *controls = ".alsaequal.bin";
+	LADSPA_Control *control_data;
+	const equal_tap_t *tap;
+	capture_record_t *rec;
+	pthread_t writer;
+	struct sigaction sa;
+	char name[80];
+	uint64_t pos = 0, end, dropped = 0, reported = 0, skip, total;
+	unsigned int rate = 0, channels, n;
+	size_t side_bytes, tap_length;
+	int recording = 0, opt;
+
+	while((opt = getopt(argc, argv, "o:h")) != -1) {
+		switch(opt) {
+		case 'o':
+			prefix = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if(optind < argc) {
+		controls = argv[optind];
+	}
+
+	control_data = LADSPAcontrolMMAPMeta(controls, 0, NULL, NULL);
+	if(control_data == NULL) {
+		fprintf(stderr, "No controls in %s\n", controls);
+		return 1;
+	}
+	if(LADSPAcontrolObjectName(controls, EQUAL_TAP_SUFFIX, name,
+			sizeof(name)) < 0) {
+		fprintf(stderr, "Can't resolve controls file %s\n", controls);
+		return 1;
+	}
+	tap = equal_tap_open(name, &tap_length);
+	if(tap == NULL) {
+		fprintf(stderr, "No audio tap for %s, is the PCM open?\n", controls);
+		return 1;
+	}
+	channels = tap->channels;
+
+	ring = equal_ring_create(2*(size_t)CAPTURE_RING_FRAMES*channels*
+			sizeof(float));
+	rec = malloc(sizeof(*rec) + 2*CAPTURE_CHUNK*channels*sizeof(float));
+	if(ring == NULL || rec == NULL || sem_init(&ring_wake, 0, 0) < 0) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = capture_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGUSR1, &sa, NULL);
+
+	if(pthread_create(&writer, NULL, capture_writer, NULL) != 0) {
+		fprintf(stderr, "Can't start the writer\n");
+		return 1;
+	}
+
+	while(!quit) {
+		if(toggle) {
+			toggle = 0;
+			__atomic_xor_fetch(&control_data->capture_enable, 1,
+					__ATOMIC_RELAXED);
+		}
+		if(!equal_tap_valid(tap)) {
+			fprintf(stderr, "The tap went away, stopping\n");
+			break;
+		}
+
+		end = __atomic_load_n(&tap->write_pos, __ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&control_data->capture_enable,
+				__ATOMIC_RELAXED)) {
+			if(recording && (end < pos || tap->rate != rate)) {
+				/* Reopened or prepared at another rate, carry on in new
+				   files */
+				capture_control(CAPTURE_STOP, rate, channels);
+				recording = 0;
+			}
+			if(!recording && tap->rate != 0) {
+				rate = tap->rate;
+				pos = end;
+				capture_control(CAPTURE_START, rate, channels);
+				recording = 1;
+			}
+		} else if(recording) {
+			capture_control(CAPTURE_STOP, rate, channels);
+			recording = 0;
+		}
+
+		while(recording && pos < end) {
+			if(end - pos > tap->frames/2) {
+				/* Fell behind the tap, pick up a safe distance from the
+				   write position */
+				skip = end - tap->frames/4 - pos;
+				dropped += skip;
+				pos += skip;
+			}
+			n = end - pos < CAPTURE_CHUNK ? end - pos : CAPTURE_CHUNK;
+			side_bytes = n*channels*sizeof(float);
+			rec->type = CAPTURE_AUDIO;
+			rec->frames = n;
+			rec->rate = rate;
+			rec->channels = channels;
+			if(!equal_tap_read_at(tap, EQUAL_TAP_PRE, (float *)(rec + 1),
+					pos, n) ||
+					!equal_tap_read_at(tap, EQUAL_TAP_POST,
+					(float *)((char *)(rec + 1) + side_bytes), pos, n) ||
+					capture_push(rec, sizeof(*rec) + 2*side_bytes) < 0) {
+				dropped += n;
+			}
+			pos += n;
+		}
+
+		total = dropped + __atomic_load_n(&writer_dropped, __ATOMIC_RELAXED);
+		if(total != reported) {
+			fprintf(stderr, "Dropped %llu frames, %llu in all\n",
+					(unsigned long long)(total - reported),
+					(unsigned long long)total);
+			reported = total;
+		}
+		usleep(CAPTURE_POLL_US);
+	}
+
+	if(recording) {
+		capture_control(CAPTURE_STOP, rate, channels);
+	}
+	__atomic_store_n(&writer_done, 1, __ATOMIC_RELEASE);
+	sem_post(&ring_wake);
+	pthread_join(writer, NULL);
+	total = dropped + writer_dropped;
+	printf("%llu frames dropped\n", (unsigned long long)total);
+
+	equal_tap_close(tap, tap_length);
+	LADSPAcontrolUnMMAP(control_data);
+	equal_ring_free(ring);
+	free(rec);
+	return 0;
+}
@@ -0,0 +1,583 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+/* alsaequal-dspd hosts the plugin instances of PCMs configured with
+   "dspd yes", so that a misbehaving plugin can't take the applications
+   down with it and one copy of the plugin serves every stream. Clients
+   are spread over a few worker threads which can be pinned to CPUs and
+   run SCHED_FIFO; see dspd.h for the protocol. */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "ladspa.h"
+#include "ladspa_utils.h"
+#include "dspd.h"
+
+#define DSPD_MAX_CLIENTS 256
+
+/* Sleeping workers wake up this often to notice they should quit */
+#define DSPD_IDLE_NS 100000000
+
+typedef struct dspd_client {
+	int fd;
+	equal_dspd_shm_t *shm;
+	size_t length;
+	void *library;
+	const LADSPA_Descriptor *klass;
+	/* Copied from the segment at connect time, the client can't change
+	   them afterwards */
+	unsigned int channels;
+	unsigned int num_controls;
+	unsigned long input_index;
+	unsigned long output_index;
+	unsigned long port[EQUAL_DSPD_MAX_CONTROLS];
+	unsigned long rate;		/* Of the instances, 0 for none */
+	LADSPA_Handle handle[EQUAL_DSPD_MAX_CHANNELS];
+	struct dspd_worker *worker;
+	struct dspd_client *next;
+} dspd_client_t;
+
+typedef struct dspd_worker {
+	unsigned int index;
+	pthread_t thread;
+	pthread_mutex_t lock;		/* Held while serving clients */
+	dspd_client_t *clients;
+	unsigned int num_clients;
+} dspd_worker_t;
+
+static equal_dspd_bells_t *bells;
+static char bells_name[64];
+static dspd_worker_t workers[EQUAL_DSPD_MAX_WORKERS];
+static unsigned int num_workers = 1;
+static volatile sig_atomic_t quit;
+
+static void dspd_release(dspd_client_t *client)
+{
+	unsigned int j;
+
+	for(j = 0; j < client->channels; j++) {
+		if(client->handle[j] == NULL) {
+			continue;
+		}
+		if(client->klass->deactivate) {
+			client->klass->deactivate(client->handle[j]);
+		}
+		if(client->klass->cleanup) {
+			client->klass->cleanup(client->handle[j]);
+		}
+		client->handle[j] = NULL;
+	}
+	client->rate = 0;
+}
+
+/* (Re)create the instances for rate, with the control ports connected
+   straight to the values in the client's segment */
+static int dspd_instantiate(dspd_client_t *client, unsigned long rate)
+{
+	const LADSPA_Descriptor *klass = client->klass;
+	unsigned int i, j;
+
+	dspd_release(client);
+	for(j = 0; j < client->channels; j++) {
+		client->handle[j] = klass->instantiate(klass, rate);
+		if(client->handle[j] == NULL) {
+			dspd_release(client);
+			return -ENOMEM;
+		}
+		for(i = 0; i < client->num_controls; i++) {
+			klass->connect_port(client->handle[j], client->port[i],
+					&client->shm->controls[i*client->channels + j]);
+		}
+		if(klass->activate) {
+			klass->activate(client->handle[j]);
+		}
+	}
+	client->rate = rate;
+	return 0;
+}
+
+static void dspd_serve(dspd_client_t *client)
+{
+	equal_dspd_shm_t *shm = client->shm;
+	const LADSPA_Descriptor *klass = client->klass;
+	uint32_t req = __atomic_load_n(&shm->req, __ATOMIC_ACQUIRE);
+	unsigned long offset = shm->offset, frames = shm->frames;
+	unsigned long rate = shm->rate;
+	float *in = shm->audio + offset;
+	float *out = shm->audio + client->channels*EQUAL_DSPD_MAX_FRAMES + offset;
+	unsigned int j;
+	int status = 0;
+
+	if(offset > EQUAL_DSPD_MAX_FRAMES ||
+			frames > EQUAL_DSPD_MAX_FRAMES - offset || rate == 0) {
+		status = -EINVAL;
+	} else if(rate != client->rate) {
+		status = dspd_instantiate(client, rate);
+	}
+	if(status == 0) {
+		for(j = 0; j < client->channels; j++) {
+			klass->connect_port(client->handle[j], client->input_index,
+					in + j*EQUAL_DSPD_MAX_FRAMES);
+			klass->connect_port(client->handle[j], client->output_index,
+					out + j*EQUAL_DSPD_MAX_FRAMES);
+			klass->run(client->handle[j], frames);
+		}
+	}
+
+	shm->status = status;
+	__atomic_store_n(&shm->ack, req, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&shm->waiting, __ATOMIC_SEQ_CST)) {
+		equal_futex_wake(&shm->ack);
+	}
+}
+
+static void *dspd_worker_thread(void *arg)
+{
+	dspd_worker_t *worker = arg;
+	uint32_t *bell = &bells->worker[worker->index].bell;
+	uint32_t *sleeping = &bells->worker[worker->index].sleeping;
+	struct timespec idle = { 0, DSPD_IDLE_NS };
+	dspd_client_t *client;
+	uint32_t rung;
+	int busy;
+
+	while(!quit) {
+		rung = __atomic_load_n(bell, __ATOMIC_SEQ_CST);
+		busy = 0;
+		pthread_mutex_lock(&worker->lock);
+		for(client = worker->clients; client != NULL; client = client->next) {
+			if(__atomic_load_n(&client->shm->req, __ATOMIC_ACQUIRE) !=
+					client->shm->ack) {
+				dspd_serve(client);
+				busy = 1;
+			}
+		}
+		pthread_mutex_unlock(&worker->lock);
+		if(busy) {
+			continue;
+		}
+		/* A client ringing after rung was read makes the wait return
+		   straight away */
+		__atomic_store_n(sleeping, 1, __ATOMIC_SEQ_CST);
+		equal_futex_wait(bell, rung, &idle);
+		__atomic_store_n(sleeping, 0, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+static int dspd_start_worker(dspd_worker_t *worker, int priority,
+		int cpu)
+{
+	struct sched_param param;
+	pthread_attr_t attr;
+	cpu_set_t cpus;
+	int err;
+
+	pthread_mutex_init(&worker->lock, NULL);
+	pthread_attr_init(&attr);
+	if(priority > 0) {
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		param.sched_priority = priority;
+		pthread_attr_setschedparam(&attr, &param);
+	}
+	if(cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	}
+	err = pthread_create(&worker->thread, &attr, dspd_worker_thread, worker);
+	pthread_attr_destroy(&attr);
+	return -err;
+}
+
+/* Check what the client asks for and load its plugin */
+static int dspd_setup(dspd_client_t *client)
+{
+	equal_dspd_shm_t *shm = client->shm;
+	const LADSPA_Descriptor *klass;
+	LADSPA_PortDescriptor port;
+	unsigned int i;
+
+	shm->library[sizeof(shm->library) - 1] = '\0';
+	shm->module[sizeof(shm->module) - 1] = '\0';
+	client->num_controls = shm->num_controls;
+	client->input_index = shm->input_index;
+	client->output_index = shm->output_index;
+	if(client->num_controls > EQUAL_DSPD_MAX_CONTROLS) {
+		return -EINVAL;
+	}
+
+	client->library = LADSPAtryLoad(shm->library);
+	if(client->library == NULL) {
+		fprintf(stderr, "Failed to load %s: %s\n", shm->library, dlerror());
+		return -ENOENT;
+	}
+	klass = LADSPAtryFind(client->library, shm->module);
+	if(klass == NULL) {
+		fprintf(stderr, "No %s in %s\n", shm->module, shm->library);
+		return -ENOENT;
+	}
+	client->klass = klass;
+
+	if(client->input_index >= klass->PortCount ||
+			client->output_index >= klass->PortCount ||
+			klass->PortDescriptors[client->input_index] !=
+			(LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO) ||
+			klass->PortDescriptors[client->output_index] !=
+			(LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO)) {
+		return -EINVAL;
+	}
+	for(i = 0; i < client->num_controls; i++) {
+		client->port[i] = shm->port[i];
+		if(client->port[i] >= klass->PortCount) {
+			return -EINVAL;
+		}
+		port = klass->PortDescriptors[client->port[i]];
+		if(!LADSPA_IS_PORT_CONTROL(port)) {
+			return -EINVAL;
+		}
+	}
+	return 0;
+}
+
+static void dspd_free(dspd_client_t *client)
+{
+	if(client->klass != NULL) {
+		dspd_release(client);
+	}
+	if(client->library != NULL) {
+		LADSPAunload(client->library);
+	}
+	if(client->shm != NULL) {
+		munmap(client->shm, client->length);
+	}
+	close(client->fd);
+	free(client);
+}
+
+/* Map the client's segment, set it up and hand it to the least busy
+   worker */
+static dspd_client_t *dspd_accept(int fd)
+{
+	equal_dspd_hello_t hello;
+	equal_dspd_reply_t reply;
+	equal_dspd_shm_t *shm;
+	dspd_client_t *client;
+	dspd_worker_t *worker;
+	struct timeval tv = { 1, 0 };
+	struct stat st;
+	unsigned int i;
+	int shm_fd, err = -EPROTO;
+
+	client = calloc(1, sizeof(*client));
+	if(client == NULL) {
+		close(fd);
+		return NULL;
+	}
+	client->fd = fd;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	if(recv(fd, &hello, sizeof(hello), 0) != sizeof(hello) ||
+			hello.magic != EQUAL_DSPD_MAGIC ||
+			hello.version != EQUAL_DSPD_VERSION) {
+		goto fail;
+	}
+	hello.shm[sizeof(hello.shm) - 1] = '\0';
+
+	shm_fd = shm_open(hello.shm, O_RDWR, 0);
+	if(shm_fd < 0) {
+		err = -errno;
+		goto fail;
+	}
+	if(fstat(shm_fd, &st) < 0 || st.st_size < sizeof(equal_dspd_shm_t)) {
+		close(shm_fd);
+		goto fail;
+	}
+	shm = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			shm_fd, 0);
+	close(shm_fd);
+	if(shm == MAP_FAILED) {
+		err = -errno;
+		goto fail;
+	}
+	client->shm = shm;
+	client->length = st.st_size;
+	client->channels = shm->channels;
+	if(shm->magic != EQUAL_DSPD_MAGIC || client->channels < 1 ||
+			client->channels > EQUAL_DSPD_MAX_CHANNELS ||
+			client->length < equal_dspd_shm_length(client->channels)) {
+		goto fail;
+	}
+	err = dspd_setup(client);
+	if(err < 0) {
+		goto fail;
+	}
+
+	worker = &workers[0];
+	for(i = 1; i < num_workers; i++) {
+		if(workers[i].num_clients < worker->num_clients) {
+			worker = &workers[i];
+		}
+	}
+	shm->ack = shm->req;
+	client->worker = worker;
+	pthread_mutex_lock(&worker->lock);
+	client->next = worker->clients;
+	worker->clients = client;
+	worker->num_clients++;
+	pthread_mutex_unlock(&worker->lock);
+
+	memset(&reply, 0, sizeof(reply));
+	reply.worker = worker->index;
+	strcpy(reply.bells, bells_name);
+	send(fd, &reply, sizeof(reply), MSG_NOSIGNAL);
+	return client;
+
+fail:
+	memset(&reply, 0, sizeof(reply));
+	reply.status = err;
+	send(fd, &reply, sizeof(reply), MSG_NOSIGNAL);
+	dspd_free(client);
+	return NULL;
+}
+
+static void dspd_remove(dspd_client_t *client)
+{
+	dspd_worker_t *worker = client->worker;
+	dspd_client_t **p;
+
+	pthread_mutex_lock(&worker->lock);
+	for(p = &worker->clients; *p != NULL; p = &(*p)->next) {
+		if(*p == client) {
+			*p = client->next;
+			break;
+		}
+	}
+	worker->num_clients--;
+	pthread_mutex_unlock(&worker->lock);
+	dspd_free(client);
+}
+
+static int dspd_listen(const char *path)
+{
+	struct sockaddr_un addr;
+	mode_t mask;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path %s is too long\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if(fd < 0) {
+		perror("socket");
+		return -1;
+	}
+	unlink(path);
+	/* Only the user's own streams may connect */
+	mask = umask(077);
+	if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+			listen(fd, 16) < 0) {
+		umask(mask);
+		fprintf(stderr, "Can't listen on %s: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	umask(mask);
+	return fd;
+}
+
+static int dspd_create_bells(void)
+{
+	int fd;
+
+	snprintf(bells_name, sizeof(bells_name), "/alsaequal-dspd-bells-%d",
+			(int)getpid());
+	fd = shm_open(bells_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if(fd < 0) {
+		perror("shm_open");
+		return -1;
+	}
+	if(ftruncate(fd, sizeof(equal_dspd_bells_t)) < 0) {
+		perror("ftruncate");
+		close(fd);
+		return -1;
+	}
+	bells = mmap(NULL, sizeof(equal_dspd_bells_t), PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	close(fd);
+	if(bells == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+	bells->magic = EQUAL_DSPD_MAGIC;
+	bells->workers = num_workers;
+	return 0;
+}
+
+static void dspd_stop(int sig)
+{
+	(void)sig;
+	quit = 1;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-s socket] [-t threads] [-c cpu,cpu,...] "
+			"[-p priority]\n"
+			"  -s  socket to listen on, the default is "
+			"$XDG_RUNTIME_DIR/" EQUAL_DSPD_SOCKET "\n"
+			"  -t  number of worker threads, the default is 1\n"
+			"  -c  CPUs to pin the workers to, in turn\n"
+			"  -p  SCHED_FIFO priority of the workers, 0 (the default) "
+			"keeps normal scheduling\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	static struct pollfd fds[1 + DSPD_MAX_CLIENTS];
+	static dspd_client_t *clients[1 + DSPD_MAX_CLIENTS];
+	char path[108], *cpulist = NULL, *tok;
+	const char *socket_path = NULL;
+	int cpus[EQUAL_DSPD_MAX_WORKERS];
+	int num_cpus = 0, priority = 0, listen_fd, fd, opt, err;
+	unsigned int i, n = 1;
+	struct sigaction sa;
+
+	while((opt = getopt(argc, argv, "s:t:c:p:h")) != -1) {
+		switch(opt) {
+		case 's':
+			socket_path = optarg;
+			break;
+		case 't':
+			num_workers = atoi(optarg);
+			if(num_workers < 1 || num_workers > EQUAL_DSPD_MAX_WORKERS) {
+				fprintf(stderr, "Between 1 and %d threads\n",
+						EQUAL_DSPD_MAX_WORKERS);
+				return 1;
+			}
+			break;
+		case 'c':
+			cpulist = optarg;
+			break;
+		case 'p':
+			priority = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	for(tok = cpulist ? strtok(cpulist, ",") : NULL;
+			tok != NULL && num_cpus < EQUAL_DSPD_MAX_WORKERS;
+			tok = strtok(NULL, ",")) {
+		cpus[num_cpus++] = atoi(tok);
+	}
+	if(socket_path == NULL) {
+		socket_path = equal_dspd_default_socket(path, sizeof(path));
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = dspd_stop;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	if(dspd_create_bells() < 0) {
+		return 1;
+	}
+	listen_fd = dspd_listen(socket_path);
+	if(listen_fd < 0) {
+		shm_unlink(bells_name);
+		return 1;
+	}
+	for(i = 0; i < num_workers; i++) {
+		workers[i].index = i;
+		err = dspd_start_worker(&workers[i], priority,
+				num_cpus ? cpus[i % num_cpus] : -1);
+		if(err < 0) {
+			fprintf(stderr, "Can't start worker %u: %s\n", i, strerror(-err));
+			shm_unlink(bells_name);
+			unlink(socket_path);
+			return 1;
+		}
+	}
+
+	/* The main thread only accepts clients and notices them leaving */
+	fds[0].fd = listen_fd;
+	fds[0].events = POLLIN;
+	while(!quit) {
+		if(poll(fds, n, -1) < 0) {
+			continue;
+		}
+		for(i = n - 1; i > 0; i--) {
+			if(fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+				dspd_remove(clients[i]);
+				fds[i] = fds[--n];
+				clients[i] = clients[n];
+			}
+		}
+		if(fds[0].revents & POLLIN) {
+			fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+			if(fd < 0) {
+				continue;
+			}
+			if(n == 1 + DSPD_MAX_CLIENTS) {
+				close(fd);
+				continue;
+			}
+			clients[n] = dspd_accept(fd);
+			if(clients[n] != NULL) {
+				fds[n].fd = fd;
+				fds[n].events = POLLIN;
+				n++;
+			}
+		}
+	}
+
+	for(i = 0; i < num_workers; i++) {
+		equal_futex_wake(&bells->worker[i].bell);
+		pthread_join(workers[i].thread, NULL);
+	}
+	for(i = 1; i < n; i++) {
+		dspd_remove(clients[i]);
+	}
+	close(listen_fd);
+	unlink(socket_path);
+	shm_unlink(bells_name);
+	return 0;
+}
@@ -0,0 +1,671 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+/* Lists the LADSPA plugins on LADSPA_PATH with their ports and
+   properties, times their run() at a few block sizes and rates and
+   checks them for denormals and in-place trouble. The report is JSON on
+   stdout, e.g. to pick a module or to certify plugins before they are
+   rolled out. Every plugin is probed in a child process, so one that
+   crashes or hangs is reported instead of taking the scan down. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/wait.h>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#include "ladspa.h"
+#include "ladspa_utils.h"
+
+/* Where the LADSPA SDK looks when LADSPA_PATH isn't set */
+#define PROBE_DEFAULT_PATH "/usr/lib/ladspa:/usr/local/lib/ladspa"
+#define PROBE_MAX_BLOCK 4096
+#define PROBE_MAX_PLUGINS 1024
+/* Seconds a plugin may take before it counts as hung */
+#define PROBE_TIMEOUT 120
+/* Rate and block of the hazard checks */
+#define PROBE_CHECK_RATE 48000
+#define PROBE_CHECK_BLOCK 256
+/* Exit status of a child that found no plugin at its index */
+#define PROBE_END 2
+
+static const unsigned long probe_rates[] = { 44100, 48000, 96000, 192000 };
+static const unsigned long probe_blocks[] = { 32, 64, 256, 1024, 4096 };
+#define PROBE_NUM_RATES (sizeof(probe_rates)/sizeof(probe_rates[0]))
+#define PROBE_NUM_BLOCKS (sizeof(probe_blocks)/sizeof(probe_blocks[0]))
+
+/* Seconds of audio run per measurement, the best of three is kept */
+static double probe_seconds = 0.2;
+static int probe_all = 0;
+
+typedef struct probe_plugin {
+	const LADSPA_Descriptor *klass;
+	LADSPA_Handle handle;
+	LADSPA_Data *controls;
+	unsigned long input;
+	unsigned long output;
+} probe_plugin_t;
+
+static float probe_in[PROBE_MAX_BLOCK] __attribute__((aligned(32)));
+static float probe_out[PROBE_MAX_BLOCK] __attribute__((aligned(32)));
+static float probe_ref[PROBE_MAX_BLOCK] __attribute__((aligned(32)));
+
+/* The build uses -ffast-math, which folds the usual isfinite() and
+   fpclassify() away, so look at the bits */
+static int probe_finite(double v)
+{
+	uint64_t bits;
+
+	memcpy(&bits, &v, sizeof(bits));
+	return ((bits >> 52) & 0x7ff) != 0x7ff;
+}
+
+static int probe_subnormal(float v)
+{
+	uint32_t bits;
+
+	memcpy(&bits, &v, sizeof(bits));
+	return (bits & 0x7f800000) == 0 && (bits & 0x007fffff) != 0;
+}
+
+static double probe_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static void probe_string(const char *s)
+{
+	putchar('"');
+	for(; s != NULL && *s != '\0'; s++) {
+		if(*s == '"' || *s == '\\') {
+			printf("\\%c", *s);
+		} else if((unsigned char)*s < 0x20) {
+			printf("\\u%04x", *s);
+		} else {
+			putchar(*s);
+		}
+	}
+	putchar('"');
+}
+
+static void probe_number(double v)
+{
+	if(probe_finite(v)) {
+		printf("%.6g", v);
+	} else {
+		printf("null");
+	}
+}
+
+static const char *probe_bool(int v)
+{
+	return v ? "true" : "false";
+}
+
+/* The value the controls start from: the default, else a bound, else 0 */
+static LADSPA_Data probe_control(const LADSPA_PortRangeHint *hint,
+		unsigned long rate)
+{
+	LADSPA_Data v;
+
+	if(LADSPADefault(hint, rate, &v) == 0) {
+		return v;
+	}
+	v = 0;
+	if(LADSPA_IS_HINT_BOUNDED_BELOW(hint->HintDescriptor)) {
+		v = hint->LowerBound;
+	} else if(LADSPA_IS_HINT_BOUNDED_ABOVE(hint->HintDescriptor)) {
+		v = hint->UpperBound;
+	}
+	if(LADSPA_IS_HINT_SAMPLE_RATE(hint->HintDescriptor)) {
+		v *= rate;
+	}
+	return v;
+}
+
+static int probe_open(probe_plugin_t *p, const LADSPA_Descriptor *klass,
+		unsigned long rate)
+{
+	unsigned long i;
+
+	memset(p, 0, sizeof(*p));
+	p->klass = klass;
+	p->controls = calloc(klass->PortCount, sizeof(LADSPA_Data));
+	if(p->controls == NULL) {
+		return -1;
+	}
+	p->handle = klass->instantiate(klass, rate);
+	if(p->handle == NULL) {
+		free(p->controls);
+		return -1;
+	}
+	for(i = 0; i < klass->PortCount; i++) {
+		if(LADSPA_IS_PORT_CONTROL(klass->PortDescriptors[i])) {
+			p->controls[i] = probe_control(&klass->PortRangeHints[i], rate);
+			klass->connect_port(p->handle, i, &p->controls[i]);
+		} else if(LADSPA_IS_PORT_INPUT(klass->PortDescriptors[i])) {
+			p->input = i;
+		} else {
+			p->output = i;
+		}
+	}
+	if(klass->activate != NULL) {
+		klass->activate(p->handle);
+	}
+	return 0;
+}
+
+static void probe_close(probe_plugin_t *p)
+{
+	if(p->klass->deactivate != NULL) {
+		p->klass->deactivate(p->handle);
+	}
+	p->klass->cleanup(p->handle);
+	free(p->controls);
+}
+
+/* One block, the buffers connected before every run like the PCM does */
+static void probe_run(probe_plugin_t *p, float *in, float *out,
+		unsigned long frames)
+{
+	p->klass->connect_port(p->handle, p->input, in);
+	p->klass->connect_port(p->handle, p->output, out);
+	p->klass->run(p->handle, frames);
+}
+
+/* Nanoseconds per frame of run() at rate in blocks of block frames, the
+   best of three, or a negative number if it can't be instantiated */
+static double probe_cost(const LADSPA_Descriptor *klass, unsigned long rate,
+		unsigned long block)
+{
+	probe_plugin_t p;
+	unsigned long frames, done;
+	double best = -1, start, t;
+	int rep;
+
+	if(probe_open(&p, klass, rate) < 0) {
+		return -1;
+	}
+	frames = probe_seconds*rate;
+	/* Warm up the caches and whatever the plugin sets up lazily */
+	for(done = 0; done < rate/20; done += block) {
+		probe_run(&p, probe_in, probe_out, block);
+	}
+	for(rep = 0; rep < 3; rep++) {
+		start = probe_now();
+		for(done = 0; done < frames; done += block) {
+			probe_run(&p, probe_in, probe_out, block);
+		}
+		t = (probe_now() - start)*1e9/done;
+		if(best < 0 || t < best) {
+			best = t;
+		}
+	}
+	probe_close(&p);
+	return best;
+}
+
+/* Feed noise, then silence while the tails decay. Plugins that let
+   them decay into subnormals slow down on the x87 and SSE units unless
+   the host flushes them, which the PCM doesn't. */
+static void probe_denormals(const LADSPA_Descriptor *klass)
+{
+	const unsigned long block = PROBE_CHECK_BLOCK, rate = PROBE_CHECK_RATE;
+	static float silence[PROBE_CHECK_BLOCK];
+	probe_plugin_t p;
+	unsigned long done, i;
+	double start, noise, quiet;
+	int subnormal = 0;
+
+	if(probe_open(&p, klass, rate) < 0) {
+		printf("null");
+		return;
+	}
+	start = probe_now();
+	for(done = 0; done < rate/2; done += block) {
+		probe_run(&p, probe_in, probe_out, block);
+	}
+	noise = (probe_now() - start)/done;
+	/* Give the tails a couple of seconds to get there */
+	for(done = 0; done < 2*rate; done += block) {
+		probe_run(&p, silence, probe_out, block);
+	}
+	start = probe_now();
+	for(done = 0; done < rate/2; done += block) {
+		probe_run(&p, silence, probe_out, block);
+		for(i = 0; i < block; i++) {
+			subnormal |= probe_subnormal(probe_out[i]);
+		}
+	}
+	quiet = (probe_now() - start)/done;
+	probe_close(&p);
+
+	printf("{\"subnormal_output\": %s, \"silence_slowdown\": ",
+			probe_bool(subnormal));
+	probe_number(quiet/noise);
+	printf(", \"hazard\": %s}", probe_bool(subnormal || quiet > 2*noise));
+}
+
+/* Run two instances on the same noise, one with separate buffers and
+   one in place, and compare. A third one with separate buffers tells
+   plugins that differ anyway, e.g. noise generators, apart. */
+static const char *probe_in_place(const LADSPA_Descriptor *klass)
+{
+	const unsigned long block = PROBE_CHECK_BLOCK, rate = PROBE_CHECK_RATE;
+	probe_plugin_t a, b, c;
+	float *again = probe_out + block, *inplace = probe_ref + block;
+	unsigned long i, n;
+	int differs = 0, random = 0;
+
+	if(LADSPA_IS_INPLACE_BROKEN(klass->Properties)) {
+		return "declared broken";
+	}
+	if(probe_open(&a, klass, rate) < 0) {
+		return "unknown";
+	}
+	if(probe_open(&b, klass, rate) < 0) {
+		probe_close(&a);
+		return "unknown";
+	}
+	if(probe_open(&c, klass, rate) < 0) {
+		probe_close(&a);
+		probe_close(&b);
+		return "unknown";
+	}
+	for(n = 0; n < rate/block; n++) {
+		probe_run(&a, probe_in, probe_ref, block);
+		probe_run(&c, probe_in, again, block);
+		memcpy(inplace, probe_in, block*sizeof(float));
+		probe_run(&b, inplace, inplace, block);
+		for(i = 0; i < block; i++) {
+			random |= probe_ref[i] != again[i];
+			differs |= probe_ref[i] != inplace[i];
+		}
+	}
+	probe_close(&a);
+	probe_close(&b);
+	probe_close(&c);
+	if(random) {
+		return "nondeterministic";
+	}
+	return differs ? "differs" : "ok";
+}
+
+static void probe_ports(const LADSPA_Descriptor *klass)
+{
+	const LADSPA_PortRangeHint *hint;
+	LADSPA_PortDescriptor port;
+	LADSPA_Data v;
+	unsigned long i;
+
+	printf("  \"ports\": [");
+	for(i = 0; i < klass->PortCount; i++) {
+		port = klass->PortDescriptors[i];
+		hint = &klass->PortRangeHints[i];
+		printf("%s\n    {\"index\": %lu, \"name\": ", i ? "," : "", i);
+		probe_string(klass->PortNames[i]);
+		printf(", \"type\": \"%s\", \"direction\": \"%s\"",
+				LADSPA_IS_PORT_AUDIO(port) ? "audio" : "control",
+				LADSPA_IS_PORT_INPUT(port) ? "input" : "output");
+		if(LADSPA_IS_PORT_CONTROL(port)) {
+			printf(", \"lower\": ");
+			if(LADSPA_IS_HINT_BOUNDED_BELOW(hint->HintDescriptor)) {
+				probe_number(hint->LowerBound);
+			} else {
+				printf("null");
+			}
+			printf(", \"upper\": ");
+			if(LADSPA_IS_HINT_BOUNDED_ABOVE(hint->HintDescriptor)) {
+				probe_number(hint->UpperBound);
+			} else {
+				printf("null");
+			}
+			printf(", \"default\": ");
+			if(LADSPADefault(hint, 1, &v) == 0) {
+				probe_number(v);
+			} else {
+				printf("null");
+			}
+			printf(", \"toggled\": %s, \"sample_rate\": %s, "
+					"\"logarithmic\": %s, \"integer\": %s",
+					probe_bool(LADSPA_IS_HINT_TOGGLED(hint->HintDescriptor)),
+					probe_bool(LADSPA_IS_HINT_SAMPLE_RATE(
+					hint->HintDescriptor)),
+					probe_bool(LADSPA_IS_HINT_LOGARITHMIC(
+					hint->HintDescriptor)),
+					probe_bool(LADSPA_IS_HINT_INTEGER(hint->HintDescriptor)));
+		}
+		printf("}");
+	}
+	printf("\n  ]");
+}
+
+static void probe_costs(const LADSPA_Descriptor *klass)
+{
+	unsigned int r, b;
+	double ns;
+	int first = 1;
+
+	printf(",\n  \"cost\": [");
+	for(r = 0; r < PROBE_NUM_RATES; r++) {
+		for(b = 0; b < PROBE_NUM_BLOCKS; b++) {
+			ns = probe_cost(klass, probe_rates[r], probe_blocks[b]);
+			printf("%s\n    {\"rate\": %lu, \"block\": %lu, "
+					"\"ns_per_frame\": ", first ? "" : ",",
+					probe_rates[r], probe_blocks[b]);
+			first = 0;
+			if(ns < 0) {
+				printf("null, \"cpu_percent\": null}");
+				continue;
+			}
+			probe_number(ns);
+			/* Of one core, per channel */
+			printf(", \"cpu_percent\": ");
+			probe_number(ns*probe_rates[r]*1e-7);
+			printf("}");
+		}
+	}
+	printf("\n  ]");
+}
+
+/* Child side: report plugin index of library as one JSON object */
+static int probe_plugin(const char *library, unsigned long index)
+{
+	LADSPA_Descriptor_Function descriptor;
+	const LADSPA_Descriptor *klass;
+	const char *reason;
+	void *handle;
+
+	handle = LADSPAtryLoad(library);
+	if(handle == NULL) {
+		if(index == 0) {
+			printf("{\"library\": ");
+			probe_string(library);
+			printf(", \"error\": ");
+			probe_string(dlerror());
+			printf("}");
+		}
+		return PROBE_END;
+	}
+	descriptor = (LADSPA_Descriptor_Function)dlsym(handle,
+			"ladspa_descriptor");
+	if(descriptor == NULL) {
+		if(probe_all) {
+			printf("{\"library\": ");
+			probe_string(library);
+			printf(", \"error\": \"not a LADSPA library\"}");
+		}
+		return PROBE_END;
+	}
+	klass = descriptor(index);
+	if(klass == NULL) {
+		return PROBE_END;
+	}
+	reason = LADSPAincompatible(klass);
+	if(reason != NULL && !probe_all) {
+		return 0;
+	}
+
+	printf("{\n  \"library\": ");
+	probe_string(library);
+	printf(", \"index\": %lu, \"id\": %lu,\n  \"label\": ", index,
+			klass->UniqueID);
+	probe_string(klass->Label);
+	printf(", \"name\": ");
+	probe_string(klass->Name);
+	printf(",\n  \"maker\": ");
+	probe_string(klass->Maker);
+	printf(", \"copyright\": ");
+	probe_string(klass->Copyright);
+	printf(",\n  \"compatible\": %s, \"reason\": ", probe_bool(reason == NULL));
+	if(reason != NULL) {
+		probe_string(reason);
+	} else {
+		printf("null");
+	}
+	printf(",\n  \"realtime\": %s, \"inplace_broken\": %s, "
+			"\"hard_rt_capable\": %s,\n  \"activate\": %s, "
+			"\"run_adding\": %s,\n",
+			probe_bool(LADSPA_IS_REALTIME(klass->Properties)),
+			probe_bool(LADSPA_IS_INPLACE_BROKEN(klass->Properties)),
+			probe_bool(LADSPA_IS_HARD_RT_CAPABLE(klass->Properties)),
+			probe_bool(klass->activate != NULL),
+			probe_bool(klass->run_adding != NULL));
+	probe_ports(klass);
+	fflush(stdout);
+	if(reason == NULL) {
+		probe_costs(klass);
+		printf(",\n  \"denormals\": ");
+		probe_denormals(klass);
+		printf(",\n  \"in_place\": \"%s\"", probe_in_place(klass));
+	}
+	printf("\n}");
+	return 0;
+}
+
+/* Probe every plugin of a library, each in a child, and print them as
+   array elements. Returns the number printed so far. */
+static int probe_library(const char *library, int printed)
+{
+	char *buf;
+	size_t len, size;
+	unsigned long index;
+	ssize_t n;
+	pid_t pid;
+	int fd[2], status;
+
+	for(index = 0; index < PROBE_MAX_PLUGINS; index++) {
+		fflush(stdout);
+		if(pipe(fd) < 0) {
+			perror("pipe");
+			return printed;
+		}
+		pid = fork();
+		if(pid < 0) {
+			perror("fork");
+			close(fd[0]);
+			close(fd[1]);
+			return printed;
+		}
+		if(pid == 0) {
+			close(fd[0]);
+			dup2(fd[1], STDOUT_FILENO);
+			close(fd[1]);
+			alarm(PROBE_TIMEOUT);
+			status = probe_plugin(library, index);
+			fflush(stdout);
+			_exit(status);
+		}
+		close(fd[1]);
+		buf = NULL;
+		len = size = 0;
+		for(;;) {
+			if(len == size) {
+				size = size ? 2*size : 4096;
+				buf = realloc(buf, size);
+				if(buf == NULL) {
+					perror("realloc");
+					exit(1);
+				}
+			}
+			n = read(fd[0], buf + len, size - len);
+			if(n <= 0) {
+				break;
+			}
+			len += n;
+		}
+		close(fd[0]);
+		waitpid(pid, &status, 0);
+
+		if(WIFEXITED(status) && (WEXITSTATUS(status) == 0 ||
+				WEXITSTATUS(status) == PROBE_END)) {
+			if(len > 0) {
+				printf("%s\n", printed ? "," : "");
+				fwrite(buf, 1, len, stdout);
+				printed++;
+			}
+			free(buf);
+			if(WEXITSTATUS(status) == PROBE_END) {
+				break;
+			}
+			continue;
+		}
+
+		/* Whatever it printed is cut short */
+		free(buf);
+		printf("%s\n{\"library\": ", printed ? "," : "");
+		probe_string(library);
+		if(WIFSIGNALED(status)) {
+			printf(", \"index\": %lu, \"error\": \"%s with signal %d\"}",
+					index, WTERMSIG(status) == SIGALRM ? "timed out" :
+					"crashed", WTERMSIG(status));
+		} else {
+			printf(", \"index\": %lu, \"error\": \"exited with status "
+					"%d\"}", index, WEXITSTATUS(status));
+		}
+		printed++;
+	}
+	return printed;
+}
+
+static int probe_filter(const struct dirent *d)
+{
+	size_t len = strlen(d->d_name);
+
+	return len > 3 && strcmp(d->d_name + len - 3, ".so") == 0;
+}
+
+/* Every library in the directories of path, split like dlopenLADSPA()
+   does, in name order */
+static int probe_path(const char *path, int printed)
+{
+	struct dirent **list;
+	const char *start, *end;
+	char dir[4096], library[8192];
+	int i, n;
+
+	for(start = path; *start != '\0'; start = *end ? end + 1 : end) {
+		end = strchr(start, ':');
+		if(end == NULL) {
+			end = start + strlen(start);
+		}
+		if(end == start || end - start >= (int)sizeof(dir)) {
+			continue;
+		}
+		memcpy(dir, start, end - start);
+		dir[end - start] = '\0';
+		n = scandir(dir, &list, probe_filter, alphasort);
+		if(n < 0) {
+			continue;
+		}
+		for(i = 0; i < n; i++) {
+			snprintf(library, sizeof(library), "%s%s%s", dir,
+					dir[strlen(dir) - 1] == '/' ? "" : "/", list[i]->d_name);
+			printed = probe_library(library, printed);
+			free(list[i]);
+		}
+		free(list);
+	}
+	return printed;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-a] [-t seconds] [library ...]\n"
+			"  -a  list the plugins the equalizer can't run too\n"
+			"  -t  audio timed per measurement, the default is 0.2 s\n"
+			"Probes the libraries given, or every one on LADSPA_PATH.\n",
+			name);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path;
+	unsigned int i;
+	int opt, printed = 0;
+
+	while((opt = getopt(argc, argv, "at:h")) != -1) {
+		switch(opt) {
+		case 'a':
+			probe_all = 1;
+			break;
+		case 't':
+			probe_seconds = atof(optarg);
+			if(probe_seconds <= 0) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+#if defined(__SSE__)
+	/* Run with denormals like an application does, not flushed as
+	   -ffast-math sets up */
+	_mm_setcsr(_mm_getcsr() & ~0x8040);
+#endif
+	/* Noise at -20 dBFS */
+	srand(1);
+	for(i = 0; i < PROBE_MAX_BLOCK; i++) {
+		probe_in[i] = 0.2f*((float)rand()/RAND_MAX - 0.5f);
+	}
+
+	path = getenv("LADSPA_PATH");
+	if(path == NULL) {
+		path = PROBE_DEFAULT_PATH;
+	}
+	printf("{\n\"path\": ");
+	if(optind < argc) {
+		printf("null");
+	} else {
+		probe_string(path);
+	}
+	printf(",\n\"rates\": [");
+	for(i = 0; i < PROBE_NUM_RATES; i++) {
+		printf("%s%lu", i ? ", " : "", probe_rates[i]);
+	}
+	printf("],\n\"blocks\": [");
+	for(i = 0; i < PROBE_NUM_BLOCKS; i++) {
+		printf("%s%lu", i ? ", " : "", probe_blocks[i]);
+	}
+	printf("],\n\"plugins\": [");
+	if(optind < argc) {
+		for(; optind < argc; optind++) {
+			printed = probe_library(argv[optind], printed);
+		}
+	} else {
+		printed = probe_path(path, printed);
+	}
+	printf("\n]\n}\n");
+	return 0;
+}
@@ -0,0 +1,598 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+/* Soak test: opens N equal PCMs on one controls file against the null
+   (or file) slave and writes to them as fast as they take audio from N
+   threads, while one thread writes the curve through the ctl plugin and
+   another reads it back. Reports the aggregate throughput, the tail
+   latency of each stream's writes and every curve read that matches no
+   state the writer could have left, i.e. a torn curve. Exits non-zero
+   on a torn curve or a failed write; a crash ends the run with the
+   signal. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <alsa/asoundlib.h>
+
+/* Curve states kept for the reader to match against */
+#define SOAK_RING 256
+/* Levels every band is set to, from its minimum to its maximum */
+#define SOAK_LEVELS 4
+/* Write latency histogram, SOAK_BUCKETS of SOAK_BUCKET_NS */
+#define SOAK_BUCKET_NS 10000
+#define SOAK_BUCKETS 2000
+
+typedef struct soak_stream {
+	snd_pcm_t *pcm;
+	pthread_t thread;
+	unsigned int index;
+	uint64_t frames;
+	uint64_t calls;
+	uint64_t max_ns;
+	int err;
+	uint32_t hist[SOAK_BUCKETS];
+} soak_stream_t;
+
+static unsigned int streams = 8;
+static unsigned int seconds = 10;
+static unsigned int channels = 2;
+static unsigned int rate = 48000;
+static unsigned int period = 1024;
+static const char *controls = "/tmp/alsaequal-soak.bin";
+static const char *library = NULL;
+static const char *module = NULL;
+static const char *plugin_dir = NULL;
+static const char *output = NULL;
+
+static volatile sig_atomic_t quit = 0;
+
+/* The curve elements, found on the writer's handle */
+static snd_ctl_elem_id_t *curve_id;
+static snd_ctl_elem_id_t **band_id;
+static unsigned int num_bands;
+static size_t curve_bytes;
+/* Integer value of each band at each level, and the curve read back
+   with every band at that level */
+static long *band_level;
+static unsigned char *level_curve;
+
+/* The curve after each write, written before the write starts. Writes
+   up to started may be visible, those up to done are. */
+static pthread_mutex_t expected_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned char *expected;
+static uint64_t started, done;
+
+static uint64_t ctl_writes, ctl_errors, ctl_reads, ctl_torn, ctl_skipped;
+
+static uint64_t soak_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static void soak_signal(int sig)
+{
+	quit = 1;
+}
+
+static void *soak_writer(void *arg)
+{
+	soak_stream_t *stream = arg;
+	snd_pcm_sframes_t got;
+	uint64_t start, ns;
+	unsigned int seed = stream->index, i;
+	float *buf;
+
+	buf = malloc((size_t)period*channels*sizeof(float));
+	if(buf == NULL) {
+		stream->err = -ENOMEM;
+		return NULL;
+	}
+	for(i = 0; i < period*channels; i++) {
+		buf[i] = (rand_r(&seed)/(float)RAND_MAX - 0.5f)*0.5f;
+	}
+
+	while(!quit) {
+		start = soak_now();
+		got = snd_pcm_writei(stream->pcm, buf, period);
+		if(got < 0) {
+			got = snd_pcm_recover(stream->pcm, got, 1);
+		}
+		ns = soak_now() - start;
+		if(got < 0) {
+			stream->err = got;
+			break;
+		}
+		stream->frames += got;
+		stream->calls++;
+		if(ns > stream->max_ns) {
+			stream->max_ns = ns;
+		}
+		stream->hist[ns/SOAK_BUCKET_NS < SOAK_BUCKETS ?
+				ns/SOAK_BUCKET_NS : SOAK_BUCKETS - 1]++;
+	}
+
+	free(buf);
+	return NULL;
+}
+
+/* Writes random whole curves and single bands, each band write setting
+   every channel of the band to one of its levels. */
+static void *soak_ctl_writer(void *arg)
+{
+	snd_ctl_t *ctl = arg;
+	snd_ctl_elem_value_t *value;
+	unsigned char *next, *prev;
+	unsigned int seed = 1, band, level, j;
+	size_t column = channels*sizeof(float);
+	uint64_t n;
+	int err;
+
+	snd_ctl_elem_value_alloca(&value);
+	while(!quit) {
+		level = rand_r(&seed) % SOAK_LEVELS;
+		band = rand_r(&seed) % (num_bands + 1);
+
+		pthread_mutex_lock(&expected_lock);
+		n = started + 1;
+		next = &expected[(n % SOAK_RING)*curve_bytes];
+		prev = &expected[((n - 1) % SOAK_RING)*curve_bytes];
+		if(band == num_bands) {
+			memcpy(next, &level_curve[level*curve_bytes], curve_bytes);
+		} else {
+			memcpy(next, prev, curve_bytes);
+			memcpy(next + band*column,
+					&level_curve[level*curve_bytes + band*column], column);
+		}
+		started = n;
+		pthread_mutex_unlock(&expected_lock);
+
+		if(band == num_bands) {
+			snd_ctl_elem_value_set_id(value, curve_id);
+			snd_ctl_elem_set_bytes(value,
+					&level_curve[level*curve_bytes], curve_bytes);
+		} else {
+			snd_ctl_elem_value_set_id(value, band_id[band]);
+			for(j = 0; j < channels; j++) {
+				snd_ctl_elem_value_set_integer(value, j,
+						band_level[level*num_bands + band]);
+			}
+		}
+		err = snd_ctl_elem_write(ctl, value);
+
+		pthread_mutex_lock(&expected_lock);
+		if(err < 0) {
+			/* Nothing changed, the state is the previous one */
+			memcpy(next, prev, curve_bytes);
+			ctl_errors++;
+		}
+		done = n;
+		ctl_writes++;
+		pthread_mutex_unlock(&expected_lock);
+	}
+
+	return NULL;
+}
+
+/* Reads the curve back and checks it against the states the writer went
+   through while the read was under way. */
+static void *soak_ctl_reader(void *arg)
+{
+	snd_ctl_t *ctl = arg;
+	snd_ctl_elem_value_t *value;
+	uint64_t first, last, n;
+	const void *curve;
+	int match;
+
+	snd_ctl_elem_value_alloca(&value);
+	snd_ctl_elem_value_set_id(value, curve_id);
+	while(!quit) {
+		pthread_mutex_lock(&expected_lock);
+		first = done;
+		pthread_mutex_unlock(&expected_lock);
+
+		if(snd_ctl_elem_read(ctl, value) < 0) {
+			pthread_mutex_lock(&expected_lock);
+			ctl_errors++;
+			pthread_mutex_unlock(&expected_lock);
+			continue;
+		}
+		curve = snd_ctl_elem_value_get_bytes(value);
+
+		pthread_mutex_lock(&expected_lock);
+		last = started;
+		match = 0;
+		if(last - first >= SOAK_RING) {
+			/* The states have been overwritten, can't tell */
+			ctl_skipped++;
+			match = 1;
+		}
+		for(n = first; !match && n <= last; n++) {
+			match = memcmp(curve, &expected[(n % SOAK_RING)*curve_bytes],
+					curve_bytes) == 0;
+		}
+		ctl_reads++;
+		if(!match && ctl_torn++ == 0) {
+			fprintf(stderr, "Torn curve read between writes %llu and %llu\n",
+					(unsigned long long)first, (unsigned long long)last);
+		}
+		pthread_mutex_unlock(&expected_lock);
+	}
+
+	return NULL;
+}
+
+/* Finds the band elements, which come before "Curve Data" in the list
+   and are in the curve's order, and reads back the curve with every band
+   at each level. */
+static int soak_ctl_setup(snd_ctl_t *ctl)
+{
+	snd_ctl_elem_list_t *list;
+	snd_ctl_elem_id_t *id;
+	snd_ctl_elem_info_t *info;
+	snd_ctl_elem_value_t *value;
+	unsigned int count, i, j, level;
+	long min, max;
+	int err;
+
+	snd_ctl_elem_list_alloca(&list);
+	snd_ctl_elem_id_alloca(&id);
+	snd_ctl_elem_info_alloca(&info);
+	snd_ctl_elem_value_alloca(&value);
+
+	if((err = snd_ctl_elem_list(ctl, list)) < 0) {
+		return err;
+	}
+	count = snd_ctl_elem_list_get_count(list);
+	if((err = snd_ctl_elem_list_alloc_space(list, count)) < 0 ||
+			(err = snd_ctl_elem_list(ctl, list)) < 0) {
+		return err;
+	}
+	band_id = calloc(count, sizeof(*band_id));
+	band_level = calloc((size_t)count*SOAK_LEVELS, sizeof(*band_level));
+	if(band_id == NULL || band_level == NULL) {
+		return -ENOMEM;
+	}
+	for(i = 0; i < count && curve_id == NULL; i++) {
+		snd_ctl_elem_list_get_id(list, i, id);
+		snd_ctl_elem_info_set_id(info, id);
+		if((err = snd_ctl_elem_info(ctl, info)) < 0) {
+			return err;
+		}
+		if(strcmp(snd_ctl_elem_info_get_name(info), "Curve Data") == 0) {
+			snd_ctl_elem_id_malloc(&curve_id);
+			snd_ctl_elem_info_get_id(info, curve_id);
+			curve_bytes = snd_ctl_elem_info_get_count(info);
+		} else if(snd_ctl_elem_info_get_type(info) ==
+					SND_CTL_ELEM_TYPE_INTEGER &&
+				snd_ctl_elem_info_is_writable(info) &&
+				snd_ctl_elem_info_get_count(info) == channels) {
+			snd_ctl_elem_id_malloc(&band_id[num_bands]);
+			snd_ctl_elem_info_get_id(info, band_id[num_bands]);
+			min = snd_ctl_elem_info_get_min(info);
+			max = snd_ctl_elem_info_get_max(info);
+			for(level = 0; level < SOAK_LEVELS; level++) {
+				band_level[level*count + num_bands] =
+						min + (max - min)*level/(SOAK_LEVELS - 1);
+			}
+			num_bands++;
+		}
+	}
+	snd_ctl_elem_list_free_space(list);
+	if(curve_id == NULL || num_bands == 0 ||
+			curve_bytes != num_bands*channels*sizeof(float)) {
+		fprintf(stderr, "No \"Curve Data\" element matching the bands\n");
+		return -ENOENT;
+	}
+	/* Pack the levels by the number of bands found */
+	for(level = 1; level < SOAK_LEVELS; level++) {
+		memmove(&band_level[level*num_bands], &band_level[level*count],
+				num_bands*sizeof(*band_level));
+	}
+
+	level_curve = malloc(SOAK_LEVELS*curve_bytes);
+	expected = malloc(SOAK_RING*curve_bytes);
+	if(level_curve == NULL || expected == NULL) {
+		return -ENOMEM;
+	}
+	for(level = 0; level < SOAK_LEVELS; level++) {
+		for(i = 0; i < num_bands; i++) {
+			snd_ctl_elem_value_set_id(value, band_id[i]);
+			for(j = 0; j < channels; j++) {
+				snd_ctl_elem_value_set_integer(value, j,
+						band_level[level*num_bands + i]);
+			}
+			if((err = snd_ctl_elem_write(ctl, value)) < 0) {
+				return err;
+			}
+		}
+		snd_ctl_elem_value_set_id(value, curve_id);
+		if((err = snd_ctl_elem_read(ctl, value)) < 0) {
+			return err;
+		}
+		memcpy(&level_curve[level*curve_bytes],
+				snd_ctl_elem_value_get_bytes(value), curve_bytes);
+	}
+	memcpy(expected, &level_curve[(SOAK_LEVELS - 1)*curve_bytes],
+			curve_bytes);
+
+	return 0;
+}
+
+/* Definitions of the PCMs and the ctl, added to the global config */
+static snd_config_t *soak_config(void)
+{
+	snd_config_t *top;
+	snd_input_t *in;
+	char *text = NULL, plugin[256];
+	size_t len = 0;
+	unsigned int i;
+	FILE *f;
+	int err;
+
+	f = open_memstream(&text, &len);
+	if(f == NULL) {
+		return NULL;
+	}
+	plugin[0] = '\0';
+	if(library != NULL) {
+		snprintf(plugin, sizeof(plugin), "\tlibrary \"%s\"\n", library);
+	}
+	if(module != NULL) {
+		snprintf(plugin + strlen(plugin), sizeof(plugin) - strlen(plugin),
+				"\tmodule \"%s\"\n", module);
+	}
+	if(plugin_dir != NULL) {
+		fprintf(f, "pcm_type.equal.lib \"%s/libasound_module_pcm_equal.so\"\n"
+				"ctl_type.equal.lib \"%s/libasound_module_ctl_equal.so\"\n",
+				plugin_dir, plugin_dir);
+	}
+	for(i = 0; i < streams; i++) {
+		fprintf(f, "pcm.alsaequal_soak_%u {\n\ttype equal\n"
+				"\tcontrols \"%s\"\n%s", i, controls, plugin);
+		if(output != NULL) {
+			fprintf(f, "\tslave.pcm { type file slave.pcm { type null } "
+					"file \"%s%u.raw\" format raw }\n}\n", output, i);
+		} else {
+			fprintf(f, "\tslave.pcm { type null }\n}\n");
+		}
+	}
+	fprintf(f, "ctl.alsaequal_soak {\n\ttype equal\n\tcontrols \"%s\"\n%s}\n",
+			controls, plugin);
+	fclose(f);
+
+	if(snd_config_update() < 0 || snd_config_copy(&top, snd_config) < 0) {
+		free(text);
+		return NULL;
+	}
+	err = snd_input_buffer_open(&in, text, len);
+	if(err == 0) {
+		err = snd_config_load(top, in);
+		snd_input_close(in);
+	}
+	free(text);
+	if(err < 0) {
+		fprintf(stderr, "Can't load the soak config: %s\n", snd_strerror(err));
+		snd_config_delete(top);
+		return NULL;
+	}
+	return top;
+}
+
+/* Upper edge of the bucket holding the given fraction of the writes, in
+   microseconds */
+static double soak_percentile(const soak_stream_t *stream, double fraction)
+{
+	uint64_t want = stream->calls*fraction, seen = 0;
+	unsigned int i;
+
+	for(i = 0; i < SOAK_BUCKETS - 1; i++) {
+		seen += stream->hist[i];
+		if(seen > want) {
+			break;
+		}
+	}
+	return (i + 1)*(SOAK_BUCKET_NS/1000.0);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-n streams] [-t seconds] [-c channels] "
+			"[-r rate] [-p period]\n"
+			"          [-C controls] [-l library] [-m module] "
+			"[-L plugin dir] [-o prefix]\n"
+			"  -n  PCMs to open, 8 by default\n"
+			"  -t  seconds to run, 10 by default\n"
+			"  -p  frames per write, 1024 by default\n"
+			"  -C  controls file, /tmp/alsaequal-soak.bin by default\n"
+			"  -L  where the equal PCM and ctl plugins are, if not "
+			"installed\n"
+			"  -o  write each stream to prefixN.raw instead of the null "
+			"device\n",
+			name);
+}
+
+int main(int argc, char *argv[])
+{
+	soak_stream_t *stream;
+	snd_config_t *config;
+	snd_ctl_t *ctl_write, *ctl_read;
+	pthread_t ctl_writer, ctl_reader;
+	struct sigaction sa;
+	uint64_t start, elapsed, frames = 0;
+	unsigned int i;
+	int opt, err, failed = 0;
+
+	while((opt = getopt(argc, argv, "n:t:c:r:p:C:l:m:L:o:h")) != -1) {
+		switch(opt) {
+		case 'n':
+			streams = atoi(optarg);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'c':
+			channels = atoi(optarg);
+			break;
+		case 'r':
+			rate = atoi(optarg);
+			break;
+		case 'p':
+			period = atoi(optarg);
+			break;
+		case 'C':
+			controls = optarg;
+			break;
+		case 'l':
+			library = optarg;
+			break;
+		case 'm':
+			module = optarg;
+			break;
+		case 'L':
+			plugin_dir = optarg;
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if(streams == 0 || channels == 0 || channels > 16 || rate == 0 ||
+			period == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	config = soak_config();
+	stream = calloc(streams, sizeof(*stream));
+	if(config == NULL || stream == NULL) {
+		fprintf(stderr, "Can't set up the soak config\n");
+		return 1;
+	}
+
+	/* The PCMs first, they create the controls */
+	for(i = 0; i < streams; i++) {
+		char name[32];
+
+		snprintf(name, sizeof(name), "alsaequal_soak_%u", i);
+		stream[i].index = i;
+		err = snd_pcm_open_lconf(&stream[i].pcm, name,
+				SND_PCM_STREAM_PLAYBACK, 0, config);
+		if(err == 0) {
+			err = snd_pcm_set_params(stream[i].pcm, SND_PCM_FORMAT_FLOAT,
+					SND_PCM_ACCESS_RW_INTERLEAVED, channels, rate, 0,
+					(unsigned int)(4ULL*period*1000000/rate));
+		}
+		if(err < 0) {
+			fprintf(stderr, "Can't open stream %u: %s\n", i,
+					snd_strerror(err));
+			return 1;
+		}
+	}
+	if((err = snd_ctl_open_lconf(&ctl_write, "alsaequal_soak", 0,
+			config)) < 0 ||
+			(err = snd_ctl_open_lconf(&ctl_read, "alsaequal_soak", 0,
+			config)) < 0 ||
+			(err = soak_ctl_setup(ctl_write)) < 0) {
+		fprintf(stderr, "Can't set up the controls: %s\n", snd_strerror(err));
+		return 1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = soak_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	start = soak_now();
+	for(i = 0; i < streams; i++) {
+		if(pthread_create(&stream[i].thread, NULL, soak_writer,
+				&stream[i]) != 0) {
+			fprintf(stderr, "Can't start stream %u\n", i);
+			return 1;
+		}
+	}
+	if(pthread_create(&ctl_writer, NULL, soak_ctl_writer, ctl_write) != 0 ||
+			pthread_create(&ctl_reader, NULL, soak_ctl_reader,
+			ctl_read) != 0) {
+		fprintf(stderr, "Can't start the control threads\n");
+		return 1;
+	}
+	while(!quit && soak_now() - start < seconds*1000000000ULL) {
+		usleep(100000);
+	}
+	quit = 1;
+	for(i = 0; i < streams; i++) {
+		pthread_join(stream[i].thread, NULL);
+	}
+	pthread_join(ctl_writer, NULL);
+	pthread_join(ctl_reader, NULL);
+	elapsed = soak_now() - start;
+
+	printf("stream     frames      calls   p50 us   p99 us p99.9 us   "
+			"max us\n");
+	for(i = 0; i < streams; i++) {
+		printf("%6u %10llu %10llu %8.0f %8.0f %8.0f %8.0f", i,
+				(unsigned long long)stream[i].frames,
+				(unsigned long long)stream[i].calls,
+				soak_percentile(&stream[i], 0.5),
+				soak_percentile(&stream[i], 0.99),
+				soak_percentile(&stream[i], 0.999),
+				stream[i].max_ns/1000.0);
+		if(stream[i].err < 0) {
+			printf(" %s", snd_strerror(stream[i].err));
+			failed = 1;
+		} else if(stream[i].calls == 0) {
+			printf(" stalled");
+			failed = 1;
+		}
+		printf("\n");
+		frames += stream[i].frames;
+	}
+	printf("%u streams, %.0f frames/s, %.1fx real time\n", streams,
+			frames*1e9/elapsed, frames*1e9/elapsed/rate);
+	printf("%llu control writes (%llu failed), %llu curve reads, "
+			"%llu torn, %llu too far behind to check\n",
+			(unsigned long long)ctl_writes, (unsigned long long)ctl_errors,
+			(unsigned long long)ctl_reads, (unsigned long long)ctl_torn,
+			(unsigned long long)ctl_skipped);
+	if(ctl_torn > 0 || ctl_errors > 0) {
+		failed = 1;
+	}
+
+	for(i = 0; i < streams; i++) {
+		snd_pcm_close(stream[i].pcm);
+	}
+	snd_ctl_close(ctl_write);
+	snd_ctl_close(ctl_read);
+	snd_config_delete(config);
+	free(stream);
+
+	return failed ? 1 : 0;
+}
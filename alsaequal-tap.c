@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+/* Sample analyzer for the alsaequal audio tap. Prints the octave band
+   spectrum of what goes into and comes out of the equalizer. Enable the
+   tap first, e.g. amixer -D equal cset name="Tap Switch" on */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "ladspa_utils.h"
+#include "tap.h"
+
+#define FFT_SIZE 8192
+#define NUM_BANDS 10
+
+static const float band_centre[NUM_BANDS] = {
+	31.25, 62.5, 125, 250, 500, 1000, 2000, 4000, 8000, 16000
+};
+
+/* In-place iterative radix-2 FFT */
+static void fft(float *re, float *im, int n)
+{
+	int i, j, k, len;
+	float ang, wr, wi, cr, ci, tr, ti, t;
+
+	for(i = 1, j = 0; i < n; i++) {
+		for(k = n >> 1; j & k; k >>= 1) {
+			j ^= k;
+		}
+		j ^= k;
+		if(i < j) {
+			t = re[i]; re[i] = re[j]; re[j] = t;
+			t = im[i]; im[i] = im[j]; im[j] = t;
+		}
+	}
+	for(len = 2; len <= n; len <<= 1) {
+		ang = -2*M_PI/len;
+		wr = cosf(ang);
+		wi = sinf(ang);
+		for(i = 0; i < n; i += len) {
+			cr = 1;
+			ci = 0;
+			for(j = 0; j < len/2; j++) {
+				tr = re[i + j + len/2]*cr - im[i + j + len/2]*ci;
+				ti = re[i + j + len/2]*ci + im[i + j + len/2]*cr;
+				re[i + j + len/2] = re[i + j] - tr;
+				im[i + j + len/2] = im[i + j] - ti;
+				re[i + j] += tr;
+				im[i + j] += ti;
+				t = cr*wr - ci*wi;
+				ci = cr*wi + ci*wr;
+				cr = t;
+			}
+		}
+	}
+}
+
+/* Octave band levels in dBFS of the channel average of frames */
+static void spectrum(const float *frames, unsigned int channels,
+		unsigned int rate, float *re, float *im, float *bands)
+{
+	unsigned int i, j, b, lo, hi;
+	float x, power;
+
+	for(i = 0; i < FFT_SIZE; i++) {
+		x = 0;
+		for(j = 0; j < channels; j++) {
+			x += frames[i*channels + j];
+		}
+		/* Hann window */
+		re[i] = x/channels*(0.5f - 0.5f*cosf(2*M_PI*i/(FFT_SIZE - 1)));
+		im[i] = 0;
+	}
+	fft(re, im, FFT_SIZE);
+
+	for(b = 0; b < NUM_BANDS; b++) {
+		lo = band_centre[b]/M_SQRT2*FFT_SIZE/rate;
+		hi = band_centre[b]*M_SQRT2*FFT_SIZE/rate;
+		if(lo < 1) {
+			lo = 1;
+		}
+		if(hi > FFT_SIZE/2) {
+			hi = FFT_SIZE/2;
+		}
+		power = 0;
+		for(i = lo; i < hi; i++) {
+			power += re[i]*re[i] + im[i]*im[i];
+		}
+		/* Hann window power gain, a full scale sine reads 0 dB */
+		bands[b] = 10*log10f(power*32/(3.0f*FFT_SIZE*FFT_SIZE) + 1e-12f);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	const char *controls = ".alsaequal.bin";
+	const equal_tap_t *tap;
+	char name[80];
+	float *pre, *post, *re, *im;
+	float pre_bands[NUM_BANDS], post_bands[NUM_BANDS];
+	uint64_t pos, last = 0;
+	size_t tap_length;
+	int b;
+
+	if(argc > 1) {
+		controls = argv[1];
+	}
+	if(LADSPAcontrolObjectName(controls, EQUAL_TAP_SUFFIX, name,
+			sizeof(name)) < 0) {
+		fprintf(stderr, "Can't resolve controls file %s\n", controls);
+		return 1;
+	}
+	tap = equal_tap_open(name, &tap_length);
+	if(tap == NULL) {
+		fprintf(stderr, "No audio tap for %s, is the PCM open?\n", controls);
+		return 1;
+	}
+
+	pre = malloc(FFT_SIZE*tap->channels*sizeof(float));
+	post = malloc(FFT_SIZE*tap->channels*sizeof(float));
+	re = malloc(FFT_SIZE*sizeof(float));
+	im = malloc(FFT_SIZE*sizeof(float));
+	if(pre == NULL || post == NULL || re == NULL || im == NULL) {
+		return 1;
+	}
+
+	printf("%-6s", "");
+	for(b = 0; b < NUM_BANDS; b++) {
+		if(band_centre[b] < 1000) {
+			printf("%7.0f", band_centre[b]);
+		} else {
+			printf("%6.0fk", band_centre[b]/1000);
+		}
+	}
+	printf("\n");
+
+	while(equal_tap_valid(tap)) {
+		usleep(100000);
+		pos = equal_tap_read(tap, EQUAL_TAP_PRE, pre, FFT_SIZE);
+		if(pos == 0 || pos == last || tap->rate == 0 ||
+				equal_tap_read(tap, EQUAL_TAP_POST, post, FFT_SIZE) != pos) {
+			continue;
+		}
+		last = pos;
+		spectrum(pre, tap->channels, tap->rate, re, im, pre_bands);
+		spectrum(post, tap->channels, tap->rate, re, im, post_bands);
+		printf("pre   ");
+		for(b = 0; b < NUM_BANDS; b++) {
+			printf("%7.1f", pre_bands[b]);
+		}
+		printf("\npost  ");
+		for(b = 0; b < NUM_BANDS; b++) {
+			printf("%7.1f", post_bands[b]);
+		}
+		printf("\n");
+		fflush(stdout);
+	}
+
+	fprintf(stderr, "The tap went away\n");
+	equal_tap_close(tap, tap_length);
+	return 0;
+}
@@ -0,0 +1,366 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "ladspa.h"
+#include "ladspa_utils.h"
+#include "alsaequal_control.h"
+
+struct alsaequal_control {
+	LADSPA_Control *control_data;
+};
+
+alsaequal_control_t *alsaequal_control_open(const char *controls_filename,
+		const char *library, const char *label, unsigned int channels)
+{
+	alsaequal_control_t *ctl;
+
+	ctl = calloc(1, sizeof(*ctl));
+	if(ctl == NULL) {
+		return NULL;
+	}
+
+	if(controls_filename == NULL) {
+		controls_filename = ".alsaequal.bin";
+	}
+	ctl->control_data = LADSPAcontrolMMAPMeta(controls_filename, channels,
+			library, label);
+	if(ctl->control_data == NULL) {
+		free(ctl);
+		errno = ENOENT;
+		return NULL;
+	}
+
+	return ctl;
+}
+
+void alsaequal_control_close(alsaequal_control_t *ctl)
+{
+	if(ctl == NULL) {
+		return;
+	}
+	LADSPAcontrolUnMMAP(ctl->control_data);
+	free(ctl);
+}
+
+unsigned int alsaequal_control_count(const alsaequal_control_t *ctl)
+{
+	return ctl->control_data->num_controls;
+}
+
+unsigned int alsaequal_control_channels(const alsaequal_control_t *ctl)
+{
+	return ctl->control_data->channels;
+}
+
+static int valid_control(const alsaequal_control_t *ctl, int control)
+{
+	return control >= 0 &&
+		(unsigned int)control < ctl->control_data->num_controls;
+}
+
+static int valid_channel(const alsaequal_control_t *ctl, int channel)
+{
+	return channel >= -1 &&
+		channel < (int)ctl->control_data->channels;
+}
+
+int alsaequal_control_find(const alsaequal_control_t *ctl, const char *name)
+{
+	const LADSPA_Control *control_data = ctl->control_data;
+	unsigned int i;
+
+	for(i = 0; i < control_data->num_controls; i++) {
+		if(strncmp(control_data->control[i].name, name,
+				sizeof(control_data->control[i].name)) == 0) {
+			return i;
+		}
+	}
+	return -ENOENT;
+}
+
+int alsaequal_control_find_port(const alsaequal_control_t *ctl,
+		unsigned long port)
+{
+	const LADSPA_Control *control_data = ctl->control_data;
+	unsigned int i;
+
+	for(i = 0; i < control_data->num_controls; i++) {
+		if(control_data->control[i].index == (int32_t)port) {
+			return i;
+		}
+	}
+	return -ENOENT;
+}
+
+const char *alsaequal_control_name(const alsaequal_control_t *ctl,
+		int control)
+{
+	if(!valid_control(ctl, control)) {
+		return NULL;
+	}
+	return ctl->control_data->control[control].name;
+}
+
+int alsaequal_control_port(const alsaequal_control_t *ctl, int control)
+{
+	if(!valid_control(ctl, control)) {
+		return -EINVAL;
+	}
+	return ctl->control_data->control[control].index;
+}
+
+int alsaequal_control_range(const alsaequal_control_t *ctl, int control,
+		float *lower, float *upper)
+{
+	if(!valid_control(ctl, control)) {
+		return -EINVAL;
+	}
+	*lower = ctl->control_data->control[control].lower;
+	*upper = ctl->control_data->control[control].upper;
+	return 0;
+}
+
+int alsaequal_control_is_output(const alsaequal_control_t *ctl, int control)
+{
+	if(!valid_control(ctl, control)) {
+		return -EINVAL;
+	}
+	return ctl->control_data->control[control].type == LADSPA_CNTRL_OUTPUT;
+}
+
+int alsaequal_control_get(alsaequal_control_t *ctl, int control, int channel,
+		float *value)
+{
+	const LADSPA_Control *control_data = ctl->control_data;
+
+	if(!valid_control(ctl, control) || channel < 0 ||
+			!valid_channel(ctl, channel)) {
+		return -EINVAL;
+	}
+	/* A single aligned float is always read whole, no snapshot needed */
+	*value = control_data->control[control].data[channel];
+	return 0;
+}
+
+int alsaequal_control_get_all(alsaequal_control_t *ctl, float *values,
+		uint32_t *seq)
+{
+	if(!LADSPAcontrolSnapshot(ctl->control_data, values, seq)) {
+		return -EAGAIN;
+	}
+	return 0;
+}
+
+/* Clamp a value to the port's bounds. Bounds relative to the sample rate
+   can't be checked here since the rate belongs to the PCM. */
+static float clamp_value(const LADSPA_Control_Data *data, float value)
+{
+	if(LADSPA_IS_HINT_SAMPLE_RATE(data->hint)) {
+		return value;
+	}
+	if(LADSPA_IS_HINT_BOUNDED_BELOW(data->hint) && value < data->lower) {
+		value = data->lower;
+	}
+	if(LADSPA_IS_HINT_BOUNDED_ABOVE(data->hint) && value > data->upper) {
+		value = data->upper;
+	}
+	return value;
+}
+
+static int valid_update(const alsaequal_control_t *ctl,
+		const alsaequal_control_update_t *update)
+{
+	return valid_control(ctl, update->control) &&
+		valid_channel(ctl, update->channel) &&
+		ctl->control_data->control[update->control].type ==
+			LADSPA_CNTRL_INPUT;
+}
+
+static void apply_update(LADSPA_Control *control_data,
+		const alsaequal_control_update_t *update)
+{
+	LADSPA_Control_Data *data = &control_data->control[update->control];
+	float value = clamp_value(data, update->value);
+	unsigned int j;
+
+	if(update->channel < 0) {
+		for(j = 0; j < control_data->channels; j++) {
+			data->data[j] = value;
+		}
+	} else {
+		data->data[update->channel] = value;
+	}
+}
+
+int alsaequal_control_set_many(alsaequal_control_t *ctl,
+		const alsaequal_control_update_t *updates, unsigned int count)
+{
+	unsigned int i;
+
+	for(i = 0; i < count; i++) {
+		if(!valid_update(ctl, &updates[i])) {
+			return -EINVAL;
+		}
+	}
+
+	LADSPAcontrolWriteLock(ctl->control_data);
+	for(i = 0; i < count; i++) {
+		apply_update(ctl->control_data, &updates[i]);
+	}
+	LADSPAcontrolWriteUnlock(ctl->control_data);
+	return 0;
+}
+
+int alsaequal_control_schedule(alsaequal_control_t *ctl,
+		const alsaequal_control_update_t *updates, unsigned int count,
+		uint64_t frame)
+{
+	unsigned int i;
+
+	if(count > LADSPA_CNTRL_MAX_EVENTS) {
+		return -E2BIG;
+	}
+	for(i = 0; i < count; i++) {
+		if(!valid_update(ctl, &updates[i])) {
+			return -EINVAL;
+		}
+	}
+
+	LADSPAcontrolWriteLock(ctl->control_data);
+	for(i = 0; i < count; i++) {
+		LADSPAcontrolQueueEvent(ctl->control_data, updates[i].control,
+				updates[i].channel, clamp_value(
+				&ctl->control_data->control[updates[i].control],
+				updates[i].value), frame);
+	}
+	LADSPAcontrolWriteUnlock(ctl->control_data);
+	return 0;
+}
+
+int alsaequal_control_position(const alsaequal_control_t *ctl,
+		uint64_t *frame, unsigned int *rate)
+{
+	if(frame != NULL) {
+		*frame = __atomic_load_n(&ctl->control_data->frame_pos,
+				__ATOMIC_RELAXED);
+	}
+	if(rate != NULL) {
+		*rate = ctl->control_data->frame_rate;
+	}
+	return ctl->control_data->frame_rate != 0 ? 0 : -ENODATA;
+}
+
+int alsaequal_control_set(alsaequal_control_t *ctl, int control, int channel,
+		float value)
+{
+	alsaequal_control_update_t update = { control, channel, value };
+	return alsaequal_control_set_many(ctl, &update, 1);
+}
+
+int alsaequal_control_set_by_name(alsaequal_control_t *ctl, const char *name,
+		int channel, float value)
+{
+	int control = alsaequal_control_find(ctl, name);
+	if(control < 0) {
+		return control;
+	}
+	return alsaequal_control_set(ctl, control, channel, value);
+}
+
+int alsaequal_control_set_all(alsaequal_control_t *ctl, const float *values)
+{
+	LADSPA_Control *control_data = ctl->control_data;
+	LADSPA_Control_Data *data;
+	unsigned int i, j;
+
+	LADSPAcontrolWriteLock(control_data);
+	for(i = 0; i < control_data->num_controls; i++) {
+		data = &control_data->control[i];
+		if(data->type != LADSPA_CNTRL_INPUT) {
+			continue;
+		}
+		for(j = 0; j < control_data->channels; j++) {
+			data->data[j] = clamp_value(data,
+					values[i*control_data->channels + j]);
+		}
+	}
+	LADSPAcontrolWriteUnlock(control_data);
+	return 0;
+}
+
+uint32_t alsaequal_control_seq(const alsaequal_control_t *ctl)
+{
+	return __atomic_load_n(&ctl->control_data->seq, __ATOMIC_ACQUIRE) & ~1U;
+}
+
+int alsaequal_control_changed(const alsaequal_control_t *ctl, uint32_t *seq)
+{
+	uint32_t now = __atomic_load_n(&ctl->control_data->seq,
+			__ATOMIC_ACQUIRE);
+
+	/* A change in progress is reported once it is committed */
+	if((now & 1) || now == *seq) {
+		return 0;
+	}
+	*seq = now;
+	return 1;
+}
+
+static long long wait_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+int alsaequal_control_wait(const alsaequal_control_t *ctl, uint32_t *seq,
+		int timeout_ms)
+{
+	struct timespec left;
+	long long deadline = 0, ns;
+	uint32_t now;
+
+	if(timeout_ms >= 0) {
+		deadline = wait_now() + timeout_ms*1000000LL;
+	}
+	while(!alsaequal_control_changed(ctl, seq)) {
+		now = __atomic_load_n(&ctl->control_data->seq, __ATOMIC_ACQUIRE);
+		if(!(now & 1) && now != *seq) {
+			/* Committed since we looked */
+			continue;
+		}
+		if(timeout_ms < 0) {
+			LADSPAcontrolWaitSeq(ctl->control_data, now, NULL);
+			continue;
+		}
+		ns = deadline - wait_now();
+		if(ns <= 0) {
+			return 0;
+		}
+		left.tv_sec = ns/1000000000;
+		left.tv_nsec = ns%1000000000;
+		LADSPAcontrolWaitSeq(ctl->control_data, now, &left);
+	}
+	return 1;
+}
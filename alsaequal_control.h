@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#ifndef ALSAEQUAL_CONTROL_H
+#define ALSAEQUAL_CONTROL_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* libalsaequal-control: direct access to the shared controls of an
+   alsaequal PCM, bypassing the ctl plugin. Values are floats in the
+   plugin's own units, every change is published to the PCMs with the
+   same seqlock they read it with, so a batch is never seen half-applied.
+
+   Controls are addressed by their position in the controls block (the
+   numid of the matching mixer element minus one); use
+   alsaequal_control_find() or alsaequal_control_find_port() to get it
+   from a port name or LADSPA port number. A channel of -1 means all
+   channels. Functions returning int return 0 on success and a negative
+   errno on failure. Not thread safe per handle. */
+
+typedef struct alsaequal_control alsaequal_control_t;
+
+typedef struct alsaequal_control_update {
+	int control;
+	int channel;
+	float value;
+} alsaequal_control_update_t;
+
+/* Open the controls of controls_filename (a relative name is taken from
+   $HOME, NULL means the default ".alsaequal.bin"). The controls must have
+   been created by the PCM or ctl plugin before. library, label and
+   channels may be NULL/0 to accept whatever the controls were made for. */
+alsaequal_control_t *alsaequal_control_open(const char *controls_filename,
+		const char *library, const char *label, unsigned int channels);
+void alsaequal_control_close(alsaequal_control_t *ctl);
+
+unsigned int alsaequal_control_count(const alsaequal_control_t *ctl);
+unsigned int alsaequal_control_channels(const alsaequal_control_t *ctl);
+
+/* Lookup, return the control or -ENOENT. */
+int alsaequal_control_find(const alsaequal_control_t *ctl, const char *name);
+int alsaequal_control_find_port(const alsaequal_control_t *ctl,
+		unsigned long port);
+
+/* Port metadata. The name is NULL and the rest fail for a bad control. */
+const char *alsaequal_control_name(const alsaequal_control_t *ctl,
+		int control);
+int alsaequal_control_port(const alsaequal_control_t *ctl, int control);
+int alsaequal_control_range(const alsaequal_control_t *ctl, int control,
+		float *lower, float *upper);
+/* 1 for values written by the plugin, which can be read but not set */
+int alsaequal_control_is_output(const alsaequal_control_t *ctl, int control);
+
+/* Read one value (channel must be a real channel here). */
+int alsaequal_control_get(alsaequal_control_t *ctl, int control, int channel,
+		float *value);
+
+/* Read every value as values[control*channels + channel] and the change
+   counter they belong to. -EAGAIN if writers kept the controls busy. */
+int alsaequal_control_get_all(alsaequal_control_t *ctl, float *values,
+		uint32_t *seq);
+
+/* Set values, clamped to the port's bounds. A batch is applied
+   atomically; it fails with nothing written if any entry is invalid. */
+int alsaequal_control_set(alsaequal_control_t *ctl, int control, int channel,
+		float value);
+int alsaequal_control_set_by_name(alsaequal_control_t *ctl, const char *name,
+		int channel, float value);
+int alsaequal_control_set_many(alsaequal_control_t *ctl,
+		const alsaequal_control_update_t *updates, unsigned int count);
+/* Replace every input value, laid out as for alsaequal_control_get_all() */
+int alsaequal_control_set_all(alsaequal_control_t *ctl, const float *values);
+
+/* Apply a batch at stream frame instead of straight away, which splits the
+   PCM's block at that frame. Frames count from the last time the stream
+   was prepared, a frame already passed takes effect with the next block.
+   The values become the stored settings at once, but the PCM keeps
+   running with the old ones until the frame. The PCM holds up to 64
+   waiting updates, beyond that the oldest take effect early; a larger
+   batch fails with -E2BIG. */
+int alsaequal_control_schedule(alsaequal_control_t *ctl,
+		const alsaequal_control_update_t *updates, unsigned int count,
+		uint64_t frame);
+
+/* The next frame the PCM will process and its sample rate, -ENODATA if no
+   PCM has been prepared on these controls. */
+int alsaequal_control_position(const alsaequal_control_t *ctl,
+		uint64_t *frame, unsigned int *rate);
+
+/* Change subscription. The counter changes whenever anyone (a mixer, the
+   ctl plugin, another client) commits a change to the inputs.
+   alsaequal_control_changed() checks without blocking, which is meant for
+   agents polling many devices from one loop; alsaequal_control_wait()
+   sleeps on a futex until a writer commits, for up to timeout_ms (-1
+   forever). Both update *seq and return 1 if it changed, 0 if not. */
+uint32_t alsaequal_control_seq(const alsaequal_control_t *ctl);
+int alsaequal_control_changed(const alsaequal_control_t *ctl, uint32_t *seq);
+int alsaequal_control_wait(const alsaequal_control_t *ctl, uint32_t *seq,
+		int timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "ladspa.h"
+#include "ladspa_utils.h"
+#include "core.h"
+#include "alsaequal_core.h"
+
+/* Frames run at a time, the planar buffers hold this many */
+#define CORE_BLOCK 1024
+
+struct alsaequal_core {
+	void *library;
+	const LADSPA_Descriptor *klass;
+	LADSPA_Control *control_data;
+	equal_core_controls_t controls;
+	LADSPA_Handle *handle;		/* [channels] */
+	unsigned long rate;		/* 0 until prepared */
+	float *planar[2];		/* [channels][CORE_BLOCK] */
+};
+
+static void core_release(alsaequal_core_t *core)
+{
+	equal_core_release(core->klass, core->handle,
+			core->control_data->channels);
+	core->rate = 0;
+}
+
+alsaequal_core_t *alsaequal_core_create(const char *controls_filename,
+		const char *library, const char *module, unsigned int channels)
+{
+	alsaequal_core_t *core;
+	size_t values;
+
+	if(channels < 1 || channels > 16) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if(controls_filename == NULL) {
+		controls_filename = ".alsaequal.bin";
+	}
+	core = calloc(1, sizeof(*core));
+	if(core == NULL) {
+		return NULL;
+	}
+
+	core->library = LADSPAtryLoad(library);
+	if(core->library == NULL) {
+		free(core);
+		errno = ENOENT;
+		return NULL;
+	}
+	core->klass = LADSPAtryFind(core->library, module);
+	if(core->klass == NULL) {
+		LADSPAunload(core->library);
+		free(core);
+		errno = ENOENT;
+		return NULL;
+	}
+	core->control_data = LADSPAcontrolMMAP(core->klass, controls_filename,
+			channels, library);
+	if(core->control_data == NULL) {
+		LADSPAunload(core->library);
+		free(core);
+		errno = EIO;
+		return NULL;
+	}
+	if(core->klass->PortDescriptors[core->control_data->input_index] !=
+			(LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO) ||
+			core->klass->PortDescriptors[core->control_data->output_index] !=
+			(LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO)) {
+		alsaequal_core_destroy(core);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	values = core->control_data->num_controls*channels;
+	core->controls.control_data = core->control_data;
+	core->controls.values = calloc(values, sizeof(LADSPA_Data));
+	core->controls.staging = calloc(values, sizeof(LADSPA_Data));
+	core->handle = calloc(channels, sizeof(LADSPA_Handle));
+	core->planar[0] = malloc(channels*CORE_BLOCK*sizeof(float));
+	core->planar[1] = malloc(channels*CORE_BLOCK*sizeof(float));
+	if(core->controls.values == NULL || core->controls.staging == NULL ||
+			core->handle == NULL || core->planar[0] == NULL ||
+			core->planar[1] == NULL) {
+		alsaequal_core_destroy(core);
+		errno = ENOMEM;
+		return NULL;
+	}
+	return core;
+}
+
+void alsaequal_core_destroy(alsaequal_core_t *core)
+{
+	if(core == NULL) {
+		return;
+	}
+	if(core->handle != NULL) {
+		core_release(core);
+	}
+	free(core->handle);
+	free(core->planar[0]);
+	free(core->planar[1]);
+	free(core->controls.values);
+	free(core->controls.staging);
+	LADSPAcontrolUnMMAP(core->control_data);
+	LADSPAunload(core->library);
+	free(core);
+}
+
+unsigned int alsaequal_core_channels(const alsaequal_core_t *core)
+{
+	return core->control_data->channels;
+}
+
+int alsaequal_core_prepare(alsaequal_core_t *core, unsigned long rate)
+{
+	int err;
+
+	if(rate == 0) {
+		return -EINVAL;
+	}
+	if(core->rate != rate) {
+		core_release(core);
+		err = equal_core_instantiate(core->klass, core->handle,
+				core->control_data->channels, rate);
+		if(err < 0) {
+			return err;
+		}
+		equal_core_connect_controls(core->klass, core->handle,
+				core->control_data, core->controls.values);
+		core->rate = rate;
+	}
+	equal_core_start(&core->controls, rate, NULL);
+	return 0;
+}
+
+/* A piece of a block of planar audio, in and out are the whole block */
+typedef struct core_block {
+	alsaequal_core_t *core;
+	float *in;
+	float *out;
+	unsigned long frames;
+} core_block_t;
+
+static void core_piece(void *arg, unsigned long offset, unsigned long frames)
+{
+	core_block_t *block = arg;
+	alsaequal_core_t *core = block->core;
+	unsigned int j;
+
+	for(j = 0; j < core->control_data->channels; j++) {
+		equal_core_run(core->klass, core->handle[j], core->control_data, j,
+				block->in + j*block->frames + offset,
+				block->out + j*block->frames + offset, frames);
+	}
+}
+
+/* Run the instances over a block of planar audio, split wherever a
+   timestamped change falls in it */
+static void core_run(alsaequal_core_t *core, float *in, float *out,
+		unsigned long frames)
+{
+	equal_core_controls_t *controls = &core->controls;
+	core_block_t block = { core, in, out, frames };
+
+	equal_core_split(&controls, 1, frames, 0, core_piece, &block);
+	equal_core_advance(&core->controls, frames);
+}
+
+void alsaequal_core_process(alsaequal_core_t *core, const float *in,
+		float *out, unsigned long frames)
+{
+	LADSPA_Control *control_data = core->control_data;
+	unsigned int channels = control_data->channels;
+	float peak[16], sum[16];
+	unsigned long n;
+
+	if(core->rate == 0) {
+		memmove(out, in, frames*channels*sizeof(float));
+		return;
+	}
+	equal_core_sync(&core->controls, NULL);
+	for(; frames > 0; frames -= n) {
+		n = frames < CORE_BLOCK ? frames : CORE_BLOCK;
+		equal_core_deinterleave(in, core->planar[0], n, channels, n, peak,
+				sum);
+		equal_core_publish_meters(control_data->peak_in, control_data->rms_in,
+				peak, sum, channels, n);
+		core_run(core, core->planar[0], core->planar[1], n);
+		equal_core_interleave(core->planar[1], out, n, channels, n, peak,
+				sum);
+		equal_core_publish_meters(control_data->peak_out,
+				control_data->rms_out, peak, sum, channels, n);
+		in += n*channels;
+		out += n*channels;
+	}
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#ifndef ALSAEQUAL_CORE_H
+#define ALSAEQUAL_CORE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* libalsaequal-core: the equalizer's audio path without ALSA, for
+   offline tools, benchmarks and other audio stacks. It runs the LADSPA
+   module on the same shared controls as the PCM, so mixers, the ctl
+   plugin and libalsaequal-control adjust it the same way, timestamped
+   changes included, and the meters and stream position are published
+   with the controls. Audio is interleaved float. Functions returning int
+   return 0 on success and a negative errno on failure. Not thread safe
+   per handle. */
+
+typedef struct alsaequal_core alsaequal_core_t;
+
+/* Load module from library (a bare name is searched for along
+   LADSPA_PATH) and map the controls of controls_filename for channels,
+   creating them with the plugin's defaults if there are none yet. A
+   relative controls_filename is taken from $HOME, NULL means the default
+   ".alsaequal.bin". Returns NULL with errno set on failure. */
+alsaequal_core_t *alsaequal_core_create(const char *controls_filename,
+		const char *library, const char *module, unsigned int channels);
+void alsaequal_core_destroy(alsaequal_core_t *core);
+
+unsigned int alsaequal_core_channels(const alsaequal_core_t *core);
+
+/* Get ready to process audio at rate, starting the stream position over
+   at frame 0. Needed before the first alsaequal_core_process() and after
+   a change of rate or a discontinuity; the instances are only made again
+   when the rate changes. */
+int alsaequal_core_prepare(alsaequal_core_t *core, unsigned long rate);
+
+/* Equalize frames of interleaved audio from in to out, which may be the
+   same buffer. Changes to the controls are picked up at the start of
+   each call. Doesn't allocate, lock or make system calls, so it can run
+   on a real-time thread. */
+void alsaequal_core_process(alsaequal_core_t *core, const float *in,
+		float *out, unsigned long frames);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+
+/* Times a period's round trip through alsaequal-dspd the way the PCM
+   makes it: deinterleave, have the daemon run the plugin, interleave.
+   Once through planar buffers of the client's own that are copied in and
+   out of the segment, once (de)interleaving straight into the segment.
+   The daemon must be listening on the socket, see make bench. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "ladspa.h"
+#include "ladspa_utils.h"
+#include "dspd.h"
+#include "core.h"
+
+#define BENCH_RATE 48000
+/* How long to wait for the daemon to come up, in 10 ms steps */
+#define BENCH_CONNECT_TRIES 200
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+/* The controls the PCM would set up for the plugin, at their defaults */
+static LADSPA_Control *bench_controls(const LADSPA_Descriptor *psDescriptor,
+		unsigned int channels)
+{
+	LADSPA_Control *control_data;
+	LADSPA_PortDescriptor port;
+	unsigned long p;
+	unsigned int i = 0, j;
+	LADSPA_Data value;
+
+	control_data = calloc(1, sizeof(LADSPA_Control) +
+			psDescriptor->PortCount*sizeof(LADSPA_Control_Data));
+	if(control_data == NULL) {
+		return NULL;
+	}
+	control_data->channels = channels;
+	for(p = 0; p < psDescriptor->PortCount; p++) {
+		port = psDescriptor->PortDescriptors[p];
+		if(LADSPA_IS_PORT_AUDIO(port)) {
+			if(LADSPA_IS_PORT_INPUT(port)) {
+				control_data->input_index = p;
+			} else {
+				control_data->output_index = p;
+			}
+			continue;
+		}
+		control_data->control[i].index = p;
+		control_data->control[i].type = LADSPA_IS_PORT_INPUT(port) ?
+				LADSPA_CNTRL_INPUT : LADSPA_CNTRL_OUTPUT;
+		if(LADSPADefault(&psDescriptor->PortRangeHints[p], BENCH_RATE,
+				&value) != 0) {
+			value = 0;
+		}
+		for(j = 0; j < channels; j++) {
+			control_data->control[i].data[j] = value;
+		}
+		i++;
+	}
+	control_data->num_controls = i;
+	return control_data;
+}
+
+static void bench_usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s -l library -m module [-s socket] "
+			"[-c channels] [-p period] [-n periods]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *socket_path = NULL, *library = NULL, *module = NULL;
+	unsigned int channels = 2, j, k, tries;
+	unsigned long period = 256, periods = 20000, i;
+	const LADSPA_Descriptor *psDescriptor;
+	LADSPA_Control *control_data;
+	LADSPA_Data *values;
+	equal_dspd_t *dspd;
+	float *interleaved, *result, *planar_in, *planar_out, *shm_in, *shm_out;
+	float peak[EQUAL_DSPD_MAX_CHANNELS], sum[EQUAL_DSPD_MAX_CHANNELS];
+	uint64_t start, copy_ns, direct_ns;
+	void *plugin;
+	int opt;
+
+	while((opt = getopt(argc, argv, "s:l:m:c:p:n:h")) != -1) {
+		switch(opt) {
+		case 's':
+			socket_path = optarg;
+			break;
+		case 'l':
+			library = optarg;
+			break;
+		case 'm':
+			module = optarg;
+			break;
+		case 'c':
+			channels = atoi(optarg);
+			break;
+		case 'p':
+			period = atol(optarg);
+			break;
+		case 'n':
+			periods = atol(optarg);
+			break;
+		default:
+			bench_usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if(library == NULL || module == NULL || channels < 1 ||
+			channels > EQUAL_DSPD_MAX_CHANNELS || period < 1 ||
+			period > EQUAL_DSPD_MAX_FRAMES || periods < 1) {
+		bench_usage(argv[0]);
+		return 1;
+	}
+
+	plugin = LADSPAtryLoad(library);
+	psDescriptor = plugin != NULL ? LADSPAtryFind(plugin, module) : NULL;
+	if(psDescriptor == NULL) {
+		fprintf(stderr, "Can't load %s from %s\n", module, library);
+		return 1;
+	}
+	control_data = bench_controls(psDescriptor, channels);
+	values = calloc(control_data->num_controls*channels, sizeof(LADSPA_Data));
+	interleaved = malloc(period*channels*sizeof(float));
+	result = malloc(period*channels*sizeof(float));
+	planar_in = malloc(period*channels*sizeof(float));
+	planar_out = malloc(period*channels*sizeof(float));
+	if(values == NULL || interleaved == NULL || result == NULL ||
+			planar_in == NULL || planar_out == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	for(k = 0; k < control_data->num_controls; k++) {
+		for(j = 0; j < channels; j++) {
+			values[k*channels + j] = control_data->control[k].data[j];
+		}
+	}
+	for(i = 0; i < period*channels; i++) {
+		interleaved[i] = (float)rand()/RAND_MAX - 0.5f;
+	}
+
+	for(tries = 0; ; tries++) {
+		dspd = equal_dspd_connect(socket_path, library, module, control_data);
+		if(dspd != NULL || tries == BENCH_CONNECT_TRIES ||
+				(errno != ENOENT && errno != ECONNREFUSED)) {
+			break;
+		}
+		usleep(10000);
+	}
+	if(dspd == NULL) {
+		fprintf(stderr, "Can't reach alsaequal-dspd: %s\n", strerror(errno));
+		return 1;
+	}
+	equal_dspd_audio(dspd, &shm_in, &shm_out);
+
+	start = bench_now();
+	for(i = 0; i < periods; i++) {
+		equal_core_deinterleave(interleaved, planar_in, period, channels,
+				period, peak, sum);
+		if(equal_dspd_run(dspd, BENCH_RATE, values, planar_in, planar_out,
+				period, period) < 0) {
+			fprintf(stderr, "Round trip failed\n");
+			return 1;
+		}
+		equal_core_interleave(planar_out, result, period, channels, period,
+				peak, sum);
+	}
+	copy_ns = bench_now() - start;
+
+	start = bench_now();
+	for(i = 0; i < periods; i++) {
+		equal_core_deinterleave(interleaved, shm_in, period, channels,
+				EQUAL_DSPD_MAX_FRAMES, peak, sum);
+		if(equal_dspd_run(dspd, BENCH_RATE, values, shm_in, shm_out,
+				EQUAL_DSPD_MAX_FRAMES, period) < 0) {
+			fprintf(stderr, "Round trip failed\n");
+			return 1;
+		}
+		/* planar_in is free by now, it takes the result to compare */
+		equal_core_interleave(shm_out, planar_in, period, channels,
+				EQUAL_DSPD_MAX_FRAMES, peak, sum);
+	}
+	direct_ns = bench_now() - start;
+
+	printf("%u channels, %lu frame periods, %lu round trips\n", channels,
+			period, periods);
+	printf("copied:   %8.2f us per period\n", copy_ns/(1000.0*periods));
+	printf("in place: %8.2f us per period\n", direct_ns/(1000.0*periods));
+	if(memcmp(planar_in, result, period*channels*sizeof(float)) != 0) {
+		fprintf(stderr, "The two paths disagree\n");
+		return 1;
+	}
+
+	equal_dspd_close(dspd);
+	LADSPAunload(plugin);
+	free(control_data);
+	free(values);
+	free(interleaved);
+	free(result);
+	free(planar_in);
+	free(planar_out);
+	return 0;
+}
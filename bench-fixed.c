@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+
+/* Times the fixed point equalizer on each code path the CPU has against
+   the float path it replaces: the S16 or S32 stream converted to planar
+   float, the same peaking bands run as float biquads, and converted back.
+   With -m the code paths are timed again with the bands below the split
+   frequency run at a decimated rate. Run by make bench. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+
+#include "fixed.h"
+
+#define BENCH_PERIOD 1024
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+/* The bands of fx as float biquads, direct form I like the fixed ones */
+typedef struct bench_float {
+	unsigned int channels;
+	unsigned int bands;
+	float coef[EQUAL_FIXED_MAX_BANDS][EQUAL_FIXED_MAX_CHANNELS][5];
+	float state[EQUAL_FIXED_MAX_BANDS][EQUAL_FIXED_MAX_CHANNELS][4];
+	float planar[EQUAL_FIXED_MAX_CHANNELS*BENCH_PERIOD];
+} bench_float_t;
+
+static void bench_float_init(bench_float_t *fl, const equal_fixed_t *fx)
+{
+	unsigned int b, j, k;
+
+	memset(fl, 0, sizeof(*fl));
+	fl->channels = fx->channels;
+	fl->bands = fx->bands;
+	for(b = 0; b < fx->bands; b++) {
+		for(j = 0; j < fx->channels; j++) {
+			for(k = 0; k < 5; k++) {
+				fl->coef[b][j][k] = ldexp(fx->band[b].coef[k][j],
+						-fx->band[b].shift);
+			}
+		}
+	}
+}
+
+static void bench_float_run(bench_float_t *fl, const void *src, void *dst,
+		int format, unsigned long n)
+{
+	const unsigned int channels = fl->channels;
+	const float scale = format == EQUAL_FIXED_S16 ? 32768.0f : 2147483648.0f;
+	float x, y, *p, *c, *s;
+	unsigned long i;
+	unsigned int b, j;
+
+	for(j = 0; j < channels; j++) {
+		p = fl->planar + j*n;
+		for(i = 0; i < n; i++) {
+			p[i] = (format == EQUAL_FIXED_S16 ?
+					((const int16_t *)src)[i*channels + j] :
+					((const int32_t *)src)[i*channels + j])/scale;
+		}
+		for(b = 0; b < fl->bands; b++) {
+			c = fl->coef[b][j];
+			s = fl->state[b][j];
+			for(i = 0; i < n; i++) {
+				x = p[i];
+				y = c[0]*x + c[1]*s[0] + c[2]*s[1] + c[3]*s[2] + c[4]*s[3];
+				s[1] = s[0];
+				s[0] = x;
+				s[3] = s[2];
+				s[2] = y;
+				p[i] = y;
+			}
+		}
+		for(i = 0; i < n; i++) {
+			y = fminf(fmaxf(p[i]*scale, -scale), scale - 1);
+			if(format == EQUAL_FIXED_S16) {
+				((int16_t *)dst)[i*channels + j] = lrintf(y);
+			} else {
+				((int32_t *)dst)[i*channels + j] = lrint(y);
+			}
+		}
+	}
+}
+
+/* Time each code path the CPU has, suffix is added to their names */
+static void bench_fixed(equal_fixed_t *fx, unsigned long rate, int format,
+		const void *src, void *dst, double seconds, const char *suffix)
+{
+	const unsigned long frames = seconds*rate;
+	unsigned long done;
+	uint64_t start, ns;
+	char name[16];
+	int isa;
+
+	for(isa = EQUAL_FIXED_SCALAR; isa <= EQUAL_FIXED_AVX2; isa++) {
+		snprintf(name, sizeof(name), "%s%s", equal_fixed_isa_name(isa),
+				suffix);
+		if(equal_fixed_set_isa(fx, isa) != isa) {
+			printf("%-10s not on this CPU\n", name);
+			continue;
+		}
+		equal_fixed_reset(fx, rate);
+		start = bench_now();
+		for(done = 0; done < frames; done += BENCH_PERIOD) {
+			equal_fixed_run(fx, src, format, dst, format, BENCH_PERIOD,
+					NULL, NULL);
+		}
+		ns = bench_now() - start;
+		printf("%-10s %8.2f ns per frame, %7.0fx real time\n", name,
+				(double)ns/frames, seconds*1e9/ns);
+	}
+}
+
+static void bench_usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-c channels] [-b bands] [-r rate] "
+			"[-f s16|s32] [-m multirate split in Hz] "
+			"[-s seconds of audio]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int channels = 2, bands = 10, b, low;
+	unsigned long rate = 48000, frames, done, k;
+	int format = EQUAL_FIXED_S16, opt;
+	double seconds = 60;
+	float split = 0;
+	float freq[EQUAL_FIXED_MAX_BANDS];
+	float gain[EQUAL_FIXED_MAX_BANDS*EQUAL_FIXED_MAX_CHANNELS];
+	equal_fixed_t *fx;
+	bench_float_t *fl;
+	void *src, *dst;
+	size_t sample;
+	uint64_t start, ns;
+
+	while((opt = getopt(argc, argv, "c:b:r:f:m:s:h")) != -1) {
+		switch(opt) {
+		case 'c':
+			channels = atoi(optarg);
+			break;
+		case 'b':
+			bands = atoi(optarg);
+			break;
+		case 'r':
+			rate = atol(optarg);
+			break;
+		case 'f':
+			format = strcmp(optarg, "s32") == 0 ? EQUAL_FIXED_S32 :
+					EQUAL_FIXED_S16;
+			break;
+		case 'm':
+			split = atof(optarg);
+			break;
+		case 's':
+			seconds = atof(optarg);
+			break;
+		default:
+			bench_usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if(channels < 1 || channels > EQUAL_FIXED_MAX_CHANNELS || bands < 1 ||
+			bands > EQUAL_FIXED_MAX_BANDS || rate < 8000 || split < 0 ||
+			seconds <= 0) {
+		bench_usage(argv[0]);
+		return 1;
+	}
+
+	/* Octaves up from 31.25 Hz, the spread of a typical graphic eq */
+	for(b = 0; b < bands; b++) {
+		freq[b] = 31.25f*powf(2, b*10.0f/bands);
+	}
+	for(k = 0; k < bands*channels; k++) {
+		gain[k] = rand() % 25 - 12;
+	}
+	fx = equal_fixed_create(channels, bands, freq);
+	fl = malloc(sizeof(*fl));
+	sample = format == EQUAL_FIXED_S16 ? sizeof(int16_t) : sizeof(int32_t);
+	src = malloc(BENCH_PERIOD*channels*sample);
+	dst = malloc(BENCH_PERIOD*channels*sample);
+	if(fx == NULL || fl == NULL || src == NULL || dst == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	for(k = 0; k < BENCH_PERIOD*channels*sample; k++) {
+		((unsigned char *)src)[k] = rand();
+	}
+	frames = seconds*rate;
+	equal_fixed_reset(fx, rate);
+	equal_fixed_set(fx, gain);
+	bench_float_init(fl, fx);
+
+	printf("%u channels, %u bands, %lu Hz, %s, %.0f s of audio\n", channels,
+			bands, rate, format == EQUAL_FIXED_S16 ? "S16" : "S32", seconds);
+	start = bench_now();
+	for(done = 0; done < frames; done += BENCH_PERIOD) {
+		bench_float_run(fl, src, dst, format, BENCH_PERIOD);
+	}
+	ns = bench_now() - start;
+	printf("%-10s %8.2f ns per frame, %7.0fx real time\n", "float",
+			(double)ns/frames, seconds*1e9/ns);
+	bench_fixed(fx, rate, format, src, dst, seconds, "");
+
+	if(split > 0) {
+		low = equal_fixed_set_multirate(fx, split);
+		equal_fixed_reset(fx, rate);
+		if(fx->stages == 0) {
+			printf("multirate %g Hz: no stages at %lu Hz\n", split, rate);
+		} else {
+			printf("multirate %g Hz: %u bands in %u stages, %u frames "
+					"latency\n", split, low, fx->stages, fx->latency);
+			bench_fixed(fx, rate, format, src, dst, seconds, "/mr");
+		}
+	}
+
+	equal_fixed_destroy(fx);
+	free(fl);
+	free(src);
+	free(dst);
+	return 0;
+}
@@ -0,0 +1,396 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "core.h"
+#include "probes.h"
+
+EQUAL_PROBE_SEMAPHORE(control_update);
+EQUAL_PROBE_SEMAPHORE(plugin_run);
+
+void equal_core_interleave(const float *src, float *dst, unsigned long n,
+		unsigned int m, unsigned long stride, float *peak, float *sum)
+{
+	unsigned long i;
+	unsigned int j;
+	float x, p, s;
+	for(j = 0; j < m; j++){
+		p = 0;
+		s = 0;
+		for(i = 0; i < n; i++){
+			x = src[i + stride*j];
+			dst[i*m + j] = x;
+			p = fmaxf(p, fabsf(x));
+			s += x*x;
+		}
+		peak[j] = p;
+		sum[j] = s;
+	}
+}
+
+void equal_core_deinterleave(const float *src, float *dst, unsigned long n,
+		unsigned int m, unsigned long stride, float *peak, float *sum)
+{
+	unsigned long i;
+	unsigned int j;
+	float x, p, s;
+	for(j = 0; j < m; j++){
+		p = 0;
+		s = 0;
+		for(i = 0; i < n; i++){
+			x = src[i*m + j];
+			dst[i + stride*j] = x;
+			p = fmaxf(p, fabsf(x));
+			s += x*x;
+		}
+		peak[j] = p;
+		sum[j] = s;
+	}
+}
+
+void equal_core_publish_meters(LADSPA_Data *peak_dst, LADSPA_Data *rms_dst,
+		const float *peak, const float *sum, unsigned int channels,
+		unsigned long frames)
+{
+	unsigned int j;
+	for(j = 0; j < channels; j++) {
+		peak_dst[j] = peak[j];
+		rms_dst[j] = sqrtf(sum[j]/frames);
+	}
+}
+
+/* The crossover frequencies are covered by the same seqlock */
+int equal_core_snapshot(equal_core_controls_t *core, LADSPA_Data *values,
+		uint32_t *seq, LADSPA_Data *freq)
+{
+	LADSPA_Control *control_data = core->control_data;
+
+	if(!LADSPAcontrolSnapshot(control_data, values, seq)) {
+		return 0;
+	}
+	if(freq == NULL) {
+		return 1;
+	}
+	memcpy(freq, control_data->crossover_freq,
+			sizeof(control_data->crossover_freq));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&control_data->seq, __ATOMIC_RELAXED) == *seq;
+}
+
+void equal_core_start(equal_core_controls_t *core, unsigned long rate,
+		LADSPA_Data *freq)
+{
+	long long since = 0;
+	uint32_t *output_seq, seq;
+
+	while(!equal_core_snapshot(core, core->values, &core->seq, freq)) {
+		if(LADSPAcontrolReadBusy(core->control_data, &since)) {
+			/* Take the controls over from a writer that died */
+			LADSPAcontrolWriteLock(core->control_data);
+			LADSPAcontrolWriteUnlock(core->control_data);
+		}
+	}
+
+	/* Frame positions start over, events queued before now are history */
+	core->frame_pos = 0;
+	core->num_pending = 0;
+	core->event_tail = __atomic_load_n(&core->control_data->event_head,
+			__ATOMIC_ACQUIRE);
+	core->control_data->frame_rate = rate;
+	__atomic_store_n(&core->control_data->frame_pos, 0, __ATOMIC_RELAXED);
+
+	/* A stream that died publishing the outputs left them odd */
+	output_seq = &core->control_data->output_seq;
+	seq = __atomic_load_n(output_seq, __ATOMIC_RELAXED);
+	if(seq & 1) {
+		__atomic_compare_exchange_n(output_seq, &seq, seq + 1, 0,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED);
+	}
+}
+
+static void equal_core_apply_event(equal_core_controls_t *core,
+		const LADSPA_Control_Event *event)
+{
+	unsigned int channels = core->control_data->channels;
+	unsigned int j;
+
+	for(j = 0; j < channels; j++) {
+		if(event->channel < 0 || j == event->channel) {
+			core->values[event->control*channels + j] = event->value;
+		}
+	}
+}
+
+uint64_t equal_core_apply_events(equal_core_controls_t *core, uint64_t frame)
+{
+	uint64_t next = UINT64_MAX;
+	unsigned int i, n = 0;
+
+	for(i = 0; i < core->num_pending; i++) {
+		if(core->pending[i].frame <= frame) {
+			equal_core_apply_event(core, &core->pending[i]);
+			continue;
+		}
+		if(core->pending[i].frame < next) {
+			next = core->pending[i].frame;
+		}
+		core->pending[n++] = core->pending[i];
+	}
+	core->num_pending = n;
+	return next;
+}
+
+/* The last change queued for a channel of a control that is still
+   pending, NULL if there is none. pending is kept in queue order. */
+static const LADSPA_Control_Event *equal_core_event_last(
+		equal_core_controls_t *core, int control, int channel)
+{
+	unsigned int i;
+	for(i = core->num_pending; i-- > 0;) {
+		if(core->pending[i].control == control &&
+				(core->pending[i].channel < 0 ||
+				core->pending[i].channel == channel)) {
+			return &core->pending[i];
+		}
+	}
+	return NULL;
+}
+
+/* Copy the events queued since the last fetch into incoming. Like the
+   snapshot the copy is only good if the seq didn't move meanwhile.
+   Returns the number copied, *head is where the next fetch starts. */
+static unsigned int equal_core_fetch_events(equal_core_controls_t *core,
+		uint32_t *head)
+{
+	LADSPA_Control *control_data = core->control_data;
+	uint32_t tail = core->event_tail;
+	unsigned int n = 0;
+
+	*head = __atomic_load_n(&control_data->event_head, __ATOMIC_ACQUIRE);
+	if(*head - tail > LADSPA_CNTRL_MAX_EVENTS) {
+		/* Lapped, the values of the lost events come with the snapshot */
+		tail = *head - LADSPA_CNTRL_MAX_EVENTS;
+	}
+	for(; tail != *head; tail++) {
+		core->incoming[n++] = control_data->event[tail %
+				LADSPA_CNTRL_MAX_EVENTS];
+	}
+	return n;
+}
+
+/* Move fetched events to the pending list */
+static void equal_core_queue_events(equal_core_controls_t *core,
+		unsigned int n)
+{
+	LADSPA_Control *control_data = core->control_data;
+	LADSPA_Control_Event *event;
+	unsigned int i;
+
+	for(i = 0; i < n; i++) {
+		event = &core->incoming[i];
+		if(event->control < 0 ||
+				event->control >= control_data->num_controls ||
+				control_data->control[event->control].type !=
+				LADSPA_CNTRL_INPUT ||
+				event->channel >= (int)control_data->channels) {
+			continue;
+		}
+		if(core->num_pending == LADSPA_CNTRL_MAX_EVENTS) {
+			/* No room, the oldest takes effect early */
+			equal_core_apply_event(core, &core->pending[0]);
+			memmove(&core->pending[0], &core->pending[1],
+					--core->num_pending*sizeof(LADSPA_Control_Event));
+		}
+		core->pending[core->num_pending++] = *event;
+	}
+}
+
+int equal_core_sync(equal_core_controls_t *core, LADSPA_Data *freq)
+{
+	LADSPA_Control *control_data = core->control_data;
+	const LADSPA_Control_Event *event;
+	unsigned int channels = control_data->channels;
+	uint32_t seq, head;
+	unsigned int events = 0;
+	int i, j, ok = 0;
+
+	seq = __atomic_load_n(&control_data->seq, __ATOMIC_RELAXED);
+	if(seq != core->seq) {
+		ok = equal_core_snapshot(core, core->staging, &seq, freq);
+		if(ok) {
+			/* Events are queued under the same lock as the values they
+			   set, so the two must come from the same write */
+			events = equal_core_fetch_events(core, &head);
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			ok = __atomic_load_n(&control_data->seq, __ATOMIC_RELAXED) == seq;
+		}
+		/* ok == 0 means a writer kept the controls busy and the change
+		   is picked up on a later block */
+		EQUAL_PROBE2(control_update, seq, ok);
+		if(ok) {
+			equal_core_queue_events(core, events);
+			core->event_tail = head;
+			/* A change queued sets the shared value too, so a control
+			   with changes pending whose value isn't that of the last
+			   one was written since and takes the write now, like a
+			   change at the current frame. The pending ones still fire
+			   at their frames. */
+			for(i = 0; i < control_data->num_controls; i++) {
+				if(control_data->control[i].type != LADSPA_CNTRL_INPUT) {
+					continue;
+				}
+				for(j = 0; j < channels; j++) {
+					event = equal_core_event_last(core, i, j);
+					if(event == NULL ||
+							event->value != core->staging[i*channels + j]) {
+						core->values[i*channels + j] =
+								core->staging[i*channels + j];
+					}
+				}
+			}
+			core->seq = seq;
+		}
+	}
+
+	if(!LADSPAcontrolOutputBegin(control_data)) {
+		return ok;
+	}
+	for(i = 0; i < control_data->num_controls; i++) {
+		if(control_data->control[i].type == LADSPA_CNTRL_OUTPUT) {
+			for(j = 0; j < channels; j++) {
+				control_data->control[i].data[j] =
+						core->values[i*channels + j];
+			}
+		}
+	}
+	LADSPAcontrolOutputEnd(control_data);
+	return ok;
+}
+
+void equal_core_advance(equal_core_controls_t *core, unsigned long frames)
+{
+	core->frame_pos += frames;
+	__atomic_store_n(&core->control_data->frame_pos, core->frame_pos,
+			__ATOMIC_RELAXED);
+}
+
+uint64_t equal_core_apply_all(equal_core_controls_t *const *cores,
+		unsigned int num, uint64_t frame)
+{
+	uint64_t next = UINT64_MAX, core_next;
+	unsigned int c;
+
+	for(c = 0; c < num; c++) {
+		core_next = equal_core_apply_events(cores[c], frame);
+		if(core_next < next) {
+			next = core_next;
+		}
+	}
+	return next;
+}
+
+void equal_core_split(equal_core_controls_t *const *cores, unsigned int num,
+		unsigned long frames, unsigned long max, equal_core_piece_t piece,
+		void *arg)
+{
+	uint64_t pos = cores[0]->frame_pos, next;
+	unsigned long done, n;
+
+	next = equal_core_apply_all(cores, num, pos);
+	for(done = 0; done < frames; done += n) {
+		n = frames - done;
+		if(next < pos + frames) {
+			n = next - (pos + done);
+		}
+		if(max != 0 && n > max) {
+			n = max;
+		}
+		piece(arg, done, n);
+		next = equal_core_apply_all(cores, num, pos + done + n);
+	}
+}
+
+int equal_core_instantiate(const LADSPA_Descriptor *klass,
+		LADSPA_Handle *handle, unsigned int channels, unsigned long rate)
+{
+	unsigned int j;
+
+	for(j = 0; j < channels; j++) {
+		handle[j] = klass->instantiate(klass, rate);
+		if(handle[j] == NULL) {
+			equal_core_release(klass, handle, channels);
+			return -ENOMEM;
+		}
+		if(klass->activate) {
+			klass->activate(handle[j]);
+		}
+	}
+	return 0;
+}
+
+void equal_core_release(const LADSPA_Descriptor *klass,
+		LADSPA_Handle *handle, unsigned int channels)
+{
+	unsigned int j;
+
+	for(j = 0; j < channels; j++) {
+		if(handle[j] == NULL) {
+			continue;
+		}
+		if(klass->deactivate) {
+			klass->deactivate(handle[j]);
+		}
+		if(klass->cleanup) {
+			klass->cleanup(handle[j]);
+		}
+		handle[j] = NULL;
+	}
+}
+
+void equal_core_connect_controls(const LADSPA_Descriptor *klass,
+		LADSPA_Handle *handle, const LADSPA_Control *control_data,
+		LADSPA_Data *values)
+{
+	int i, j;
+
+	for(j = 0; j < control_data->channels; j++) {
+		for(i = 0; i < control_data->num_controls; i++) {
+			klass->connect_port(handle[j], control_data->control[i].index,
+					&values[i*control_data->channels + j]);
+		}
+	}
+}
+
+void equal_core_run(const LADSPA_Descriptor *klass, LADSPA_Handle handle,
+		const LADSPA_Control *control_data, unsigned int channel,
+		float *in, float *out, unsigned long frames)
+{
+	uint64_t start = 0;
+
+	klass->connect_port(handle, control_data->input_index, in);
+	klass->connect_port(handle, control_data->output_index, out);
+	if(EQUAL_PROBE_ENABLED(plugin_run)) {
+		start = equal_probe_now();
+	}
+	klass->run(handle, frames);
+	EQUAL_PROBE3(plugin_run, channel, frames, equal_probe_now() - start);
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#ifndef EQUAL_CORE_H
+#define EQUAL_CORE_H
+
+#include <stdint.h>
+
+#include "ladspa.h"
+#include "ladspa_utils.h"
+
+/* The pieces of the audio path that don't depend on ALSA and are shared
+   by the PCM and libalsaequal-core: the (de)interleave passes, the
+   controls as the audio thread sees them, the plugin instances and a run
+   split at scheduled changes. Everything else the PCM does per period,
+   dspd, zones, fades, the watchdog, branches and the integer engine
+   among it, is its own and stays in pcm_equal.c. */
+
+/* The (de)interleave passes also measure the peak and the sum of squares
+   of each channel, so metering costs no extra trip through memory. n
+   frames of m channels, planar channels are stride frames apart. */
+void equal_core_interleave(const float *src, float *dst, unsigned long n,
+		unsigned int m, unsigned long stride, float *peak, float *sum);
+void equal_core_deinterleave(const float *src, float *dst, unsigned long n,
+		unsigned int m, unsigned long stride, float *peak, float *sum);
+
+/* Publish the levels of the last block of frames to the shared controls */
+void equal_core_publish_meters(LADSPA_Data *peak_dst, LADSPA_Data *rms_dst,
+		const float *peak, const float *sum, unsigned int channels,
+		unsigned long frames);
+
+/* The shared controls as the audio thread sees them. The plugins are
+   connected to values, a private copy that only changes between blocks
+   or at the frame of a timestamped change. values and staging hold
+   num_controls*channels values each and are provided by the caller. */
+typedef struct equal_core_controls {
+	LADSPA_Control *control_data;
+	LADSPA_Data *values;
+	LADSPA_Data *staging;
+	uint32_t seq;
+	/* Timestamped control changes waiting for their frame */
+	uint64_t frame_pos;
+	uint32_t event_tail;
+	unsigned int num_pending;
+	LADSPA_Control_Event pending[LADSPA_CNTRL_MAX_EVENTS];
+	LADSPA_Control_Event incoming[LADSPA_CNTRL_MAX_EVENTS];
+} equal_core_controls_t;
+
+/* Snapshot the control values into values, and the crossover frequencies
+   into freq unless it is NULL. Returns 0 if a writer got in the way. */
+int equal_core_snapshot(equal_core_controls_t *core, LADSPA_Data *values,
+		uint32_t *seq, LADSPA_Data *freq);
+
+/* Start the stream over at frame 0 and rate with the controls as they
+   are now, dropping any timestamped change queued before. */
+void equal_core_start(equal_core_controls_t *core, unsigned long rate,
+		LADSPA_Data *freq);
+
+/* Pick up a new set of control values if a writer changed them, and
+   publish the values of the plugin's output controls without waiting
+   for anyone, see LADSPAcontrolOutputBegin(). Controls with a
+   timestamped change pending keep their value until its frame unless
+   they were written again since, which takes effect at once. Returns
+   1 if a new set was taken, with the crossover frequencies in freq. */
+int equal_core_sync(equal_core_controls_t *core, LADSPA_Data *freq);
+
+/* Apply the pending changes due by frame. Returns the frame of the next
+   pending change, UINT64_MAX if there is none. */
+uint64_t equal_core_apply_events(equal_core_controls_t *core, uint64_t frame);
+
+/* Move the stream position on by frames and publish it */
+void equal_core_advance(equal_core_controls_t *core, unsigned long frames);
+
+/* Apply the pending changes of each of num cores due by frame. Returns
+   the earliest frame of a change still pending, UINT64_MAX if none. */
+uint64_t equal_core_apply_all(equal_core_controls_t *const *cores,
+		unsigned int num, uint64_t frame);
+
+/* Called for each piece of a split run: frames starting offset frames
+   into the run */
+typedef void (*equal_core_piece_t)(void *arg, unsigned long offset,
+		unsigned long frames);
+
+/* Run frames from the stream position of cores[0] in pieces, split
+   wherever a timestamped change of any of num cores falls and at most
+   max frames long (0 for no limit). The changes due are applied before
+   each piece. The stream position is left for the caller to advance. */
+void equal_core_split(equal_core_controls_t *const *cores, unsigned int num,
+		unsigned long frames, unsigned long max, equal_core_piece_t piece,
+		void *arg);
+
+/* Make and activate an instance of klass at rate for each of channels.
+   Returns 0, or -ENOMEM with all of them released. */
+int equal_core_instantiate(const LADSPA_Descriptor *klass,
+		LADSPA_Handle *handle, unsigned int channels, unsigned long rate);
+
+/* Deactivate and clean up the instances in handle, setting them NULL.
+   NULL entries are skipped. */
+void equal_core_release(const LADSPA_Descriptor *klass,
+		LADSPA_Handle *handle, unsigned int channels);
+
+/* Connect the control ports of the instances in handle to values, laid
+   out like equal_core_controls_t.values */
+void equal_core_connect_controls(const LADSPA_Descriptor *klass,
+		LADSPA_Handle *handle, const LADSPA_Control *control_data,
+		LADSPA_Data *values);
+
+/* Run the instance of channel over frames of in into out */
+void equal_core_run(const LADSPA_Descriptor *klass, LADSPA_Handle handle,
+		const LADSPA_Control *control_data, unsigned int channel,
+		float *in, float *out, unsigned long frames);
+
+#endif
@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "crossover.h"
+
+enum {
+	XO_PASS,
+	XO_LOWPASS,
+	XO_HIGHPASS,
+	XO_ALLPASS
+};
+
+/* Lowest crossover frequency accepted, the highest is just below Nyquist */
+#define XO_MIN_FREQ 10.0f
+
+equal_crossover_t *equal_crossover_create(unsigned int channels,
+		unsigned int bands)
+{
+	equal_crossover_t *xo;
+	void *state;
+
+	if(bands < 2 || bands > EQUAL_CROSSOVER_MAX_BANDS) {
+		return NULL;
+	}
+	xo = calloc(1, sizeof(*xo));
+	if(xo == NULL) {
+		return NULL;
+	}
+	xo->channels = channels;
+	xo->bands = bands;
+	xo->stages = 2*(bands - 1);
+	if(posix_memalign(&state, sizeof(equal_v4sf),
+			channels*2*xo->stages*sizeof(equal_v4sf)) != 0) {
+		free(xo);
+		return NULL;
+	}
+	xo->state = state;
+	memset(xo->state, 0, channels*2*xo->stages*sizeof(equal_v4sf));
+	xo->rate = 48000;
+	equal_crossover_set(xo, NULL);
+	return xo;
+}
+
+void equal_crossover_destroy(equal_crossover_t *xo)
+{
+	if(xo == NULL) {
+		return;
+	}
+	free(xo->state);
+	free(xo);
+}
+
+void equal_crossover_defaults(unsigned int bands, float *freq)
+{
+	static const float defaults[EQUAL_CROSSOVER_MAX_BANDS - 1]
+			[EQUAL_CROSSOVER_MAX_BANDS - 1] = {
+		{ 2000 },
+		{ 250, 2500 },
+		{ 120, 1200, 6000 },
+	};
+	memcpy(freq, defaults[bands - 2], (bands - 1)*sizeof(float));
+}
+
+void equal_crossover_reset(equal_crossover_t *xo, unsigned long rate)
+{
+	memset(xo->state, 0, xo->channels*2*xo->stages*sizeof(equal_v4sf));
+	xo->rate = rate;
+	equal_crossover_set(xo, xo->freq);
+}
+
+/* Butterworth (Q = 1/sqrt(2)) biquad, two in series make an LR4 section.
+   The allpass is what an LR4 low-pass/high-pass pair sums to. */
+static void xo_biquad(int type, float freq, unsigned long rate, float *c)
+{
+	float w0, cosw, alpha, a0;
+
+	if(type == XO_PASS) {
+		c[0] = 1;
+		c[1] = c[2] = c[3] = c[4] = 0;
+		return;
+	}
+	w0 = 2*M_PI*freq/rate;
+	cosw = cosf(w0);
+	alpha = sinf(w0)/(2*M_SQRT1_2);
+	a0 = 1 + alpha;
+	switch(type) {
+	case XO_LOWPASS:
+		c[0] = (1 - cosw)/2;
+		c[1] = 1 - cosw;
+		c[2] = (1 - cosw)/2;
+		break;
+	case XO_HIGHPASS:
+		c[0] = (1 + cosw)/2;
+		c[1] = -(1 + cosw);
+		c[2] = (1 + cosw)/2;
+		break;
+	default:
+		c[0] = 1 - alpha;
+		c[1] = -2*cosw;
+		c[2] = 1 + alpha;
+		break;
+	}
+	c[3] = -2*cosw;
+	c[4] = 1 - alpha;
+	c[0] /= a0;
+	c[1] /= a0;
+	c[2] /= a0;
+	c[3] /= a0;
+	c[4] /= a0;
+}
+
+static void xo_set_stage(equal_crossover_t *xo, unsigned int band,
+		unsigned int stage, int type, float freq)
+{
+	float c[5];
+
+	xo_biquad(type, freq, xo->rate, c);
+	xo->b0[stage][band] = c[0];
+	xo->b1[stage][band] = c[1];
+	xo->b2[stage][band] = c[2];
+	xo->a1[stage][band] = c[3];
+	xo->a2[stage][band] = c[4];
+}
+
+void equal_crossover_set(equal_crossover_t *xo, const float *freq)
+{
+	float f[EQUAL_CROSSOVER_MAX_BANDS - 1], t, max;
+	unsigned int b, k, s, n = xo->bands - 1;
+
+	if(freq == NULL) {
+		equal_crossover_defaults(xo->bands, f);
+	} else {
+		memcpy(f, freq, n*sizeof(float));
+	}
+	if(xo->coef_rate == xo->rate &&
+			memcmp(f, xo->freq, n*sizeof(float)) == 0) {
+		return;
+	}
+	memcpy(xo->freq, f, n*sizeof(float));
+	xo->coef_rate = xo->rate;
+
+	/* Sort and keep clear of DC and Nyquist */
+	max = 0.45f*xo->rate;
+	for(k = 0; k < n; k++) {
+		if(!(f[k] >= XO_MIN_FREQ)) {
+			f[k] = XO_MIN_FREQ;
+		}
+		if(f[k] > max) {
+			f[k] = max;
+		}
+	}
+	for(k = 1; k < n; k++) {
+		for(b = k; b > 0 && f[b - 1] > f[b]; b--) {
+			t = f[b];
+			f[b] = f[b - 1];
+			f[b - 1] = t;
+		}
+	}
+
+	for(b = 0; b < EQUAL_CROSSOVER_MAX_BANDS; b++) {
+		s = 0;
+		if(b < xo->bands) {
+			/* High-passes of the crossovers below */
+			for(k = 0; k < b; k++) {
+				xo_set_stage(xo, b, s++, XO_HIGHPASS, f[k]);
+				xo_set_stage(xo, b, s++, XO_HIGHPASS, f[k]);
+			}
+			/* Low-pass of the crossover above */
+			if(b < n) {
+				xo_set_stage(xo, b, s++, XO_LOWPASS, f[b]);
+				xo_set_stage(xo, b, s++, XO_LOWPASS, f[b]);
+			}
+			/* Phase match the crossovers further up */
+			for(k = b + 1; k < n; k++) {
+				xo_set_stage(xo, b, s++, XO_ALLPASS, f[k]);
+			}
+		}
+		for(; s < xo->stages; s++) {
+			xo_set_stage(xo, b, s, XO_PASS, 0);
+		}
+	}
+}
+
+void equal_crossover_run(equal_crossover_t *xo, const float *src,
+		float *dst, unsigned long frames, float *peak, float *sum)
+{
+	const unsigned int channels = xo->channels;
+	const unsigned int stages = xo->stages;
+	const unsigned int out_channels = channels*xo->bands;
+	equal_v4sf *z1, *z2, v, y;
+	const float *in;
+	float *out, x, p, q;
+	unsigned long i;
+	unsigned int j, k, b;
+
+	for(j = 0; j < channels; j++) {
+		z1 = xo->state + 2*j*stages;
+		z2 = z1 + stages;
+		in = src + j*frames;
+		out = dst + j;
+		p = 0;
+		q = 0;
+		for(i = 0; i < frames; i++) {
+			x = in[i];
+			p = fmaxf(p, fabsf(x));
+			q += x*x;
+			/* Transposed direct form II, every lane at once */
+			v = (equal_v4sf){ x, x, x, x };
+			for(k = 0; k < stages; k++) {
+				y = xo->b0[k]*v + z1[k];
+				z1[k] = xo->b1[k]*v - xo->a1[k]*y + z2[k];
+				z2[k] = xo->b2[k]*v - xo->a2[k]*y;
+				v = y;
+			}
+			for(b = 0; b < xo->bands; b++) {
+				out[b*channels] = v[b];
+			}
+			out += out_channels;
+		}
+		peak[j] = p;
+		sum[j] = q;
+	}
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#ifndef EQUAL_CROSSOVER_H
+#define EQUAL_CROSSOVER_H
+
+/* Linkwitz-Riley (LR4) crossover splitting every channel into 2-4 bands.
+
+   Band b is a chain of biquads: the LR4 high-passes of the crossovers
+   below it, the LR4 low-pass of the crossover above it, and for every
+   crossover further up the allpass an LR4 pair sums to, so all bands
+   stay in phase and add up flat. The chains of all bands run side by
+   side in the lanes of one 4-wide vector, shorter chains padded with
+   pass-through stages, so a frame costs at most 6 vector biquads. */
+
+#define EQUAL_CROSSOVER_MAX_BANDS 4
+#define EQUAL_CROSSOVER_MAX_STAGES (2*(EQUAL_CROSSOVER_MAX_BANDS - 1))
+
+typedef float equal_v4sf __attribute__((vector_size(16)));
+
+typedef struct equal_crossover {
+	unsigned int channels;
+	unsigned int bands;
+	unsigned int stages;
+	unsigned long rate;
+	float freq[EQUAL_CROSSOVER_MAX_BANDS - 1];	/* As requested */
+	unsigned long coef_rate;	/* Rate the coefficients are for */
+	/* Per stage coefficients, one lane per band */
+	equal_v4sf b0[EQUAL_CROSSOVER_MAX_STAGES];
+	equal_v4sf b1[EQUAL_CROSSOVER_MAX_STAGES];
+	equal_v4sf b2[EQUAL_CROSSOVER_MAX_STAGES];
+	equal_v4sf a1[EQUAL_CROSSOVER_MAX_STAGES];
+	equal_v4sf a2[EQUAL_CROSSOVER_MAX_STAGES];
+	/* Filter state, [channels][2][stages] */
+	equal_v4sf *state;
+} equal_crossover_t;
+
+equal_crossover_t *equal_crossover_create(unsigned int channels,
+		unsigned int bands);
+void equal_crossover_destroy(equal_crossover_t *xo);
+
+/* Suggested crossover frequencies for a number of bands. */
+void equal_crossover_defaults(unsigned int bands, float *freq);
+
+/* Clear the filter state and set the sample rate. */
+void equal_crossover_reset(equal_crossover_t *xo, unsigned long rate);
+
+/* Set the bands-1 crossover frequencies, in Hz. Out of order or out of
+   range frequencies are sorted and clamped. */
+void equal_crossover_set(equal_crossover_t *xo, const float *freq);
+
+/* Split planar src (channels after each other) into interleaved dst with
+   channels*bands channels, band b of channel j going to channel
+   b*channels + j. Also measures the peak and sum of squares of each
+   input channel. */
+void equal_crossover_run(equal_crossover_t *xo, const float *src,
+		float *dst, unsigned long frames, float *peak, float *sum);
+
+#endif
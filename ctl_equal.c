@@ -18,6 +18,7 @@
  */
 
 #include <stdio.h>
+#include <math.h>
 #include <alsa/asoundlib.h>
 #include <alsa/control_external.h>
 
@@ -28,44 +29,159 @@ typedef struct snd_ctl_equal_control {
 	long min;
 	long max;
 	char *name;
+	int scaled;	/* Shown as 0-100, otherwise the value is rounded */
 } snd_ctl_equal_control_t;
 
+/* Elements that follow the per-port controls */
+enum {
+	EQUAL_ELEM_CURVE,
+	EQUAL_ELEM_INPUT_PEAK,
+	EQUAL_ELEM_INPUT_RMS,
+	EQUAL_ELEM_OUTPUT_PEAK,
+	EQUAL_ELEM_OUTPUT_RMS,
+	EQUAL_ELEM_MLOCK,
+	EQUAL_ELEM_TAP,
+	EQUAL_ELEM_CROSSOVER,
+	EQUAL_ELEM_POSITION,
+	EQUAL_ELEM_SCHEDULE,
+	EQUAL_ELEM_MODULE,
+	EQUAL_ELEM_WATCHDOG,
+	EQUAL_ELEM_LATENCY,
+	EQUAL_ELEM_CAPTURE,
+	EQUAL_NUM_ELEMS
+};
+
+/* Largest value a bytes element can carry */
+#define EQUAL_MAX_BYTES 512
+
+/* Meters read in hundredths of a dB relative to full scale */
+#define EQUAL_METER_MIN -9600
+#define EQUAL_METER_MAX 1200
+
+/* Range of the crossover frequencies, in Hz */
+#define EQUAL_CROSSOVER_MIN 10
+#define EQUAL_CROSSOVER_MAX 24000
+
 typedef struct snd_ctl_equal {
 	snd_ctl_ext_t ext;
-	void *library;
-	const LADSPA_Descriptor *klass;
 	int num_input_controls;
 	LADSPA_Control *control_data;
 	snd_ctl_equal_control_t *control_info;
+	/* Size of the whole-curve element, 0 if it doesn't fit */
+	unsigned int curve_bytes;
+	LADSPA_Data *snapshot;
+	/* Stream frame writes through this handle take effect at, 0 for
+	   straight away */
+	int64_t schedule;
+	/* Zone the elements are named after, "" for none */
+	char zone[32];
 } snd_ctl_equal_t;
 
+static const char *equal_elem_names[EQUAL_NUM_ELEMS] = {
+	[EQUAL_ELEM_CURVE] = "Curve Data",
+	[EQUAL_ELEM_INPUT_PEAK] = "Input Peak Meter",
+	[EQUAL_ELEM_INPUT_RMS] = "Input RMS Meter",
+	[EQUAL_ELEM_OUTPUT_PEAK] = "Output Peak Meter",
+	[EQUAL_ELEM_OUTPUT_RMS] = "Output RMS Meter",
+	[EQUAL_ELEM_MLOCK] = "Memory Lock Status",
+	[EQUAL_ELEM_TAP] = "Tap Switch",
+	[EQUAL_ELEM_CROSSOVER] = "Crossover Frequency",
+	[EQUAL_ELEM_POSITION] = "Stream Position",
+	[EQUAL_ELEM_SCHEDULE] = "Schedule Position",
+	[EQUAL_ELEM_MODULE] = "Module",
+	[EQUAL_ELEM_WATCHDOG] = "Watchdog Status",
+	[EQUAL_ELEM_LATENCY] = "Latency",
+	[EQUAL_ELEM_CAPTURE] = "Capture Switch",
+};
+
 static void equal_close(snd_ctl_ext_t *ext)
 {
 	snd_ctl_equal_t *equal = ext->private_data;
 	int i;
-	for (i = 0; i < equal->num_input_controls; i++) {
+	for (i = 0; i < equal->control_data->num_controls; i++) {
 		free(equal->control_info[i].name);
 	}
 	free(equal->control_info);
+	free(equal->snapshot);
 	LADSPAcontrolUnMMAP(equal->control_data);
-	LADSPAunload(equal->library);
 	free(equal);
 }
 
+/* Number of crossover frequencies, set up by a crossover PCM */
+static unsigned int equal_crossovers(snd_ctl_equal_t *equal)
+{
+	uint32_t bands = equal->control_data->crossover_bands;
+	if(bands < 2 || bands > LADSPA_CNTRL_MAX_CROSSOVERS + 1) {
+		return 0;
+	}
+	return bands - 1;
+}
+
+/* Number of modules a PCM on these controls can switch between */
+static unsigned int equal_modules(snd_ctl_equal_t *equal)
+{
+	uint32_t modules = equal->control_data->num_modules;
+	if(modules < 2 || modules > LADSPA_CNTRL_MAX_MODULES) {
+		return 0;
+	}
+	return modules;
+}
+
+static int equal_elem_present(snd_ctl_equal_t *equal, int elem)
+{
+	if(elem == EQUAL_ELEM_CURVE) {
+		return equal->curve_bytes != 0;
+	}
+	if(elem == EQUAL_ELEM_CROSSOVER) {
+		return equal_crossovers(equal) > 0;
+	}
+	if(elem == EQUAL_ELEM_MODULE) {
+		return equal_modules(equal) > 0;
+	}
+	if(elem == EQUAL_ELEM_WATCHDOG) {
+		return equal->control_data->watchdog_levels > 0;
+	}
+	return 1;
+}
+
 static int equal_elem_count(snd_ctl_ext_t *ext)
 {
 	snd_ctl_equal_t *equal = ext->private_data;
-	return equal->num_input_controls;
+	int count = equal->control_data->num_controls;
+	int elem;
+	for(elem = 0; elem < EQUAL_NUM_ELEMS; elem++) {
+		if(equal_elem_present(equal, elem)) {
+			count++;
+		}
+	}
+	return count;
 }
 
 static int equal_elem_list(snd_ctl_ext_t *ext, unsigned int offset,
 		snd_ctl_elem_id_t *id)
 {
 	snd_ctl_equal_t *equal = ext->private_data;
+	char name[64];
+	int elem;
 	snd_ctl_elem_id_set_interface(id, SND_CTL_ELEM_IFACE_MIXER);
-	snd_ctl_elem_id_set_name(id, equal->control_info[offset].name);
-	snd_ctl_elem_id_set_device(id, offset);
-	return 0;
+	if(offset < equal->control_data->num_controls) {
+		snd_ctl_elem_id_set_name(id, equal->control_info[offset].name);
+		snd_ctl_elem_id_set_device(id, offset);
+		return 0;
+	}
+	offset -= equal->control_data->num_controls;
+	for(elem = 0; elem < EQUAL_NUM_ELEMS; elem++) {
+		if(!equal_elem_present(equal, elem)) {
+			continue;
+		}
+		if(offset-- == 0) {
+			snprintf(name, sizeof(name), "%s%s", equal->zone,
+					equal_elem_names[elem]);
+			snd_ctl_elem_id_set_name(id, name);
+			return 0;
+		}
+	}
+	return -EINVAL;
 }
 
 static snd_ctl_ext_key_t equal_find_elem(snd_ctl_ext_t *ext,
@@ -74,15 +190,26 @@ static snd_ctl_ext_key_t equal_find_elem(snd_ctl_ext_t *ext,
 	snd_ctl_equal_t *equal = ext->private_data;
 	const char *name;
 	unsigned int i, key;
+	int elem;
 
 	name = snd_ctl_elem_id_get_name(id);
 
-	for (i = 0; i < equal->num_input_controls; i++) {
+	for (i = 0; i < equal->control_data->num_controls; i++) {
 		key = i;
 		if (!strcmp(name, equal->control_info[key].name)) {
 			return key;
 		}
 	}
+	if(strncmp(name, equal->zone, strlen(equal->zone)) != 0) {
+		return SND_CTL_EXT_KEY_NOT_FOUND;
+	}
+	name += strlen(equal->zone);
+	for(elem = 0; elem < EQUAL_NUM_ELEMS; elem++) {
+		if(equal_elem_present(equal, elem) &&
+				!strcmp(name, equal_elem_names[elem])) {
+			return equal->control_data->num_controls + elem;
+		}
+	}
 
 	return SND_CTL_EXT_KEY_NOT_FOUND;
 }
@@ -91,18 +218,246 @@ static int equal_get_attribute(snd_ctl_ext_t *ext, snd_ctl_ext_key_t key,
 		int *type, unsigned int *acc, unsigned int *count)
 {
 	snd_ctl_equal_t *equal = ext->private_data;
-	*type = SND_CTL_ELEM_TYPE_INTEGER;
-	*acc = SND_CTL_EXT_ACCESS_READWRITE;
 	*count = equal->control_data->channels;
-	return 0;
+	if(key < equal->control_data->num_controls) {
+		*type = SND_CTL_ELEM_TYPE_INTEGER;
+		if(equal->control_data->control[key].type == LADSPA_CNTRL_INPUT) {
+			*acc = SND_CTL_EXT_ACCESS_READWRITE;
+		} else {
+			*acc = SND_CTL_EXT_ACCESS_READ | SND_CTL_EXT_ACCESS_VOLATILE;
+		}
+		return 0;
+	}
+	switch(key - equal->control_data->num_controls) {
+	case EQUAL_ELEM_CURVE:
+		*type = SND_CTL_ELEM_TYPE_BYTES;
+		*acc = SND_CTL_EXT_ACCESS_READWRITE;
+		*count = equal->curve_bytes;
+		return 0;
+	case EQUAL_ELEM_MLOCK:
+		/* Status and locked KiB */
+		*type = SND_CTL_ELEM_TYPE_INTEGER;
+		*acc = SND_CTL_EXT_ACCESS_READ | SND_CTL_EXT_ACCESS_VOLATILE;
+		*count = 2;
+		return 0;
+	case EQUAL_ELEM_TAP:
+	case EQUAL_ELEM_CAPTURE:
+		*type = SND_CTL_ELEM_TYPE_BOOLEAN;
+		*acc = SND_CTL_EXT_ACCESS_READWRITE;
+		*count = 1;
+		return 0;
+	case EQUAL_ELEM_CROSSOVER:
+		*type = SND_CTL_ELEM_TYPE_INTEGER;
+		*acc = SND_CTL_EXT_ACCESS_READWRITE;
+		*count = equal_crossovers(equal);
+		return 0;
+	case EQUAL_ELEM_POSITION:
+		*type = SND_CTL_ELEM_TYPE_INTEGER64;
+		*acc = SND_CTL_EXT_ACCESS_READ | SND_CTL_EXT_ACCESS_VOLATILE;
+		*count = 1;
+		return 0;
+	case EQUAL_ELEM_SCHEDULE:
+		*type = SND_CTL_ELEM_TYPE_INTEGER64;
+		*acc = SND_CTL_EXT_ACCESS_READWRITE;
+		*count = 1;
+		return 0;
+	case EQUAL_ELEM_MODULE:
+		*type = SND_CTL_ELEM_TYPE_ENUMERATED;
+		*acc = SND_CTL_EXT_ACCESS_READWRITE;
+		*count = 1;
+		return 0;
+	case EQUAL_ELEM_WATCHDOG:
+		/* Level, steps down, steps up and blocks over budget */
+		*type = SND_CTL_ELEM_TYPE_INTEGER;
+		*acc = SND_CTL_EXT_ACCESS_READ | SND_CTL_EXT_ACCESS_VOLATILE;
+		*count = 4;
+		return 0;
+	case EQUAL_ELEM_LATENCY:
+		/* Frames, for adding to what snd_pcm_delay() reports */
+		*type = SND_CTL_ELEM_TYPE_INTEGER;
+		*acc = SND_CTL_EXT_ACCESS_READ | SND_CTL_EXT_ACCESS_VOLATILE;
+		*count = 1;
+		return 0;
+	default:
+		*type = SND_CTL_ELEM_TYPE_INTEGER;
+		*acc = SND_CTL_EXT_ACCESS_READ | SND_CTL_EXT_ACCESS_VOLATILE;
+		return 0;
+	}
 }
 
 static int equal_get_integer_info(snd_ctl_ext_t *ext,
 	snd_ctl_ext_key_t key, long *imin, long *imax, long *istep)
 {
+	snd_ctl_equal_t *equal = ext->private_data;
 	*istep = 1;
+	if(key == equal->control_data->num_controls + EQUAL_ELEM_MLOCK ||
+			key == equal->control_data->num_controls +
+			EQUAL_ELEM_WATCHDOG) {
+		*imin = INT32_MIN;
+		*imax = INT32_MAX;
+	} else if(key == equal->control_data->num_controls +
+			EQUAL_ELEM_LATENCY) {
+		*imin = 0;
+		*imax = INT32_MAX;
+	} else if(key == equal->control_data->num_controls +
+			EQUAL_ELEM_CROSSOVER) {
+		*imin = EQUAL_CROSSOVER_MIN;
+		*imax = EQUAL_CROSSOVER_MAX;
+	} else if(key >= equal->control_data->num_controls) {
+		*imin = EQUAL_METER_MIN;
+		*imax = EQUAL_METER_MAX;
+	} else if(equal->control_info[key].scaled) {
+		*imin = 0;
+		*imax = 100;
+	} else {
+		*imin = INT32_MIN;
+		*imax = INT32_MAX;
+	}
+	return 0;
+}
+
+static int equal_get_integer64_info(snd_ctl_ext_t *ext ATTRIBUTE_UNUSED,
+	snd_ctl_ext_key_t key ATTRIBUTE_UNUSED, int64_t *imin, int64_t *imax,
+	int64_t *istep)
+{
 	*imin = 0;
-	*imax = 100;
+	*imax = INT64_MAX;
+	*istep = 1;
+	return 0;
+}
+
+static int equal_read_integer64(snd_ctl_ext_t *ext, snd_ctl_ext_key_t key,
+		int64_t *value)
+{
+	snd_ctl_equal_t *equal = ext->private_data;
+
+	switch(key - equal->control_data->num_controls) {
+	case EQUAL_ELEM_POSITION:
+		value[0] = __atomic_load_n(&equal->control_data->frame_pos,
+				__ATOMIC_RELAXED);
+		return 0;
+	case EQUAL_ELEM_SCHEDULE:
+		value[0] = equal->schedule;
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+static int equal_write_integer64(snd_ctl_ext_t *ext, snd_ctl_ext_key_t key,
+		int64_t *value)
+{
+	snd_ctl_equal_t *equal = ext->private_data;
+
+	if(key != equal->control_data->num_controls + EQUAL_ELEM_SCHEDULE) {
+		return -EPERM;
+	}
+	if(equal->schedule == value[0]) {
+		return 0;
+	}
+	equal->schedule = value[0] < 0 ? 0 : value[0];
+	return 1;
+}
+
+static int equal_get_enumerated_info(snd_ctl_ext_t *ext,
+		snd_ctl_ext_key_t key ATTRIBUTE_UNUSED, unsigned int *items)
+{
+	*items = equal_modules(ext->private_data);
+	return 0;
+}
+
+static int equal_get_enumerated_name(snd_ctl_ext_t *ext,
+		snd_ctl_ext_key_t key ATTRIBUTE_UNUSED, unsigned int item,
+		char *name, size_t name_max_len)
+{
+	snd_ctl_equal_t *equal = ext->private_data;
+
+	if(item >= equal_modules(equal)) {
+		return -EINVAL;
+	}
+	snprintf(name, name_max_len, "%.*s",
+			(int)sizeof(equal->control_data->module_names[item]),
+			equal->control_data->module_names[item]);
+	return 0;
+}
+
+static int equal_read_enumerated(snd_ctl_ext_t *ext,
+		snd_ctl_ext_key_t key ATTRIBUTE_UNUSED, unsigned int *items)
+{
+	snd_ctl_equal_t *equal = ext->private_data;
+	items[0] = __atomic_load_n(&equal->control_data->module_index,
+			__ATOMIC_RELAXED);
+	return 0;
+}
+
+/* The PCM notices the new selection on its next block and fades over */
+static int equal_write_enumerated(snd_ctl_ext_t *ext,
+		snd_ctl_ext_key_t key ATTRIBUTE_UNUSED, unsigned int *items)
+{
+	snd_ctl_equal_t *equal = ext->private_data;
+
+	if(items[0] >= equal_modules(equal)) {
+		return -EINVAL;
+	}
+	if(__atomic_exchange_n(&equal->control_data->module_index, items[0],
+			__ATOMIC_RELAXED) == items[0]) {
+		return 0;
+	}
+	return 1;
+}
+
+/* Set control index of channel j, at the scheduled frame if there is one */
+static void equal_set_control(snd_ctl_equal_t *equal, int index, int j,
+		LADSPA_Data setting)
+{
+	if(equal->schedule > 0) {
+		LADSPAcontrolQueueEvent(equal->control_data, index, j, setting,
+				equal->schedule);
+	} else {
+		equal->control_data->control[index].data[j] = setting;
+	}
+}
+
+static long equal_meter_value(LADSPA_Data level)
+{
+	long value;
+	if(level <= 0) {
+		return EQUAL_METER_MIN;
+	}
+	value = lrintf(2000*log10f(level));
+	if(value < EQUAL_METER_MIN) {
+		return EQUAL_METER_MIN;
+	}
+	if(value > EQUAL_METER_MAX) {
+		return EQUAL_METER_MAX;
+	}
+	return value;
+}
+
+static int equal_read_meter(snd_ctl_equal_t *equal, int elem, long *value)
+{
+	const LADSPA_Data *levels;
+	int i;
+
+	switch(elem) {
+	case EQUAL_ELEM_INPUT_PEAK:
+		levels = equal->control_data->peak_in;
+		break;
+	case EQUAL_ELEM_INPUT_RMS:
+		levels = equal->control_data->rms_in;
+		break;
+	case EQUAL_ELEM_OUTPUT_PEAK:
+		levels = equal->control_data->peak_out;
+		break;
+	case EQUAL_ELEM_OUTPUT_RMS:
+		levels = equal->control_data->rms_out;
+		break;
+	default:
+		return -EINVAL;
+	}
+	for(i = 0; i < equal->control_data->channels; i++) {
+		value[i] = equal_meter_value(levels[i]);
+	}
 	return 0;
 }
 
@@ -110,10 +465,65 @@ static int equal_read_integer(snd_ctl_ext_t *ext, snd_ctl_ext_key_t key,
 		long *value)
 {
 	snd_ctl_equal_t *equal = ext->private_data;
+	const LADSPA_Data *data;
+	LADSPA_Data output[16];
 	int i;
 
+	if(key == equal->control_data->num_controls + EQUAL_ELEM_MLOCK) {
+		value[0] = equal->control_data->mlock_status;
+		value[1] = equal->control_data->mlock_kbytes;
+		return 0;
+	}
+	if(key == equal->control_data->num_controls + EQUAL_ELEM_WATCHDOG) {
+		value[0] = __atomic_load_n(&equal->control_data->watchdog_level,
+				__ATOMIC_RELAXED);
+		value[1] = __atomic_load_n(&equal->control_data->watchdog_down,
+				__ATOMIC_RELAXED);
+		value[2] = __atomic_load_n(&equal->control_data->watchdog_up,
+				__ATOMIC_RELAXED);
+		value[3] = __atomic_load_n(&equal->control_data->watchdog_overruns,
+				__ATOMIC_RELAXED);
+		return 0;
+	}
+	if(key == equal->control_data->num_controls + EQUAL_ELEM_LATENCY) {
+		value[0] = __atomic_load_n(&equal->control_data->latency,
+				__ATOMIC_RELAXED);
+		return 0;
+	}
+	if(key == equal->control_data->num_controls + EQUAL_ELEM_TAP) {
+		value[0] = __atomic_load_n(&equal->control_data->tap_enable,
+				__ATOMIC_RELAXED);
+		return 0;
+	}
+	if(key == equal->control_data->num_controls + EQUAL_ELEM_CAPTURE) {
+		value[0] = __atomic_load_n(&equal->control_data->capture_enable,
+				__ATOMIC_RELAXED);
+		return 0;
+	}
+	if(key == equal->control_data->num_controls + EQUAL_ELEM_CROSSOVER) {
+		for(i = 0; i < equal_crossovers(equal); i++) {
+			value[i] = lrintf(equal->control_data->crossover_freq[i]);
+		}
+		return 0;
+	}
+	if(key >= equal->control_data->num_controls) {
+		return equal_read_meter(equal,
+				key - equal->control_data->num_controls, value);
+	}
+
+	data = equal->control_data->control[key].data;
+	if(equal->control_data->control[key].type == LADSPA_CNTRL_OUTPUT) {
+		/* Published by the PCM every block, all channels from the same
+		   one unless it kept them busy */
+		LADSPAcontrolReadOutput(equal->control_data, key, output);
+		data = output;
+	}
 	for(i = 0; i < equal->control_data->channels; i++) {
-		value[i] = ((equal->control_data->control[key].data[i] -
+		if(!equal->control_info[key].scaled) {
+			value[i] = lrintf(data[i]);
+			continue;
+		}
+		value[i] = ((data[i] -
 			equal->control_info[key].min)/
 			(equal->control_info[key].max-
 			equal->control_info[key].min))*100;
@@ -122,6 +532,24 @@ static int equal_read_integer(snd_ctl_ext_t *ext, snd_ctl_ext_key_t key,
 	return equal->control_data->channels*sizeof(long);
 }
 
+/* Clamp a value to the port's own bounds, where it has them. Bounds
+   relative to the sample rate can't be checked since the rate belongs to
+   the PCM. */
+static LADSPA_Data equal_clamp(const LADSPA_Control_Data *data,
+		LADSPA_Data value)
+{
+	if(LADSPA_IS_HINT_SAMPLE_RATE(data->hint)) {
+		return value;
+	}
+	if(LADSPA_IS_HINT_BOUNDED_BELOW(data->hint) && !(value >= data->lower)) {
+		value = data->lower;
+	}
+	if(LADSPA_IS_HINT_BOUNDED_ABOVE(data->hint) && value > data->upper) {
+		value = data->upper;
+	}
+	return value;
+}
+
 static int equal_write_integer(snd_ctl_ext_t *ext, snd_ctl_ext_key_t key,
 		long *value)
 {
@@ -129,13 +557,99 @@ static int equal_write_integer(snd_ctl_ext_t *ext, snd_ctl_ext_key_t key,
 	int i;
 	float setting;
 
+	if(key == equal->control_data->num_controls + EQUAL_ELEM_TAP) {
+		__atomic_store_n(&equal->control_data->tap_enable, !!value[0],
+				__ATOMIC_RELAXED);
+		return 1;
+	}
+	if(key == equal->control_data->num_controls + EQUAL_ELEM_CAPTURE) {
+		__atomic_store_n(&equal->control_data->capture_enable,
+				!!value[0], __ATOMIC_RELAXED);
+		return 1;
+	}
+	if(key == equal->control_data->num_controls + EQUAL_ELEM_CROSSOVER) {
+		LADSPAcontrolWriteLock(equal->control_data);
+		for(i = 0; i < equal_crossovers(equal); i++) {
+			equal->control_data->crossover_freq[i] = value[i];
+		}
+		LADSPAcontrolWriteUnlock(equal->control_data);
+		return 1;
+	}
+	if(key >= equal->control_data->num_controls ||
+			equal->control_data->control[key].type != LADSPA_CNTRL_INPUT) {
+		return -EPERM;
+	}
+
+	LADSPAcontrolWriteLock(equal->control_data);
 	for(i = 0; i < equal->control_data->channels; i++) {
 		setting = value[i];
-		equal->control_data->control[key].data[i] = (setting/100)*
-			(equal->control_info[key].max-
-			equal->control_info[key].min)+
-			equal->control_info[key].min;
+		if(equal->control_info[key].scaled) {
+			setting = (setting/100)*(equal->control_info[key].max-
+					equal->control_info[key].min)+
+					equal->control_info[key].min;
+		}
+		equal_set_control(equal, key, i,
+				equal_clamp(&equal->control_data->control[key], setting));
+	}
+	LADSPAcontrolWriteUnlock(equal->control_data);
+
+	return 1;
+}
+
+/* The curve element holds every input control for every channel as
+   native endian floats, ordered by control then channel. */
+static int equal_read_bytes(snd_ctl_ext_t *ext, snd_ctl_ext_key_t key,
+		unsigned char *data, size_t max_bytes)
+{
+	snd_ctl_equal_t *equal = ext->private_data;
+	unsigned int channels = equal->control_data->channels;
+	LADSPA_Data *curve = (LADSPA_Data *)data;
+	long long since = 0;
+	int i;
+
+	if(max_bytes < equal->curve_bytes) {
+		return -EINVAL;
+	}
+	while(!LADSPAcontrolSnapshot(equal->control_data, equal->snapshot, NULL)) {
+		if(LADSPAcontrolReadBusy(equal->control_data, &since)) {
+			/* Take the controls over from a writer that died */
+			LADSPAcontrolWriteLock(equal->control_data);
+			LADSPAcontrolWriteUnlock(equal->control_data);
+		}
 	}
+	for(i = 0; i < equal->control_data->num_controls; i++) {
+		if(equal->control_data->control[i].type == LADSPA_CNTRL_INPUT) {
+			memcpy(curve, &equal->snapshot[i*channels],
+					channels*sizeof(LADSPA_Data));
+			curve += channels;
+		}
+	}
+
+	return 0;
+}
+
+static int equal_write_bytes(snd_ctl_ext_t *ext, snd_ctl_ext_key_t key,
+		unsigned char *data, size_t max_bytes)
+{
+	snd_ctl_equal_t *equal = ext->private_data;
+	unsigned int channels = equal->control_data->channels;
+	const LADSPA_Data *curve = (const LADSPA_Data *)data;
+	int i, j;
+
+	if(max_bytes < equal->curve_bytes) {
+		return -EINVAL;
+	}
+	LADSPAcontrolWriteLock(equal->control_data);
+	for(i = 0; i < equal->control_data->num_controls; i++) {
+		if(equal->control_data->control[i].type != LADSPA_CNTRL_INPUT) {
+			continue;
+		}
+		for(j = 0; j < channels; j++) {
+			equal_set_control(equal, i, j,
+					equal_clamp(&equal->control_data->control[i], *curve++));
+		}
+	}
+	LADSPAcontrolWriteUnlock(equal->control_data);
 
 	return 1;
 }
@@ -147,6 +661,15 @@ static int equal_read_event(snd_ctl_ext_t *ext ATTRIBUTE_UNUSED,
 	return -EAGAIN;
 }
 
+/* Copy a string into a fixed size field, cutting it short if needed. */
+static void equal_copy_name(char *dst, size_t size, const char *src)
+{
+	size_t len = strnlen(src, size - 1);
+
+	memcpy(dst, src, len);
+	dst[len] = '\0';
+}
+
 static snd_ctl_ext_callback_t equal_ext_callback = {
 	.close = equal_close,
 	.elem_count = equal_elem_count,
@@ -156,6 +679,15 @@ static snd_ctl_ext_callback_t equal_ext_callback = {
 	.get_integer_info = equal_get_integer_info,
 	.read_integer = equal_read_integer,
 	.write_integer = equal_write_integer,
+	.get_integer64_info = equal_get_integer64_info,
+	.read_integer64 = equal_read_integer64,
+	.write_integer64 = equal_write_integer64,
+	.get_enumerated_info = equal_get_enumerated_info,
+	.get_enumerated_name = equal_get_enumerated_name,
+	.read_enumerated = equal_read_enumerated,
+	.write_enumerated = equal_write_enumerated,
+	.read_bytes = equal_read_bytes,
+	.write_bytes = equal_write_bytes,
 	.read_event = equal_read_event,
 };
 
@@ -165,11 +697,14 @@ SND_CTL_PLUGIN_DEFINE_FUNC(equal)
 		failure */
 	snd_config_iterator_t it, next;
 	snd_ctl_equal_t *equal;
+	void *plugin;
+	const LADSPA_Descriptor *klass;
 	const char *controls = ".alsaequal.bin";
 	const char *library = "caps.so";
 	const char *module = "Eq10";
 	long channels = 2;
 	const char *sufix = " Playback Volume";
+	const char *zone = NULL;
 	int err, i, index;
 
 	/* Parse configuration options from asoundrc */
@@ -192,6 +727,14 @@ SND_CTL_PLUGIN_DEFINE_FUNC(equal)
 			snd_config_get_string(n, &module);
 			continue;
 		}
+		if (strcmp(id, "zone") == 0) {
+			snd_config_get_string(n, &zone);
+			if(zone != NULL && strlen(zone) > 24) {
+				SNDERR("zone names are at most 24 characters");
+				return -EINVAL;
+			}
+			continue;
+		}
 		if (strcmp(id, "channels") == 0) {
 			snd_config_get_integer(n, &channels);
 			if(channels < 1) {
@@ -214,25 +757,61 @@ SND_CTL_PLUGIN_DEFINE_FUNC(equal)
 	equal->ext.poll_fd = -1;
 	equal->ext.callback = &equal_ext_callback;
 	equal->ext.private_data = equal;
-
-	/* Open the LADSPA Plugin */
-	equal->library = LADSPAload(library);
-	if(equal->library == NULL) {
-		return -1;
+	if(zone != NULL && zone[0] != '\0') {
+		snprintf(equal->zone, sizeof(equal->zone), "%s ", zone);
 	}
 
-	equal->klass = LADSPAfind(equal->library, library, module);
-	if(equal->klass == NULL) {
-		return -1;
+	/* MMAP to the controls file, the metadata stored with the controls
+	   saves loading the plugin unless it is missing or stale */
+	equal->control_data = LADSPAcontrolMMAPMeta(controls, channels,
+			library, module);
+	if(equal->control_data == NULL) {
+		/* Open the LADSPA Plugin */
+		plugin = LADSPAload(library);
+		if(plugin == NULL) {
+			return -1;
+		}
+
+		klass = LADSPAfind(plugin, library, module);
+		if(klass == NULL) {
+			LADSPAunload(plugin);
+			return -1;
+		}
+
+		equal->control_data = LADSPAcontrolMMAP(klass, controls, channels,
+				library);
+		if(equal->control_data == NULL) {
+			LADSPAunload(plugin);
+			return -1;
+		}
+
+		/* Make sure that the control file makes sense */
+		if(klass->PortDescriptors[equal->control_data->input_index] !=
+				(LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO)) {
+			SNDERR("Problem with control file %s.", controls);
+			LADSPAunload(plugin);
+			return -1;
+		}
+		if(klass->PortDescriptors[equal->control_data->output_index] !=
+				(LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO)) {
+			SNDERR("Problem with control file %s.", controls);
+			LADSPAunload(plugin);
+			return -1;
+		}
+		LADSPAunload(plugin);
 	}
 
-	/* Import data from the LADSPA Plugin */
-	strncpy(equal->ext.id, equal->klass->Label, sizeof(equal->ext.id));
-	strncpy(equal->ext.driver, "LADSPA Plugin", sizeof(equal->ext.driver));
-	strncpy(equal->ext.name, equal->klass->Label, sizeof(equal->ext.name));
-	strncpy(equal->ext.longname, equal->klass->Name,
-			sizeof(equal->ext.longname));
-	strncpy(equal->ext.mixername, "alsaequal", sizeof(equal->ext.mixername));
+	/* Import data about the LADSPA Plugin */
+	equal_copy_name(equal->ext.id, sizeof(equal->ext.id),
+			equal->control_data->label);
+	equal_copy_name(equal->ext.driver, sizeof(equal->ext.driver),
+			"LADSPA Plugin");
+	equal_copy_name(equal->ext.name, sizeof(equal->ext.name),
+			equal->control_data->label);
+	equal_copy_name(equal->ext.longname, sizeof(equal->ext.longname),
+			equal->control_data->name);
+	equal_copy_name(equal->ext.mixername, sizeof(equal->ext.mixername),
+			"alsaequal");
 
 	/* Create the ALSA External Plugin */
 	err = snd_ctl_ext_create(&equal->ext, name, SND_CTL_NONBLOCK);
@@ -240,12 +819,6 @@ SND_CTL_PLUGIN_DEFINE_FUNC(equal)
 		return -1;
 	}
 
-	/* MMAP to the controls file */
-	equal->control_data = LADSPAcontrolMMAP(equal->klass, controls, channels);
-	if(equal->control_data == NULL) {
-		return -1;
-	}
-	
 	equal->num_input_controls = 0;
 	for(i = 0; i < equal->control_data->num_controls; i++) {
 		if(equal->control_data->control[i].type == LADSPA_CNTRL_INPUT) {
@@ -254,45 +827,42 @@ SND_CTL_PLUGIN_DEFINE_FUNC(equal)
 	}
 	
 	/* Pull in data from controls file */
-	equal->control_info = malloc(
-			sizeof(snd_ctl_equal_control_t)*equal->num_input_controls);
+	equal->control_info = calloc(equal->control_data->num_controls,
+			sizeof(snd_ctl_equal_control_t));
 	if(equal->control_info == NULL) {
 		return -1;
 	}
 
-	for(i = 0; i < equal->num_input_controls; i++) {
-		if(equal->control_data->control[i].type == LADSPA_CNTRL_INPUT) {
-			index = equal->control_data->control[i].index;
-			if(equal->klass->PortDescriptors[index] &
-					(LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL) == 0) {
-				SNDERR("Problem with control file %s, %d.", controls, index);
-				return -1;
-			}
-			equal->control_info[i].min =
-					equal->klass->PortRangeHints[index].LowerBound;
-			equal->control_info[i].max =
-					equal->klass->PortRangeHints[index].UpperBound;
-			equal->control_info[i].name = malloc(
-					strlen(equal->klass->PortNames[index]) +
-					strlen(sufix) + 6);
-			if(equal->control_info[i].name == NULL) {
-				return -1;
-			}
-			sprintf(equal->control_info[i].name, "%02d. %s%s",
-					index, equal->klass->PortNames[index], sufix);
+	for(i = 0; i < equal->control_data->num_controls; i++) {
+		index = equal->control_data->control[i].index;
+		equal->control_info[i].min = equal->control_data->control[i].lower;
+		equal->control_info[i].max = equal->control_data->control[i].upper;
+		equal->control_info[i].scaled =
+				equal->control_info[i].max > equal->control_info[i].min;
+		equal->control_info[i].name = malloc(
+				strlen(equal->zone) +
+				strlen(equal->control_data->control[i].name) +
+				strlen(sufix) + 6);
+		if(equal->control_info[i].name == NULL) {
+			return -1;
 		}
+		/* Plugin outputs are read-only and carry no volume suffix */
+		sprintf(equal->control_info[i].name, "%s%02d. %s%s",
+				equal->zone, index, equal->control_data->control[i].name,
+				equal->control_data->control[i].type == LADSPA_CNTRL_INPUT ?
+				sufix : "");
 	}
 
-	/* Make sure that the control file makes sense */
-	if(equal->klass->PortDescriptors[equal->control_data->input_index] !=
-			(LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO)) {
-		SNDERR("Problem with control file %s.", controls);
+	/* Whole-curve element, only if the curve fits in a bytes value */
+	equal->snapshot = malloc(equal->control_data->num_controls*
+			equal->control_data->channels*sizeof(LADSPA_Data));
+	if(equal->snapshot == NULL) {
 		return -1;
 	}
-	if(equal->klass->PortDescriptors[equal->control_data->output_index] !=
-			(LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO)) {
-		SNDERR("Problem with control file %s.", controls);
-		return -1;
+	equal->curve_bytes = equal->num_input_controls*
+			equal->control_data->channels*sizeof(LADSPA_Data);
+	if(equal->curve_bytes > EQUAL_MAX_BYTES) {
+		equal->curve_bytes = 0;
 	}
 
 	*handlep = equal->ext.handle;
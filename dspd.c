@@ -0,0 +1,351 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "dspd.h"
+#include "probes.h"
+
+/* Polls of ack before going to sleep on it, the daemon usually answers
+   within a few microseconds */
+#define DSPD_SPIN 2000
+
+/* A daemon that takes longer than this is taken for dead, however long
+   the period is. Shorter periods only wait for half their length. */
+#define DSPD_TIMEOUT_NS 200000000
+
+EQUAL_PROBE_SEMAPHORE(dspd_call);
+
+static inline void dspd_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+char *equal_dspd_default_socket(char *path, size_t len)
+{
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+	snprintf(path, len, "%s/%s", dir != NULL && dir[0] != '\0' ? dir : "/tmp",
+			EQUAL_DSPD_SOCKET);
+	return path;
+}
+
+static uint64_t dspd_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static int dspd_socket(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if(fd < 0) {
+		return -1;
+	}
+	if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Create the segment, filled in from the controls */
+static equal_dspd_shm_t *dspd_shm_create(const char *name,
+		const char *library, const char *module,
+		const LADSPA_Control *control_data, size_t length)
+{
+	equal_dspd_shm_t *shm;
+	int fd, i;
+
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if(fd < 0) {
+		return NULL;
+	}
+	if(ftruncate(fd, length) < 0) {
+		close(fd);
+		shm_unlink(name);
+		return NULL;
+	}
+	shm = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(shm == MAP_FAILED) {
+		shm_unlink(name);
+		return NULL;
+	}
+
+	shm->magic = EQUAL_DSPD_MAGIC;
+	shm->version = EQUAL_DSPD_VERSION;
+	strncpy(shm->library, library, sizeof(shm->library) - 1);
+	strncpy(shm->module, module, sizeof(shm->module) - 1);
+	shm->channels = control_data->channels;
+	shm->num_controls = control_data->num_controls;
+	shm->input_index = control_data->input_index;
+	shm->output_index = control_data->output_index;
+	for(i = 0; i < control_data->num_controls; i++) {
+		shm->port[i] = control_data->control[i].index;
+	}
+	return shm;
+}
+
+equal_dspd_t *equal_dspd_connect(const char *socket, const char *library,
+		const char *module, const LADSPA_Control *control_data)
+{
+	static unsigned int serial;
+	equal_dspd_hello_t hello;
+	equal_dspd_reply_t reply;
+	char path[108];
+	equal_dspd_t *dspd;
+	struct stat st;
+	int fd, err;
+
+	if(control_data->channels > EQUAL_DSPD_MAX_CHANNELS ||
+			control_data->num_controls > EQUAL_DSPD_MAX_CONTROLS) {
+		errno = EINVAL;
+		return NULL;
+	}
+	dspd = calloc(1, sizeof(*dspd));
+	if(dspd == NULL) {
+		return NULL;
+	}
+	dspd->channels = control_data->channels;
+	dspd->num_controls = control_data->num_controls;
+	dspd->length = equal_dspd_shm_length(dspd->channels);
+
+	dspd->fd = dspd_socket(socket != NULL ? socket :
+			equal_dspd_default_socket(path, sizeof(path)));
+	if(dspd->fd < 0) {
+		goto fail;
+	}
+
+	memset(&hello, 0, sizeof(hello));
+	hello.magic = EQUAL_DSPD_MAGIC;
+	hello.version = EQUAL_DSPD_VERSION;
+	snprintf(hello.shm, sizeof(hello.shm), "/alsaequal-dspd-%d-%u",
+			(int)getpid(), __atomic_fetch_add(&serial, 1, __ATOMIC_RELAXED));
+	dspd->shm = dspd_shm_create(hello.shm, library, module, control_data,
+			dspd->length);
+	if(dspd->shm == NULL) {
+		goto fail;
+	}
+
+	/* The daemon has the segment mapped once it answers */
+	errno = 0;
+	if(send(dspd->fd, &hello, sizeof(hello), MSG_NOSIGNAL) != sizeof(hello) ||
+			recv(dspd->fd, &reply, sizeof(reply), 0) != sizeof(reply)) {
+		err = errno ? errno : EPROTO;
+		shm_unlink(hello.shm);
+		errno = err;
+		goto fail;
+	}
+	shm_unlink(hello.shm);
+	if(reply.status < 0) {
+		errno = -reply.status;
+		goto fail;
+	}
+	reply.bells[sizeof(reply.bells) - 1] = '\0';
+	if(reply.worker >= EQUAL_DSPD_MAX_WORKERS) {
+		errno = EPROTO;
+		goto fail;
+	}
+	dspd->worker = reply.worker;
+
+	fd = shm_open(reply.bells, O_RDWR, 0);
+	if(fd < 0) {
+		goto fail;
+	}
+	if(fstat(fd, &st) < 0 || st.st_size < sizeof(equal_dspd_bells_t)) {
+		close(fd);
+		errno = EPROTO;
+		goto fail;
+	}
+	dspd->bells = mmap(NULL, sizeof(equal_dspd_bells_t),
+			PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(dspd->bells == MAP_FAILED) {
+		dspd->bells = NULL;
+		goto fail;
+	}
+	return dspd;
+
+fail:
+	err = errno;
+	equal_dspd_close(dspd);
+	errno = err;
+	return NULL;
+}
+
+void equal_dspd_close(equal_dspd_t *dspd)
+{
+	if(dspd == NULL) {
+		return;
+	}
+	if(dspd->fd >= 0) {
+		close(dspd->fd);
+	}
+	if(dspd->shm != NULL) {
+		munmap(dspd->shm, dspd->length);
+	}
+	if(dspd->bells != NULL) {
+		munmap(dspd->bells, sizeof(equal_dspd_bells_t));
+	}
+	free(dspd);
+}
+
+/* Hand the request over and wait for the answer */
+/* Hand the request to the daemon and wait for it until deadline */
+static int dspd_call(equal_dspd_t *dspd, uint64_t deadline)
+{
+	equal_dspd_shm_t *shm = dspd->shm;
+	struct timespec timeout;
+	uint64_t start, now;
+	uint32_t req, ack;
+	int i;
+
+	start = dspd_now();
+	req = shm->req + 1;
+	__atomic_store_n(&shm->req, req, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&dspd->bells->worker[dspd->worker].bell, 1,
+			__ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&dspd->bells->worker[dspd->worker].sleeping,
+			__ATOMIC_SEQ_CST)) {
+		equal_futex_wake(&dspd->bells->worker[dspd->worker].bell);
+	}
+
+	for(i = 0; i < DSPD_SPIN; i++) {
+		if(__atomic_load_n(&shm->ack, __ATOMIC_ACQUIRE) == req) {
+			goto done;
+		}
+		dspd_relax();
+	}
+	__atomic_store_n(&shm->waiting, 1, __ATOMIC_SEQ_CST);
+	while((ack = __atomic_load_n(&shm->ack, __ATOMIC_SEQ_CST)) != req) {
+		now = dspd_now();
+		if(now >= deadline) {
+			__atomic_store_n(&shm->waiting, 0, __ATOMIC_RELAXED);
+			return -ETIMEDOUT;
+		}
+		timeout.tv_sec = 0;
+		timeout.tv_nsec = deadline - now;
+		equal_futex_wait(&shm->ack, ack, &timeout);
+	}
+	__atomic_store_n(&shm->waiting, 0, __ATOMIC_RELAXED);
+
+done:
+	now = dspd_now() - start;
+	dspd->calls++;
+	dspd->total_ns += now;
+	if(now > dspd->max_ns) {
+		dspd->max_ns = now;
+	}
+	EQUAL_PROBE2(dspd_call, shm->frames, now);
+	return shm->status;
+}
+
+void equal_dspd_audio(equal_dspd_t *dspd, float **in, float **out)
+{
+	*in = dspd->shm->audio;
+	*out = dspd->shm->audio + dspd->channels*EQUAL_DSPD_MAX_FRAMES;
+}
+
+int equal_dspd_run(equal_dspd_t *dspd, unsigned long rate,
+		LADSPA_Data *controls, const float *in, float *out,
+		unsigned long stride, unsigned long frames)
+{
+	equal_dspd_shm_t *shm = dspd->shm;
+	const unsigned int channels = dspd->channels;
+	float *shm_in = shm->audio;
+	float *shm_out = shm->audio + channels*EQUAL_DSPD_MAX_FRAMES;
+	unsigned long done, n, offset;
+	uint64_t deadline, wait;
+	unsigned int j;
+	int err;
+
+	/* The period is lost anyway once half of it has gone by */
+	wait = (uint64_t)frames*500000000ULL/(rate ? rate : 1);
+	if(wait > DSPD_TIMEOUT_NS) {
+		wait = DSPD_TIMEOUT_NS;
+	}
+	deadline = dspd_now() + wait;
+
+	memcpy(shm->controls, controls,
+			dspd->num_controls*channels*sizeof(LADSPA_Data));
+	shm->rate = rate;
+	if(stride == EQUAL_DSPD_MAX_FRAMES && in >= shm_in &&
+			in < shm_in + EQUAL_DSPD_MAX_FRAMES) {
+		offset = in - shm_in;
+		if(out != shm_out + offset ||
+				frames > EQUAL_DSPD_MAX_FRAMES - offset) {
+			return -EINVAL;
+		}
+		/* Already in place */
+		shm->offset = offset;
+		shm->frames = frames;
+		err = dspd_call(dspd, deadline);
+		if(err < 0) {
+			return err;
+		}
+		goto done;
+	}
+
+	shm->offset = 0;
+	for(done = 0; done < frames; done += n) {
+		n = frames - done;
+		if(n > EQUAL_DSPD_MAX_FRAMES) {
+			n = EQUAL_DSPD_MAX_FRAMES;
+		}
+		for(j = 0; j < channels; j++) {
+			memcpy(shm_in + j*EQUAL_DSPD_MAX_FRAMES, in + j*stride + done,
+					n*sizeof(float));
+		}
+		shm->frames = n;
+		err = dspd_call(dspd, deadline);
+		if(err < 0) {
+			return err;
+		}
+		for(j = 0; j < channels; j++) {
+			memcpy(out + j*stride + done, shm_out + j*EQUAL_DSPD_MAX_FRAMES,
+					n*sizeof(float));
+		}
+	}
+
+done:
+	memcpy(controls, shm->controls,
+			dspd->num_controls*channels*sizeof(LADSPA_Data));
+	return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#ifndef EQUAL_DSPD_H
+#define EQUAL_DSPD_H
+
+#include <stdint.h>
+#include <time.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "ladspa.h"
+#include "ladspa_utils.h"
+
+/* Out of process DSP. Instead of running the plugin itself a PCM can hand
+   its audio to alsaequal-dspd, which hosts the instances of any number of
+   clients on a few worker threads.
+
+   Each client owns a shared memory segment holding the plugin setup, the
+   control values and the audio of one request, which the daemon runs the
+   plugin on in place. A request is a round trip of two counters: the
+   client bumps req and rings its worker's doorbell, the worker runs the
+   plugin and sets ack to req. Both sides only make the futex system call
+   when the other one is actually asleep. The Unix socket is used for the
+   handshake and tells the daemon when a client goes away. */
+
+#define EQUAL_DSPD_MAGIC 0x44505345	/* "ESPD" */
+#define EQUAL_DSPD_VERSION 2
+#define EQUAL_DSPD_MAX_FRAMES 4096
+#define EQUAL_DSPD_MAX_CHANNELS 16
+#define EQUAL_DSPD_MAX_CONTROLS 128
+#define EQUAL_DSPD_MAX_WORKERS 64
+
+/* Socket used when none is configured, in $XDG_RUNTIME_DIR or /tmp */
+#define EQUAL_DSPD_SOCKET "alsaequal-dspd.sock"
+
+/* Doorbells of the worker threads, one shared memory object per daemon */
+typedef struct equal_dspd_bells {
+	uint32_t magic;
+	uint32_t workers;
+	struct {
+		uint32_t bell;		/* Futex, bumped for every request */
+		uint32_t sleeping;	/* Set while the worker waits on bell */
+	} __attribute__((aligned(64))) worker[EQUAL_DSPD_MAX_WORKERS];
+} equal_dspd_bells_t;
+
+/* A client's segment */
+typedef struct equal_dspd_shm {
+	uint32_t magic;
+	uint32_t version;
+	/* Set up by the client before it connects */
+	char library[256];
+	char module[64];
+	uint32_t channels;
+	uint32_t num_controls;
+	int32_t input_index;
+	int32_t output_index;
+	int32_t port[EQUAL_DSPD_MAX_CONTROLS];
+	/* The current request */
+	uint32_t rate;
+	uint32_t offset;	/* Of the first frame in each channel's audio */
+	uint32_t frames;
+	int32_t status;		/* 0 or -errno, valid once ack == req */
+	uint32_t req __attribute__((aligned(64)));
+	uint32_t waiting;	/* Set while the client waits on ack */
+	uint32_t ack __attribute__((aligned(64)));
+	/* [control][channel], the plugin's control ports are connected here */
+	LADSPA_Data controls[EQUAL_DSPD_MAX_CONTROLS*EQUAL_DSPD_MAX_CHANNELS]
+			__attribute__((aligned(64)));
+	/* Input [channels][MAX_FRAMES], then output [channels][MAX_FRAMES] */
+	float audio[];
+} equal_dspd_shm_t;
+
+static inline size_t equal_dspd_shm_length(unsigned int channels)
+{
+	return sizeof(equal_dspd_shm_t) +
+			2*(size_t)channels*EQUAL_DSPD_MAX_FRAMES*sizeof(float);
+}
+
+/* Handshake on the socket, the client sends the name of its segment and
+   gets the doorbells and its worker back */
+typedef struct equal_dspd_hello {
+	uint32_t magic;
+	uint32_t version;
+	char shm[64];
+} equal_dspd_hello_t;
+
+typedef struct equal_dspd_reply {
+	int32_t status;
+	uint32_t worker;
+	char bells[64];
+} equal_dspd_reply_t;
+
+static inline long equal_futex_wait(uint32_t *addr, uint32_t val,
+		const struct timespec *timeout)
+{
+	return syscall(SYS_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+static inline long equal_futex_wake(uint32_t *addr)
+{
+	return syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Client side, used by the PCM */
+typedef struct equal_dspd {
+	int fd;
+	equal_dspd_shm_t *shm;
+	size_t length;
+	equal_dspd_bells_t *bells;
+	unsigned int worker;
+	unsigned int channels;
+	unsigned int num_controls;
+	/* Round trip times */
+	uint64_t calls;
+	uint64_t total_ns;
+	uint64_t max_ns;
+} equal_dspd_t;
+
+/* Fill in the default socket path, returns path. */
+char *equal_dspd_default_socket(char *path, size_t len);
+
+/* Connect to the daemon at socket (NULL for the default) and have it
+   instantiate module from library for the controls described by
+   control_data. Returns NULL with errno set on failure. */
+equal_dspd_t *equal_dspd_connect(const char *socket, const char *library,
+		const char *module, const LADSPA_Control *control_data);
+void equal_dspd_close(equal_dspd_t *dspd);
+
+/* The segment's planar input and output, channels EQUAL_DSPD_MAX_FRAMES
+   apart. A client that (de)interleaves straight into these saves the
+   copies in and out of the segment. */
+void equal_dspd_audio(equal_dspd_t *dspd, float **in, float **out);
+
+/* Run frames of planar in (channels stride frames apart) at rate with the
+   given control values, writing planar out with the same stride. Control
+   outputs of the plugin are copied back to controls. When in and out are
+   at the same frame of the segment's audio the plugin runs there without
+   copying the audio. Returns 0, or a negative errno if the daemon failed
+   or didn't answer within half the length of the frames at rate. */
+int equal_dspd_run(equal_dspd_t *dspd, unsigned long rate,
+		LADSPA_Data *controls, const float *in, float *out,
+		unsigned long stride, unsigned long frames);
+
+#endif
@@ -0,0 +1,852 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+
+#include "fixed.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FIXED_X86 1
+#endif
+
+/* Sample format inside the engine: full scale is 1 << FIXED_FRAC */
+#define FIXED_FRAC (31 - EQUAL_FIXED_HEADROOM)
+#define FIXED_MAX ((1 << FIXED_FRAC) - 1)
+#define FIXED_MIN (-(1 << FIXED_FRAC))
+/* Bits dropped from samples before squaring them for the RMS */
+#define FIXED_RMS_SHIFT (FIXED_FRAC - 16)
+
+equal_fixed_t *equal_fixed_create(unsigned int channels, unsigned int bands,
+		const float *freq)
+{
+	equal_fixed_t *fx;
+	void *mem;
+	float lo, hi, r;
+	unsigned int b;
+
+	if(channels < 1 || channels > EQUAL_FIXED_MAX_CHANNELS ||
+			bands < 1 || bands > EQUAL_FIXED_MAX_BANDS) {
+		return NULL;
+	}
+	if(posix_memalign(&mem, 32, sizeof(equal_fixed_t)) != 0) {
+		return NULL;
+	}
+	fx = mem;
+	memset(fx, 0, sizeof(*fx));
+	fx->channels = channels;
+	fx->bands = bands;
+	memcpy(fx->freq, freq, bands*sizeof(float));
+
+	/* Bandwidth from the ratio to the neighbouring bands, an octave for
+	   a lone band */
+	for(b = 0; b < bands; b++) {
+		lo = b > 0 ? freq[b]/freq[b - 1] : 0;
+		hi = b + 1 < bands ? freq[b + 1]/freq[b] : 0;
+		if(lo > 1 && hi > 1) {
+			r = sqrtf(lo*hi);
+		} else if(lo > 1) {
+			r = lo;
+		} else if(hi > 1) {
+			r = hi;
+		} else {
+			r = 2;
+		}
+		fx->q[b] = sqrtf(r)/(r - 1);
+	}
+
+	equal_fixed_set_isa(fx, EQUAL_FIXED_AVX2);
+	equal_fixed_reset(fx, 48000);
+	return fx;
+}
+
+void equal_fixed_destroy(equal_fixed_t *fx)
+{
+	free(fx);
+}
+
+int equal_fixed_parse_frequency(const char *name, float *freq)
+{
+	char *end;
+	double f;
+
+	f = strtod(name, &end);
+	if(end == name || !(f > 0)) {
+		return -1;
+	}
+	while(*end == ' ') {
+		end++;
+	}
+	if(*end == 'k' || *end == 'K') {
+		f *= 1000;
+		end++;
+	}
+	if(strncasecmp(end, "Hz", 2) != 0) {
+		return -1;
+	}
+	*freq = f;
+	return 0;
+}
+
+int equal_fixed_set_isa(equal_fixed_t *fx, int isa)
+{
+#ifdef FIXED_X86
+	__builtin_cpu_init();
+	if(isa >= EQUAL_FIXED_AVX2 && !__builtin_cpu_supports("avx2")) {
+		isa = EQUAL_FIXED_SSE4;
+	}
+	if(isa >= EQUAL_FIXED_SSE4 && !__builtin_cpu_supports("sse4.2")) {
+		isa = EQUAL_FIXED_SCALAR;
+	}
+#else
+	isa = EQUAL_FIXED_SCALAR;
+#endif
+	fx->isa = isa;
+	return isa;
+}
+
+const char *equal_fixed_isa_name(int isa)
+{
+	switch(isa) {
+	case EQUAL_FIXED_AVX2:
+		return "avx2";
+	case EQUAL_FIXED_SSE4:
+		return "sse4.2";
+	default:
+		return "scalar";
+	}
+}
+
+/* Peaking biquad (RBJ cookbook) as b0 b1 b2 -a1 -a2, flat for no gain and
+   for bands too close to Nyquist to be placed */
+static int fixed_biquad(float gain, float freq, float q, double rate,
+		double *c)
+{
+	double A, w0, cosw, alpha, a0;
+
+	if(gain == 0 || !isfinite(gain) || freq >= 0.45*rate) {
+		c[0] = 1;
+		c[1] = c[2] = c[3] = c[4] = 0;
+		return 0;
+	}
+	A = pow(10, gain/40.0);
+	w0 = 2*M_PI*freq/rate;
+	cosw = cos(w0);
+	alpha = sin(w0)/(2*q);
+	a0 = 1 + alpha/A;
+	c[0] = (1 + alpha*A)/a0;
+	c[1] = -2*cosw/a0;
+	c[2] = (1 - alpha*A)/a0;
+	c[3] = 2*cosw/a0;
+	c[4] = -(1 - alpha/A)/a0;
+	return 1;
+}
+
+/* Quantize the coefficients of every channel of a band to the finest Q
+   format the largest of them fits in */
+static void fixed_band_set(equal_fixed_t *fx, unsigned int b)
+{
+	equal_fixed_band_t *bd = &fx->band[b];
+	double c[EQUAL_FIXED_MAX_CHANNELS][5], max = 0, rate = fx->rate;
+	unsigned int j, k;
+	int shift;
+
+	/* The low bands run after the decimation */
+	if(fx->stages > 0 && (fx->low >> b & 1)) {
+		rate = ldexp(rate, -(int)fx->stages);
+	}
+	bd->active = 0;
+	for(j = 0; j < fx->channels; j++) {
+		bd->active |= fixed_biquad(fx->gain[b*fx->channels + j],
+				fx->freq[b], fx->q[b], rate, c[j]);
+		for(k = 0; k < 5; k++) {
+			max = fmax(max, fabs(c[j][k]));
+		}
+	}
+	for(shift = 30; shift > 1 && ldexp(max, shift) >= INT32_MAX; shift--) {
+	}
+	for(j = 0; j < fx->channels; j++) {
+		for(k = 0; k < 5; k++) {
+			bd->coef[k][j] = llrint(ldexp(c[j][k], shift));
+		}
+	}
+	bd->shift = shift;
+}
+
+unsigned int equal_fixed_set_multirate(equal_fixed_t *fx, float split)
+{
+	unsigned int b, n = 0;
+
+	fx->split = split;
+	fx->low = 0;
+	for(b = 0; b < fx->bands; b++) {
+		if(fx->freq[b] < split) {
+			fx->low |= 1U << b;
+			n++;
+		}
+	}
+	return n;
+}
+
+static double fixed_bessel_i0(double x)
+{
+	double sum = 1, term = 1;
+	int k;
+
+	for(k = 1; k < 32; k++) {
+		term *= (x/(2*k))*(x/(2*k));
+		sum += term;
+	}
+	return sum;
+}
+
+/* Kaiser windowed half-band taps, scaled to add up to 1/2 so that both
+   phases pass DC as it is. Returns the peak gain from stop to Nyquist. */
+static double fixed_halfband_design(double *g, unsigned int taps, double beta,
+		double stop)
+{
+	const unsigned int points = 64;
+	double sum = 0, peak = 0, o, f, h;
+	unsigned int i, k;
+
+	for(k = 0; k < taps; k++) {
+		o = 2*k + 1;
+		g[k] = sin(M_PI*o/2)/(M_PI*o)*
+				fixed_bessel_i0(beta*sqrt(1 - (o/(2*taps))*(o/(2*taps))))/
+				fixed_bessel_i0(beta);
+		sum += g[k];
+	}
+	for(k = 0; k < taps; k++) {
+		g[k] *= 0.25/sum;
+	}
+	for(i = 0; i <= points; i++) {
+		f = stop + (0.5 - stop)*i/points;
+		h = 0.5;
+		for(k = 0; k < taps; k++) {
+			h += 2*g[k]*cos(2*M_PI*f*(2*k + 1));
+		}
+		peak = fmax(peak, fabs(h));
+	}
+	return peak;
+}
+
+/* The shortest half-band, trying the Kaiser windows in turn, that is
+   80 dB down from stop (of its input rate) on. Stages far above the low
+   bands have a wide transition and get by with a few taps. */
+static void fixed_halfband(equal_fixed_stage_t *st, double stop)
+{
+	const double target = 1e-4;
+	double g[EQUAL_FIXED_HALFBAND_TAPS], best[EQUAL_FIXED_HALFBAND_TAPS];
+	double peak, min;
+	unsigned int k, taps;
+	int b;
+
+	for(taps = 1; taps <= EQUAL_FIXED_HALFBAND_TAPS; taps++) {
+		min = HUGE_VAL;
+		for(b = 0; b <= 30; b++) {
+			peak = fixed_halfband_design(g, taps, b*0.5, stop);
+			if(peak < min) {
+				min = peak;
+				memcpy(best, g, sizeof(g));
+			}
+		}
+		if(min <= target) {
+			break;
+		}
+	}
+	if(taps > EQUAL_FIXED_HALFBAND_TAPS) {
+		taps = EQUAL_FIXED_HALFBAND_TAPS;
+	}
+	for(k = 0; k < taps; k++) {
+		st->coef[k] = llrint(ldexp(best[k], 30));
+	}
+	st->taps = taps;
+}
+
+/* As many stages as keep the lowest rate EQUAL_FIXED_LOW_RATIO times
+   above the highest low band. Each half-band only has to keep out what
+   would alias below a quarter of the lowest rate, where the low bands
+   act. A change at the lowest rate comes back up a whole decimated frame
+   late, which the delay covers. */
+static void fixed_multirate_reset(equal_fixed_t *fx)
+{
+	float top = 0;
+	unsigned int b, s;
+
+	fx->stages = 0;
+	fx->latency = 0;
+	fx->pos = 0;
+	if(fx->low == 0) {
+		return;
+	}
+	for(b = 0; b < fx->bands; b++) {
+		if((fx->low >> b & 1) && fx->freq[b] > top) {
+			top = fx->freq[b];
+		}
+	}
+	while(fx->stages < EQUAL_FIXED_MAX_STAGES &&
+			ldexp(fx->rate, -(int)fx->stages - 1) >=
+			EQUAL_FIXED_LOW_RATIO*top) {
+		fx->stages++;
+	}
+	for(s = 0; s < fx->stages; s++) {
+		fixed_halfband(&fx->stage[s], 0.5 - ldexp(1, (int)s -
+				(int)fx->stages - 2));
+		fx->latency += (4*fx->stage[s].taps - 3) << s;
+		memset(fx->stage[s].down, 0, sizeof(fx->stage[s].down));
+		memset(fx->stage[s].up, 0, sizeof(fx->stage[s].up));
+	}
+	if(fx->stages > 0) {
+		fx->latency += (1U << fx->stages) - 1;
+	}
+	memset(fx->delay, 0, sizeof(fx->delay));
+}
+
+void equal_fixed_reset(equal_fixed_t *fx, unsigned long rate)
+{
+	unsigned int b;
+
+	fx->rate = rate;
+	fixed_multirate_reset(fx);
+	for(b = 0; b < fx->bands; b++) {
+		memset(fx->band[b].state, 0, sizeof(fx->band[b].state));
+		fixed_band_set(fx, b);
+	}
+}
+
+void equal_fixed_set(equal_fixed_t *fx, const float *gain)
+{
+	const unsigned int channels = fx->channels;
+	unsigned int b;
+
+	for(b = 0; b < fx->bands; b++) {
+		if(memcmp(&fx->gain[b*channels], &gain[b*channels],
+				channels*sizeof(float)) != 0) {
+			memcpy(&fx->gain[b*channels], &gain[b*channels],
+					channels*sizeof(float));
+			fixed_band_set(fx, b);
+		}
+	}
+}
+
+/* The reference filter, one channel of the work block. The sum is done
+   unsigned so that it wraps instead of overflowing. */
+static void fixed_band_scalar(equal_fixed_band_t *bd, unsigned int j,
+		int32_t *p, unsigned int stride, unsigned long n)
+{
+	const int shift = bd->shift;
+	const uint64_t round = 1ULL << (shift - 1);
+	const int64_t b0 = bd->coef[0][j], b1 = bd->coef[1][j],
+			b2 = bd->coef[2][j], a1 = bd->coef[3][j], a2 = bd->coef[4][j];
+	int64_t x1 = bd->state[0][j], x2 = bd->state[1][j];
+	int64_t y1 = bd->state[2][j], y2 = bd->state[3][j];
+	int64_t x, y;
+	uint64_t acc;
+	unsigned long i;
+
+	for(i = 0; i < n; i++) {
+		x = p[i*stride];
+		acc = round + (uint64_t)(b0*x) + (uint64_t)(b1*x1) +
+				(uint64_t)(b2*x2) + (uint64_t)(a1*y1) + (uint64_t)(a2*y2);
+		y = (int64_t)acc >> shift;
+		if(y > INT32_MAX) {
+			y = INT32_MAX;
+		} else if(y < INT32_MIN) {
+			y = INT32_MIN;
+		}
+		x2 = x1;
+		x1 = x;
+		y2 = y1;
+		y1 = y;
+		p[i*stride] = y;
+	}
+	bd->state[0][j] = x1;
+	bd->state[1][j] = x2;
+	bd->state[2][j] = y1;
+	bd->state[3][j] = y2;
+}
+
+#ifdef FIXED_X86
+/* Channels j and j+1. pmuldq multiplies the sign extended low halves of
+   the 64 bit lanes, which is where the samples and coefficients are. */
+__attribute__((target("sse4.2")))
+static void fixed_band_sse4(equal_fixed_band_t *bd, unsigned int j,
+		int32_t *p, unsigned int stride, unsigned long n)
+{
+	const __m128i b0 = _mm_loadu_si128((const __m128i *)&bd->coef[0][j]);
+	const __m128i b1 = _mm_loadu_si128((const __m128i *)&bd->coef[1][j]);
+	const __m128i b2 = _mm_loadu_si128((const __m128i *)&bd->coef[2][j]);
+	const __m128i a1 = _mm_loadu_si128((const __m128i *)&bd->coef[3][j]);
+	const __m128i a2 = _mm_loadu_si128((const __m128i *)&bd->coef[4][j]);
+	const __m128i round = _mm_set1_epi64x(1LL << (bd->shift - 1));
+	const __m128i sign = _mm_set1_epi64x(1LL << (63 - bd->shift));
+	const __m128i shift = _mm_cvtsi32_si128(bd->shift);
+	const __m128i max = _mm_set1_epi64x(INT32_MAX);
+	const __m128i min = _mm_set1_epi64x(INT32_MIN);
+	__m128i x1 = _mm_loadu_si128((const __m128i *)&bd->state[0][j]);
+	__m128i x2 = _mm_loadu_si128((const __m128i *)&bd->state[1][j]);
+	__m128i y1 = _mm_loadu_si128((const __m128i *)&bd->state[2][j]);
+	__m128i y2 = _mm_loadu_si128((const __m128i *)&bd->state[3][j]);
+	__m128i x, y, acc;
+	unsigned long i;
+
+	for(i = 0; i < n; i++) {
+		x = _mm_cvtepi32_epi64(_mm_loadl_epi64((const __m128i *)
+				(p + i*stride)));
+		acc = _mm_add_epi64(round, _mm_mul_epi32(b0, x));
+		acc = _mm_add_epi64(acc, _mm_mul_epi32(b1, x1));
+		acc = _mm_add_epi64(acc, _mm_mul_epi32(b2, x2));
+		acc = _mm_add_epi64(acc, _mm_mul_epi32(a1, y1));
+		acc = _mm_add_epi64(acc, _mm_mul_epi32(a2, y2));
+		/* There is no arithmetic shift of 64 bit lanes, sign extend the
+		   logical one */
+		y = _mm_srl_epi64(acc, shift);
+		y = _mm_sub_epi64(_mm_xor_si128(y, sign), sign);
+		y = _mm_blendv_epi8(y, max, _mm_cmpgt_epi64(y, max));
+		y = _mm_blendv_epi8(y, min, _mm_cmpgt_epi64(min, y));
+		x2 = x1;
+		x1 = x;
+		y2 = y1;
+		y1 = y;
+		_mm_storel_epi64((__m128i *)(p + i*stride),
+				_mm_shuffle_epi32(y, _MM_SHUFFLE(2, 0, 2, 0)));
+	}
+	_mm_storeu_si128((__m128i *)&bd->state[0][j], x1);
+	_mm_storeu_si128((__m128i *)&bd->state[1][j], x2);
+	_mm_storeu_si128((__m128i *)&bd->state[2][j], y1);
+	_mm_storeu_si128((__m128i *)&bd->state[3][j], y2);
+}
+
+/* Channels j to j+3, the same steps four lanes wide */
+__attribute__((target("avx2")))
+static void fixed_band_avx2(equal_fixed_band_t *bd, unsigned int j,
+		int32_t *p, unsigned int stride, unsigned long n)
+{
+	const __m256i b0 = _mm256_loadu_si256((const __m256i *)&bd->coef[0][j]);
+	const __m256i b1 = _mm256_loadu_si256((const __m256i *)&bd->coef[1][j]);
+	const __m256i b2 = _mm256_loadu_si256((const __m256i *)&bd->coef[2][j]);
+	const __m256i a1 = _mm256_loadu_si256((const __m256i *)&bd->coef[3][j]);
+	const __m256i a2 = _mm256_loadu_si256((const __m256i *)&bd->coef[4][j]);
+	const __m256i round = _mm256_set1_epi64x(1LL << (bd->shift - 1));
+	const __m256i sign = _mm256_set1_epi64x(1LL << (63 - bd->shift));
+	const __m128i shift = _mm_cvtsi32_si128(bd->shift);
+	const __m256i max = _mm256_set1_epi64x(INT32_MAX);
+	const __m256i min = _mm256_set1_epi64x(INT32_MIN);
+	const __m256i pack = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+	__m256i x1 = _mm256_loadu_si256((const __m256i *)&bd->state[0][j]);
+	__m256i x2 = _mm256_loadu_si256((const __m256i *)&bd->state[1][j]);
+	__m256i y1 = _mm256_loadu_si256((const __m256i *)&bd->state[2][j]);
+	__m256i y2 = _mm256_loadu_si256((const __m256i *)&bd->state[3][j]);
+	__m256i x, y, acc;
+	unsigned long i;
+
+	for(i = 0; i < n; i++) {
+		x = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *)
+				(p + i*stride)));
+		acc = _mm256_add_epi64(round, _mm256_mul_epi32(b0, x));
+		acc = _mm256_add_epi64(acc, _mm256_mul_epi32(b1, x1));
+		acc = _mm256_add_epi64(acc, _mm256_mul_epi32(b2, x2));
+		acc = _mm256_add_epi64(acc, _mm256_mul_epi32(a1, y1));
+		acc = _mm256_add_epi64(acc, _mm256_mul_epi32(a2, y2));
+		y = _mm256_srl_epi64(acc, shift);
+		y = _mm256_sub_epi64(_mm256_xor_si256(y, sign), sign);
+		y = _mm256_blendv_epi8(y, max, _mm256_cmpgt_epi64(y, max));
+		y = _mm256_blendv_epi8(y, min, _mm256_cmpgt_epi64(min, y));
+		x2 = x1;
+		x1 = x;
+		y2 = y1;
+		y1 = y;
+		_mm_storeu_si128((__m128i *)(p + i*stride), _mm256_castsi256_si128(
+				_mm256_permutevar8x32_epi32(y, pack)));
+	}
+	_mm256_storeu_si256((__m256i *)&bd->state[0][j], x1);
+	_mm256_storeu_si256((__m256i *)&bd->state[1][j], x2);
+	_mm256_storeu_si256((__m256i *)&bd->state[2][j], y1);
+	_mm256_storeu_si256((__m256i *)&bd->state[3][j], y2);
+}
+#endif
+
+/* A flat band passes the block untouched but keeps its history up to
+   date, so that it comes in without a click when it is turned up */
+static void fixed_band_follow(equal_fixed_t *fx, equal_fixed_band_t *bd,
+		const int32_t *w, unsigned long n)
+{
+	const unsigned int channels = fx->channels;
+	unsigned int j;
+
+	for(j = 0; j < channels; j++) {
+		if(n > 1) {
+			bd->state[1][j] = bd->state[3][j] = w[(n - 2)*channels + j];
+		} else {
+			bd->state[1][j] = bd->state[3][j] = bd->state[0][j];
+		}
+		bd->state[0][j] = bd->state[2][j] = w[(n - 1)*channels + j];
+	}
+}
+
+/* Run the bands with their bit set in mask over n frames of p */
+static void fixed_bands(equal_fixed_t *fx, uint32_t mask, int32_t *p,
+		unsigned long n)
+{
+	const unsigned int channels = fx->channels;
+	equal_fixed_band_t *bd;
+	unsigned int b, j;
+
+	for(b = 0; b < fx->bands; b++) {
+		if(!(mask >> b & 1)) {
+			continue;
+		}
+		bd = &fx->band[b];
+		if(!bd->active) {
+			fixed_band_follow(fx, bd, p, n);
+			continue;
+		}
+		j = 0;
+#ifdef FIXED_X86
+		if(fx->isa >= EQUAL_FIXED_AVX2) {
+			for(; j + 4 <= channels; j += 4) {
+				fixed_band_avx2(bd, j, p + j, channels, n);
+			}
+		}
+		if(fx->isa >= EQUAL_FIXED_SSE4) {
+			for(; j + 2 <= channels; j += 2) {
+				fixed_band_sse4(bd, j, p + j, channels, n);
+			}
+		}
+#endif
+		for(; j < channels; j++) {
+			fixed_band_scalar(bd, j, p + j, channels, n);
+		}
+	}
+}
+
+static int32_t fixed_saturate(int64_t v)
+{
+	return v > INT32_MAX ? INT32_MAX : v < INT32_MIN ? INT32_MIN : v;
+}
+
+/* One channel of a half-band decimator over buf, which starts with the
+   history. Inlined for each number of taps so that their loop unrolls. */
+static inline __attribute__((always_inline)) void fixed_decimate_taps(
+		const int64_t *coef, const unsigned int taps, const int32_t *buf,
+		unsigned long first, unsigned long count, int32_t *out,
+		unsigned int stride)
+{
+	const unsigned int hist = 4*taps - 2, centre = 2*taps - 1;
+	const int32_t *p;
+	unsigned long i, m;
+	unsigned int k;
+	int64_t acc;
+
+	for(i = first, m = 0; i < count; i += 2, m++) {
+		p = buf + hist + i - centre;
+		acc = ((int64_t)p[0] << 29) + (1 << 29);
+		for(k = 0; k < taps; k++) {
+			acc += coef[k]*((int64_t)p[-2*(int)k - 1] + p[2*k + 1]);
+		}
+		out[m*stride] = fixed_saturate(acc >> 30);
+	}
+}
+
+/* One channel of a half-band interpolator, likewise */
+static inline __attribute__((always_inline)) void fixed_interpolate_taps(
+		const int64_t *coef, const unsigned int taps, const int32_t *buf,
+		unsigned long count, int32_t *out, unsigned int stride)
+{
+	const unsigned int hist = 2*taps - 1;
+	const int32_t *p;
+	unsigned long q;
+	unsigned int k;
+	int64_t acc;
+
+	for(q = 0; q < count; q++) {
+		p = buf + hist + q - (taps - 1);
+		acc = 1 << 28;
+		for(k = 0; k < taps; k++) {
+			acc += coef[k]*((int64_t)p[-(int)k - 1] + p[k]);
+		}
+		out[2*q*stride] = fixed_saturate(acc >> 29);
+		out[(2*q + 1)*stride] = p[0];
+	}
+}
+
+/* Halve the rate of count frames from in to out, which may be the same.
+   The outputs fall on the inputs with an odd index, odd says whether the
+   first one has. Returns the number of frames out. */
+static unsigned long fixed_decimate(equal_fixed_t *fx, equal_fixed_stage_t *st,
+		int odd, const int32_t *in, unsigned long count, int32_t *out)
+{
+	const unsigned int channels = fx->channels, hist = 4*st->taps - 2;
+	const unsigned long first = odd ? 0 : 1;
+	int32_t buf[4*EQUAL_FIXED_HALFBAND_TAPS - 2 + EQUAL_FIXED_LOW_BLOCK];
+	const int64_t *coef = st->coef;
+	unsigned long i;
+	unsigned int j;
+
+	for(j = 0; j < channels; j++) {
+		memcpy(buf, st->down[j], hist*sizeof(int32_t));
+		for(i = 0; i < count; i++) {
+			buf[hist + i] = in[i*channels + j];
+		}
+		switch(st->taps) {
+		case 1:
+			fixed_decimate_taps(coef, 1, buf, first, count, out + j, channels);
+			break;
+		case 2:
+			fixed_decimate_taps(coef, 2, buf, first, count, out + j, channels);
+			break;
+		case 3:
+			fixed_decimate_taps(coef, 3, buf, first, count, out + j, channels);
+			break;
+		case 4:
+			fixed_decimate_taps(coef, 4, buf, first, count, out + j, channels);
+			break;
+		case 5:
+			fixed_decimate_taps(coef, 5, buf, first, count, out + j, channels);
+			break;
+		default:
+			fixed_decimate_taps(coef, 6, buf, first, count, out + j, channels);
+			break;
+		}
+		memcpy(st->down[j], buf + count, hist*sizeof(int32_t));
+	}
+	return count > first ? (count - first + 1)/2 : 0;
+}
+
+/* Double the rate of count frames from in to out. Every other output is
+   an input as it is, the ones between are interpolated. */
+static void fixed_interpolate(equal_fixed_t *fx, equal_fixed_stage_t *st,
+		const int32_t *in, unsigned long count, int32_t *out)
+{
+	const unsigned int channels = fx->channels, hist = 2*st->taps - 1;
+	int32_t buf[2*EQUAL_FIXED_HALFBAND_TAPS - 1 + EQUAL_FIXED_LOW_BLOCK];
+	const int64_t *coef = st->coef;
+	unsigned long q;
+	unsigned int j;
+
+	for(j = 0; j < channels; j++) {
+		memcpy(buf, st->up[j], hist*sizeof(int32_t));
+		for(q = 0; q < count; q++) {
+			buf[hist + q] = in[q*channels + j];
+		}
+		switch(st->taps) {
+		case 1:
+			fixed_interpolate_taps(coef, 1, buf, count, out + j, channels);
+			break;
+		case 2:
+			fixed_interpolate_taps(coef, 2, buf, count, out + j, channels);
+			break;
+		case 3:
+			fixed_interpolate_taps(coef, 3, buf, count, out + j, channels);
+			break;
+		case 4:
+			fixed_interpolate_taps(coef, 4, buf, count, out + j, channels);
+			break;
+		case 5:
+			fixed_interpolate_taps(coef, 5, buf, count, out + j, channels);
+			break;
+		default:
+			fixed_interpolate_taps(coef, 6, buf, count, out + j, channels);
+			break;
+		}
+		memcpy(st->up[j], buf + count, hist*sizeof(int32_t));
+	}
+}
+
+/* Copy n frames between the work block and the delay line from frame
+   pos on, in at most two pieces around the end of the line */
+static void fixed_delay_copy(equal_fixed_t *fx, unsigned long pos,
+		unsigned long n, int in)
+{
+	const unsigned int channels = fx->channels;
+	unsigned long done, k, at;
+
+	for(done = 0; done < n; done += k) {
+		at = (pos + done) & (EQUAL_FIXED_DELAY - 1);
+		k = EQUAL_FIXED_DELAY - at;
+		if(k > n - done) {
+			k = n - done;
+		}
+		if(in) {
+			memcpy(&fx->delay[at*channels], &fx->work[done*channels],
+					k*channels*sizeof(int32_t));
+		} else {
+			memcpy(&fx->work[done*channels], &fx->delay[at*channels],
+					k*channels*sizeof(int32_t));
+		}
+	}
+}
+
+/* The low bands on the work block. The input goes into the delay line,
+   the change the low bands make to the decimated input comes back up
+   and is added to the input it lines up with, then the work block is
+   refilled from latency frames back. */
+static void fixed_multirate(equal_fixed_t *fx, unsigned long n)
+{
+	const unsigned int channels = fx->channels, stages = fx->stages;
+	const unsigned long mask = EQUAL_FIXED_DELAY - 1;
+	/* How far back the change lands, the latency without the frame it
+	   is late by */
+	const unsigned long back = fx->latency - ((1UL << stages) - 1);
+	int32_t *d = fx->low_work[0], *e = fx->low_work[1], *t, *x;
+	unsigned long i, m, r;
+	unsigned int j, s;
+	int64_t v;
+
+	fixed_delay_copy(fx, fx->pos, n, 1);
+	m = fixed_decimate(fx, &fx->stage[0], fx->pos & 1, fx->work, n, d);
+	for(s = 1; s < stages; s++) {
+		m = fixed_decimate(fx, &fx->stage[s], (fx->pos >> s) & 1, d, m, d);
+	}
+	if(m > 0) {
+		memcpy(e, d, m*channels*sizeof(int32_t));
+		fixed_bands(fx, fx->low, e, m);
+		for(i = 0; i < m*channels; i++) {
+			e[i] = fixed_saturate((int64_t)e[i] - d[i]);
+		}
+		for(s = stages; s-- > 0; m *= 2) {
+			fixed_interpolate(fx, &fx->stage[s], e, m, d);
+			t = d;
+			d = e;
+			e = t;
+		}
+		/* The first change out belongs to the first decimated frame
+		   this block finished */
+		r = (fx->pos >> stages) << stages;
+		for(i = 0; i < m; i++) {
+			x = &fx->delay[((r + i - back) & mask)*channels];
+			for(j = 0; j < channels; j++) {
+				v = (int64_t)x[j] + e[i*channels + j];
+				x[j] = fixed_saturate(v);
+			}
+		}
+	}
+
+	fixed_delay_copy(fx, fx->pos - fx->latency, n, 0);
+	fx->pos += n;
+}
+
+static void fixed_measure(equal_fixed_t *fx, unsigned long n,
+		equal_fixed_levels_t *levels)
+{
+	const unsigned int channels = fx->channels;
+	const int32_t *w = fx->work;
+	uint32_t peak, a;
+	uint64_t sum;
+	int64_t s;
+	unsigned long i;
+	unsigned int j;
+
+	if(levels == NULL) {
+		return;
+	}
+	for(j = 0; j < channels; j++) {
+		peak = levels->peak[j];
+		sum = levels->sum[j];
+		for(i = 0; i < n; i++) {
+			a = w[i*channels + j] < 0 ? -(uint32_t)w[i*channels + j] :
+					(uint32_t)w[i*channels + j];
+			if(a > peak) {
+				peak = a;
+			}
+			s = w[i*channels + j] >> FIXED_RMS_SHIFT;
+			sum += s*s;
+		}
+		levels->peak[j] = peak;
+		levels->sum[j] = sum;
+	}
+}
+
+static void fixed_import(equal_fixed_t *fx, const void *src, int format,
+		unsigned long n)
+{
+	const unsigned long samples = n*fx->channels;
+	int32_t *w = fx->work;
+	unsigned long i;
+
+	if(format == EQUAL_FIXED_S16) {
+		const int16_t *s = src;
+		for(i = 0; i < samples; i++) {
+			w[i] = s[i]*(1 << (FIXED_FRAC - 15));
+		}
+	} else {
+		const int32_t *s = src;
+		for(i = 0; i < samples; i++) {
+			w[i] = s[i] >> EQUAL_FIXED_HEADROOM;
+		}
+	}
+}
+
+static void fixed_export(equal_fixed_t *fx, void *dst, int format,
+		unsigned long n)
+{
+	const unsigned long samples = n*fx->channels;
+	const int32_t *w = fx->work;
+	unsigned long i;
+	int32_t v;
+
+	if(format == EQUAL_FIXED_S16) {
+		int16_t *d = dst;
+		for(i = 0; i < samples; i++) {
+			v = w[i] < FIXED_MIN ? FIXED_MIN : w[i] > FIXED_MAX ?
+					FIXED_MAX : w[i];
+			v = (v + (1 << (FIXED_FRAC - 16))) >> (FIXED_FRAC - 15);
+			d[i] = v > INT16_MAX ? INT16_MAX : v;
+		}
+	} else {
+		int32_t *d = dst;
+		for(i = 0; i < samples; i++) {
+			v = w[i] < FIXED_MIN ? FIXED_MIN : w[i] > FIXED_MAX ?
+					FIXED_MAX : w[i];
+			d[i] = (uint32_t)v << EQUAL_FIXED_HEADROOM;
+		}
+	}
+}
+
+void equal_fixed_run(equal_fixed_t *fx, const void *src, int src_format,
+		void *dst, int dst_format, unsigned long frames,
+		equal_fixed_levels_t *in, equal_fixed_levels_t *out)
+{
+	const unsigned int channels = fx->channels;
+	const size_t src_frame = channels*(src_format == EQUAL_FIXED_S16 ?
+			sizeof(int16_t) : sizeof(int32_t));
+	const size_t dst_frame = channels*(dst_format == EQUAL_FIXED_S16 ?
+			sizeof(int16_t) : sizeof(int32_t));
+	unsigned long done, n;
+
+	for(done = 0; done < frames; done += n) {
+		n = frames - done;
+		if(n > EQUAL_FIXED_BLOCK) {
+			n = EQUAL_FIXED_BLOCK;
+		}
+		fixed_import(fx, (const char *)src + done*src_frame, src_format, n);
+		fixed_measure(fx, n, in);
+		if(fx->stages > 0) {
+			fixed_multirate(fx, n);
+			fixed_bands(fx, ~fx->low, fx->work, n);
+		} else {
+			fixed_bands(fx, ~0U, fx->work, n);
+		}
+		fixed_measure(fx, n, out);
+		fixed_export(fx, (char *)dst + done*dst_frame, dst_format, n);
+	}
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#ifndef EQUAL_FIXED_H
+#define EQUAL_FIXED_H
+
+#include <stdint.h>
+
+/* Integer equalizer for S16/S32 streams, for hosts where float DSP and
+   the conversions around it cost too much.
+
+   Every band is a peaking biquad in direct form I with 32 bit samples,
+   32 bit coefficients and a 64 bit accumulator. Samples are kept as
+   Q4.27, i.e. 4 bits (24 dB) of headroom over full scale between bands.
+   The coefficients of a band share a Q format, the finest all of them
+   fit in, so a cut in the bass keeps its precision next to a big boost
+   in the treble. The accumulator wraps like two's complement, only the
+   result is saturated.
+
+   The scalar code is the reference, the SSE4.2 and AVX2 versions run
+   two and four channels at a time and produce the same bits.
+
+   Bands below a split frequency can run at a fraction of the rate, which
+   at 96 or 192 kHz both saves their CPU and gives their coefficients room.
+   The input is decimated by two, once per stage, with linear phase
+   half-band filters. The low bands filter the decimated signal and only
+   the change they make is interpolated back up, through the same
+   half-bands, and added to the input, delayed to line up. The full rate
+   bands then run on the sum. Flat low bands change nothing, the delay is
+   the same whatever the gains. */
+
+#define EQUAL_FIXED_MAX_BANDS 32
+#define EQUAL_FIXED_MAX_CHANNELS 16
+#define EQUAL_FIXED_HEADROOM 4
+/* Full scale of the levels: the peak, and the samples squared for sum */
+#define EQUAL_FIXED_PEAK_ONE (1U << (31 - EQUAL_FIXED_HEADROOM))
+#define EQUAL_FIXED_RMS_ONE (1U << 16)
+/* Frames converted and filtered at a time */
+#define EQUAL_FIXED_BLOCK 256
+/* Multirate: decimation stages, side taps per half-band, the lowest
+   rate as a multiple of the highest low band, and the delay line */
+#define EQUAL_FIXED_MAX_STAGES 5
+#define EQUAL_FIXED_HALFBAND_TAPS 6
+#define EQUAL_FIXED_LOW_RATIO 32
+#define EQUAL_FIXED_DELAY 1024
+#define EQUAL_FIXED_LOW_BLOCK (EQUAL_FIXED_BLOCK + (1 << EQUAL_FIXED_MAX_STAGES))
+
+enum {
+	EQUAL_FIXED_S16,
+	EQUAL_FIXED_S32
+};
+
+enum {
+	EQUAL_FIXED_SCALAR,
+	EQUAL_FIXED_SSE4,
+	EQUAL_FIXED_AVX2
+};
+
+/* Peak (Q4.27) and sum of squares (of Q16) per channel, accumulated */
+typedef struct equal_fixed_levels {
+	uint32_t peak[EQUAL_FIXED_MAX_CHANNELS];
+	uint64_t sum[EQUAL_FIXED_MAX_CHANNELS];
+} equal_fixed_levels_t;
+
+/* One band: b0 b1 b2 -a1 -a2 and the x1 x2 y1 y2 state, one 64 bit lane
+   per channel so the vector code loads them as they are */
+typedef struct equal_fixed_band {
+	int64_t coef[5][EQUAL_FIXED_MAX_CHANNELS];
+	int64_t state[4][EQUAL_FIXED_MAX_CHANNELS];
+	int shift;	/* Fractional bits of the coefficients */
+	int active;	/* 0 if flat on every channel */
+} __attribute__((aligned(32))) equal_fixed_band_t;
+
+/* One half-band stage. Only every other tap is non zero besides the
+   centre, which is 1/2, and the taps are symmetric, so coef[k] is the
+   tap 2k+1 away from the centre on either side (Q30). The histories
+   keep the last inputs of the decimator and of the interpolator. */
+typedef struct equal_fixed_stage {
+	int64_t coef[EQUAL_FIXED_HALFBAND_TAPS];
+	unsigned int taps;
+	int32_t down[EQUAL_FIXED_MAX_CHANNELS][4*EQUAL_FIXED_HALFBAND_TAPS - 2];
+	int32_t up[EQUAL_FIXED_MAX_CHANNELS][2*EQUAL_FIXED_HALFBAND_TAPS - 1];
+} equal_fixed_stage_t;
+
+typedef struct equal_fixed {
+	unsigned int channels;
+	unsigned int bands;
+	unsigned long rate;
+	int isa;
+	float freq[EQUAL_FIXED_MAX_BANDS];
+	float q[EQUAL_FIXED_MAX_BANDS];
+	/* Gains in dB as set, [band*channels + channel] */
+	float gain[EQUAL_FIXED_MAX_BANDS*EQUAL_FIXED_MAX_CHANNELS];
+	equal_fixed_band_t band[EQUAL_FIXED_MAX_BANDS];
+	int32_t work[EQUAL_FIXED_BLOCK*EQUAL_FIXED_MAX_CHANNELS]
+			__attribute__((aligned(32)));
+	/* Multirate: the bands below split, one bit each, and the stages
+	   set up for the rate, 0 if it runs at the full rate */
+	float split;
+	uint32_t low;
+	unsigned int stages;
+	unsigned int latency;	/* Frames the input is delayed by */
+	unsigned long pos;	/* Frames through the delay line */
+	equal_fixed_stage_t stage[EQUAL_FIXED_MAX_STAGES];
+	int32_t low_work[2][EQUAL_FIXED_LOW_BLOCK*EQUAL_FIXED_MAX_CHANNELS]
+			__attribute__((aligned(32)));
+	int32_t delay[EQUAL_FIXED_DELAY*EQUAL_FIXED_MAX_CHANNELS];
+} equal_fixed_t;
+
+/* Bands at the given centre frequencies, in Hz. The bandwidth of each
+   band follows the spacing to its neighbours. */
+equal_fixed_t *equal_fixed_create(unsigned int channels, unsigned int bands,
+		const float *freq);
+void equal_fixed_destroy(equal_fixed_t *fx);
+
+/* Centre frequency of a band from a port name such as "250 Hz" or
+   "1.5 kHz". Returns 0 on success, -1 if the name isn't a frequency. */
+int equal_fixed_parse_frequency(const char *name, float *freq);
+
+/* Pick the code path, the best the CPU supports by default. Asking for
+   one the CPU lacks gets the next best. Returns the one in use. */
+int equal_fixed_set_isa(equal_fixed_t *fx, int isa);
+const char *equal_fixed_isa_name(int isa);
+
+/* Run the bands below split, in Hz, at a decimated rate, 0 to run every
+   band at the full rate. Takes effect at the next reset, which picks the
+   number of stages for the rate; at too low a rate there are none.
+   Flat, the output is that of the full rate delayed by latency. A band
+   boosted or cut by 12 dB on its own comes within 0.02 dB of the design
+   at its centre; that is within 0.01 dB of the full rate at 96 kHz, and
+   up to 0.35 dB from it at 192 kHz, where the full rate misses the cuts
+   of the bands below 50 Hz. test-fixed checks both. Returns the number
+   of bands below split. */
+unsigned int equal_fixed_set_multirate(equal_fixed_t *fx, float split);
+
+/* Clear the filter state and set the sample rate. */
+void equal_fixed_reset(equal_fixed_t *fx, unsigned long rate);
+
+/* Set the gains in dB, laid out gain[band*channels + channel]. Only the
+   bands that changed are recomputed. */
+void equal_fixed_set(equal_fixed_t *fx, const float *gain);
+
+/* Filter interleaved frames from src to dst, either format on either
+   side, adding the levels before and after the equalizer to in and out. */
+void equal_fixed_run(equal_fixed_t *fx, const void *src, int src_format,
+		void *dst, int dst_format, unsigned long frames,
+		equal_fixed_levels_t *in, equal_fixed_levels_t *out);
+
+#endif
@@ -0,0 +1,482 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "ladspa.h"
+#include "ladspa_utils.h"
+#include "graph.h"
+
+typedef float v4sf __attribute__((vector_size(16)));
+
+/* dst += gain*src, four samples at a time. The planar channel offsets
+   aren't necessarily 16 byte aligned so the vectors go through memcpy,
+   which compiles to unaligned loads and stores. */
+static void graph_add(float *dst, const float *src, float gain,
+		unsigned long n)
+{
+	v4sf a, b, g = { gain, gain, gain, gain };
+	unsigned long i;
+
+	for(i = 0; i + 4 <= n; i += 4) {
+		memcpy(&a, dst + i, sizeof(a));
+		memcpy(&b, src + i, sizeof(b));
+		a += g*b;
+		memcpy(dst + i, &a, sizeof(a));
+	}
+	for(; i < n; i++) {
+		dst[i] += gain*src[i];
+	}
+}
+
+/* Buffers come from the caller's memory if it gave one, otherwise they
+   are mapped */
+static float *graph_alloc(equal_graph_t *graph, unsigned long floats)
+{
+	float *ptr;
+
+	if(graph->memory.alloc != NULL) {
+		return graph->memory.alloc(graph->memory.arg, floats*sizeof(float));
+	}
+	ptr = mmap(NULL, floats*sizeof(float), PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return ptr != MAP_FAILED ? ptr : NULL;
+}
+
+static void graph_free(equal_graph_t *graph, float *ptr, unsigned long floats)
+{
+	if(ptr == NULL) {
+		return;
+	}
+	if(graph->memory.release != NULL) {
+		graph->memory.release(graph->memory.arg, ptr, floats*sizeof(float));
+	} else {
+		munmap(ptr, floats*sizeof(float));
+	}
+}
+
+equal_graph_t *equal_graph_create(unsigned int channels)
+{
+	equal_graph_t *graph;
+
+	graph = calloc(1, sizeof(*graph));
+	if(graph == NULL) {
+		return NULL;
+	}
+	graph->channels = channels;
+	sem_init(&graph->done, 0, 0);
+	return graph;
+}
+
+int equal_graph_add_branch(equal_graph_t *graph, const char *library,
+		const char *module, LADSPA_Data gain, const LADSPA_Data *controls,
+		unsigned int num_controls)
+{
+	equal_branch_t *branch;
+	const LADSPA_Descriptor *klass;
+	const char *reason;
+	unsigned long i;
+	int input = -1, output = -1;
+
+	if(graph->num_branches == EQUAL_GRAPH_MAX_BRANCHES) {
+		fprintf(stderr, "Can only run a maximum of %d branches.\n",
+				EQUAL_GRAPH_MAX_BRANCHES);
+		return -EINVAL;
+	}
+	branch = &graph->branch[graph->num_branches];
+	memset(branch, 0, sizeof(*branch));
+	branch->gain = gain;
+
+	if(library != NULL) {
+		branch->library = LADSPAtryLoad(library);
+		if(branch->library == NULL) {
+			fprintf(stderr, "Can't load branch library %s: %s\n", library,
+					dlerror());
+			return -ENOENT;
+		}
+		klass = LADSPAtryFind(branch->library, module);
+		if(klass == NULL) {
+			fprintf(stderr, "No module %s in branch library %s\n", module,
+					library);
+			LADSPAunload(branch->library);
+			return -ENOENT;
+		}
+		reason = LADSPAincompatible(klass);
+		if(reason != NULL) {
+			fprintf(stderr, "LADSPA plugin %s can't be used: %s\n",
+					module, reason);
+			LADSPAunload(branch->library);
+			return -EINVAL;
+		}
+		for(i = 0; i < klass->PortCount; i++) {
+			if(klass->PortDescriptors[i] ==
+					(LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO)) {
+				input = i;
+			} else if(klass->PortDescriptors[i] ==
+					(LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO)) {
+				output = i;
+			}
+		}
+		branch->klass = klass;
+		branch->input_index = input;
+		branch->output_index = output;
+		branch->adding = klass->run_adding != NULL &&
+				(gain == 1 || klass->set_run_adding_gain != NULL);
+	}
+
+	if(num_controls > 0) {
+		branch->values = malloc(num_controls*sizeof(LADSPA_Data));
+		if(branch->values == NULL) {
+			if(branch->library != NULL) {
+				LADSPAunload(branch->library);
+			}
+			return -ENOMEM;
+		}
+		memcpy(branch->values, controls, num_controls*sizeof(LADSPA_Data));
+		branch->num_values = num_controls;
+	}
+
+	graph->num_branches++;
+	return 0;
+}
+
+/* Instantiate a branch for every channel and connect its control ports
+   to the configured values, or the defaults. */
+static int graph_instantiate(equal_graph_t *graph, equal_branch_t *branch,
+		unsigned long rate)
+{
+	const LADSPA_Descriptor *klass = branch->klass;
+	LADSPA_Data *ports;
+	unsigned long i, n;
+	unsigned int j;
+
+	branch->instance = calloc(graph->channels, sizeof(LADSPA_Handle));
+	branch->ports = calloc(graph->channels*klass->PortCount,
+			sizeof(LADSPA_Data));
+	if(branch->instance == NULL || branch->ports == NULL) {
+		return -ENOMEM;
+	}
+
+	for(j = 0; j < graph->channels; j++) {
+		branch->instance[j] = klass->instantiate(klass, rate);
+		if(branch->instance[j] == NULL) {
+			return -ENOMEM;
+		}
+		ports = &branch->ports[j*klass->PortCount];
+		for(i = 0, n = 0; i < klass->PortCount; i++) {
+			if(!LADSPA_IS_PORT_CONTROL(klass->PortDescriptors[i])) {
+				continue;
+			}
+			if(LADSPA_IS_PORT_INPUT(klass->PortDescriptors[i])) {
+				if(n < branch->num_values) {
+					ports[i] = branch->values[n];
+				} else {
+					LADSPADefault(&klass->PortRangeHints[i], rate, &ports[i]);
+				}
+				n++;
+			}
+			klass->connect_port(branch->instance[j], i, &ports[i]);
+		}
+		if(branch->adding && klass->set_run_adding_gain != NULL) {
+			klass->set_run_adding_gain(branch->instance[j], branch->gain);
+		}
+		if(klass->activate) {
+			klass->activate(branch->instance[j]);
+		}
+	}
+	return 0;
+}
+
+static void graph_release(equal_graph_t *graph, equal_branch_t *branch)
+{
+	unsigned int j;
+
+	if(branch->instance != NULL) {
+		for(j = 0; j < graph->channels; j++) {
+			if(branch->instance[j] == NULL) {
+				continue;
+			}
+			if(branch->klass->deactivate) {
+				branch->klass->deactivate(branch->instance[j]);
+			}
+			if(branch->klass->cleanup) {
+				branch->klass->cleanup(branch->instance[j]);
+			}
+		}
+	}
+	free(branch->instance);
+	free(branch->ports);
+	branch->instance = NULL;
+	branch->ports = NULL;
+}
+
+/* Run the jobs that belong to worker t over the current piece */
+static void graph_run_jobs(equal_graph_t *graph, unsigned int t)
+{
+	equal_branch_t *branch;
+	const float *in;
+	float *base = graph->acc[t], *dst;
+	unsigned long stride = graph->max_frames, frames = graph->frames;
+	unsigned int j, k, jobs;
+
+	for(j = 0; j < graph->channels; j++) {
+		memset(base + j*stride, 0, frames*sizeof(float));
+	}
+
+	jobs = graph->num_branches*graph->channels;
+	for(k = t; k < jobs; k += graph->num_threads) {
+		branch = &graph->branch[k/graph->channels];
+		j = k%graph->channels;
+		in = graph->in + j*graph->stride + graph->offset;
+		dst = base + j*stride;
+
+		if(branch->klass == NULL || graph->bypass) {
+			graph_add(dst, in, branch->gain, frames);
+		} else if(branch->adding) {
+			branch->klass->connect_port(branch->instance[j],
+					branch->input_index, (LADSPA_Data *)in);
+			branch->klass->connect_port(branch->instance[j],
+					branch->output_index, dst);
+			branch->klass->run_adding(branch->instance[j], frames);
+		} else {
+			branch->klass->connect_port(branch->instance[j],
+					branch->input_index, (LADSPA_Data *)in);
+			branch->klass->connect_port(branch->instance[j],
+					branch->output_index, graph->scratch[t]);
+			branch->klass->run(branch->instance[j], frames);
+			graph_add(dst, graph->scratch[t], branch->gain, frames);
+		}
+	}
+}
+
+static void *graph_worker_thread(void *arg)
+{
+	equal_graph_worker_t *worker = arg;
+	equal_graph_t *graph = worker->graph;
+
+	while(1) {
+		while(sem_wait(&worker->start) < 0 && errno == EINTR);
+		if(!__atomic_load_n(&graph->running, __ATOMIC_ACQUIRE)) {
+			break;
+		}
+		graph_run_jobs(graph, worker->index);
+		sem_post(&graph->done);
+	}
+	return NULL;
+}
+
+/* Start a worker, with real-time scheduling if asked and allowed */
+static int graph_worker_start(equal_graph_worker_t *worker, int priority)
+{
+	pthread_attr_t attr;
+	struct sched_param param;
+	int err;
+
+	if(priority > 0) {
+		pthread_attr_init(&attr);
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		param.sched_priority = priority;
+		pthread_attr_setschedparam(&attr, &param);
+		err = pthread_create(&worker->thread, &attr, graph_worker_thread,
+				worker);
+		pthread_attr_destroy(&attr);
+		if(err == 0) {
+			return 0;
+		}
+	}
+	return -pthread_create(&worker->thread, NULL, graph_worker_thread,
+			worker);
+}
+
+int equal_graph_start(equal_graph_t *graph, unsigned long rate,
+		unsigned long max_frames, unsigned int threads, int priority,
+		const equal_graph_memory_t *memory)
+{
+	unsigned int b, t, jobs;
+	long cpus;
+	int err;
+
+	jobs = graph->num_branches*graph->channels;
+	if(threads == 0) {
+		threads = graph->num_branches;
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		if(cpus > 0 && threads > cpus) {
+			threads = cpus;
+		}
+	}
+	if(threads > jobs) {
+		threads = jobs;
+	}
+	if(threads < 1) {
+		threads = 1;
+	}
+	graph->num_threads = threads;
+	graph->max_frames = max_frames;
+	if(memory != NULL) {
+		graph->memory = *memory;
+	} else {
+		memset(&graph->memory, 0, sizeof(graph->memory));
+	}
+
+	for(b = 0; b < graph->num_branches; b++) {
+		if(graph->branch[b].klass != NULL) {
+			err = graph_instantiate(graph, &graph->branch[b], rate);
+			if(err < 0) {
+				goto fail;
+			}
+		}
+	}
+
+	err = -ENOMEM;
+	graph->acc = calloc(threads, sizeof(float *));
+	graph->scratch = calloc(threads, sizeof(float *));
+	graph->worker = calloc(threads, sizeof(equal_graph_worker_t));
+	if(graph->acc == NULL || graph->scratch == NULL || graph->worker == NULL) {
+		goto fail;
+	}
+	for(t = 0; t < threads; t++) {
+		graph->scratch[t] = graph_alloc(graph, max_frames);
+		if(graph->scratch[t] == NULL) {
+			goto fail;
+		}
+		graph->acc[t] = graph_alloc(graph, max_frames*graph->channels);
+		if(graph->acc[t] == NULL) {
+			goto fail;
+		}
+	}
+
+	__atomic_store_n(&graph->running, 1, __ATOMIC_RELEASE);
+	for(t = 1; t < threads; t++) {
+		graph->worker[t].graph = graph;
+		graph->worker[t].index = t;
+		sem_init(&graph->worker[t].start, 0, 0);
+		err = graph_worker_start(&graph->worker[t], priority);
+		if(err < 0) {
+			sem_destroy(&graph->worker[t].start);
+			goto fail;
+		}
+		graph->worker[t].started = 1;
+	}
+	return 0;
+
+fail:
+	equal_graph_stop(graph);
+	return err;
+}
+
+void equal_graph_stop(equal_graph_t *graph)
+{
+	unsigned int b, t;
+
+	if(graph->worker != NULL) {
+		__atomic_store_n(&graph->running, 0, __ATOMIC_RELEASE);
+		for(t = 1; t < graph->num_threads; t++) {
+			if(graph->worker[t].started) {
+				sem_post(&graph->worker[t].start);
+				pthread_join(graph->worker[t].thread, NULL);
+				sem_destroy(&graph->worker[t].start);
+			}
+		}
+	}
+	for(t = 0; t < graph->num_threads; t++) {
+		if(graph->acc != NULL) {
+			graph_free(graph, graph->acc[t],
+					graph->max_frames*graph->channels);
+		}
+		if(graph->scratch != NULL) {
+			graph_free(graph, graph->scratch[t], graph->max_frames);
+		}
+	}
+	free(graph->acc);
+	free(graph->scratch);
+	free(graph->worker);
+	graph->acc = NULL;
+	graph->scratch = NULL;
+	graph->worker = NULL;
+	graph->num_threads = 0;
+
+	for(b = 0; b < graph->num_branches; b++) {
+		graph_release(graph, &graph->branch[b]);
+	}
+}
+
+void equal_graph_run(equal_graph_t *graph, const float *in, float *out,
+		unsigned long frames)
+{
+	unsigned long offset, chunk;
+	unsigned int j, t;
+
+	graph->in = in;
+	graph->out = out;
+	graph->stride = frames;
+
+	for(offset = 0; offset < frames; offset += chunk) {
+		chunk = frames - offset;
+		if(chunk > graph->max_frames) {
+			chunk = graph->max_frames;
+		}
+		graph->offset = offset;
+		graph->frames = chunk;
+
+		for(t = 1; t < graph->num_threads; t++) {
+			sem_post(&graph->worker[t].start);
+		}
+		graph_run_jobs(graph, 0);
+		for(t = 1; t < graph->num_threads; t++) {
+			while(sem_wait(&graph->done) < 0 && errno == EINTR);
+		}
+
+		/* Every job is done with this piece of in, so the sum can
+		   overwrite it */
+		for(j = 0; j < graph->channels; j++) {
+			memcpy(out + j*frames + offset, graph->acc[0] + j*graph->max_frames,
+					chunk*sizeof(float));
+			for(t = 1; t < graph->num_threads; t++) {
+				graph_add(out + j*frames + offset,
+						graph->acc[t] + j*graph->max_frames, 1, chunk);
+			}
+		}
+	}
+}
+
+void equal_graph_destroy(equal_graph_t *graph)
+{
+	unsigned int b;
+
+	if(graph == NULL) {
+		return;
+	}
+	equal_graph_stop(graph);
+	for(b = 0; b < graph->num_branches; b++) {
+		if(graph->branch[b].library != NULL) {
+			LADSPAunload(graph->branch[b].library);
+		}
+		free(graph->branch[b].values);
+	}
+	sem_destroy(&graph->done);
+	free(graph);
+}
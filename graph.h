@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#ifndef EQUAL_GRAPH_H
+#define EQUAL_GRAPH_H
+
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "ladspa.h"
+
+/* Parallel branches behind the equalizer. The equalizer's output is fed
+   to every branch, each a single LADSPA module (or a plain wire for a dry
+   path) with its own gain, and the branches are summed into the output:
+
+       eq -+-> branch 0 -+-> out
+           +-> branch 1 -+
+           +-> ...      -+
+
+   This is a fixed one-level fan-out, not a general graph. Every (branch,
+   channel) pair is an independent job. Jobs are spread over a fixed set
+   of worker threads, the caller being worker 0. Each worker sums its jobs
+   straight into its own accumulator with run_adding() where the plugin
+   has it, so branches need no buffers of their own; the accumulators of
+   a piece are added together into the output once every job is done with
+   the piece, which lets the output replace the input. */
+
+#define EQUAL_GRAPH_MAX_BRANCHES 16
+
+/* Where the buffers come from, so that the PCM can lock and account for
+   them with the rest of its audio path. alloc returns zeroed memory or
+   NULL. */
+typedef struct equal_graph_memory {
+	void *(*alloc)(void *arg, size_t bytes);
+	void (*release)(void *arg, void *ptr, size_t bytes);
+	void *arg;
+} equal_graph_memory_t;
+
+typedef struct equal_branch {
+	void *library;			/* NULL for a dry path */
+	const LADSPA_Descriptor *klass;
+	LADSPA_Data gain;
+	LADSPA_Data *values;		/* Configured control inputs, in port order */
+	unsigned int num_values;
+	int adding;			/* Sum with run_adding() */
+	unsigned long input_index;
+	unsigned long output_index;
+	LADSPA_Data *ports;		/* [channels][PortCount] control values */
+	LADSPA_Handle *instance;	/* [channels] */
+} equal_branch_t;
+
+typedef struct equal_graph_worker {
+	struct equal_graph *graph;
+	unsigned int index;
+	pthread_t thread;
+	int started;
+	sem_t start;
+} equal_graph_worker_t;
+
+typedef struct equal_graph {
+	unsigned int channels;
+	unsigned int num_branches;
+	equal_branch_t branch[EQUAL_GRAPH_MAX_BRANCHES];
+	/* Set between runs: the module branches pass their input with their
+	   gain like dry paths, which keeps the routing without their cost */
+	int bypass;
+	/* Valid between equal_graph_start() and equal_graph_stop() */
+	unsigned int num_threads;
+	unsigned long max_frames;
+	equal_graph_memory_t memory;
+	int running;
+	float **acc;			/* [num_threads] */
+	float **scratch;		/* [num_threads], for plugins without run_adding */
+	equal_graph_worker_t *worker;	/* [num_threads], worker 0 is unused */
+	sem_t done;
+	/* Current piece of the block, channel j of in and out starts at
+	   j*stride + offset */
+	const float *in;
+	float *out;
+	unsigned long stride;
+	unsigned long offset;
+	unsigned long frames;
+} equal_graph_t;
+
+equal_graph_t *equal_graph_create(unsigned int channels);
+
+/* Add a branch running module from library, or a dry path when library is
+   NULL. Control inputs not given in controls take the plugin's defaults.
+   Returns 0 or a negative errno, -ENOENT if the library or the module
+   can't be found. */
+int equal_graph_add_branch(equal_graph_t *graph, const char *library,
+		const char *module, LADSPA_Data gain, const LADSPA_Data *controls,
+		unsigned int num_controls);
+
+/* Instantiate the branches for rate and start threads workers (0 picks
+   one per branch, up to the number of CPUs). Blocks passed to
+   equal_graph_run() are split into max_frames pieces. A priority above 0
+   asks for SCHED_FIFO workers. The buffers come from memory, or are
+   mapped privately if it is NULL. */
+int equal_graph_start(equal_graph_t *graph, unsigned long rate,
+		unsigned long max_frames, unsigned int threads, int priority,
+		const equal_graph_memory_t *memory);
+void equal_graph_stop(equal_graph_t *graph);
+
+/* Run the branches over planar (channel after channel) in and write the
+   sum to out, which may be in itself but must not overlap it otherwise. */
+void equal_graph_run(equal_graph_t *graph, const float *in, float *out,
+		unsigned long frames);
+
+void equal_graph_destroy(equal_graph_t *graph);
+
+#endif
@@ -3,6 +3,8 @@
    warranty.
   ------------------------------------------------------------------*/
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -13,9 +15,22 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <math.h>
+#include <sched.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <limits.h>
 
 #include "ladspa.h"
 #include "ladspa_utils.h"
+#include "probes.h"
+
+EQUAL_PROBE_SEMAPHORE(ladspa_load);
+EQUAL_PROBE_SEMAPHORE(ladspa_find);
+EQUAL_PROBE_SEMAPHORE(control_mmap);
 
 /* ------------------------------------------------------------------ */
 
@@ -120,6 +135,10 @@ dlopenLADSPA(const char * pcFilename, int iFlag) {
 void * LADSPAload(const char * pcPluginFilename) {
 
   void * pvPluginHandle;
+  uint64_t start = 0;
+
+  if (EQUAL_PROBE_ENABLED(ladspa_load))
+    start = equal_probe_now();
 
   pvPluginHandle = dlopenLADSPA(pcPluginFilename, RTLD_NOW);
   if (!pvPluginHandle) {
@@ -130,6 +149,8 @@ void * LADSPAload(const char * pcPluginFilename) {
     exit(1);
   }
 
+  EQUAL_PROBE2(ladspa_load, pcPluginFilename, equal_probe_now() - start);
+
   return pvPluginHandle;
 }
 
@@ -145,6 +166,10 @@ const LADSPA_Descriptor * LADSPAfind(void * pvLADSPAPluginLibrary,
   const LADSPA_Descriptor * psDescriptor;
   LADSPA_Descriptor_Function pfDescriptorFunction;
   unsigned long lPluginIndex;
+  uint64_t start = 0;
+
+  if (EQUAL_PROBE_ENABLED(ladspa_find))
+    start = equal_probe_now();
 
   dlerror();
   pfDescriptorFunction
@@ -172,6 +197,36 @@ const LADSPA_Descriptor * LADSPAfind(void * pvLADSPAPluginLibrary,
 	      pcPluginLibraryFilename);
       exit(1);
     }
+    if (strcmp(psDescriptor->Label, pcPluginLabel) == 0) {
+      EQUAL_PROBE2(ladspa_find, pcPluginLabel, equal_probe_now() - start);
+      return psDescriptor;
+    }
+  }
+}
+
+/* ------------------------------------------------------------------ */
+
+void * LADSPAtryLoad(const char * pcPluginFilename) {
+  return dlopenLADSPA(pcPluginFilename, RTLD_NOW);
+}
+
+const LADSPA_Descriptor *
+LADSPAtryFind(void * pvLADSPAPluginLibrary, const char * pcPluginLabel) {
+
+  const LADSPA_Descriptor * psDescriptor;
+  LADSPA_Descriptor_Function pfDescriptorFunction;
+  unsigned long lPluginIndex;
+
+  pfDescriptorFunction
+    = (LADSPA_Descriptor_Function)dlsym(pvLADSPAPluginLibrary,
+					"ladspa_descriptor");
+  if (!pfDescriptorFunction)
+    return NULL;
+
+  for (lPluginIndex = 0;; lPluginIndex++) {
+    psDescriptor = pfDescriptorFunction(lPluginIndex);
+    if (psDescriptor == NULL)
+      return NULL;
     if (strcmp(psDescriptor->Label, pcPluginLabel) == 0)
       return psDescriptor;
   }
@@ -179,6 +234,36 @@ const LADSPA_Descriptor * LADSPAfind(void * pvLADSPAPluginLibrary,
 
 /* ------------------------------------------------------------------ */
 
+const char * LADSPAincompatible(const LADSPA_Descriptor * psDescriptor) {
+
+  unsigned long lPortIndex;
+  int iInputs = 0;
+  int iOutputs = 0;
+
+  for (lPortIndex = 0; lPortIndex < psDescriptor->PortCount; lPortIndex++) {
+    if (psDescriptor->PortDescriptors[lPortIndex]
+	== (LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO))
+      iInputs++;
+    else if (psDescriptor->PortDescriptors[lPortIndex]
+	     == (LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO))
+      iOutputs++;
+  }
+
+  if (iInputs == 0)
+    return "no audio input";
+  if (iInputs > 1)
+    return "more than one audio input";
+  if (iOutputs == 0)
+    return "no audio output";
+  if (iOutputs > 1)
+    return "more than one audio output";
+  if (psDescriptor->run == NULL)
+    return "no run()";
+  return NULL;
+}
+
+/* ------------------------------------------------------------------ */
+
 int LADSPADefault(const LADSPA_PortRangeHint * psPortRangeHint,
 		 const unsigned long          lSampleRate,
 		 LADSPA_Data                * pfResult) {
@@ -257,28 +342,475 @@ int LADSPADefault(const LADSPA_PortRangeHint * psPortRangeHint,
 
 /* ------------------------------------------------------------------ */
 
-void LADSPAcontrolUnMMAP(LADSPA_Control *control)
+/* The live control block is kept in POSIX shared memory, named after the
+   controls file, so that slider moves never touch the file system. The
+   controls file itself is only written back a little while after the
+   last change and when a process closes the controls. */
+#define LADSPA_CNTRL_SAVE_DELAY_MS 2000
+
+/* Bytes of the shared memory object that are locked, as open file
+   description locks so that the maps of one process don't share them.
+   Every user holds a read lock on LADSPA_CNTRL_LIVE_BYTE for as long as
+   it has the block mapped, so the last one out can tell even if others
+   died without detaching, and a write lock on LADSPA_CNTRL_INIT_BYTE
+   while it attaches or detaches. */
+#define LADSPA_CNTRL_INIT_BYTE 0
+#define LADSPA_CNTRL_LIVE_BYTE 1
+
+typedef struct LADSPA_Control_Map_ {
+	LADSPA_Control *control;
+	char *filename;
+	char shmname[64];
+	int fd;
+	timer_t timer;
+	int timer_valid;
+	int dirty;
+	struct LADSPA_Control_Map_ *next;
+} LADSPA_Control_Map;
+
+static pthread_mutex_t LADSPAmapLock = PTHREAD_MUTEX_INITIALIZER;
+static LADSPA_Control_Map *LADSPAmaps = NULL;
+
+static LADSPA_Control_Map *LADSPAcontrolFindMap(const LADSPA_Control *control)
 {
-	munmap(control, control->length);
+	LADSPA_Control_Map *map;
+	for(map = LADSPAmaps; map != NULL; map = map->next) {
+		if(map->control == control) {
+			return map;
+		}
+	}
+	return NULL;
 }
 
-LADSPA_Control * LADSPAcontrolMMAP(const LADSPA_Descriptor *psDescriptor,
-		const char *controls_filename, unsigned int channels)
+/* Name of the shared memory object backing a controls file. The size of
+   the header is part of it so that a build with another layout never
+   maps a block left behind by this one. */
+static void LADSPAcontrolShmName(const char *filename, char *name, size_t len)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	const unsigned char *p;
+
+	for(p = (const unsigned char *)filename; *p != '\0'; p++) {
+		hash ^= *p;
+		hash *= 1099511628211ULL;
+	}
+	snprintf(name, len, "/alsaequal-%u-%zx-%016" PRIx64,
+			(unsigned int)getuid(), sizeof(LADSPA_Control), hash);
+}
+
+static int LADSPAcontrolLock(int fd, short type, off_t byte, int wait)
+{
+	struct flock fl;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = byte;
+	fl.l_len = 1;
+	while(fcntl(fd, wait ? F_OFD_SETLKW : F_OFD_SETLK, &fl) < 0) {
+		if(errno != EINTR) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Fold one control port's metadata into an FNV-1a hash. Names are
+   hashed as stored, cut to the size of LADSPA_Control_Data.name. */
+static uint64_t LADSPAcontrolHashPort(uint64_t hash, int32_t index,
+		const char *name, int32_t hint, LADSPA_Data lower, LADSPA_Data upper)
+{
+	const unsigned char *p;
+	size_t i, len;
+	struct {
+		int32_t index;
+		int32_t hint;
+		LADSPA_Data lower;
+		LADSPA_Data upper;
+	} fixed = { index, hint, lower, upper };
+
+	len = strnlen(name, sizeof(((LADSPA_Control_Data *)0)->name) - 1);
+	for(i = 0, p = (const unsigned char *)name; i <= len; i++) {
+		hash ^= i < len ? p[i] : 0;
+		hash *= 1099511628211ULL;
+	}
+	for(i = 0, p = (const unsigned char *)&fixed; i < sizeof(fixed); i++) {
+		hash ^= p[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/* Hash of the port metadata stored in control. */
+static uint64_t LADSPAcontrolMetaHash(const LADSPA_Control *control)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	unsigned long i;
+
+	for(i = 0; i < control->num_controls; i++) {
+		hash = LADSPAcontrolHashPort(hash, control->control[i].index,
+				control->control[i].name, control->control[i].hint,
+				control->control[i].lower, control->control[i].upper);
+	}
+	return hash;
+}
+
+/* Hash of the metadata psDescriptor would store, see
+   LADSPAcontrolMetaHash(). */
+static uint64_t LADSPAcontrolDescriptorHash(
+		const LADSPA_Descriptor *psDescriptor)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	const LADSPA_PortRangeHint *hint;
+	unsigned long i;
+
+	for(i = 0; i < psDescriptor->PortCount; i++) {
+		if(psDescriptor->PortDescriptors[i]&LADSPA_PORT_CONTROL) {
+			hint = &psDescriptor->PortRangeHints[i];
+			hash = LADSPAcontrolHashPort(hash, i, psDescriptor->PortNames[i],
+					hint->HintDescriptor, hint->LowerBound, hint->UpperBound);
+		}
+	}
+	return hash;
+}
+
+/* Record what the ctl plugin needs to know about the plugin's ports so
+   that it can build its elements without loading the plugin. */
+static void LADSPAcontrolFillMeta(LADSPA_Control *control,
+		const LADSPA_Descriptor *psDescriptor, const char *library)
+{
+	const LADSPA_PortRangeHint *hint;
+	unsigned long i;
+
+	snprintf(control->label, sizeof(control->label), "%s",
+			psDescriptor->Label);
+	snprintf(control->name, sizeof(control->name), "%s",
+			psDescriptor->Name);
+	snprintf(control->library, sizeof(control->library), "%s", library);
+	for(i = 0; i < control->num_controls; i++) {
+		hint = &psDescriptor->PortRangeHints[control->control[i].index];
+		control->control[i].hint = hint->HintDescriptor;
+		control->control[i].lower = hint->LowerBound;
+		control->control[i].upper = hint->UpperBound;
+		snprintf(control->control[i].name, sizeof(control->control[i].name),
+				"%s", psDescriptor->PortNames[control->control[i].index]);
+	}
+	control->meta_id = psDescriptor->UniqueID;
+	control->meta_hash = LADSPAcontrolMetaHash(control);
+	control->meta_version = LADSPA_CNTRL_META_VERSION;
+}
+
+/* Build the default controls for a plugin. */
+static LADSPA_Control *LADSPAcontrolDefaults(
+		const LADSPA_Descriptor *psDescriptor, const char *library,
+		unsigned int channels, unsigned long num_controls,
+		unsigned long length)
 {
-	const char * homePath;
-	char *filename;
-	unsigned long i, j, num_controls, index;
 	LADSPA_Control *default_controls;
-	LADSPA_Control *ptr;
+	const char *reason;
+	unsigned long i, j, index;
+
+	reason = LADSPAincompatible(psDescriptor);
+	if(reason != NULL) {
+		fprintf(stderr, "LADSPA plugin %s can't be used: %s\n",
+				psDescriptor->Label, reason);
+		return NULL;
+	}
+	default_controls = calloc(1, length);
+	if(default_controls == NULL) {
+		return NULL;
+	}
+	default_controls->length = length;
+	default_controls->id = psDescriptor->UniqueID;
+	default_controls->channels = channels;
+	default_controls->num_controls = num_controls;
+	default_controls->input_index = -1;
+	default_controls->output_index = -1;
+	default_controls->seq = 0;
+	default_controls->writer = 0;
+	default_controls->waiters = 0;
+	default_controls->output_seq = 0;
+	for(i = 0, index=0; i < psDescriptor->PortCount; i++) {
+		if(psDescriptor->PortDescriptors[i]&LADSPA_PORT_CONTROL) {
+				default_controls->control[index].index = i;
+				LADSPADefault(&psDescriptor->PortRangeHints[i], 44100,
+						&default_controls->control[index].data[0]);
+			for(j = 1; j < channels; j++) {
+				default_controls->control[index].data[j] =
+						default_controls->control[index].data[0];
+			}
+			if(psDescriptor->PortDescriptors[i]&LADSPA_PORT_INPUT) {
+				default_controls->control[index].type = LADSPA_CNTRL_INPUT;
+			} else {
+				default_controls->control[index].type = LADSPA_CNTRL_OUTPUT;
+			}
+			index++;
+		} else if(psDescriptor->PortDescriptors[i] ==
+				(LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO)) {
+			default_controls->input_index = i;
+		} else if(psDescriptor->PortDescriptors[i] ==
+				(LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO)) {
+			default_controls->output_index = i;
+		}
+	}
+	LADSPAcontrolFillMeta(default_controls, psDescriptor, library);
+	return default_controls;
+}
+
+/* Read a controls file into memory. Returns NULL if there is no usable
+   file; *stale is set when the file belongs to this plugin but was
+   written with a different layout. */
+static LADSPA_Control *LADSPAcontrolLoad(const char *filename,
+		uint32_t id, unsigned int channels, unsigned long length, int *stale)
+{
+	LADSPA_Control *controls;
 	int fd;
-	unsigned long length;
 
-	if(channels > 16) {
-		fprintf(stderr, "Can only control a maximum of 16 channels.\n");
+	*stale = 0;
+	fd = open(filename, O_RDONLY);
+	if(fd < 0) {
+		return NULL;
+	}
+	controls = malloc(length);
+	if(controls == NULL) {
+		close(fd);
 		return NULL;
 	}
+	if(read(fd, controls, length) < (ssize_t)(3*sizeof(uint32_t))) {
+		fprintf(stderr, "%s is too short.\n", filename);
+		*stale = 1;
+	} else if(controls->id != id) {
+		fprintf(stderr, "%s is not a control file for ladspa id %" PRId32 ".\n",
+				filename, controls->id);
+	} else if(controls->channels != channels) {
+		fprintf(stderr, "%s is not a control file doesn't have %ud channels.\n",
+				filename, channels);
+	} else if(controls->length != length) {
+		fprintf(stderr, "%s is the wrong length, resetting to defaults.\n",
+				filename);
+		*stale = 1;
+	} else {
+		close(fd);
+		return controls;
+	}
+	close(fd);
+	free(controls);
+	return NULL;
+}
+
+/* Take a consistent copy of the whole block to write back */
+static LADSPA_Control *LADSPAcontrolCopy(const LADSPA_Control *control)
+{
+	LADSPA_Control *copy;
+	uint32_t seq;
+	long long since = 0;
+
+	copy = malloc(control->length);
+	if(copy == NULL) {
+		return NULL;
+	}
+	do {
+		while((seq = __atomic_load_n(&control->seq, __ATOMIC_ACQUIRE)) & 1) {
+			if(LADSPAcontrolReadBusy(control, &since)) {
+				/* Torn by a writer that died, the next one saves it */
+				free(copy);
+				return NULL;
+			}
+		}
+		memcpy(copy, control, control->length);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while(__atomic_load_n(&control->seq, __ATOMIC_RELAXED) != seq);
+	copy->seq = 0;
+	copy->writer = 0;
+	copy->waiters = 0;
+	copy->output_seq = 0;
+	return copy;
+}
+
+/* Write a private copy of the controls to their file. The data goes to a
+   temporary file first which is renamed over the original so that a
+   crash never leaves a half-written controls file behind. */
+static int LADSPAcontrolSave(const LADSPA_Control *copy,
+		const char *filename)
+{
+	char *tmpname;
+	int fd, ret = -1;
+
+	tmpname = malloc(strlen(filename) + 8);
+	if(tmpname == NULL) {
+		return -1;
+	}
+
+	sprintf(tmpname, "%s.XXXXXX", filename);
+	fd = mkstemp(tmpname);
+	if(fd < 0) {
+		fprintf(stderr, "Failed to save controls file:%s.\n", filename);
+		goto out;
+	}
+	fchmod(fd, 0664);
+	if(write(fd, copy, copy->length) != (ssize_t)copy->length ||
+			fsync(fd) < 0) {
+		fprintf(stderr, "Failed to save controls file:%s.\n", filename);
+		close(fd);
+		unlink(tmpname);
+		goto out;
+	}
+	close(fd);
+	if(rename(tmpname, filename) < 0) {
+		fprintf(stderr, "Failed to save controls file:%s.\n", filename);
+		unlink(tmpname);
+		goto out;
+	}
+	ret = 0;
+out:
+	free(tmpname);
+	return ret;
+}
+
+/* Write the controls back to their file */
+static int LADSPAcontrolPersist(const LADSPA_Control *control,
+		const char *filename)
+{
+	LADSPA_Control *copy;
+	int ret;
+
+	copy = LADSPAcontrolCopy(control);
+	if(copy == NULL) {
+		return -1;
+	}
+	ret = LADSPAcontrolSave(copy, filename);
+	free(copy);
+	return ret;
+}
+
+/* Mark a map as having changes that aren't in the file yet, if it is
+   still open. Called with LADSPAmapLock held. */
+static void LADSPAcontrolRedirty(const LADSPA_Control_Map *target)
+{
+	LADSPA_Control_Map *map;
+	for(map = LADSPAmaps; map != NULL; map = map->next) {
+		if(map == target) {
+			map->dirty = 1;
+			break;
+		}
+	}
+}
+
+/* The copy is taken under LADSPAmapLock, which keeps the map from being
+   closed meanwhile, and written out without it so that the fsync()
+   doesn't hold up other maps. */
+static void LADSPAcontrolSaveTimer(union sigval sv)
+{
+	LADSPA_Control_Map *map;
+	LADSPA_Control *copy = NULL;
+	char *filename = NULL;
+	int save = 0;
+
+	pthread_mutex_lock(&LADSPAmapLock);
+	/* The map may have been closed while the timer was in flight */
+	for(map = LADSPAmaps; map != NULL; map = map->next) {
+		if(map == sv.sival_ptr) {
+			if(map->dirty) {
+				save = 1;
+				copy = LADSPAcontrolCopy(map->control);
+				filename = strdup(map->filename);
+				map->dirty = 0;
+			}
+			break;
+		}
+	}
+	pthread_mutex_unlock(&LADSPAmapLock);
+
+	if(save && (copy == NULL || filename == NULL ||
+			LADSPAcontrolSave(copy, filename) < 0)) {
+		pthread_mutex_lock(&LADSPAmapLock);
+		LADSPAcontrolRedirty(sv.sival_ptr);
+		pthread_mutex_unlock(&LADSPAmapLock);
+	}
+	free(copy);
+	free(filename);
+}
+
+/* Note a change to the controls and (re)arm the write-back timer. */
+static void LADSPAcontrolDirty(LADSPA_Control *control)
+{
+	LADSPA_Control_Map *map;
+	struct itimerspec its;
+	struct sigevent sev;
+
+	pthread_mutex_lock(&LADSPAmapLock);
+	map = LADSPAcontrolFindMap(control);
+	if(map != NULL) {
+		map->dirty = 1;
+		if(!map->timer_valid) {
+			memset(&sev, 0, sizeof(sev));
+			sev.sigev_notify = SIGEV_THREAD;
+			sev.sigev_notify_function = LADSPAcontrolSaveTimer;
+			sev.sigev_value.sival_ptr = map;
+			map->timer_valid = (timer_create(CLOCK_MONOTONIC, &sev,
+					&map->timer) == 0);
+		}
+		if(map->timer_valid) {
+			memset(&its, 0, sizeof(its));
+			its.it_value.tv_sec = LADSPA_CNTRL_SAVE_DELAY_MS/1000;
+			its.it_value.tv_nsec = (LADSPA_CNTRL_SAVE_DELAY_MS%1000)*1000000;
+			timer_settime(map->timer, 0, &its, NULL);
+		}
+	}
+	pthread_mutex_unlock(&LADSPAmapLock);
+}
+
+void LADSPAcontrolUnMMAP(LADSPA_Control *control)
+{
+	LADSPA_Control_Map *map, **pmap;
+	int last;
+
+	pthread_mutex_lock(&LADSPAmapLock);
+	for(pmap = &LADSPAmaps; *pmap != NULL; pmap = &(*pmap)->next) {
+		if((*pmap)->control == control) {
+			break;
+		}
+	}
+	map = *pmap;
+	if(map != NULL) {
+		*pmap = map->next;
+	}
+	pthread_mutex_unlock(&LADSPAmapLock);
+
+	if(map == NULL) {
+		munmap(control, control->length);
+		return;
+	}
+	if(map->timer_valid) {
+		timer_delete(map->timer);
+	}
+
+	/* The last user out writes the controls back and removes the block,
+	   so the next one starts from the file */
+	LADSPAcontrolLock(map->fd, F_WRLCK, LADSPA_CNTRL_INIT_BYTE, 1);
+	LADSPAcontrolLock(map->fd, F_UNLCK, LADSPA_CNTRL_LIVE_BYTE, 0);
+	last = LADSPAcontrolLock(map->fd, F_WRLCK, LADSPA_CNTRL_LIVE_BYTE,
+			0) == 0;
+	if(map->dirty || last) {
+		LADSPAcontrolPersist(control, map->filename);
+	}
+	if(last) {
+		shm_unlink(map->shmname);
+	}
+	close(map->fd);
+
+	free(map->filename);
+	free(map);
+	munmap(control, control->length);
+}
+
+/* Resolve the controls filename, if no path is given it is stored in the
+   home directory. */
+static char *LADSPAcontrolFilename(const char *controls_filename)
+{
+	const char * homePath;
+	char *filename;
 
-	/* Create config filename, if no path specified store in home directory */
 	if (controls_filename[0] == '/') {
 		filename = malloc(strlen(controls_filename) + 1);
 		if (filename==NULL) {
@@ -296,6 +828,179 @@ LADSPA_Control * LADSPAcontrolMMAP(const LADSPA_Descriptor *psDescriptor,
 		}
 		sprintf(filename, "%s/%s", homePath, controls_filename);
 	}
+	return filename;
+}
+
+/* Map the shared control block for filename, creating it from the
+   controls file, or from the plugin defaults when psDescriptor is given
+   and there is no usable file. Takes ownership of filename. */
+static LADSPA_Control *LADSPAcontrolAttach(char *filename,
+		const LADSPA_Descriptor *psDescriptor, const char *library,
+		uint32_t id, unsigned int channels, unsigned long num_controls,
+		unsigned long length)
+{
+	char shmname[64];
+	LADSPA_Control *initial;
+	LADSPA_Control *ptr = MAP_FAILED;
+	LADSPA_Control_Map *map;
+	struct stat st;
+	int fd, stale;
+
+	/* Open the shared control block, the first user fills it in */
+	LADSPAcontrolShmName(filename, shmname, sizeof(shmname));
+	while(1) {
+		fd = shm_open(shmname, O_RDWR | O_CREAT, 0600);
+		if(fd < 0) {
+			fprintf(stderr, "Failed to open shared controls for %s.\n",
+					filename);
+			free(filename);
+			return NULL;
+		}
+		if(LADSPAcontrolLock(fd, F_WRLCK, LADSPA_CNTRL_INIT_BYTE, 1) < 0 ||
+				fstat(fd, &st) < 0) {
+			goto fail;
+		}
+		/* The last user removed it while we were waiting */
+		if(st.st_nlink > 0) {
+			break;
+		}
+		close(fd);
+	}
+	if(st.st_size == 0) {
+		initial = LADSPAcontrolLoad(filename, id, channels, length, &stale);
+		if(initial == NULL) {
+			if(psDescriptor == NULL ||
+					(access(filename, F_OK) == 0 && !stale)) {
+				goto fail;
+			}
+			/* If the file doesn't exist create it and populate
+				it with default data. */
+			initial = LADSPAcontrolDefaults(psDescriptor, library, channels,
+					num_controls, length);
+			if(initial == NULL) {
+				goto fail;
+			}
+			if(LADSPAcontrolPersist(initial, filename) < 0) {
+				free(initial);
+				goto fail;
+			}
+		}
+		initial->seq = 0;
+		initial->writer = 0;
+		initial->waiters = 0;
+		initial->output_seq = 0;
+		if(ftruncate(fd, length) < 0 ||
+				pwrite(fd, initial, length, 0) != (ssize_t)length) {
+			free(initial);
+			goto fail;
+		}
+		free(initial);
+	} else if(st.st_size != length) {
+		fprintf(stderr, "%s is the wrong length.\n",
+				filename);
+		goto fail;
+	}
+
+	/* MMap Configuration File */
+	ptr = (LADSPA_Control*)mmap(NULL, length,
+			PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(ptr == MAP_FAILED) {
+		goto fail;
+	}
+
+	/* Make sure we're mapped to the right file type. */
+	if(ptr->length != length) {
+		fprintf(stderr, "%s is the wrong length.\n",
+				filename);
+		goto fail;
+	}
+
+	if(ptr->id != id) {
+		fprintf(stderr, "%s is not a control file for ladspa id %" PRId32 ".\n",
+				filename, ptr->id);
+		goto fail;
+	}
+
+	if(ptr->channels != channels) {
+		fprintf(stderr, "%s is not a control file doesn't have %ud channels.\n",
+				filename, channels);
+		goto fail;
+	}
+
+	map = calloc(1, sizeof(*map));
+	if(map == NULL ||
+			LADSPAcontrolLock(fd, F_RDLCK, LADSPA_CNTRL_LIVE_BYTE, 1) < 0) {
+		free(map);
+		goto fail;
+	}
+	LADSPAcontrolLock(fd, F_UNLCK, LADSPA_CNTRL_INIT_BYTE, 0);
+	map->control = ptr;
+	map->filename = filename;
+	map->fd = fd;
+	snprintf(map->shmname, sizeof(map->shmname), "%s", shmname);
+
+	pthread_mutex_lock(&LADSPAmapLock);
+	map->next = LADSPAmaps;
+	LADSPAmaps = map;
+	pthread_mutex_unlock(&LADSPAmapLock);
+
+	return ptr;
+
+fail:
+	if(ptr != MAP_FAILED) {
+		munmap(ptr, length);
+	}
+	/* Don't leave a block no one uses behind */
+	if(LADSPAcontrolLock(fd, F_WRLCK, LADSPA_CNTRL_LIVE_BYTE, 0) == 0) {
+		shm_unlink(shmname);
+	}
+	close(fd);
+	free(filename);
+	return NULL;
+}
+
+/* Check that the metadata describes library/label and the plugin whose
+   values the controls hold. With ports set the stored port metadata is
+   checked against its hash, and with psDescriptor against the plugin. */
+static int LADSPAcontrolMetaValid(const LADSPA_Control *control,
+		const char *library, const char *label, int ports,
+		const LADSPA_Descriptor *psDescriptor)
+{
+	return control->meta_version == LADSPA_CNTRL_META_VERSION &&
+		control->meta_id == control->id &&
+		(library == NULL || strncmp(control->library, library,
+				sizeof(control->library)) == 0) &&
+		(label == NULL || strncmp(control->label, label,
+				sizeof(control->label)) == 0) &&
+		(!ports || control->meta_hash == LADSPAcontrolMetaHash(control)) &&
+		(psDescriptor == NULL ||
+			(control->meta_id == psDescriptor->UniqueID &&
+			control->meta_hash == LADSPAcontrolDescriptorHash(psDescriptor)));
+}
+
+LADSPA_Control * LADSPAcontrolMMAP(const LADSPA_Descriptor *psDescriptor,
+		const char *controls_filename, unsigned int channels,
+		const char *library)
+{
+	char *filename;
+	unsigned long i, num_controls;
+	LADSPA_Control *ptr;
+	unsigned long length;
+	uint64_t start = 0;
+
+	if(EQUAL_PROBE_ENABLED(control_mmap)) {
+		start = equal_probe_now();
+	}
+
+	if(channels > 16) {
+		fprintf(stderr, "Can only control a maximum of 16 channels.\n");
+		return NULL;
+	}
+
+	filename = LADSPAcontrolFilename(controls_filename);
+	if(filename == NULL) {
+		return NULL;
+	}
 
 	/* Count the number of controls */
 	num_controls = 0;
@@ -307,6 +1012,7 @@ LADSPA_Control * LADSPAcontrolMMAP(const LADSPA_Descriptor *psDescriptor,
 
 	if(num_controls == 0) {
 		fprintf(stderr, "No Controls on LADSPA Module.\n");
+		free(filename);
 		return NULL;
 	}
 
@@ -315,110 +1021,270 @@ LADSPA_Control * LADSPAcontrolMMAP(const LADSPA_Descriptor *psDescriptor,
 			num_controls*sizeof(LADSPA_Control_Data) +
 			num_controls*sizeof(LADSPA_Data)*channels;
 
-	/* Open config file */
-	fd = open(filename, O_RDWR);
-	if(fd < 0) {
-		if(errno == ENOENT){
-			/* If the file doesn't exist create it and populate
-				it with default data. */
-			fd = open(filename, O_RDWR | O_CREAT, 0664);
-			if(fd < 0) {
-				fprintf(stderr, "Failed to open controls file:%s.\n",
-						filename);
-				free(filename);
-				return NULL;
-			}
-			/* Create default controls stucture */
-			default_controls = malloc(length);
-			if(default_controls == NULL) {
-				free(filename);
-				return NULL;
-			}
-			default_controls->length = length;
-			default_controls->id = psDescriptor->UniqueID;
-			default_controls->channels = channels;
-			default_controls->num_controls = num_controls;
-			default_controls->input_index = -1;
-			default_controls->output_index = -1;
-			for(i = 0, index=0; i < psDescriptor->PortCount; i++) {
-				if(psDescriptor->PortDescriptors[i]&LADSPA_PORT_CONTROL) {
-						default_controls->control[index].index = i;
-						LADSPADefault(&psDescriptor->PortRangeHints[i], 44100,
-								&default_controls->control[index].data[0]);
-					for(j = 1; j < channels; j++) {
-						default_controls->control[index].data[j] =
-								default_controls->control[index].data[0];
-					}
-					if(psDescriptor->PortDescriptors[i]&LADSPA_PORT_INPUT) {
-						default_controls->control[index].type = LADSPA_CNTRL_INPUT;
-					} else {
-						default_controls->control[index].type = LADSPA_CNTRL_OUTPUT;
-					}
-					index++;
-				} else if(psDescriptor->PortDescriptors[i] ==
-						(LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO)) {
-					default_controls->input_index = i;
-				} else if(psDescriptor->PortDescriptors[i] ==
-						(LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO)) {
-					default_controls->output_index = i;
-				}
-			}
-			if((default_controls->output_index == -1) ||
-				(default_controls->input_index == -1)) {
-					fprintf(stderr,
-						"LADSPA Plugin must have one audio channel\n");
-				free(default_controls);
-				free(filename);
-				return NULL;
-			}
-			/* Write the deafult data to the file. */
-			if(write(fd, default_controls, length) < 0) {
-				free(default_controls);
-				free(filename);
-				return NULL;
-			}
-			free(default_controls);
-		} else {
-			free(filename);
-			return NULL;
-		}
+	ptr = LADSPAcontrolAttach(filename, psDescriptor, library,
+			psDescriptor->UniqueID, channels, num_controls, length);
+
+	/* Refresh metadata that is missing or describes another library */
+	if(ptr != NULL && !LADSPAcontrolMetaValid(ptr, library,
+			psDescriptor->Label, 1, psDescriptor)) {
+		LADSPAcontrolWriteLock(ptr);
+		LADSPAcontrolFillMeta(ptr, psDescriptor, library);
+		LADSPAcontrolWriteUnlock(ptr);
 	}
 
-	/* MMap Configuration File */
-	ptr = (LADSPA_Control*)mmap(NULL, length,
-			PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-	close (fd);
+	EQUAL_PROBE4(control_mmap, controls_filename, channels, ptr != NULL,
+			equal_probe_now() - start);
 
-	if(ptr == MAP_FAILED) {
-		free(filename);
+	return ptr;
+}
+
+LADSPA_Control * LADSPAcontrolMMAPMeta(const char *controls_filename,
+		unsigned int channels, const char *library, const char *label)
+{
+	char *filename;
+	char shmname[64];
+	LADSPA_Control header;
+	LADSPA_Control *ptr;
+	ssize_t got;
+	int fd;
+
+	filename = LADSPAcontrolFilename(controls_filename);
+	if(filename == NULL) {
 		return NULL;
 	}
 
-	/* Make sure we're mapped to the right file type. */
-	if(ptr->length != length) {
-		fprintf(stderr, "%s is the wrong length.\n",
-				filename);
-		LADSPAcontrolUnMMAP(ptr);
+	/* Peek at the header of the shared block, or of the file if no one
+	   has the controls open */
+	LADSPAcontrolShmName(filename, shmname, sizeof(shmname));
+	fd = shm_open(shmname, O_RDONLY, 0);
+	if(fd < 0) {
+		fd = open(filename, O_RDONLY);
+	}
+	if(fd < 0) {
 		free(filename);
 		return NULL;
 	}
-
-	if(ptr->id != psDescriptor->UniqueID) {
-		fprintf(stderr, "%s is not a control file for ladspa id %" PRId32 ".\n",
-				filename, ptr->id);
-		LADSPAcontrolUnMMAP(ptr);
+	got = pread(fd, &header, sizeof(header), 0);
+	close(fd);
+	if(got != sizeof(header) || header.channels > 16 ||
+			(channels != 0 && header.channels != channels) ||
+			header.length < sizeof(header) ||
+			!LADSPAcontrolMetaValid(&header, library, label, 0, NULL)) {
 		free(filename);
 		return NULL;
 	}
 
-	if(ptr->channels != channels) {
-		fprintf(stderr, "%s is not a control file doesn't have %ud channels.\n",
-				filename, channels);
+	ptr = LADSPAcontrolAttach(filename, NULL, library, header.id,
+			header.channels, header.num_controls, header.length);
+	if(ptr == NULL) {
+		return NULL;
+	}
+	if(!LADSPAcontrolMetaValid(ptr, library, label, 1, NULL)) {
 		LADSPAcontrolUnMMAP(ptr);
-		free(filename);
 		return NULL;
 	}
 
-	free(filename);
 	return ptr;
 }
+
+int LADSPAcontrolObjectName(const char *controls_filename, const char *suffix,
+		char *name, size_t len)
+{
+	char *filename;
+	size_t used;
+
+	filename = LADSPAcontrolFilename(controls_filename);
+	if(filename == NULL) {
+		return -1;
+	}
+	LADSPAcontrolShmName(filename, name, len);
+	free(filename);
+	used = strlen(name);
+	if(used + strlen(suffix) + 1 > len) {
+		return -1;
+	}
+	strcpy(name + used, suffix);
+	return 0;
+}
+
+/* ------------------------------------------------------------------ */
+
+/* How long to wait for a writer before checking that its process is
+   still there */
+#define LADSPA_CNTRL_LOCK_TIMEOUT_NS 200000000LL
+
+static long long LADSPAnow(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+/* Whether the writer pid is gone, checked like the tap's producer */
+static int LADSPAwriterGone(int32_t pid)
+{
+	return pid != 0 && kill(pid, 0) < 0 && errno == ESRCH;
+}
+
+void LADSPAcontrolWriteLock(LADSPA_Control *control)
+{
+	int32_t owner, self = getpid();
+	long long start = 0;
+	uint32_t seq;
+
+	while(1) {
+		owner = 0;
+		if(__atomic_compare_exchange_n(&control->writer, &owner, self, 0,
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			break;
+		}
+		if(start == 0) {
+			start = LADSPAnow();
+		} else if(LADSPAnow() - start > LADSPA_CNTRL_LOCK_TIMEOUT_NS &&
+				LADSPAwriterGone(owner) &&
+				__atomic_compare_exchange_n(&control->writer, &owner, self,
+				0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			/* The writer died, seq is odd if it was mid-update */
+			break;
+		}
+		sched_yield();
+	}
+	seq = __atomic_load_n(&control->seq, __ATOMIC_RELAXED);
+	__atomic_store_n(&control->seq, seq | 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+int LADSPAcontrolReadBusy(const LADSPA_Control *control, long long *since)
+{
+	uint32_t seq = __atomic_load_n(&control->seq, __ATOMIC_RELAXED);
+
+	if(!(seq & 1)) {
+		/* Done already, the read just overlapped a write */
+		*since = 0;
+	} else if(*since == 0) {
+		*since = LADSPAnow();
+	} else if(LADSPAnow() - *since > LADSPA_CNTRL_LOCK_TIMEOUT_NS &&
+			LADSPAwriterGone(__atomic_load_n(&control->writer,
+			__ATOMIC_RELAXED))) {
+		return 1;
+	}
+	sched_yield();
+	return 0;
+}
+
+void LADSPAcontrolWriteUnlock(LADSPA_Control *control)
+{
+	__atomic_add_fetch(&control->seq, 1, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&control->writer, 0, __ATOMIC_RELEASE);
+	/* Only a commit someone waits for costs a system call */
+	if(__atomic_load_n(&control->waiters, __ATOMIC_SEQ_CST)) {
+		syscall(SYS_futex, &control->seq, FUTEX_WAKE, INT_MAX, NULL, NULL,
+				0);
+	}
+	LADSPAcontrolDirty(control);
+}
+
+void LADSPAcontrolWaitSeq(LADSPA_Control *control, uint32_t seq,
+		const struct timespec *timeout)
+{
+	__atomic_add_fetch(&control->waiters, 1, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&control->seq, __ATOMIC_SEQ_CST) == seq) {
+		syscall(SYS_futex, &control->seq, FUTEX_WAIT, seq, timeout, NULL, 0);
+	}
+	__atomic_sub_fetch(&control->waiters, 1, __ATOMIC_RELEASE);
+}
+
+int LADSPAcontrolOutputBegin(LADSPA_Control *control)
+{
+	uint32_t seq = __atomic_load_n(&control->output_seq, __ATOMIC_RELAXED);
+
+	if((seq & 1) || !__atomic_compare_exchange_n(&control->output_seq, &seq,
+			seq + 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		return 0;
+	}
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	return 1;
+}
+
+void LADSPAcontrolOutputEnd(LADSPA_Control *control)
+{
+	uint32_t seq = __atomic_load_n(&control->output_seq, __ATOMIC_RELAXED);
+
+	/* Even already if a prepare took it for the leftover of a dead
+	   stream meanwhile, it must not go odd again */
+	__atomic_store_n(&control->output_seq, (seq | 1) + 1, __ATOMIC_RELEASE);
+}
+
+int LADSPAcontrolReadOutput(const LADSPA_Control *control, int index,
+		LADSPA_Data *values)
+{
+	uint32_t before, after;
+	unsigned long j;
+	int retry;
+
+	for(retry = 0; retry < 16; retry++) {
+		before = __atomic_load_n(&control->output_seq, __ATOMIC_ACQUIRE);
+		for(j = 0; j < control->channels; j++) {
+			values[j] = control->control[index].data[j];
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		after = __atomic_load_n(&control->output_seq, __ATOMIC_RELAXED);
+		if(before == after && !(before & 1)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+void LADSPAcontrolQueueEvent(LADSPA_Control *control, int index, int channel,
+		LADSPA_Data value, uint64_t frame)
+{
+	LADSPA_Control_Event *event;
+	uint32_t head;
+	unsigned int j;
+
+	head = control->event_head;
+	event = &control->event[head % LADSPA_CNTRL_MAX_EVENTS];
+	event->frame = frame;
+	event->control = index;
+	event->channel = channel;
+	event->value = value;
+	__atomic_store_n(&control->event_head, head + 1, __ATOMIC_RELEASE);
+
+	for(j = 0; j < control->channels; j++) {
+		if(channel < 0 || j == channel) {
+			control->control[index].data[j] = value;
+		}
+	}
+}
+
+int LADSPAcontrolSnapshot(const LADSPA_Control *control,
+		LADSPA_Data *values, uint32_t *seq)
+{
+	uint32_t before, after;
+	unsigned long i, j;
+	int retry;
+
+	for(retry = 0; retry < 16; retry++) {
+		before = __atomic_load_n(&control->seq, __ATOMIC_ACQUIRE);
+		if(before & 1) {
+			continue;
+		}
+		for(i = 0; i < control->num_controls; i++) {
+			for(j = 0; j < control->channels; j++) {
+				values[i*control->channels + j] = control->control[i].data[j];
+			}
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		after = __atomic_load_n(&control->seq, __ATOMIC_RELAXED);
+		if(before == after) {
+			if(seq != NULL) {
+				*seq = before;
+			}
+			return 1;
+		}
+	}
+
+	return 0;
+}
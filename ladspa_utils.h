@@ -8,6 +8,7 @@
 
 #include "ladspa.h"
 #include <stdint.h>
+#include <time.h>
 
 /* This function call takes a plugin library filename, searches for
    the library along the LADSPA_PATH, loads it with dlopen() and
@@ -30,6 +31,18 @@ LADSPAfind(void * pvLADSPAPluginLibrary,
 			   const char * pcPluginLibraryFilename,
 			   const char * pcPluginLabel);
 
+/* As LADSPAload() and LADSPAfind(), but returning NULL on failure
+   instead of exiting, for long running hosts. dlerror() has the reason
+   a load failed. */
+void * LADSPAtryLoad(const char * pcPluginFilename);
+const LADSPA_Descriptor *
+LADSPAtryFind(void * pvLADSPAPluginLibrary, const char * pcPluginLabel);
+
+/* Check that a plugin fits the equalizer: exactly one audio input and
+   one audio output, which the PCM runs one instance of per channel, and
+   a run() callback. Returns NULL if it does, otherwise why not. */
+const char * LADSPAincompatible(const LADSPA_Descriptor * psDescriptor);
+
 /* Find the default value for a port. Return 0 if a default is found
    and -1 if not. */
 int LADSPADefault(const LADSPA_PortRangeHint * psPortRangeHint,
@@ -40,12 +53,29 @@ int LADSPADefault(const LADSPA_PortRangeHint * psPortRangeHint,
 /* MMAP to a controls file */
 #define LADSPA_CNTRL_INPUT	0
 #define LADSPA_CNTRL_OUTPUT	1
+#define LADSPA_CNTRL_META_VERSION	2
+#define LADSPA_CNTRL_MAX_CROSSOVERS	3
+#define LADSPA_CNTRL_MAX_EVENTS	64
+#define LADSPA_CNTRL_MAX_MODULES	8
 typedef struct LADSPA_Control_Data_ {
 	int32_t index;
 	LADSPA_Data data[16];	/* Max number of channels, would be nicer if 
 								this wasn't a fixed number */
 	int32_t type;
+	/* Port metadata copied from the plugin */
+	int32_t hint;
+	LADSPA_Data lower;
+	LADSPA_Data upper;
+	char name[64];
 } LADSPA_Control_Data;
+/* A change that takes effect at a given frame of the stream */
+typedef struct LADSPA_Control_Event_ {
+	uint64_t frame;
+	int32_t control;	/* Index into control[] */
+	int32_t channel;	/* -1 for all channels */
+	LADSPA_Data value;
+	int32_t reserved;
+} LADSPA_Control_Event;
 typedef struct LADSPA_Control_ {
 	uint32_t length;
 	uint32_t id;
@@ -53,10 +83,128 @@ typedef struct LADSPA_Control_ {
 	uint32_t num_controls;
 	int32_t input_index;
 	int32_t output_index;
+	uint32_t seq;		/* Odd while a writer is updating the controls */
+	int32_t writer;		/* Pid of the writer holding them, 0 if none */
+	uint32_t waiters;	/* Blocked in LADSPAcontrolWaitSeq() */
+	uint32_t output_seq;	/* Odd while the PCM publishes the outputs */
+	/* Plugin metadata, valid once meta_version is LADSPA_CNTRL_META_VERSION */
+	uint32_t meta_version;
+	uint32_t meta_id;	/* UniqueID of the plugin described */
+	uint64_t meta_hash;	/* Of the control ports' metadata */
+	char label[64];
+	char name[128];
+	char library[256];
+	/* Levels of the last processed block per channel, published by the
+	   PCM, 1.0 is full scale */
+	LADSPA_Data peak_in[16];
+	LADSPA_Data rms_in[16];
+	LADSPA_Data peak_out[16];
+	LADSPA_Data rms_out[16];
+	/* Status published by the PCM */
+	int32_t mlock_status;	/* 1 locked, 0 off, -errno if locking failed */
+	uint32_t mlock_kbytes;
+	uint32_t tap_enable;	/* Publish samples to the audio tap */
+	uint32_t capture_enable;	/* alsaequal-capture records the tap */
+	/* Crossover bands set up by the PCM, 0 for none. The frequencies
+	   (Hz) are written under the seqlock like the control values */
+	uint32_t crossover_bands;
+	LADSPA_Data crossover_freq[LADSPA_CNTRL_MAX_CROSSOVERS];
+	/* Frames processed since the PCM was prepared, and its rate */
+	uint32_t frame_rate;
+	uint64_t frame_pos;
+	/* Ring of timestamped changes, event_head counts every event ever
+	   queued. Readers that fall a whole ring behind lose the oldest. */
+	uint32_t event_head;
+	LADSPA_Control_Event event[LADSPA_CNTRL_MAX_EVENTS];
+	/* Modules the PCM can switch between, published by the PCM.
+	   module_index selects the one running, 0 being the configured
+	   module */
+	uint32_t num_modules;
+	uint32_t module_index;
+	char module_names[LADSPA_CNTRL_MAX_MODULES][32];
+	/* Watchdog status published by the PCM: the number of fallback
+	   levels (0 without a watchdog) and the one in use, and counters of
+	   the steps down and back up and of the blocks that ran over budget */
+	uint32_t watchdog_levels;
+	uint32_t watchdog_level;
+	uint32_t watchdog_down;
+	uint32_t watchdog_up;
+	uint32_t watchdog_overruns;
+	/* Frames the PCM's output lags its input by on top of the slave,
+	   published by the PCM */
+	uint32_t latency;
 	LADSPA_Control_Data control[];
 } LADSPA_Control;
+/* The controls live in a shared memory block keyed by the controls
+   filename, loaded from the file by the first user. Changes are written
+   back to the file a short while after the last write and when the
+   controls are unmapped. */
 LADSPA_Control * LADSPAcontrolMMAP(const LADSPA_Descriptor *psDescriptor,
-		const char *controls_filename, unsigned int channels);
+		const char *controls_filename, unsigned int channels,
+		const char *library);
+
+/* Map existing controls using only the metadata stored with them, without
+   loading the plugin. Returns NULL if there are no controls yet or their
+   metadata is missing, inconsistent or was written for another
+   library/label. A NULL
+   library or label, or 0 channels, accepts whatever the controls hold. */
+LADSPA_Control * LADSPAcontrolMMAPMeta(const char *controls_filename,
+		unsigned int channels, const char *library, const char *label);
 void LADSPAcontrolUnMMAP(LADSPA_Control *control);
 
+/* Name of the shared memory object with the given suffix that belongs to
+   a controls file, e.g. the audio tap. Returns 0 on success. */
+int LADSPAcontrolObjectName(const char *controls_filename, const char *suffix,
+		char *name, size_t len);
+
+/* Writers bracket every change to the control values with these two
+   calls so that readers never see a half-applied set of controls. The
+   writer's pid is kept with the controls, a writer whose process is gone
+   is taken over by the next one; a live writer is waited for however
+   long it takes. */
+void LADSPAcontrolWriteLock(LADSPA_Control *control);
+void LADSPAcontrolWriteUnlock(LADSPA_Control *control);
+
+/* Set a control to value at stream frame instead of straight away. The
+   value is stored as the control's setting right away, the PCM holds the
+   old value until the frame comes. channel is -1 for all channels. Must
+   be called between LADSPAcontrolWriteLock() and
+   LADSPAcontrolWriteUnlock(). */
+void LADSPAcontrolQueueEvent(LADSPA_Control *control, int index, int channel,
+		LADSPA_Data value, uint64_t frame);
+
+/* Copy a consistent snapshot of all control values into values, laid
+   out as values[control*channels + channel], and return 1. Never blocks;
+   returns 0 if a writer kept the controls busy, in which case values
+   holds a torn copy and must be discarded. */
+int LADSPAcontrolSnapshot(const LADSPA_Control *control,
+		LADSPA_Data *values, uint32_t *seq);
+
+/* For readers that can afford to wait, after a read found a writer in
+   the way: yields, and returns 1 if the writer has held the controls for
+   a while and its process is gone, in which case they stay busy until a
+   writer takes them over. since keeps track of the wait between calls
+   and starts out 0. */
+int LADSPAcontrolReadBusy(const LADSPA_Control *control, long long *since);
+
+/* The values of the plugin's output controls are only written by the
+   PCM, under a sequence of their own, so that publishing them never
+   waits for a writer of the inputs nor wakes their readers. Begin
+   returns 0 if another stream on the same controls is publishing them,
+   and the block's values are skipped. */
+int LADSPAcontrolOutputBegin(LADSPA_Control *control);
+void LADSPAcontrolOutputEnd(LADSPA_Control *control);
+
+/* Copy the values of output control index for every channel, and return
+   1. Never blocks; returns 0 if the PCM kept them busy, in which case
+   values may mix two blocks. */
+int LADSPAcontrolReadOutput(const LADSPA_Control *control, int index,
+		LADSPA_Data *values);
+
+/* Block until seq of the controls is no longer seq, for at most timeout
+   (NULL for no limit). Writers wake the waiters when they commit. May
+   return early, callers look at seq again. */
+void LADSPAcontrolWaitSeq(LADSPA_Control *control, uint32_t seq,
+		const struct timespec *timeout);
+
 #endif
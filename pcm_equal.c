@@ -23,118 +23,2269 @@
 #include <alsa/pcm_external.h>
 #include <alsa/control.h>
 #include <linux/soundcard.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <math.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <dlfcn.h>
 
 #include "ladspa.h"
 #include "ladspa_utils.h"
+#include "ringbuffer.h"
+#include "tap.h"
+#include "graph.h"
+#include "crossover.h"
+#include "dspd.h"
+#include "fixed.h"
+#include "core.h"
+#include "probes.h"
+
+EQUAL_PROBE_SEMAPHORE(transfer_entry);
+EQUAL_PROBE_SEMAPHORE(transfer_exit);
+EQUAL_PROBE_SEMAPHORE(init);
+EQUAL_PROBE_SEMAPHORE(close);
+EQUAL_PROBE_SEMAPHORE(watchdog);
+
+/* Frames processed per run() call by the pipeline thread */
+#define PIPELINE_CHUNK_FRAMES 1024
+
+/* Frames each plugin instance processes when warmed up in mlock mode */
+#define WARMUP_FRAMES 256
+
+/* Frames of history kept in the audio tap */
+#define TAP_FRAMES 65536
+
+/* Most control values a branch can be configured with */
+#define BRANCH_MAX_CONTROLS 64
+
+/* Buffers at least this big are offered to transparent hugepages */
+#define HUGEPAGE_SIZE (2*1024*1024)
+
+/* Buffers up to ARENA_MAX bytes are carved out of shared ARENA_SIZE
+   mappings rather than taking pages of their own */
+#define ARENA_SIZE (64*1024)
+#define ARENA_MAX (8*1024)
+#define ARENA_ALIGN 64
+
+/* Sets of plugin instances kept per PCM: the rate in use, the standby
+   rate, the module being switched to and one more for whatever was used
+   before */
+#define POOL_SIZE 4
+
+/* Frames run at a time while crossfading between modules */
+#define XFADE_CHUNK 256
+
+/* Range of the block adapter's block size in frames */
+#define BLOCK_MIN 16
+#define BLOCK_MAX 16384
+
+/* standby_rate picking the other of the 44.1k and 48k families */
+#define STANDBY_AUTO -1
+
+/* Most fallbacks the watchdog steps down through */
+#define WATCHDOG_MAX_LEVELS 8
+
+/* Longest the watchdog waits to step up again is recover << this */
+#define WATCHDOG_MAX_BACKOFF 4
+
+/* Most zones a PCM carries */
+#define MAX_ZONES 8
+
+/* One activated instance per channel of a module at a sample rate, kept
+   across prepares so that a rate seen before costs no instantiate() */
+typedef struct equal_instances {
+	const LADSPA_Descriptor *klass;
+	unsigned long rate;		/* 0 for an unused set */
+	unsigned long last_used;
+	int busy;			/* Running, fading out or switched to next */
+	LADSPA_Handle *handle;		/* [channels] */
+} equal_instances_t;
+
+/* A module that can be switched to at runtime, module 0 is the one the
+   controls were made for */
+typedef struct equal_module {
+	void *library;
+	const LADSPA_Descriptor *klass;
+} equal_module_t;
+
+/* A watchdog fallback, including the ones before it */
+typedef struct equal_fallback {
+	int module;		/* Module to run, -1 for the selected one */
+	unsigned int channels;	/* Channels still processed */
+	char name[48];
+} equal_fallback_t;
+
+/* Memory on the audio path: a mapping of its own, an arena of small
+   buffers or shared memory locked in place */
+typedef struct equal_region {
+	struct equal_region *next;
+	void *ptr;
+	size_t bytes;
+	size_t used;		/* Handed out of an arena */
+	int mapped;		/* Unmapped when released */
+	int locked;
+} equal_region_t;
+
+/* A group of channels with controls and instances of its own */
+typedef struct equal_zone {
+	char name[32];
+	LADSPA_Control *control_data;
+	equal_core_controls_t core;
+	unsigned int map[16];		/* PCM channel of each zone channel */
+	LADSPA_Handle *handle;		/* [channels] */
+	unsigned long rate;		/* 0 until instantiated */
+} equal_zone_t;
 
 typedef struct snd_pcm_equal {
 	snd_pcm_extplug_t ext;
 	void *library;
 	const LADSPA_Descriptor *klass;
 	LADSPA_Control *control_data;
-	LADSPA_Handle *channel[];
+	/* The controls as the audio thread sees them, core.values is the
+	   private copy the plugins are connected to */
+	equal_core_controls_t core;
+	/* Lock the audio path's memory and warm the plugins up */
+	int mlock;
+	int mlock_error;
+	size_t locked_bytes;
+	equal_region_t *regions;
+	equal_region_t *arena;
+	float *warmup_buf;
+	/* Audio tap for external analyzers, enabled through the controls.
+	   NULL if another PCM on the controls has it. */
+	equal_tap_t *tap;
+	size_t tap_length;
+	/* Parallel branches summed behind the equalizer */
+	equal_graph_t *graph;
+	int branch_threads;
+	/* Crossover splitting each channel into bands on the slave */
+	equal_crossover_t *crossover;
+	unsigned int out_channels;
+	/* Pipelined mode, DSP runs one period behind on its own thread */
+	int pipeline;
+	int pipeline_priority;
+	int pipeline_running;
+	int pipeline_primed;
+	pthread_t pipeline_thread;
+	sem_t pipeline_wake;
+	equal_ring_t *in_ring;
+	equal_ring_t *out_ring;
+	float *pipeline_buf[2];
+	snd_pcm_uframes_t buffer_size;
+	snd_pcm_uframes_t latency;
+	unsigned long underruns;
+	unsigned long overruns;
+	/* Output bytes that keep the latency fixed: late output that already
+	   played as silence and is dropped when it arrives, and the output of
+	   input that didn't fit in_ring, played as silence next period */
+	size_t pipeline_late;
+	size_t pipeline_hole;
+	/* Block adapter, the plugins only ever run whole blocks of block
+	   frames. block_fill frames of the block being gathered are in
+	   block_in, the output of the block before is read from block_out
+	   at the same offset. */
+	snd_pcm_uframes_t block;
+	snd_pcm_uframes_t block_fill;
+	float *block_in;
+	float *block_out;
+	/* Instance pool, channel points at the handles of the current set */
+	equal_instances_t pool[POOL_SIZE];
+	pthread_mutex_t pool_lock;
+	unsigned long pool_clock;
+	long standby_rate;
+	unsigned long rate;
+	equal_instances_t *current;
+	LADSPA_Handle *channel;
+	/* Module switching. The audio thread asks the loader thread for the
+	   instances of module_req, which hands them back in swap_ready, and
+	   then fades from the old set to the new one. */
+	unsigned int num_modules;
+	equal_module_t module[LADSPA_CNTRL_MAX_MODULES];
+	int loader_running;
+	pthread_t loader_thread;
+	sem_t loader_wake;
+	unsigned int module_req;
+	int module_failed;
+	int swap_pending;
+	equal_instances_t *swap_ready;
+	equal_instances_t *xfade_from;
+	unsigned long xfade_pos;
+	unsigned long xfade_frames;
+	long xfade_ms;
+	float *xfade_buf;
+	snd_pcm_uframes_t xfade_chunk;
+	/* Out of process mode, alsaequal-dspd runs the plugin */
+	int dspd_mode;
+	char *dspd_socket;
+	char *dspd_library;
+	char *dspd_module;
+	equal_dspd_t *dspd;
+	int dspd_error;
+	/* Integer engine for S16/S32 streams instead of the plugin, band b
+	   takes its gains from control fixed_band[b] */
+	equal_fixed_t *fixed;
+	unsigned int fixed_band[EQUAL_FIXED_MAX_BANDS];
+	float fixed_gain[EQUAL_FIXED_MAX_BANDS*EQUAL_FIXED_MAX_CHANNELS];
+	equal_fixed_levels_t fixed_in;
+	equal_fixed_levels_t fixed_out;
+	/* Watchdog stepping down to cheaper processing while run() takes
+	   longer than wd_budget percent of the audio it processes, level 0
+	   being full processing */
+	unsigned int wd_budget;
+	unsigned int wd_trigger;
+	unsigned int wd_recover;
+	unsigned int wd_num_levels;
+	equal_fallback_t wd_level[WATCHDOG_MAX_LEVELS + 1];
+	unsigned int wd_current;
+	unsigned int wd_over;
+	unsigned int wd_under;
+	unsigned int wd_since_up;
+	unsigned int wd_backoff;
+	int wd_module;
+	/* Steps taken, and how many of them were logged */
+	unsigned int wd_down;
+	unsigned int wd_up;
+	unsigned int wd_logged_down;
+	unsigned int wd_logged_up;
+	/* Channels processed, the others fade to their dry input */
+	unsigned int wet_channels;
+	float wet[16];
+	/* Zones, the channels in zoned are left to them */
+	unsigned int num_zones;
+	equal_zone_t zone[MAX_ZONES];
+	uint32_t zoned;
+	/* The controls of the PCM and then of each zone, a run is split at
+	   the changes of any of them */
+	unsigned int num_cores;
+	equal_core_controls_t *cores[1 + MAX_ZONES];
 } snd_pcm_equal_t;
 
-static inline void interleave(float *src, float *dst, int n, int m)
+/* Track memory used on the audio path and, in mlock mode, lock it,
+   remembering the outcome for the status reported through the
+   controls. */
+static equal_region_t *equal_region_add(snd_pcm_equal_t *equal, void *ptr,
+		size_t bytes, int mapped)
+{
+	equal_region_t *region;
+
+	region = calloc(1, sizeof(*region));
+	if(region == NULL) {
+		return NULL;
+	}
+	region->ptr = ptr;
+	region->bytes = bytes;
+	region->mapped = mapped;
+	/* mlock() faults in every page it locks */
+	if(equal->mlock) {
+		if(mlock(ptr, bytes) == 0) {
+			region->locked = 1;
+			equal->locked_bytes += bytes;
+		} else {
+			equal->mlock_error = errno;
+		}
+	}
+	region->next = equal->regions;
+	equal->regions = region;
+	return region;
+}
+
+static void equal_region_remove(snd_pcm_equal_t *equal, void *ptr)
+{
+	equal_region_t **pos, *region;
+
+	for(pos = &equal->regions; *pos != NULL; pos = &(*pos)->next) {
+		if((*pos)->ptr == ptr) {
+			break;
+		}
+	}
+	region = *pos;
+	if(region == NULL) {
+		return;
+	}
+	*pos = region->next;
+	if(region == equal->arena) {
+		equal->arena = NULL;
+	}
+	if(region->locked) {
+		munlock(region->ptr, region->bytes);
+		equal->locked_bytes -= region->bytes;
+	}
+	if(region->mapped) {
+		munmap(region->ptr, region->bytes);
+	}
+	free(region);
+}
+
+/* Map zeroed memory. In mlock mode the pages are populated up front and
+   locked. */
+static equal_region_t *equal_map(snd_pcm_equal_t *equal, size_t bytes)
+{
+	equal_region_t *region;
+	void *ptr;
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+#ifdef MAP_POPULATE
+	if(equal->mlock) {
+		flags |= MAP_POPULATE;
+	}
+#endif
+	ptr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if(ptr == MAP_FAILED) {
+		return NULL;
+	}
+#ifdef MADV_HUGEPAGE
+	if(bytes >= HUGEPAGE_SIZE) {
+		madvise(ptr, bytes, MADV_HUGEPAGE);
+	}
+#endif
+	region = equal_region_add(equal, ptr, bytes, 1);
+	if(region == NULL) {
+		munmap(ptr, bytes);
+	}
+	return region;
+}
+
+/* Allocate zeroed memory for the audio path. Small buffers share an
+   arena and are only given back when the PCM is closed. */
+static void *equal_alloc(snd_pcm_equal_t *equal, size_t bytes)
+{
+	equal_region_t *region;
+	void *ptr;
+
+	if(bytes > ARENA_MAX) {
+		region = equal_map(equal, bytes);
+		return region != NULL ? region->ptr : NULL;
+	}
+	bytes = (bytes + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	if(equal->arena == NULL || equal->arena->used + bytes > ARENA_SIZE) {
+		equal->arena = equal_map(equal, ARENA_SIZE);
+		if(equal->arena == NULL) {
+			return NULL;
+		}
+	}
+	ptr = (char *)equal->arena->ptr + equal->arena->used;
+	equal->arena->used += bytes;
+	return ptr;
+}
+
+static void equal_free(snd_pcm_equal_t *equal, void *ptr, size_t bytes)
+{
+	if(ptr != NULL && bytes > ARENA_MAX) {
+		equal_region_remove(equal, ptr);
+	}
+}
+
+/* Lock shared memory the audio path reads, in mlock mode. */
+static void equal_lock_shared(snd_pcm_equal_t *equal, void *ptr,
+		size_t bytes)
+{
+	if(equal->mlock) {
+		equal_region_add(equal, ptr, bytes, 0);
+	}
+}
+
+/* Report how locking went, once everything the audio path uses has been
+   allocated. */
+static void equal_publish_mlock(snd_pcm_equal_t *equal)
+{
+	equal->control_data->mlock_status =
+			equal->mlock_error ? -equal->mlock_error : 1;
+	equal->control_data->mlock_kbytes = equal->locked_bytes/1024;
+}
+
+/* Memory for the branch graph, mapped, locked and counted like the rest
+   of the audio path */
+static void *equal_graph_alloc(void *arg, size_t bytes)
+{
+	equal_region_t *region = equal_map(arg, bytes);
+	return region != NULL ? region->ptr : NULL;
+}
+
+static void equal_graph_release(void *arg, void *ptr, size_t bytes)
+{
+	equal_region_remove(arg, ptr);
+}
+
+static equal_ring_t *equal_ring_alloc(snd_pcm_equal_t *equal, size_t size)
+{
+	equal_ring_t *ring;
+
+	ring = equal_alloc(equal, equal_ring_footprint(size));
+	if(ring != NULL) {
+		equal_ring_init(ring, size);
+	}
+	return ring;
+}
+
+static void equal_ring_release(snd_pcm_equal_t *equal, equal_ring_t *ring)
+{
+	if(ring != NULL) {
+		equal_free(equal, ring, equal_ring_footprint(ring->size));
+	}
+}
+
+/* Run a set of instances over planar in, writing planar out. Both have
+   channels stride frames apart. */
+static void equal_run_set(snd_pcm_equal_t *equal,
+		const LADSPA_Descriptor *klass, LADSPA_Handle *handle, float *in,
+		float *out, snd_pcm_uframes_t stride, snd_pcm_uframes_t frames)
+{
+	int j;
+
+	for(j = 0; j < equal->control_data->channels; j++) {
+		if((equal->zoned >> j & 1) ||
+				(j >= equal->wet_channels && equal->wet[j] == 0)) {
+			continue;
+		}
+		equal_core_run(klass, handle[j], equal->control_data, j,
+				in + j*stride, out + j*stride, frames);
+	}
+}
+
+/* Pick up changes to the controls of the PCM and of the zones */
+static void equal_sync_controls(snd_pcm_equal_t *equal)
+{
+	LADSPA_Data freq[LADSPA_CNTRL_MAX_CROSSOVERS];
+	unsigned int z;
+
+	if(equal_core_sync(&equal->core,
+			equal->crossover != NULL ? freq : NULL) &&
+			equal->crossover != NULL) {
+		equal_crossover_set(equal->crossover, freq);
+	}
+	for(z = 0; z < equal->num_zones; z++) {
+		equal_core_sync(&equal->zone[z].core, NULL);
+	}
+}
+
+/* Apply the pending changes of the PCM and of the zones due by frame.
+   Returns the frame of the next pending change, UINT64_MAX if there is
+   none. */
+static uint64_t equal_apply_events(snd_pcm_equal_t *equal, uint64_t frame)
+{
+	return equal_core_apply_all(equal->cores, equal->num_cores, frame);
+}
+
+/* Run a zone's instances over its channels of planar in and out */
+static void equal_zone_run(snd_pcm_equal_t *equal, equal_zone_t *zone,
+		float *in, float *out, snd_pcm_uframes_t stride,
+		snd_pcm_uframes_t frames)
+{
+	LADSPA_Control *control_data = zone->control_data;
+	int j;
+
+	for(j = 0; j < control_data->channels; j++) {
+		equal_core_run(equal->klass, zone->handle[j], control_data,
+				zone->map[j], in + zone->map[j]*stride,
+				out + zone->map[j]*stride, frames);
+	}
+}
+
+/* Publish the levels of a zone's channels with its controls */
+static void equal_zone_meters(equal_zone_t *zone, LADSPA_Data *peak_dst,
+		LADSPA_Data *rms_dst, const float *peak, const float *sum,
+		snd_pcm_uframes_t size)
+{
+	float zpeak[16], zsum[16];
+	int j;
+
+	for(j = 0; j < zone->control_data->channels; j++) {
+		zpeak[j] = peak[zone->map[j]];
+		zsum[j] = sum[zone->map[j]];
+	}
+	equal_core_publish_meters(peak_dst, rms_dst, zpeak, zsum,
+			zone->control_data->channels, size);
+}
+
+/* Ask for the module selected in the controls and switch to it once its
+   instances are ready. Never blocks, the loader thread does the work. */
+static void equal_switch_module(snd_pcm_equal_t *equal)
+{
+	equal_instances_t *set;
+	unsigned int want;
+
+	set = __atomic_exchange_n(&equal->swap_ready, NULL, __ATOMIC_ACQ_REL);
+	if(set != NULL) {
+		__atomic_store_n(&equal->swap_pending, 0, __ATOMIC_RELAXED);
+		if(set->rate != equal->rate || set->klass == equal->klass ||
+				equal->xfade_from != NULL) {
+			__atomic_store_n(&set->busy, 0, __ATOMIC_RELEASE);
+		} else {
+			equal->xfade_from = equal->current;
+			equal->xfade_pos = 0;
+			equal->current = set;
+			equal->klass = set->klass;
+			equal->channel = set->handle;
+		}
+	}
+
+	want = equal->wd_module >= 0 ? (unsigned int)equal->wd_module :
+			__atomic_load_n(&equal->control_data->module_index,
+			__ATOMIC_RELAXED);
+	if(want >= equal->num_modules ||
+			__atomic_load_n(&equal->swap_pending, __ATOMIC_ACQUIRE) ||
+			equal->xfade_from != NULL ||
+			equal->module[want].klass == equal->klass ||
+			(int)want == __atomic_load_n(&equal->module_failed,
+			__ATOMIC_ACQUIRE)) {
+		return;
+	}
+	__atomic_store_n(&equal->module_req, want, __ATOMIC_RELAXED);
+	__atomic_store_n(&equal->swap_pending, 1, __ATOMIC_RELAXED);
+	sem_post(&equal->loader_wake);
+}
+
+/* Run the set being switched away from over the same input and fade the
+   output from it to what the new set produced */
+static void equal_crossfade(snd_pcm_equal_t *equal, float *in, float *out,
+		snd_pcm_uframes_t stride, snd_pcm_uframes_t frames)
+{
+	equal_instances_t *from = equal->xfade_from;
+	float *old, g, step;
+	unsigned long i;
+	int j;
+
+	equal_run_set(equal, from->klass, from->handle, in, equal->xfade_buf,
+			equal->xfade_chunk, frames);
+	step = 1.0f/equal->xfade_frames;
+	for(j = 0; j < equal->control_data->channels; j++) {
+		old = equal->xfade_buf + j*equal->xfade_chunk;
+		g = fminf(equal->xfade_pos*step, 1);
+		for(i = 0; i < frames; i++) {
+			out[j*stride + i] = old[i] + g*(out[j*stride + i] - old[i]);
+			g = fminf(g + step, 1);
+		}
+	}
+	equal->xfade_pos += frames;
+	if(equal->xfade_pos >= equal->xfade_frames) {
+		equal->xfade_from = NULL;
+		__atomic_store_n(&from->busy, 0, __ATOMIC_RELEASE);
+	}
+}
+
+/* Fade the channels the watchdog stopped processing to their dry input,
+   and back once they are processed again */
+static void equal_wet_mix(snd_pcm_equal_t *equal, const float *in, float *out,
+		snd_pcm_uframes_t stride, snd_pcm_uframes_t frames)
+{
+	const float step = 1.0f/equal->xfade_frames;
+	float g, target;
+	unsigned long i;
+	int j;
+
+	for(j = 0; j < equal->control_data->channels; j++) {
+		target = j < equal->wet_channels ? 1 : 0;
+		g = equal->wet[j];
+		if(g == target) {
+			if(target == 0) {
+				memcpy(out + j*stride, in + j*stride, frames*sizeof(float));
+			}
+			continue;
+		}
+		for(i = 0; i < frames; i++) {
+			g = target > g ? fminf(g + step, 1) : fmaxf(g - step, 0);
+			out[j*stride + i] = in[j*stride + i] +
+					g*(out[j*stride + i] - in[j*stride + i]);
+		}
+		equal->wet[j] = g;
+	}
+}
+
+static uint64_t equal_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static void equal_watchdog_step(snd_pcm_equal_t *equal, unsigned int level)
+{
+	LADSPA_Control *control_data = equal->control_data;
+	int down = level > equal->wd_current;
+
+	equal->wd_current = level;
+	equal->wd_over = 0;
+	equal->wd_under = 0;
+	equal->wd_module = equal->wd_level[level].module;
+	equal->wet_channels = equal->wd_level[level].channels;
+	__atomic_store_n(&control_data->watchdog_level, level, __ATOMIC_RELAXED);
+	__atomic_add_fetch(down ? &control_data->watchdog_down :
+			&control_data->watchdog_up, 1, __ATOMIC_RELAXED);
+	if(down) {
+		equal->wd_down++;
+	} else {
+		equal->wd_up++;
+	}
+	EQUAL_PROBE2(watchdog, level, down);
+}
+
+/* Log the steps taken since the last time. The steps happen on the
+   audio thread, which mustn't block on stderr, so they are only counted
+   there and logged from prepare and close with the audio stopped. */
+static void equal_watchdog_report(snd_pcm_equal_t *equal)
+{
+	unsigned int down = equal->wd_down - equal->wd_logged_down;
+	unsigned int up = equal->wd_up - equal->wd_logged_up;
+
+	if(down == 0 && up == 0) {
+		return;
+	}
+	SNDERR("Watchdog: stepped down %u and up %u times, now running %s "
+			"(level %u of %u)", down, up,
+			equal->wd_level[equal->wd_current].name, equal->wd_current,
+			equal->wd_num_levels);
+	equal->wd_logged_down = equal->wd_down;
+	equal->wd_logged_up = equal->wd_up;
+}
+
+/* Step down a level after wd_trigger blocks in a row over budget, and
+   back up after wd_recover blocks in a row under half of it. Falling
+   back again soon after stepping up doubles the wait for the next step
+   up, so that a host on the edge doesn't flap. */
+static void equal_watchdog(snd_pcm_equal_t *equal, uint64_t elapsed,
+		snd_pcm_uframes_t frames)
+{
+	uint64_t budget;
+
+	budget = (uint64_t)frames*10000000ULL*equal->wd_budget/equal->rate;
+	if(equal->wd_since_up < UINT_MAX) {
+		equal->wd_since_up++;
+	}
+	if(elapsed > budget) {
+		__atomic_add_fetch(&equal->control_data->watchdog_overruns, 1,
+				__ATOMIC_RELAXED);
+		equal->wd_under = 0;
+		if(++equal->wd_over < equal->wd_trigger ||
+				equal->wd_current == equal->wd_num_levels) {
+			return;
+		}
+		if(equal->wd_since_up >= equal->wd_recover) {
+			equal->wd_backoff = 0;
+		} else if(equal->wd_backoff < WATCHDOG_MAX_BACKOFF) {
+			equal->wd_backoff++;
+		}
+		equal_watchdog_step(equal, equal->wd_current + 1);
+		return;
+	}
+	equal->wd_over = 0;
+	if(equal->wd_current == 0 || elapsed >= budget/2) {
+		equal->wd_under = 0;
+		return;
+	}
+	if(++equal->wd_under >= equal->wd_recover << equal->wd_backoff) {
+		equal->wd_since_up = 0;
+		equal_watchdog_step(equal, equal->wd_current - 1);
+	}
+}
+
+/* Have alsaequal-dspd run the plugin. If it can't, the audio passes
+   through untouched until the next prepare reconnects. */
+static void equal_run_remote(snd_pcm_equal_t *equal, float *in, float *out,
+		snd_pcm_uframes_t stride, snd_pcm_uframes_t frames)
+{
+	int j, err = -ENOTCONN;
+
+	if(equal->dspd != NULL && equal->dspd_error == 0) {
+		err = equal_dspd_run(equal->dspd, equal->rate, equal->core.values, in,
+				out, stride, frames);
+		if(err < 0) {
+			equal->dspd_error = err;
+		}
+	}
+	if(err < 0) {
+		for(j = 0; j < equal->control_data->channels; j++) {
+			memcpy(out + j*stride, in + j*stride, frames*sizeof(float));
+		}
+	}
+}
+
+/* Run the plugins, zones and fades over frames of planar in into out */
+static void equal_process(snd_pcm_equal_t *equal, float *in, float *out,
+		snd_pcm_uframes_t stride, snd_pcm_uframes_t frames)
+{
+	unsigned int z;
+
+	if(equal->dspd_mode) {
+		equal_run_remote(equal, in, out, stride, frames);
+	} else {
+		equal_run_set(equal, equal->klass, equal->channel, in, out, stride,
+				frames);
+	}
+	for(z = 0; z < equal->num_zones; z++) {
+		equal_zone_run(equal, &equal->zone[z], in, out, stride, frames);
+	}
+	if(equal->xfade_from != NULL) {
+		equal_crossfade(equal, in, out, stride, frames);
+	}
+	if(equal->wd_budget) {
+		equal_wet_mix(equal, in, out, stride, frames);
+	}
+}
+
+/* A period of planar audio run in pieces by equal_core_split() */
+typedef struct equal_period {
+	snd_pcm_equal_t *equal;
+	float *in;
+	float *out;
+	snd_pcm_uframes_t stride;
+} equal_period_t;
+
+static void equal_period_piece(void *arg, unsigned long offset,
+		unsigned long frames)
+{
+	equal_period_t *period = arg;
+
+	equal_process(period->equal, period->in + offset, period->out + offset,
+			period->stride, frames);
+}
+
+/* Pass planar in through the block adapter into out, running a block
+   whenever one is complete. The output is exactly block frames behind
+   the input, and changes due anywhere in a block apply from its start. */
+static void equal_run_blocks(snd_pcm_equal_t *equal, const float *in,
+		float *out, snd_pcm_uframes_t size)
+{
+	const snd_pcm_uframes_t block = equal->block;
+	uint64_t pos = equal->core.frame_pos;
+	snd_pcm_uframes_t done, n;
+	int j;
+
+	for(done = 0; done < size; done += n) {
+		n = block - equal->block_fill;
+		if(n > size - done) {
+			n = size - done;
+		}
+		for(j = 0; j < equal->control_data->channels; j++) {
+			memcpy(equal->block_in + j*block + equal->block_fill,
+					in + j*size + done, n*sizeof(float));
+			memcpy(out + j*size + done,
+					equal->block_out + j*block + equal->block_fill,
+					n*sizeof(float));
+		}
+		equal->block_fill += n;
+		if(equal->block_fill == block) {
+			equal->block_fill = 0;
+			equal_apply_events(equal, pos + done + n - 1);
+			equal_process(equal, equal->block_in, equal->block_out, block,
+					block);
+		}
+	}
+}
+
+/* Whether a period of size frames can go straight to and from the
+   segment alsaequal-dspd runs the plugin on, skipping a copy each way.
+   Only when nothing but the plugin touches the planar audio. */
+static int equal_dspd_direct(snd_pcm_equal_t *equal, snd_pcm_uframes_t size)
+{
+	return equal->dspd_mode && equal->dspd != NULL &&
+			equal->dspd_error == 0 && equal->block == 0 &&
+			equal->graph == NULL && equal->crossover == NULL &&
+			size <= EQUAL_DSPD_MAX_FRAMES;
+}
+
+/* Run the plugin chain over size interleaved frames in src, the result
+   ends up in dst. Both buffers are used as scratch space. */
+static void equal_run(snd_pcm_equal_t *equal, float *src, float *dst,
+		snd_pcm_uframes_t size)
+{
+	LADSPA_Control *control_data = equal->control_data;
+	float peak[16], sum[16];
+	float *in = dst, *out = src;
+	equal_period_t period;
+	uint64_t start = 0;
+	snd_pcm_uframes_t stride = size;
+	unsigned int z;
+	int tap;
+
+	if(equal->wd_budget) {
+		start = equal_now();
+	}
+	equal_sync_controls(equal);
+	if(equal->num_modules > 1) {
+		equal_switch_module(equal);
+	}
+
+	/* A capture being recorded needs the tap as well */
+	tap = equal->tap != NULL &&
+			(__atomic_load_n(&control_data->tap_enable,
+			__ATOMIC_RELAXED) ||
+			__atomic_load_n(&control_data->capture_enable,
+			__ATOMIC_RELAXED));
+	if(tap) {
+		equal_tap_put(equal->tap, EQUAL_TAP_PRE, src, size);
+	}
+
+	/* NOTE: swap source and destination memory space when deinterleaved.
+		then swap it back during the interleave call below */
+	if(equal_dspd_direct(equal, size)) {
+		equal_dspd_audio(equal->dspd, &in, &out);
+		stride = EQUAL_DSPD_MAX_FRAMES;
+	}
+	equal_core_deinterleave(src, in, size, control_data->channels, stride,
+			peak, sum);
+	equal_core_publish_meters(control_data->peak_in, control_data->rms_in,
+			peak, sum, control_data->channels, size);
+	for(z = 0; z < equal->num_zones; z++) {
+		equal_zone_meters(&equal->zone[z], equal->zone[z].control_data->peak_in,
+				equal->zone[z].control_data->rms_in, peak, sum, size);
+	}
+	
+	/* run() is split wherever a timestamped change falls in the block,
+	   the block adapter only ever runs whole blocks */
+	if(equal->block) {
+		equal_run_blocks(equal, dst, src, size);
+	} else {
+		period.equal = equal;
+		period.in = in;
+		period.out = out;
+		period.stride = stride;
+		equal_core_split(equal->cores, equal->num_cores, size,
+				equal->xfade_from != NULL ? XFADE_CHUNK : 0,
+				equal_period_piece, &period);
+	}
+	equal_core_advance(&equal->core, size);
+	for(z = 0; z < equal->num_zones; z++) {
+		equal_core_advance(&equal->zone[z].core, size);
+	}
+
+	/* The branches sum back into src, where the interleave below reads.
+	   When the watchdog bypasses everything the module branches turn
+	   into dry paths, so the routing stays the same. */
+	if(equal->graph != NULL) {
+		equal->graph->bypass = equal->wd_budget && equal->wet_channels == 0;
+		equal_graph_run(equal->graph, src, src, size);
+	}
+
+	if(equal->crossover != NULL) {
+		/* The tap sees the equalizer output before the split, which
+		   takes an interleave pass of its own */
+		if(tap) {
+			equal_core_interleave(src, dst, size, control_data->channels,
+					size, peak, sum);
+			equal_tap_put(equal->tap, EQUAL_TAP_POST, dst, size);
+			equal_tap_commit(equal->tap, size);
+		}
+		/* Split straight into the interleaved slave area */
+		equal_crossover_run(equal->crossover, src, dst, size, peak, sum);
+	} else {
+		equal_core_interleave(out, dst, size, control_data->channels, stride,
+				peak, sum);
+	}
+	equal_core_publish_meters(control_data->peak_out, control_data->rms_out,
+			peak, sum, control_data->channels, size);
+	for(z = 0; z < equal->num_zones; z++) {
+		equal_zone_meters(&equal->zone[z],
+				equal->zone[z].control_data->peak_out,
+				equal->zone[z].control_data->rms_out, peak, sum, size);
+	}
+	if(equal->crossover == NULL) {
+		if(tap) {
+			equal_tap_put(equal->tap, EQUAL_TAP_POST, dst, size);
+			equal_tap_commit(equal->tap, size);
+		}
+	}
+
+	if(equal->wd_budget) {
+		equal_watchdog(equal, equal_now() - start, size);
+	}
+}
+
+/* Hand the band gains to the integer engine */
+static void equal_fixed_gains(snd_pcm_equal_t *equal)
+{
+	unsigned int channels = equal->control_data->channels;
+	unsigned int b;
+
+	for(b = 0; b < equal->fixed->bands; b++) {
+		memcpy(&equal->fixed_gain[b*channels],
+				&equal->core.values[equal->fixed_band[b]*channels],
+				channels*sizeof(float));
+	}
+	equal_fixed_set(equal->fixed, equal->fixed_gain);
+}
+
+static int equal_fixed_format(snd_pcm_format_t format)
+{
+	return format == SND_PCM_FORMAT_S16 ? EQUAL_FIXED_S16 : EQUAL_FIXED_S32;
+}
+
+/* An interleaved period for the integer engine, run in pieces */
+typedef struct equal_fixed_period {
+	snd_pcm_equal_t *equal;
+	const char *src;
+	char *dst;
+	int src_format;
+	int dst_format;
+	size_t src_frame;
+	size_t dst_frame;
+} equal_fixed_period_t;
+
+static void equal_fixed_piece(void *arg, unsigned long offset,
+		unsigned long frames)
+{
+	equal_fixed_period_t *period = arg;
+	snd_pcm_equal_t *equal = period->equal;
+
+	equal_fixed_gains(equal);
+	equal_fixed_run(equal->fixed, period->src + offset*period->src_frame,
+			period->src_format, period->dst + offset*period->dst_frame,
+			period->dst_format, frames, &equal->fixed_in, &equal->fixed_out);
+}
+
+/* equal_run() for the integer engine, the samples are never converted to
+   float */
+static void equal_run_fixed(snd_pcm_equal_t *equal, const char *src,
+		char *dst, snd_pcm_uframes_t size)
+{
+	LADSPA_Control *control_data = equal->control_data;
+	const unsigned int channels = control_data->channels;
+	const int src_format = equal_fixed_format(equal->ext.format);
+	const int dst_format = equal_fixed_format(equal->ext.slave_format);
+	const size_t src_frame = channels*(src_format == EQUAL_FIXED_S16 ?
+			sizeof(int16_t) : sizeof(int32_t));
+	const size_t dst_frame = channels*(dst_format == EQUAL_FIXED_S16 ?
+			sizeof(int16_t) : sizeof(int32_t));
+	equal_fixed_period_t period = { equal, src, dst, src_format,
+			dst_format, src_frame, dst_frame };
+	float peak[16], sum[16];
+	unsigned int j;
+
+	equal_sync_controls(equal);
+	memset(&equal->fixed_in, 0, sizeof(equal->fixed_in));
+	memset(&equal->fixed_out, 0, sizeof(equal->fixed_out));
+
+	equal_core_split(equal->cores, equal->num_cores, size, 0,
+			equal_fixed_piece, &period);
+	equal_core_advance(&equal->core, size);
+
+	for(j = 0; j < channels; j++) {
+		peak[j] = equal->fixed_in.peak[j]*(1.0f/EQUAL_FIXED_PEAK_ONE);
+		sum[j] = equal->fixed_in.sum[j]*
+				(1.0f/EQUAL_FIXED_RMS_ONE/EQUAL_FIXED_RMS_ONE);
+	}
+	equal_core_publish_meters(control_data->peak_in, control_data->rms_in,
+			peak, sum, channels, size);
+	for(j = 0; j < channels; j++) {
+		peak[j] = equal->fixed_out.peak[j]*(1.0f/EQUAL_FIXED_PEAK_ONE);
+		sum[j] = equal->fixed_out.sum[j]*
+				(1.0f/EQUAL_FIXED_RMS_ONE/EQUAL_FIXED_RMS_ONE);
+	}
+	equal_core_publish_meters(control_data->peak_out, control_data->rms_out,
+			peak, sum, channels, size);
+}
+
+static void *equal_pipeline_thread(void *arg)
+{
+	snd_pcm_equal_t *equal = arg;
+	size_t frame_bytes, out_frame_bytes, avail;
+	snd_pcm_uframes_t frames;
+
+	frame_bytes = equal->control_data->channels*sizeof(float);
+	out_frame_bytes = equal->out_channels*sizeof(float);
+
+	while(1) {
+		sem_wait(&equal->pipeline_wake);
+		if(!__atomic_load_n(&equal->pipeline_running, __ATOMIC_ACQUIRE)) {
+			break;
+		}
+		while((avail = equal_ring_read_space(equal->in_ring)) >=
+				frame_bytes) {
+			frames = avail/frame_bytes;
+			if(frames > PIPELINE_CHUNK_FRAMES) {
+				frames = PIPELINE_CHUNK_FRAMES;
+			}
+			equal_ring_read(equal->in_ring, equal->pipeline_buf[0],
+					frames*frame_bytes);
+			equal_run(equal, equal->pipeline_buf[0],
+					equal->pipeline_buf[1], frames);
+			equal_ring_write(equal->out_ring, equal->pipeline_buf[1],
+					frames*out_frame_bytes);
+		}
+	}
+
+	return NULL;
+}
+
+static int equal_pipeline_start(snd_pcm_equal_t *equal)
+{
+	pthread_attr_t attr;
+	struct sched_param param;
+	int err;
+
+	equal_ring_reset(equal->in_ring);
+	equal_ring_reset(equal->out_ring);
+	equal->pipeline_primed = 0;
+	equal->pipeline_late = 0;
+	equal->pipeline_hole = 0;
+	equal->latency = 0;
+
+	__atomic_store_n(&equal->pipeline_running, 1, __ATOMIC_RELEASE);
+
+	/* Try for real-time scheduling, fall back to a normal thread */
+	pthread_attr_init(&attr);
+	if(equal->pipeline_priority > 0) {
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		param.sched_priority = equal->pipeline_priority;
+		pthread_attr_setschedparam(&attr, &param);
+		err = pthread_create(&equal->pipeline_thread, &attr,
+				equal_pipeline_thread, equal);
+		if(err == 0) {
+			pthread_attr_destroy(&attr);
+			return 0;
+		}
+		pthread_attr_destroy(&attr);
+		pthread_attr_init(&attr);
+	}
+	err = pthread_create(&equal->pipeline_thread, &attr,
+			equal_pipeline_thread, equal);
+	pthread_attr_destroy(&attr);
+	if(err != 0) {
+		__atomic_store_n(&equal->pipeline_running, 0, __ATOMIC_RELEASE);
+		SNDERR("Failed to start the DSP thread: %s", strerror(err));
+		return -err;
+	}
+	return 0;
+}
+
+static void equal_pipeline_stop(snd_pcm_equal_t *equal)
+{
+	if(!__atomic_load_n(&equal->pipeline_running, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+	__atomic_store_n(&equal->pipeline_running, 0, __ATOMIC_RELEASE);
+	sem_post(&equal->pipeline_wake);
+	pthread_join(equal->pipeline_thread, NULL);
+}
+
+/* Publish the frames the output lags the input by with the controls of
+   the PCM and of its zones */
+static void equal_publish_latency(snd_pcm_equal_t *equal)
+{
+	uint32_t latency = equal->block + equal->latency;
+	unsigned int z;
+
+	if(equal->fixed != NULL) {
+		latency += equal->fixed->latency;
+	}
+	__atomic_store_n(&equal->control_data->latency, latency,
+			__ATOMIC_RELAXED);
+	for(z = 0; z < equal->num_zones; z++) {
+		__atomic_store_n(&equal->zone[z].control_data->latency, latency,
+				__ATOMIC_RELAXED);
+	}
+}
+
+/* Hand the input to the DSP thread and return the output it produced for
+   the previous period. The first period after a (re)start is primed with
+   silence which sets the extra latency to one period, and it stays at
+   that when the DSP thread falls behind or the input ring is full. */
+static void equal_pipeline_transfer(snd_pcm_equal_t *equal,
+		float *src, float *dst, snd_pcm_uframes_t size)
+{
+	size_t bytes, out_bytes, pad, got;
+
+	bytes = size*equal->control_data->channels*sizeof(float);
+	out_bytes = size*equal->out_channels*sizeof(float);
+
+	if(!equal->pipeline_primed) {
+		memset(dst, 0, out_bytes);
+		equal_ring_write(equal->out_ring, dst, out_bytes);
+		equal->latency = size;
+		equal->pipeline_primed = 1;
+		equal_publish_latency(equal);
+	}
+
+	/* The output of input dropped last period never comes */
+	pad = equal->pipeline_hole < out_bytes ? equal->pipeline_hole : out_bytes;
+	equal->pipeline_hole -= pad;
+
+	/* The input goes in whole or not at all */
+	if(equal_ring_write_space(equal->in_ring) < bytes) {
+		equal->pipeline_hole += out_bytes;
+		equal->overruns++;
+	} else {
+		equal_ring_write(equal->in_ring, src, bytes);
+	}
+	sem_post(&equal->pipeline_wake);
+
+	/* Output that already played as silence comes before this period's */
+	if(equal->pipeline_late > 0) {
+		equal->pipeline_late -= equal_ring_skip(equal->out_ring,
+				equal->pipeline_late);
+	}
+	memset(dst, 0, pad);
+	got = 0;
+	if(equal->pipeline_late == 0) {
+		got = equal_ring_read(equal->out_ring, (char *)dst + pad,
+				out_bytes - pad);
+	}
+	if(got < out_bytes - pad) {
+		/* The DSP thread fell behind, pad with silence and drop what it
+		   produces for it later */
+		memset((char *)dst + pad + got, 0, out_bytes - pad - got);
+		equal->pipeline_late += out_bytes - pad - got;
+		equal->underruns++;
+	}
+}
+
+static snd_pcm_sframes_t equal_transfer(snd_pcm_extplug_t *ext,
+		  const snd_pcm_channel_area_t *dst_areas,
+		  snd_pcm_uframes_t dst_offset,
+		  const snd_pcm_channel_area_t *src_areas,
+		  snd_pcm_uframes_t src_offset,
+		  snd_pcm_uframes_t size)
+{
+	snd_pcm_equal_t *equal = (snd_pcm_equal_t *)ext;
+	float *src, *dst;
+	uint64_t start = 0;
+
+	EQUAL_PROBE3(transfer_entry, size, equal->control_data->channels,
+			equal->control_data->seq);
+	if(EQUAL_PROBE_ENABLED(transfer_exit)) {
+		start = equal_probe_now();
+	}
+
+	/* Calculate buffer locations */
+	src = (float*)(src_areas->addr +
+			(src_areas->first + src_areas->step * src_offset)/8);
+	dst = (float*)(dst_areas->addr +
+			(dst_areas->first + dst_areas->step * dst_offset)/8);
+
+	if(equal->fixed != NULL) {
+		equal_run_fixed(equal, (const char *)src, (char *)dst, size);
+	} else if(equal->pipeline) {
+		equal_pipeline_transfer(equal, src, dst, size);
+	} else {
+		equal_run(equal, src, dst, size);
+	}
+
+	EQUAL_PROBE4(transfer_exit, size, equal->control_data->channels,
+			equal_probe_now() - start, equal->control_data->seq);
+
+	return size;
+}
+
+/* Run every instance over a block of silence so that the plugin state is
+   faulted in before the first real period. */
+static void equal_warmup(snd_pcm_equal_t *equal)
+{
+	LADSPA_Control *control_data = equal->control_data;
+	unsigned int z;
+	int j;
+
+	memset(equal->warmup_buf, 0, 2*WARMUP_FRAMES*sizeof(float));
+	for(j = 0; j < control_data->channels; j++) {
+		equal_core_run(equal->klass, equal->channel[j], control_data, j,
+				equal->warmup_buf, equal->warmup_buf + WARMUP_FRAMES,
+				WARMUP_FRAMES);
+	}
+	for(z = 0; z < equal->num_zones; z++) {
+		equal_zone_run(equal, &equal->zone[z], equal->warmup_buf,
+				equal->warmup_buf + WARMUP_FRAMES, 0, WARMUP_FRAMES);
+	}
+
+}
+
+/* (Re)size the pipeline buffers for the negotiated buffer size and
+   restart the DSP thread with empty rings. */
+static int equal_pipeline_init(snd_pcm_equal_t *equal)
+{
+	size_t frame_bytes, ring_bytes;
+	int i;
+
+	equal_pipeline_stop(equal);
+
+	/* Sized for the output side, which is wider with a crossover */
+	frame_bytes = equal->out_channels*sizeof(float);
+	ring_bytes = 2*(equal->buffer_size + PIPELINE_CHUNK_FRAMES)*frame_bytes;
+
+	if(equal->in_ring == NULL || equal->in_ring->size < ring_bytes) {
+		equal_ring_release(equal, equal->in_ring);
+		equal_ring_release(equal, equal->out_ring);
+		equal->in_ring = equal_ring_alloc(equal, ring_bytes);
+		equal->out_ring = equal_ring_alloc(equal, ring_bytes);
+		if(equal->in_ring == NULL || equal->out_ring == NULL) {
+			return -ENOMEM;
+		}
+	}
+	for(i = 0; i < 2; i++) {
+		if(equal->pipeline_buf[i] == NULL) {
+			equal->pipeline_buf[i] = equal_alloc(equal,
+					PIPELINE_CHUNK_FRAMES*frame_bytes);
+			if(equal->pipeline_buf[i] == NULL) {
+				return -ENOMEM;
+			}
+		}
+	}
+
+	return equal_pipeline_start(equal);
+}
+
+static void equal_pool_release(snd_pcm_equal_t *equal,
+		equal_instances_t *set)
+{
+	if(set->klass != NULL) {
+		equal_core_release(set->klass, set->handle,
+				equal->control_data->channels);
+	}
+	set->rate = 0;
+	set->klass = NULL;
+}
+
+static void equal_zone_release(snd_pcm_equal_t *equal, equal_zone_t *zone)
+{
+	equal_core_release(equal->klass, zone->handle,
+			zone->control_data->channels);
+	zone->rate = 0;
+}
+
+/* Activated instances of klass for rate, reusing a set made before when
+   there is one, otherwise replacing the least recently used set that is
+   neither busy nor keep. Called with pool_lock held. */
+static equal_instances_t *equal_pool_get(snd_pcm_equal_t *equal,
+		const LADSPA_Descriptor *klass, unsigned long rate,
+		const equal_instances_t *keep)
+{
+	equal_instances_t *set = NULL;
+	int i;
+
+	for(i = 0; i < POOL_SIZE; i++) {
+		if(equal->pool[i].klass == klass && equal->pool[i].rate == rate) {
+			equal->pool[i].last_used = ++equal->pool_clock;
+			return &equal->pool[i];
+		}
+	}
+	for(i = 0; i < POOL_SIZE; i++) {
+		if(&equal->pool[i] == keep ||
+				__atomic_load_n(&equal->pool[i].busy, __ATOMIC_ACQUIRE)) {
+			continue;
+		}
+		if(set == NULL || equal->pool[i].last_used < set->last_used) {
+			set = &equal->pool[i];
+		}
+	}
+	if(set == NULL) {
+		return NULL;
+	}
+
+	equal_pool_release(equal, set);
+	if(equal_core_instantiate(klass, set->handle,
+			equal->control_data->channels, rate) < 0) {
+		return NULL;
+	}
+	set->klass = klass;
+	set->rate = rate;
+	set->last_used = ++equal->pool_clock;
+	return set;
+}
+
+/* Connect the control ports of a set to the private copy of the controls */
+static void equal_connect_controls(snd_pcm_equal_t *equal,
+		equal_instances_t *set)
+{
+	equal_core_connect_controls(set->klass, set->handle, equal->control_data,
+			equal->core.values);
+}
+
+/* Instantiates the modules the audio thread asks for */
+static void *equal_loader_thread(void *arg)
+{
+	snd_pcm_equal_t *equal = arg;
+	equal_instances_t *set;
+	unsigned int module;
+
+	for(;;) {
+		while(sem_wait(&equal->loader_wake) < 0 && errno == EINTR);
+		if(!__atomic_load_n(&equal->loader_running, __ATOMIC_ACQUIRE)) {
+			break;
+		}
+		module = __atomic_load_n(&equal->module_req, __ATOMIC_RELAXED);
+		pthread_mutex_lock(&equal->pool_lock);
+		set = equal_pool_get(equal, equal->module[module].klass,
+				equal->rate, NULL);
+		if(set != NULL) {
+			equal_connect_controls(equal, set);
+			__atomic_store_n(&set->busy, 1, __ATOMIC_RELAXED);
+			__atomic_store_n(&equal->module_failed, -1, __ATOMIC_RELAXED);
+			__atomic_store_n(&equal->swap_ready, set, __ATOMIC_RELEASE);
+		} else {
+			/* Not asked for again until another module is selected */
+			__atomic_store_n(&equal->module_failed, module,
+					__ATOMIC_RELEASE);
+			__atomic_store_n(&equal->swap_pending, 0, __ATOMIC_RELEASE);
+		}
+		pthread_mutex_unlock(&equal->pool_lock);
+	}
+	return NULL;
+}
+
+/* The rate a stream at rate is likely to switch to next, 0 for none */
+static unsigned long equal_standby_rate(snd_pcm_equal_t *equal,
+		unsigned long rate)
+{
+	if(equal->standby_rate != STANDBY_AUTO) {
+		return equal->standby_rate;
+	}
+	if(rate % 44100 == 0) {
+		return rate/44100*48000;
+	}
+	if(rate % 48000 == 0) {
+		return rate/48000*44100;
+	}
+	return 0;
+}
+
+static int equal_close(snd_pcm_extplug_t *ext) {
+	snd_pcm_equal_t *equal = ext->private_data;
+	size_t controls_bytes;
+	int i;
+	EQUAL_PROBE1(close, equal->control_data->channels);
+	if(equal->pipeline) {
+		equal_pipeline_stop(equal);
+		sem_destroy(&equal->pipeline_wake);
+		equal_ring_release(equal, equal->in_ring);
+		equal_ring_release(equal, equal->out_ring);
+		for(i = 0; i < 2; i++) {
+			equal_free(equal, equal->pipeline_buf[i], PIPELINE_CHUNK_FRAMES*
+					equal->out_channels*sizeof(float));
+		}
+	}
+	if(equal->wd_budget) {
+		equal_watchdog_report(equal);
+	}
+	if(equal->loader_running) {
+		__atomic_store_n(&equal->loader_running, 0, __ATOMIC_RELEASE);
+		sem_post(&equal->loader_wake);
+		pthread_join(equal->loader_thread, NULL);
+		sem_destroy(&equal->loader_wake);
+		equal_free(equal, equal->xfade_buf, equal->control_data->channels*
+				equal->xfade_chunk*sizeof(float));
+	}
+	if(equal->block) {
+		equal_free(equal, equal->block_in, equal->control_data->channels*
+				equal->block*sizeof(float));
+		equal_free(equal, equal->block_out, equal->control_data->channels*
+				equal->block*sizeof(float));
+	}
+	for(i = 0; i < POOL_SIZE; i++) {
+		if(equal->pool[i].handle != NULL) {
+			equal_pool_release(equal, &equal->pool[i]);
+			free(equal->pool[i].handle);
+		}
+	}
+	pthread_mutex_destroy(&equal->pool_lock);
+	for(i = 0; i < equal->num_zones; i++) {
+		equal_zone_t *zone = &equal->zone[i];
+		controls_bytes = zone->control_data->num_controls*
+				zone->control_data->channels*sizeof(LADSPA_Data);
+		equal_zone_release(equal, zone);
+		free(zone->handle);
+		equal_free(equal, zone->core.values, controls_bytes);
+		equal_free(equal, zone->core.staging, controls_bytes);
+		equal_region_remove(equal, zone->control_data);
+		LADSPAcontrolUnMMAP(zone->control_data);
+	}
+	for(i = 1; i < equal->num_modules; i++) {
+		LADSPAunload(equal->module[i].library);
+	}
+	controls_bytes = equal->control_data->num_controls*
+			equal->control_data->channels*sizeof(LADSPA_Data);
+	equal_free(equal, equal->core.values, controls_bytes);
+	equal_free(equal, equal->core.staging, controls_bytes);
+	equal_free(equal, equal->warmup_buf, 2*WARMUP_FRAMES*sizeof(float));
+	/* The graph gives its buffers back to the regions */
+	equal_graph_destroy(equal->graph);
+	equal_region_remove(equal, equal->control_data);
+	while(equal->regions != NULL) {
+		equal_region_remove(equal, equal->regions->ptr);
+	}
+	if(equal->tap != NULL) {
+		equal_tap_destroy(equal->tap, equal->tap_length);
+	}
+	equal_crossover_destroy(equal->crossover);
+	equal_dspd_close(equal->dspd);
+	equal_fixed_destroy(equal->fixed);
+	free(equal->dspd_socket);
+	free(equal->dspd_library);
+	free(equal->dspd_module);
+	LADSPAcontrolUnMMAP(equal->control_data);
+	if(equal->library != NULL) {
+		LADSPAunload(equal->library);
+	}
+	free(equal);
+	return 0;
+}
+
+/* Make the instances of the selected module for rate current */
+static int equal_init_instances(snd_pcm_equal_t *equal, unsigned long rate)
+{
+	equal_instances_t *set;
+	unsigned long standby;
+	unsigned int module;
+
+	/* One LADSPA Plugin for each channel of the selected module, already
+	   running if this rate was used before or kept on standby. A module
+	   switch in progress is settled straight away. */
+	module = equal->control_data->module_index;
+	if(module >= equal->num_modules) {
+		module = 0;
+	}
+	pthread_mutex_lock(&equal->pool_lock);
+	set = __atomic_exchange_n(&equal->swap_ready, NULL, __ATOMIC_ACQ_REL);
+	if(set != NULL) {
+		set->busy = 0;
+	}
+	if(equal->xfade_from != NULL) {
+		equal->xfade_from->busy = 0;
+		equal->xfade_from = NULL;
+	}
+	if(equal->current != NULL) {
+		equal->current->busy = 0;
+	}
+	equal->swap_pending = 0;
+	equal->module_failed = -1;
+	equal->rate = rate;
+	set = equal_pool_get(equal, equal->module[module].klass, equal->rate,
+			NULL);
+	if(set == NULL) {
+		pthread_mutex_unlock(&equal->pool_lock);
+		SNDERR("Failed to instantiate %s at %lu Hz",
+				equal->module[module].klass->Label, equal->rate);
+		return -ENOMEM;
+	}
+	set->busy = 1;
+	equal->current = set;
+	equal->klass = set->klass;
+	equal->channel = set->handle;
+	standby = equal_standby_rate(equal, equal->rate);
+	if(standby != 0 && standby != equal->rate &&
+			equal_pool_get(equal, equal->klass, standby, set) == NULL) {
+		SNDERR("Failed to instantiate %s at %lu Hz for standby",
+				equal->klass->Label, standby);
+	}
+	/* The plugins see a private copy of the controls so that a curve is
+	   always applied as a whole */
+	equal_connect_controls(equal, set);
+	pthread_mutex_unlock(&equal->pool_lock);
+	return 0;
+}
+
+/* Instances of the zones for rate, made again only when the rate changed,
+   and the zones' controls as they are now */
+static int equal_zones_prepare(snd_pcm_equal_t *equal, unsigned long rate)
+{
+	equal_zone_t *zone;
+	unsigned int z;
+	int err;
+
+	for(z = 0; z < equal->num_zones; z++) {
+		zone = &equal->zone[z];
+		if(zone->rate != rate) {
+			equal_zone_release(equal, zone);
+			err = equal_core_instantiate(equal->klass, zone->handle,
+					zone->control_data->channels, rate);
+			if(err < 0) {
+				SNDERR("Failed to instantiate %s at %lu Hz for zone %s",
+						equal->klass->Label, rate, zone->name);
+				return err;
+			}
+			equal_core_connect_controls(equal->klass, zone->handle,
+					zone->control_data, zone->core.values);
+			zone->rate = rate;
+		}
+		equal_core_start(&zone->core, rate, NULL);
+	}
+	return 0;
+}
+
+/* Connect to alsaequal-dspd, again if the daemon went away. Failing that
+   the audio passes through, the stream keeps going. */
+static void equal_dspd_reconnect(snd_pcm_equal_t *equal)
+{
+	if(equal->dspd != NULL && equal->dspd_error == 0) {
+		return;
+	}
+	if(equal->dspd != NULL) {
+		SNDERR("alsaequal-dspd failed: %s, reconnecting",
+				strerror(-equal->dspd_error));
+		equal_dspd_close(equal->dspd);
+	}
+	equal->dspd_error = 0;
+	equal->dspd = equal_dspd_connect(equal->dspd_socket, equal->dspd_library,
+			equal->dspd_module, equal->control_data);
+	if(equal->dspd == NULL) {
+		SNDERR("Can't reach alsaequal-dspd: %s, passing audio through",
+				strerror(errno));
+	}
+}
+
+static int equal_init(snd_pcm_extplug_t *ext)
+{
+	snd_pcm_equal_t *equal = (snd_pcm_equal_t *)ext;
+	LADSPA_Data freq[LADSPA_CNTRL_MAX_CROSSOVERS];
+	uint64_t start = 0;
+	int err = 0;
+
+	if(EQUAL_PROBE_ENABLED(init)) {
+		start = equal_probe_now();
+	}
+
+	/* The DSP thread must not touch the instances while we replace them */
+	if(equal->pipeline) {
+		equal_pipeline_stop(equal);
+	}
+	if(equal->wd_budget) {
+		equal_watchdog_report(equal);
+	}
+
+	if(equal->dspd_mode) {
+		equal->rate = ext->rate;
+		equal_dspd_reconnect(equal);
+	} else if(equal->fixed != NULL) {
+		equal->rate = ext->rate;
+		equal_fixed_reset(equal->fixed, ext->rate);
+	} else {
+		err = equal_init_instances(equal, ext->rate);
+		if(err < 0) {
+			return err;
+		}
+		err = equal_zones_prepare(equal, ext->rate);
+		if(err < 0) {
+			return err;
+		}
+	}
+	equal->xfade_frames = equal->xfade_ms*ext->rate/1000;
+	if(equal->xfade_frames == 0) {
+		equal->xfade_frames = 1;
+	}
+	/* The block adapter starts over with a block of silence */
+	if(equal->block) {
+		equal->block_fill = 0;
+		memset(equal->block_out, 0, equal->control_data->channels*
+				equal->block*sizeof(float));
+	}
+
+	/* Frame positions start over, events queued before now are history */
+	equal_core_start(&equal->core, ext->rate,
+			equal->crossover != NULL ? freq : NULL);
+	if(equal->crossover != NULL) {
+		equal_crossover_reset(equal->crossover, ext->rate);
+		equal_crossover_set(equal->crossover, freq);
+	}
+
+	if(equal->graph != NULL) {
+		equal_graph_memory_t memory = { equal_graph_alloc,
+				equal_graph_release, equal };
+		equal_graph_stop(equal->graph);
+		err = equal_graph_start(equal->graph, ext->rate,
+				equal->pipeline || equal->buffer_size == 0 ?
+				PIPELINE_CHUNK_FRAMES : equal->buffer_size,
+				equal->branch_threads, equal->pipeline_priority, &memory);
+		if(err < 0) {
+			SNDERR("Failed to start the branches: %s", strerror(-err));
+			return err;
+		}
+	}
+
+	if(equal->mlock && equal->channel != NULL) {
+		equal_warmup(equal);
+	}
+	if(equal->tap != NULL) {
+		equal->tap->rate = ext->rate;
+	}
+
+	if(equal->pipeline) {
+		err = equal_pipeline_init(equal);
+	}
+	if(equal->mlock) {
+		equal_publish_mlock(equal);
+	}
+	equal_publish_latency(equal);
+
+	EQUAL_PROBE3(init, ext->rate, equal->control_data->channels,
+			equal_probe_now() - start);
+
+	return err;
+}
+
+static int equal_hw_params(snd_pcm_extplug_t *ext, snd_pcm_hw_params_t *params)
+{
+	snd_pcm_equal_t *equal = (snd_pcm_equal_t *)ext;
+
+	if(snd_pcm_hw_params_get_buffer_size(params, &equal->buffer_size) < 0) {
+		equal->buffer_size = 0;
+	}
+	return 0;
+}
+
+static void equal_dump(snd_pcm_extplug_t *ext, snd_output_t *out)
+{
+	snd_pcm_equal_t *equal = (snd_pcm_equal_t *)ext;
+	unsigned int i, j;
+
+	if(equal->dspd_mode) {
+		snd_output_printf(out, "LADSPA plugin %s (%s) in alsaequal-dspd\n",
+				equal->control_data->label, equal->control_data->name);
+		if(equal->dspd == NULL || equal->dspd_error) {
+			snd_output_printf(out, "Not connected, passing audio through\n");
+		} else if(equal->dspd->calls > 0) {
+			snd_output_printf(out, "Round trip %.1f us average, %.1f us "
+					"worst over %llu calls\n", equal->dspd->total_ns/
+					(1000.0*equal->dspd->calls), equal->dspd->max_ns/1000.0,
+					(unsigned long long)equal->dspd->calls);
+		}
+	} else if(equal->fixed != NULL) {
+		snd_output_printf(out, "Fixed point (%s) equalizer for %s (%s), "
+				"bands at", equal_fixed_isa_name(equal->fixed->isa),
+				equal->control_data->label, equal->control_data->name);
+		for(i = 0; i < equal->fixed->bands; i++) {
+			snd_output_printf(out, " %.0f", equal->fixed->freq[i]);
+		}
+		snd_output_printf(out, " Hz\n");
+		if(equal->fixed->stages > 0) {
+			snd_output_printf(out, "Bands below %.0f Hz at %.0f Hz, %u "
+					"frames of latency\n", equal->fixed->split,
+					ldexp(equal->rate, -(int)equal->fixed->stages),
+					equal->fixed->latency);
+		}
+	} else {
+		snd_output_printf(out, "LADSPA plugin %s (%s)\n",
+				equal->klass->Label, equal->klass->Name);
+	}
+	if(equal->mlock) {
+		if(equal->mlock_error) {
+			snd_output_printf(out, "Memory locking failed: %s\n",
+					strerror(equal->mlock_error));
+		} else {
+			snd_output_printf(out, "%zu bytes locked in memory\n",
+					equal->locked_bytes);
+		}
+	}
+	if(equal->library != NULL) {
+		snd_output_printf(out, "Instances ready for");
+		for(i = 0; i < POOL_SIZE; i++) {
+			if(equal->pool[i].rate != 0) {
+				snd_output_printf(out, " %lu", equal->pool[i].rate);
+			}
+		}
+		snd_output_printf(out, " Hz\n");
+	}
+	if(equal->num_modules > 1) {
+		snd_output_printf(out, "Switchable modules:");
+		for(i = 0; i < equal->num_modules; i++) {
+			snd_output_printf(out, " %s", equal->module[i].klass->Label);
+		}
+		snd_output_printf(out, "\n");
+	}
+	if(equal->graph != NULL) {
+		snd_output_printf(out, "%u parallel branches on %u threads\n",
+				equal->graph->num_branches, equal->graph->num_threads);
+	}
+	if(equal->crossover != NULL) {
+		snd_output_printf(out, "%u band crossover at", equal->crossover->bands);
+		for(i = 0; i < equal->crossover->bands - 1; i++) {
+			snd_output_printf(out, " %.0f", equal->crossover->freq[i]);
+		}
+		snd_output_printf(out, " Hz\n");
+	}
+	if(equal->block) {
+		snd_output_printf(out, "Plugins run in blocks of %lu frames, %lu "
+				"frames latency\n", equal->block, equal->block);
+	}
+	if(equal->pipeline) {
+		snd_output_printf(out, "Pipelined DSP thread: %lu frames latency, "
+				"%lu underruns, %lu overruns\n", equal->latency,
+				equal->underruns, equal->overruns);
+	}
+	if(equal->wd_budget) {
+		snd_output_printf(out, "Watchdog at %u%% of the period: running %s "
+				"(level %u of %u), %u steps down, %u up, %u blocks over "
+				"budget\n", equal->wd_budget,
+				equal->wd_level[equal->wd_current].name, equal->wd_current,
+				equal->wd_num_levels, equal->control_data->watchdog_down,
+				equal->control_data->watchdog_up,
+				equal->control_data->watchdog_overruns);
+	}
+	for(i = 0; i < equal->num_zones; i++) {
+		snd_output_printf(out, "Zone %s:", equal->zone[i].name);
+		for(j = 0; j < equal->zone[i].control_data->channels; j++) {
+			snd_output_printf(out, " %u", equal->zone[i].map[j]);
+		}
+		snd_output_printf(out, "\n");
+	}
+}
+
+/* Build the branches from a compound of
+   name { library "..." module "..." gain 0.5 controls [ ... ] }
+   entries. A branch without a module is a dry path, a module without a
+   library is taken from the equalizer's library. */
+static int equal_parse_branches(equal_graph_t *graph, snd_config_t *conf,
+		const char *default_library)
+{
+	snd_config_iterator_t i, next, k, knext, c, cnext;
+	LADSPA_Data values[BRANCH_MAX_CONTROLS];
+	int err;
+
+	snd_config_for_each(i, next, conf) {
+		snd_config_t *n = snd_config_iterator_entry(i);
+		const char *id, *library = NULL, *module = NULL;
+		unsigned int num_values = 0;
+		double gain = 1;
+
+		if (snd_config_get_id(n, &id) < 0)
+			continue;
+		if (snd_config_get_type(n) != SND_CONFIG_TYPE_COMPOUND) {
+			SNDERR("Branch %s must be a compound", id);
+			return -EINVAL;
+		}
+		snd_config_for_each(k, knext, n) {
+			snd_config_t *m = snd_config_iterator_entry(k);
+			const char *key;
+			if (snd_config_get_id(m, &key) < 0)
+				continue;
+			if (strcmp(key, "library") == 0) {
+				snd_config_get_string(m, &library);
+				continue;
+			}
+			if (strcmp(key, "module") == 0) {
+				snd_config_get_string(m, &module);
+				continue;
+			}
+			if (strcmp(key, "gain") == 0) {
+				if(snd_config_get_ireal(m, &gain) < 0) {
+					SNDERR("gain of branch %s must be a number", id);
+					return -EINVAL;
+				}
+				continue;
+			}
+			if (strcmp(key, "controls") == 0) {
+				snd_config_for_each(c, cnext, m) {
+					double value;
+					if(num_values == BRANCH_MAX_CONTROLS ||
+							snd_config_get_ireal(snd_config_iterator_entry(c),
+							&value) < 0) {
+						SNDERR("Bad controls for branch %s", id);
+						return -EINVAL;
+					}
+					values[num_values++] = value;
+				}
+				continue;
+			}
+			SNDERR("Unknown field %s in branch %s", key, id);
+			return -EINVAL;
+		}
+		if(library != NULL && module == NULL) {
+			SNDERR("Branch %s has a library but no module", id);
+			return -EINVAL;
+		}
+		if(module != NULL && library == NULL) {
+			library = default_library;
+		}
+		err = equal_graph_add_branch(graph, module ? library : NULL, module,
+				gain, values, num_values);
+		if(err < 0) {
+			return err;
+		}
+	}
+	return 0;
+}
+
+/* Set up the crossover. The frequencies live with the controls so they
+   can be changed from a mixer, and PCMs with different numbers of bands
+   on the same controls share them: each uses the first bands - 1 and
+   crossover_bands is the most any of them set up. The configured ones
+   (or the defaults) only fill in frequencies the controls don't have
+   yet, existing ones are never overwritten. */
+static int equal_crossover_init(snd_pcm_equal_t *equal, unsigned int bands,
+		snd_config_t *conf)
+{
+	LADSPA_Control *control_data = equal->control_data;
+	snd_config_iterator_t i, next;
+	float freq[EQUAL_CROSSOVER_MAX_BANDS - 1];
+	unsigned int n = 0, have;
+
+	equal_crossover_defaults(bands, freq);
+	if(conf != NULL) {
+		snd_config_for_each(i, next, conf) {
+			double value;
+			if(n == bands - 1 || snd_config_get_ireal(
+					snd_config_iterator_entry(i), &value) < 0) {
+				SNDERR("crossover_frequencies must list %u frequencies",
+						bands - 1);
+				return -EINVAL;
+			}
+			freq[n++] = value;
+		}
+	}
+
+	LADSPAcontrolWriteLock(control_data);
+	have = control_data->crossover_bands;
+	if(have < 2 || have > EQUAL_CROSSOVER_MAX_BANDS) {
+		have = 1;
+	}
+	if(have < bands) {
+		memcpy(&control_data->crossover_freq[have - 1], &freq[have - 1],
+				(bands - have)*sizeof(float));
+		control_data->crossover_bands = bands;
+	}
+	LADSPAcontrolWriteUnlock(control_data);
+
+	equal->crossover = equal_crossover_create(control_data->channels, bands);
+	if(equal->crossover == NULL) {
+		return -ENOMEM;
+	}
+	equal->out_channels = control_data->channels*bands;
+	return 0;
+}
+
+/* Whether klass has the audio and control ports the controls were made
+   for, so that it can run on them in place of the configured module. */
+static int equal_module_compatible(const LADSPA_Control *control_data,
+		const LADSPA_Descriptor *klass)
+{
+	LADSPA_PortDescriptor port;
+	unsigned long index;
+	int i;
+
+	if(control_data->input_index >= klass->PortCount ||
+			control_data->output_index >= klass->PortCount ||
+			klass->PortDescriptors[control_data->input_index] !=
+			(LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO) ||
+			klass->PortDescriptors[control_data->output_index] !=
+			(LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO)) {
+		return 0;
+	}
+	for(i = 0; i < control_data->num_controls; i++) {
+		index = control_data->control[i].index;
+		if(index >= klass->PortCount) {
+			return 0;
+		}
+		port = klass->PortDescriptors[index];
+		if(!LADSPA_IS_PORT_CONTROL(port) ||
+				LADSPA_IS_PORT_INPUT(port) !=
+				(control_data->control[i].type == LADSPA_CNTRL_INPUT)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Load the modules that can be switched to from a compound of
+   name { library "..." module "..." } entries, a module without a library
+   is taken from the equalizer's library. The names are published with the
+   controls for the ctl plugin's "Module" element. */
+static int equal_modules_init(snd_pcm_equal_t *equal, snd_config_t *conf,
+		const char *default_library)
+{
+	LADSPA_Control *control_data = equal->control_data;
+	char names[LADSPA_CNTRL_MAX_MODULES][32];
+	snd_config_iterator_t i, next, k, knext;
+	equal_module_t *m;
+
+	equal->module[0].klass = equal->klass;
+	equal->num_modules = 1;
+	memset(names, 0, sizeof(names));
+	strncpy(names[0], equal->klass->Label, sizeof(names[0]) - 1);
+
+	if(conf != NULL) {
+		snd_config_for_each(i, next, conf) {
+			snd_config_t *n = snd_config_iterator_entry(i);
+			const char *id, *library = default_library, *module = NULL;
+
+			if (snd_config_get_id(n, &id) < 0)
+				continue;
+			if (snd_config_get_type(n) != SND_CONFIG_TYPE_COMPOUND) {
+				SNDERR("Module %s must be a compound", id);
+				return -EINVAL;
+			}
+			snd_config_for_each(k, knext, n) {
+				snd_config_t *c = snd_config_iterator_entry(k);
+				const char *key;
+				if (snd_config_get_id(c, &key) < 0)
+					continue;
+				if (strcmp(key, "library") == 0) {
+					snd_config_get_string(c, &library);
+					continue;
+				}
+				if (strcmp(key, "module") == 0) {
+					snd_config_get_string(c, &module);
+					continue;
+				}
+				SNDERR("Unknown field %s in module %s", key, id);
+				return -EINVAL;
+			}
+			if(module == NULL) {
+				SNDERR("Module %s has no module", id);
+				return -EINVAL;
+			}
+			if(equal->num_modules == LADSPA_CNTRL_MAX_MODULES) {
+				SNDERR("At most %d modules", LADSPA_CNTRL_MAX_MODULES - 1);
+				return -EINVAL;
+			}
+			m = &equal->module[equal->num_modules];
+			m->library = LADSPAtryLoad(library);
+			if(m->library == NULL) {
+				SNDERR("Can't load module library %s: %s", library,
+						dlerror());
+				return -ENOENT;
+			}
+			m->klass = LADSPAtryFind(m->library, module);
+			if(m->klass == NULL) {
+				SNDERR("No module %s in library %s", module, library);
+				LADSPAunload(m->library);
+				m->library = NULL;
+				return -ENOENT;
+			}
+			strncpy(names[equal->num_modules], id, sizeof(names[0]) - 1);
+			equal->num_modules++;
+			if(!equal_module_compatible(control_data, m->klass)) {
+				SNDERR("Module %s doesn't have the ports of %s", module,
+						equal->klass->Label);
+				return -EINVAL;
+			}
+		}
+	}
+
+	LADSPAcontrolWriteLock(control_data);
+	control_data->num_modules = equal->num_modules;
+	memcpy(control_data->module_names, names, sizeof(names));
+	if(control_data->module_index >= equal->num_modules) {
+		control_data->module_index = 0;
+	}
+	LADSPAcontrolWriteUnlock(control_data);
+	return 0;
+}
+
+/* Set up the watchdog from
+   watchdog { budget 80 trigger 3 recover 500 fallbacks [ ... ] }
+   Each fallback is the name of one of the modules, "channels N" or
+   "bypass", and applies on top of the ones before it. */
+static int equal_watchdog_init(snd_pcm_equal_t *equal, snd_config_t *conf)
 {
-	int i, j;
-	for(i = 0; i < n; i++){
-		for(j = 0; j < m; j++){
-			dst[i*m + j] = src[i + n*j];
+	LADSPA_Control *control_data = equal->control_data;
+	snd_config_iterator_t i, next;
+	snd_config_t *fallbacks = NULL;
+	equal_fallback_t *level;
+	long budget = 80, trigger = 3, recover = 500;
+	unsigned int channels, m;
+
+	snd_config_for_each(i, next, conf) {
+		snd_config_t *n = snd_config_iterator_entry(i);
+		const char *id;
+		if (snd_config_get_id(n, &id) < 0)
+			continue;
+		if (strcmp(id, "budget") == 0) {
+			snd_config_get_integer(n, &budget);
+			if(budget < 1 || budget > 100) {
+				SNDERR("watchdog budget must be between 1 and 100 percent");
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "trigger") == 0) {
+			snd_config_get_integer(n, &trigger);
+			if(trigger < 1) {
+				SNDERR("watchdog trigger < 1");
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "recover") == 0) {
+			snd_config_get_integer(n, &recover);
+			if(recover < 1 || recover > 1000000) {
+				SNDERR("watchdog recover must be between 1 and 1000000");
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "fallbacks") == 0) {
+			fallbacks = n;
+			continue;
+		}
+		SNDERR("Unknown field %s in watchdog", id);
+		return -EINVAL;
+	}
+
+	level = &equal->wd_level[0];
+	level->module = -1;
+	level->channels = control_data->channels;
+	strcpy(level->name, "everything");
+	equal->wd_num_levels = 0;
+	if(fallbacks == NULL) {
+		level[1] = level[0];
+		level[1].channels = 0;
+		strcpy(level[1].name, "bypass");
+		equal->wd_num_levels = 1;
+	} else {
+		snd_config_for_each(i, next, fallbacks) {
+			const char *str;
+			if(snd_config_get_string(snd_config_iterator_entry(i),
+					&str) < 0) {
+				SNDERR("watchdog fallbacks must be strings");
+				return -EINVAL;
+			}
+			if(equal->wd_num_levels == WATCHDOG_MAX_LEVELS) {
+				SNDERR("At most %d watchdog fallbacks", WATCHDOG_MAX_LEVELS);
+				return -EINVAL;
+			}
+			level = &equal->wd_level[++equal->wd_num_levels];
+			*level = level[-1];
+			snprintf(level->name, sizeof(level->name), "%s", str);
+			if(strcmp(str, "bypass") == 0) {
+				level->channels = 0;
+				continue;
+			}
+			if(sscanf(str, "channels %u", &channels) == 1) {
+				if(channels >= level->channels) {
+					SNDERR("watchdog fallback %s doesn't process fewer "
+							"channels", str);
+					return -EINVAL;
+				}
+				level->channels = channels;
+				continue;
+			}
+			for(m = 0; m < equal->num_modules; m++) {
+				if(strcmp(str, control_data->module_names[m]) == 0) {
+					break;
+				}
+			}
+			if(m == equal->num_modules) {
+				SNDERR("watchdog fallback %s is not bypass, channels N or "
+						"one of the modules", str);
+				return -EINVAL;
+			}
+			level->module = m;
+		}
+		if(equal->wd_num_levels == 0) {
+			SNDERR("watchdog needs at least one fallback");
+			return -EINVAL;
 		}
 	}
+
+	equal->wd_budget = budget;
+	equal->wd_trigger = trigger;
+	equal->wd_recover = recover;
+	equal->wd_since_up = UINT_MAX;
+	control_data->watchdog_levels = equal->wd_num_levels;
+	control_data->watchdog_level = 0;
+	return 0;
 }
 
-static inline void deinterleave(float *src, float *dst, int n, int m)
+/* Set up the zones from a compound of
+   name { channels [ 0 1 ] controls "..." }
+   entries. Every zone runs the equalizer's module on controls of its
+   own, the channels no zone takes keep the equalizer's controls. */
+static int equal_zones_init(snd_pcm_equal_t *equal, snd_config_t *conf,
+		const char *library, const char *main_controls)
 {
-	int i, j;
-	for(i = 0; i < n; i++){
-		for(j = 0; j < m; j++){
-			dst[i + n*j] = src[i*m + j];
+	LADSPA_Control *control_data = equal->control_data;
+	snd_config_iterator_t i, next, k, knext;
+	equal_zone_t *zone;
+	size_t controls_bytes;
+	unsigned int map[16];
+	unsigned int channels;
+	long channel;
+
+	snd_config_for_each(i, next, conf) {
+		snd_config_t *n = snd_config_iterator_entry(i);
+		const char *id, *controls = NULL;
+		channels = 0;
+		if (snd_config_get_id(n, &id) < 0)
+			continue;
+		if(equal->num_zones == MAX_ZONES) {
+			SNDERR("At most %d zones", MAX_ZONES);
+			return -EINVAL;
+		}
+		if(snd_config_get_type(n) != SND_CONFIG_TYPE_COMPOUND) {
+			SNDERR("zone %s must be a compound", id);
+			return -EINVAL;
+		}
+		snd_config_for_each(k, knext, n) {
+			snd_config_t *kn = snd_config_iterator_entry(k);
+			const char *kid;
+			snd_config_iterator_t c, cnext;
+			if (snd_config_get_id(kn, &kid) < 0)
+				continue;
+			if (strcmp(kid, "controls") == 0) {
+				snd_config_get_string(kn, &controls);
+				continue;
+			}
+			if (strcmp(kid, "channels") == 0) {
+				snd_config_for_each(c, cnext, kn) {
+					if(snd_config_get_integer(snd_config_iterator_entry(c),
+							&channel) < 0 || channel < 0 ||
+							channel >= control_data->channels) {
+						SNDERR("zone %s has a channel the PCM doesn't", id);
+						return -EINVAL;
+					}
+					if(equal->zoned >> channel & 1) {
+						SNDERR("Channel %ld is in more than one zone", channel);
+						return -EINVAL;
+					}
+					equal->zoned |= 1u << channel;
+					map[channels++] = channel;
+				}
+				continue;
+			}
+			SNDERR("Unknown field %s in zone %s", kid, id);
+			return -EINVAL;
+		}
+		if(controls == NULL || channels == 0) {
+			SNDERR("zone %s needs controls and channels", id);
+			return -EINVAL;
+		}
+		if(strcmp(controls, main_controls) == 0) {
+			SNDERR("zone %s needs controls of its own", id);
+			return -EINVAL;
+		}
+
+		zone = &equal->zone[equal->num_zones];
+		snprintf(zone->name, sizeof(zone->name), "%s", id);
+		memcpy(zone->map, map, sizeof(map));
+		zone->control_data = LADSPAcontrolMMAP(equal->klass, controls,
+				channels, library);
+		if(zone->control_data == NULL) {
+			return -1;
+		}
+		equal->num_zones++;
+		if(zone->control_data->input_index != control_data->input_index ||
+				zone->control_data->output_index !=
+				control_data->output_index) {
+			SNDERR("Problem with control file %s.", controls);
+			return -1;
+		}
+		controls_bytes = zone->control_data->num_controls*channels*
+				sizeof(LADSPA_Data);
+		zone->core.control_data = zone->control_data;
+		equal->cores[equal->num_cores++] = &zone->core;
+		zone->core.values = equal_alloc(equal, controls_bytes);
+		zone->core.staging = equal_alloc(equal, controls_bytes);
+		zone->handle = calloc(channels, sizeof(LADSPA_Handle));
+		if(zone->core.values == NULL || zone->core.staging == NULL ||
+				zone->handle == NULL) {
+			return -ENOMEM;
 		}
+		zone->control_data->watchdog_levels = 0;
 	}
+	return 0;
 }
 
-static snd_pcm_sframes_t equal_transfer(snd_pcm_extplug_t *ext,
-		  const snd_pcm_channel_area_t *dst_areas,
-		  snd_pcm_uframes_t dst_offset,
-		  const snd_pcm_channel_area_t *src_areas,
-		  snd_pcm_uframes_t src_offset,
-		  snd_pcm_uframes_t size)
+/* Map the controls by their stored metadata for the modes that don't
+   run the plugin here, loading it only if they have to be created */
+static LADSPA_Control *equal_controls_map(const char *controls,
+		unsigned int channels, const char *library, const char *module)
 {
-	snd_pcm_equal_t *equal = (snd_pcm_equal_t *)ext;
-	float *src, *dst;
-	int j;
-	
-	/* Calculate buffer locations */
-	src = (float*)(src_areas->addr +
-			(src_areas->first + src_areas->step * src_offset)/8);
-	dst = (float*)(dst_areas->addr +
-			(dst_areas->first + dst_areas->step * dst_offset)/8);	
-	
-	/* NOTE: swap source and destination memory space when deinterleaved.
-		then swap it back during the interleave call below */
-	deinterleave(src, dst, size, equal->control_data->channels);
-	
-	for(j = 0; j < equal->control_data->channels; j++) {
-		equal->klass->connect_port(equal->channel[j],
-			equal->control_data->input_index,
-			dst + j*size);
-		equal->klass->connect_port(equal->channel[j],
-			equal->control_data->output_index,
-			src + j*size);
-		equal->klass->run(equal->channel[j], size);
-	}
-	
-	interleave(src, dst, size, equal->control_data->channels);
+	const LADSPA_Descriptor *klass;
+	LADSPA_Control *control_data;
+	void *plugin;
 
-	return size;
+	control_data = LADSPAcontrolMMAPMeta(controls, channels, library, module);
+	if(control_data != NULL) {
+		return control_data;
+	}
+	plugin = LADSPAtryLoad(library);
+	if(plugin == NULL) {
+		SNDERR("Can't load module library %s: %s", library, dlerror());
+		errno = ENOENT;
+		return NULL;
+	}
+	klass = LADSPAtryFind(plugin, module);
+	if(klass == NULL) {
+		SNDERR("No module %s in library %s", module, library);
+		LADSPAunload(plugin);
+		errno = ENOENT;
+		return NULL;
+	}
+	control_data = LADSPAcontrolMMAP(klass, controls, channels, library);
+	LADSPAunload(plugin);
+	if(control_data == NULL) {
+		errno = EIO;
+	}
+	return control_data;
 }
 
-static int equal_close(snd_pcm_extplug_t *ext) {
-	snd_pcm_equal_t *equal = ext->private_data;
-	int i;
-	for (i = 0; i < equal->control_data->channels; i++) {
-		if(equal->klass->deactivate) {
-			equal->klass->deactivate(equal->channel[i]);
-		}
-		/* TODO: Figure out why this segfaults */
-		/* if(equal->klass->cleanup) {
-			equal->klass->cleanup(equal->channel[i]);
-		} */
+static int equal_dspd_init(snd_pcm_equal_t *equal, const char *controls,
+		unsigned int channels, const char *library, const char *module,
+		const char *socket)
+{
+	equal->dspd_mode = 1;
+	equal->control_data = equal_controls_map(controls, channels, library,
+			module);
+	if(equal->control_data == NULL) {
+		return -errno;
+	}
+
+	equal->dspd_library = strdup(library);
+	equal->dspd_module = strdup(module);
+	if(socket != NULL) {
+		equal->dspd_socket = strdup(socket);
+	}
+	if(equal->dspd_library == NULL || equal->dspd_module == NULL ||
+			(socket != NULL && equal->dspd_socket == NULL)) {
+		return -ENOMEM;
+	}
+
+	/* A daemon that isn't there is a configuration problem at this point,
+	   later on the stream survives it */
+	equal->dspd = equal_dspd_connect(socket, library, module,
+			equal->control_data);
+	if(equal->dspd == NULL) {
+		SNDERR("Can't reach alsaequal-dspd: %s", strerror(errno));
+		return -errno;
 	}
-	LADSPAcontrolUnMMAP(equal->control_data);
-	LADSPAunload(equal->library);
-	free(equal);
 	return 0;
 }
 
-static int equal_init(snd_pcm_extplug_t *ext)
+/* Set up the integer engine with a band for every control input of the
+   plugin, each of which must be a gain in dB named by its frequency */
+static int equal_fixed_init(snd_pcm_equal_t *equal, const char *controls,
+		unsigned int channels, const char *library, const char *module)
 {
-	snd_pcm_equal_t *equal = (snd_pcm_equal_t *)ext;
-	int i, j;
+	LADSPA_Control *control_data;
+	float freq[EQUAL_FIXED_MAX_BANDS];
+	unsigned int bands = 0;
+	int i;
 
-	/* Instantiate a LADSPA Plugin for each channel */
-	for(i = 0; i < equal->control_data->channels; i++) {
-		equal->channel[i] = equal->klass->instantiate(
-				equal->klass, ext->rate);
-		if(equal->channel[i] == NULL) {
-			return -1;
+	if(channels > EQUAL_FIXED_MAX_CHANNELS) {
+		SNDERR("fixed_point supports up to %d channels",
+				EQUAL_FIXED_MAX_CHANNELS);
+		return -EINVAL;
+	}
+	equal->control_data = equal_controls_map(controls, channels, library,
+			module);
+	if(equal->control_data == NULL) {
+		return -errno;
+	}
+	control_data = equal->control_data;
+	for(i = 0; i < control_data->num_controls; i++) {
+		if(control_data->control[i].type != LADSPA_CNTRL_INPUT) {
+			continue;
 		}
-		if(equal->klass->activate) {
-			equal->klass->activate(equal->channel[i]);
+		if(bands == EQUAL_FIXED_MAX_BANDS) {
+			SNDERR("fixed_point supports up to %d bands",
+					EQUAL_FIXED_MAX_BANDS);
+			return -EINVAL;
 		}
-	}
-
-	/* Connect controls to the LADSPA Plugin */
-	for(j = 0; j < equal->control_data->channels; j++) {
-		for(i = 0; i < equal->control_data->num_controls; i++) {
-			equal->klass->connect_port(equal->channel[j], 
-					equal->control_data->control[i].index,
-					&equal->control_data->control[i].data[j]);
+		if(equal_fixed_parse_frequency(control_data->control[i].name,
+				&freq[bands]) < 0) {
+			SNDERR("fixed_point can't use %s, control \"%s\" is not a band",
+					module, control_data->control[i].name);
+			return -EINVAL;
 		}
+		equal->fixed_band[bands++] = i;
+	}
+	if(bands == 0) {
+		SNDERR("fixed_point can't use %s, it has no bands", module);
+		return -EINVAL;
+	}
+	equal->fixed = equal_fixed_create(channels, bands, freq);
+	if(equal->fixed == NULL) {
+		return -ENOMEM;
 	}
-
 	return 0;
 }
 
@@ -142,6 +2293,8 @@ static snd_pcm_extplug_callback_t equal_callback = {
 	.transfer = equal_transfer,
 	.init = equal_init,
 	.close = equal_close,
+	.hw_params = equal_hw_params,
+	.dump = equal_dump,
 };
 
 SND_PCM_PLUGIN_DEFINE_FUNC(equal)
@@ -153,7 +2306,29 @@ SND_PCM_PLUGIN_DEFINE_FUNC(equal)
 	const char *library = "caps.so";
 	const char *module = "Eq10";
 	long channels = 2;
-	int err;
+	int pipeline = 0;
+	long pipeline_priority = 0;
+	long block = 0;
+	int lock = 0;
+	snd_config_t *branches = NULL;
+	long branch_threads = 0;
+	long crossover = 0;
+	snd_config_t *crossover_frequencies = NULL;
+	long standby_rate = STANDBY_AUTO;
+	snd_config_t *modules = NULL;
+	long module_crossfade = 20;
+	int dspd = 0;
+	const char *dspd_socket = NULL;
+	int fixed_point = 0;
+	double multirate = 0;
+	snd_config_t *watchdog = NULL;
+	snd_config_t *zones = NULL;
+	static const unsigned int fixed_formats[] = {
+		SND_PCM_FORMAT_S16,
+		SND_PCM_FORMAT_S32
+	};
+	char tapname[80];
+	int err, k;
 	
 	/* Parse configuration options from asoundrc */
 	snd_config_for_each(i, next, conf) {
@@ -187,6 +2362,136 @@ SND_PCM_PLUGIN_DEFINE_FUNC(equal)
 			}
 			continue;
 		}
+		if (strcmp(id, "pipeline") == 0) {
+			pipeline = snd_config_get_bool(n);
+			if(pipeline < 0) {
+				SNDERR("pipeline must be a boolean");
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "pipeline_priority") == 0) {
+			snd_config_get_integer(n, &pipeline_priority);
+			if(pipeline_priority < 0 || pipeline_priority > 99) {
+				SNDERR("pipeline_priority must be between 0 and 99");
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "block") == 0) {
+			snd_config_get_integer(n, &block);
+			if(block != 0 && (block < BLOCK_MIN || block > BLOCK_MAX)) {
+				SNDERR("block must be 0 or between %d and %d frames",
+						BLOCK_MIN, BLOCK_MAX);
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "mlock") == 0) {
+			lock = snd_config_get_bool(n);
+			if(lock < 0) {
+				SNDERR("mlock must be a boolean");
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "branches") == 0) {
+			if(snd_config_get_type(n) != SND_CONFIG_TYPE_COMPOUND) {
+				SNDERR("branches must be a compound");
+				return -EINVAL;
+			}
+			branches = n;
+			continue;
+		}
+		if (strcmp(id, "branch_threads") == 0) {
+			snd_config_get_integer(n, &branch_threads);
+			if(branch_threads < 0) {
+				SNDERR("branch_threads < 0");
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "crossover") == 0) {
+			snd_config_get_integer(n, &crossover);
+			if(crossover != 0 && (crossover < 2 ||
+					crossover > EQUAL_CROSSOVER_MAX_BANDS)) {
+				SNDERR("crossover must be between 2 and %d bands",
+						EQUAL_CROSSOVER_MAX_BANDS);
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "crossover_frequencies") == 0) {
+			crossover_frequencies = n;
+			continue;
+		}
+		if (strcmp(id, "modules") == 0) {
+			if(snd_config_get_type(n) != SND_CONFIG_TYPE_COMPOUND) {
+				SNDERR("modules must be a compound");
+				return -EINVAL;
+			}
+			modules = n;
+			continue;
+		}
+		if (strcmp(id, "module_crossfade") == 0) {
+			snd_config_get_integer(n, &module_crossfade);
+			if(module_crossfade < 0 || module_crossfade > 1000) {
+				SNDERR("module_crossfade must be between 0 and 1000 ms");
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "dspd") == 0) {
+			dspd = snd_config_get_bool(n);
+			if(dspd < 0) {
+				SNDERR("dspd must be a boolean");
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "dspd_socket") == 0) {
+			snd_config_get_string(n, &dspd_socket);
+			continue;
+		}
+		if (strcmp(id, "fixed_point") == 0) {
+			fixed_point = snd_config_get_bool(n);
+			if(fixed_point < 0) {
+				SNDERR("fixed_point must be a boolean");
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "multirate") == 0) {
+			if(snd_config_get_ireal(n, &multirate) < 0 || multirate < 0) {
+				SNDERR("multirate must be a frequency in Hz");
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "watchdog") == 0) {
+			if(snd_config_get_type(n) != SND_CONFIG_TYPE_COMPOUND) {
+				SNDERR("watchdog must be a compound");
+				return -EINVAL;
+			}
+			watchdog = n;
+			continue;
+		}
+		if (strcmp(id, "zones") == 0) {
+			if(snd_config_get_type(n) != SND_CONFIG_TYPE_COMPOUND) {
+				SNDERR("zones must be a compound");
+				return -EINVAL;
+			}
+			zones = n;
+			continue;
+		}
+		if (strcmp(id, "standby_rate") == 0) {
+			snd_config_get_integer(n, &standby_rate);
+			if(standby_rate < 0 && standby_rate != STANDBY_AUTO) {
+				SNDERR("standby_rate must be a rate, 0 or -1");
+				return -EINVAL;
+			}
+			continue;
+		}
 		SNDERR("Unknown field %s", id);
 		return -EINVAL;
 	}
@@ -196,26 +2501,78 @@ SND_PCM_PLUGIN_DEFINE_FUNC(equal)
 		SNDERR("No slave configuration for equal pcm");
 		return -EINVAL;
 	}
+	if (dspd && modules) {
+		SNDERR("modules can't be switched in dspd mode");
+		return -EINVAL;
+	}
+	if (fixed_point && (dspd || pipeline || branches || crossover ||
+			modules)) {
+		SNDERR("fixed_point can't be combined with dspd, pipeline, "
+				"branches, crossover or modules");
+		return -EINVAL;
+	}
+	if (block && fixed_point) {
+		SNDERR("block can't be combined with fixed_point");
+		return -EINVAL;
+	}
+	if (multirate > 0 && !fixed_point) {
+		SNDERR("multirate needs fixed_point");
+		return -EINVAL;
+	}
+	if (watchdog && (dspd || fixed_point)) {
+		SNDERR("watchdog can't be combined with dspd or fixed_point");
+		return -EINVAL;
+	}
+	if (zones && (dspd || fixed_point || modules || watchdog)) {
+		SNDERR("zones can't be combined with dspd, fixed_point, modules "
+				"or watchdog");
+		return -EINVAL;
+	}
+	if (channels > 16) {
+		SNDERR("channels > 16");
+		return -EINVAL;
+	}
 
 	/* Intialize the local object data */
-	equal = calloc(1, sizeof(*equal) + channels*sizeof(LADSPA_Handle *));
+	equal = calloc(1, sizeof(*equal));
 	if (equal == NULL)
 		return -ENOMEM;
+	for(k = 0; k < POOL_SIZE; k++) {
+		equal->pool[k].handle = calloc(channels, sizeof(LADSPA_Handle));
+		if(equal->pool[k].handle == NULL) {
+			return -ENOMEM;
+		}
+	}
 
 	equal->ext.version = SND_PCM_EXTPLUG_VERSION;
 	equal->ext.name = "alsaequal";
 	equal->ext.callback = &equal_callback;
 	equal->ext.private_data = equal;
-
-	/* Open the LADSPA Plugin */
-	equal->library = LADSPAload(library);
-	if(equal->library == NULL) {
-		return -1;
+	equal->pipeline = pipeline;
+	equal->pipeline_priority = pipeline_priority;
+	equal->mlock = lock;
+	equal->branch_threads = branch_threads;
+	equal->standby_rate = standby_rate;
+	equal->xfade_ms = module_crossfade;
+	equal->block = block;
+	equal->xfade_chunk = block > XFADE_CHUNK ? block : XFADE_CHUNK;
+	pthread_mutex_init(&equal->pool_lock, NULL);
+	if(pipeline && sem_init(&equal->pipeline_wake, 0, 0) < 0) {
+		return -errno;
 	}
 
-	equal->klass = LADSPAfind(equal->library, library, module);
-	if(equal->klass == NULL) {
-		return -1;
+	/* Open the LADSPA Plugin, in dspd mode the daemon runs it and in
+	   fixed point mode it only provides the controls */
+	if(!dspd && !fixed_point) {
+		equal->library = LADSPAload(library);
+		if(equal->library == NULL) {
+			return -1;
+		}
+
+		equal->klass = LADSPAfind(equal->library, library, module);
+		if(equal->klass == NULL) {
+			return -1;
+		}
 	}
 
 	/* Create the ALSA External Plugin */
@@ -224,22 +2581,151 @@ SND_PCM_PLUGIN_DEFINE_FUNC(equal)
 		return err;
 	}
 
-	/* MMAP to the controls file */
-	equal->control_data = LADSPAcontrolMMAP(equal->klass, controls, channels);
-	if(equal->control_data == NULL) {
-		return -1;
+	if(dspd) {
+		err = equal_dspd_init(equal, controls, channels, library, module,
+				dspd_socket);
+		if(err < 0) {
+			return err;
+		}
+	} else if(fixed_point) {
+		err = equal_fixed_init(equal, controls, channels, library, module);
+		if(err < 0) {
+			return err;
+		}
+		if(multirate > 0 &&
+				equal_fixed_set_multirate(equal->fixed, multirate) == 0) {
+			SNDERR("multirate %g Hz is below every band of %s", multirate,
+					module);
+			return -EINVAL;
+		}
+	} else {
+		/* MMAP to the controls file */
+		equal->control_data = LADSPAcontrolMMAP(equal->klass, controls,
+				channels, library);
+		if(equal->control_data == NULL) {
+			return -1;
+		}
+
+		/* Make sure that the control file makes sense */
+		if(equal->klass->PortDescriptors[equal->control_data->input_index] !=
+				(LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO)) {
+			SNDERR("Problem with control file %s.", controls);
+			return -1;
+		}
+		if(equal->klass->PortDescriptors[equal->control_data->output_index] !=
+				(LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO)) {
+			SNDERR("Problem with control file %s.", controls);
+			return -1;
+		}
+	}
+
+	equal->core.control_data = equal->control_data;
+	equal->cores[0] = &equal->core;
+	equal->num_cores = 1;
+	equal->core.values = equal_alloc(equal, equal->control_data->num_controls*
+			equal->control_data->channels*sizeof(LADSPA_Data));
+	equal->core.staging = equal_alloc(equal,
+			equal->control_data->num_controls*
+			equal->control_data->channels*sizeof(LADSPA_Data));
+	if(equal->core.values == NULL || equal->core.staging == NULL) {
+		return -ENOMEM;
+	}
+	equal->wd_module = -1;
+	equal->wet_channels = equal->control_data->channels;
+	for(k = 0; k < equal->control_data->channels; k++) {
+		equal->wet[k] = 1;
 	}
 
-	/* Make sure that the control file makes sense */
-	if(equal->klass->PortDescriptors[equal->control_data->input_index] !=
-			(LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO)) {
-		SNDERR("Problem with control file %s.", controls);
-		return -1;
+	if(equal->library != NULL) {
+		err = equal_modules_init(equal, modules, library);
+		if(err < 0) {
+			return err;
+		}
 	}
-	if(equal->klass->PortDescriptors[equal->control_data->output_index] !=
-			(LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO)) {
-		SNDERR("Problem with control file %s.", controls);
-		return -1;
+	if(equal->block) {
+		equal->block_in = equal_alloc(equal, equal->control_data->channels*
+				equal->block*sizeof(float));
+		equal->block_out = equal_alloc(equal, equal->control_data->channels*
+				equal->block*sizeof(float));
+		if(equal->block_in == NULL || equal->block_out == NULL) {
+			return -ENOMEM;
+		}
+	}
+	if(equal->num_modules > 1) {
+		equal->xfade_buf = equal_alloc(equal, equal->control_data->channels*
+				equal->xfade_chunk*sizeof(float));
+		if(equal->xfade_buf == NULL || sem_init(&equal->loader_wake, 0, 0) < 0) {
+			return -ENOMEM;
+		}
+		equal->loader_running = 1;
+		err = pthread_create(&equal->loader_thread, NULL, equal_loader_thread,
+				equal);
+		if(err != 0) {
+			equal->loader_running = 0;
+			return -err;
+		}
+	}
+
+	if(watchdog != NULL) {
+		err = equal_watchdog_init(equal, watchdog);
+		if(err < 0) {
+			return err;
+		}
+	} else {
+		equal->control_data->watchdog_levels = 0;
+	}
+
+	if(zones != NULL) {
+		err = equal_zones_init(equal, zones, library, controls);
+		if(err < 0) {
+			return err;
+		}
+	}
+
+	if(branches != NULL) {
+		equal->graph = equal_graph_create(equal->control_data->channels);
+		if(equal->graph == NULL) {
+			return -ENOMEM;
+		}
+		err = equal_parse_branches(equal->graph, branches, library);
+		if(err < 0) {
+			return err;
+		}
+		if(equal->graph->num_branches == 0) {
+			equal_graph_destroy(equal->graph);
+			equal->graph = NULL;
+		}
+	}
+
+	equal->out_channels = equal->control_data->channels;
+	if(crossover) {
+		err = equal_crossover_init(equal, crossover, crossover_frequencies);
+		if(err < 0) {
+			return err;
+		}
+	}
+
+	/* The tap costs an unused shared memory object until it is enabled,
+	   it carries float samples only */
+	if(!fixed_point && LADSPAcontrolObjectName(controls, EQUAL_TAP_SUFFIX, tapname,
+			sizeof(tapname)) == 0) {
+		equal->tap = equal_tap_create(tapname,
+				equal->control_data->channels, TAP_FRAMES,
+				&equal->tap_length);
+	}
+
+	/* Lock the shared controls and set aside silence for the warm-up */
+	if(equal->mlock) {
+		equal_lock_shared(equal, equal->control_data,
+				equal->control_data->length);
+		for(k = 0; k < equal->num_zones; k++) {
+			equal_lock_shared(equal, equal->zone[k].control_data,
+					equal->zone[k].control_data->length);
+		}
+		equal->warmup_buf = equal_alloc(equal, 2*WARMUP_FRAMES*sizeof(float));
+		if(equal->warmup_buf == NULL) {
+			return -ENOMEM;
+		}
 	}
 
 	/* Set PCM Contraints */
@@ -249,11 +2735,18 @@ SND_PCM_PLUGIN_DEFINE_FUNC(equal)
 			equal->control_data->channels);
 	snd_pcm_extplug_set_slave_param(&equal->ext,
 			SND_PCM_EXTPLUG_HW_CHANNELS,
-			equal->control_data->channels);
-	snd_pcm_extplug_set_param(&equal->ext,
-			SND_PCM_EXTPLUG_HW_FORMAT, SND_PCM_FORMAT_FLOAT);
-	snd_pcm_extplug_set_slave_param(&equal->ext,
-			SND_PCM_EXTPLUG_HW_FORMAT, SND_PCM_FORMAT_FLOAT);
+			equal->out_channels);
+	if(fixed_point) {
+		snd_pcm_extplug_set_param_list(&equal->ext,
+				SND_PCM_EXTPLUG_HW_FORMAT, 2, fixed_formats);
+		snd_pcm_extplug_set_slave_param_list(&equal->ext,
+				SND_PCM_EXTPLUG_HW_FORMAT, 2, fixed_formats);
+	} else {
+		snd_pcm_extplug_set_param(&equal->ext,
+				SND_PCM_EXTPLUG_HW_FORMAT, SND_PCM_FORMAT_FLOAT);
+		snd_pcm_extplug_set_slave_param(&equal->ext,
+				SND_PCM_EXTPLUG_HW_FORMAT, SND_PCM_FORMAT_FLOAT);
+	}
 
 	*pcmp = equal->ext.pcm;
 	
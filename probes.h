@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#ifndef EQUAL_PROBES_H
+#define EQUAL_PROBES_H
+
+/* Static USDT probes for perf, bpftrace and systemtap, provider
+   "alsaequal". Without sys/sdt.h they compile to nothing. Each probe has
+   a semaphore which the tracer sets while it is attached. The probe
+   macros test it before evaluating their arguments, so arguments such as
+   elapsed times cost nothing untraced, and the measurements that feed
+   them are only started when EQUAL_PROBE_ENABLED() says somebody is
+   listening. */
+
+#include <stdint.h>
+
+#ifdef HAVE_SYS_SDT_H
+
+#include <time.h>
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define EQUAL_PROBE_SEMAPHORE(name) \
+	__extension__ unsigned short alsaequal_##name##_semaphore \
+	__attribute__((unused, visibility("hidden"), section(".probes")))
+#define EQUAL_PROBE_ENABLED(name) \
+	__builtin_expect(alsaequal_##name##_semaphore, 0)
+
+#define EQUAL_PROBE1(name, a) \
+	do { \
+		if(EQUAL_PROBE_ENABLED(name)) \
+			STAP_PROBE1(alsaequal, name, a); \
+	} while(0)
+#define EQUAL_PROBE2(name, a, b) \
+	do { \
+		if(EQUAL_PROBE_ENABLED(name)) \
+			STAP_PROBE2(alsaequal, name, a, b); \
+	} while(0)
+#define EQUAL_PROBE3(name, a, b, c) \
+	do { \
+		if(EQUAL_PROBE_ENABLED(name)) \
+			STAP_PROBE3(alsaequal, name, a, b, c); \
+	} while(0)
+#define EQUAL_PROBE4(name, a, b, c, d) \
+	do { \
+		if(EQUAL_PROBE_ENABLED(name)) \
+			STAP_PROBE4(alsaequal, name, a, b, c, d); \
+	} while(0)
+
+static inline uint64_t equal_probe_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+#else
+
+#define EQUAL_PROBE_SEMAPHORE(name) \
+	extern int alsaequal_##name##_semaphore_unused
+#define EQUAL_PROBE_ENABLED(name) 0
+#define EQUAL_PROBE1(name, a) do { (void)(a); } while(0)
+#define EQUAL_PROBE2(name, a, b) do { (void)(a); (void)(b); } while(0)
+#define EQUAL_PROBE3(name, a, b, c) \
+	do { (void)(a); (void)(b); (void)(c); } while(0)
+#define EQUAL_PROBE4(name, a, b, c, d) \
+	do { (void)(a); (void)(b); (void)(c); (void)(d); } while(0)
+
+static inline uint64_t equal_probe_now(void)
+{
+	return 0;
+}
+
+#endif
+
+#endif
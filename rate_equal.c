@@ -0,0 +1,299 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+/* Sample rate converter for ALSA's rate and plug PCMs, e.g.
+   rate_converter "equal_best". The conversion itself is in resample.c.
+
+   alsa-lib from plugin version 0x010003 on asks which formats a
+   converter takes and hands it the areas as they are, so S16, S32 and
+   FLOAT, interleaved or not, are read and written in place. Older ones
+   only know convert_s16, and the rate PCM converts to S16 and back
+   around it, two more passes. */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <alsa/asoundlib.h>
+#include <alsa/pcm_rate.h>
+
+#include "resample.h"
+
+typedef struct snd_pcm_rate_equal {
+	int quality;
+	int s16;	/* Only convert_s16 is used */
+	int in_format;
+	int out_format;
+	unsigned int channels;
+	unsigned int in_rate;
+	unsigned int out_rate;
+	equal_resample_t *rs;
+} snd_pcm_rate_equal_t;
+
+static snd_pcm_uframes_t muldiv_near(snd_pcm_uframes_t a, unsigned int b,
+		unsigned int c)
+{
+	return ((unsigned long long)a*b + c/2)/c;
+}
+
+static snd_pcm_uframes_t equal_rate_input_frames(void *obj,
+		snd_pcm_uframes_t frames)
+{
+	snd_pcm_rate_equal_t *rate = obj;
+	return muldiv_near(frames, rate->in_rate, rate->out_rate);
+}
+
+static snd_pcm_uframes_t equal_rate_output_frames(void *obj,
+		snd_pcm_uframes_t frames)
+{
+	snd_pcm_rate_equal_t *rate = obj;
+	return muldiv_near(frames, rate->out_rate, rate->in_rate);
+}
+
+static void equal_rate_free(void *obj)
+{
+	snd_pcm_rate_equal_t *rate = obj;
+	equal_resample_destroy(rate->rs);
+	rate->rs = NULL;
+}
+
+static int equal_rate_format(snd_pcm_format_t format)
+{
+	switch(format) {
+	case SND_PCM_FORMAT_S16:
+		return EQUAL_RESAMPLE_S16;
+	case SND_PCM_FORMAT_S32:
+		return EQUAL_RESAMPLE_S32;
+	case SND_PCM_FORMAT_FLOAT:
+		return EQUAL_RESAMPLE_FLOAT;
+	default:
+		return -1;
+	}
+}
+
+static int equal_rate_init(void *obj, snd_pcm_rate_info_t *info)
+{
+	snd_pcm_rate_equal_t *rate = obj;
+
+	if(!rate->s16) {
+		rate->in_format = equal_rate_format(info->in.format);
+		rate->out_format = equal_rate_format(info->out.format);
+		if(rate->in_format < 0 || rate->out_format < 0) {
+			return -EINVAL;
+		}
+	}
+
+	/* The filter depends on the rates, keep it if they didn't change */
+	if(rate->rs == NULL || rate->channels != info->channels ||
+			rate->in_rate != info->in.rate ||
+			rate->out_rate != info->out.rate) {
+		equal_rate_free(obj);
+		rate->channels = info->channels;
+		rate->in_rate = info->in.rate;
+		rate->out_rate = info->out.rate;
+		rate->rs = equal_resample_create(rate->channels, rate->in_rate,
+				rate->out_rate, rate->quality);
+		if(rate->rs == NULL) {
+			return -EINVAL;
+		}
+	}
+	return 0;
+}
+
+/* The rate PCM moves whole periods, step exactly one input period per
+   output period so that the history never grows or starves */
+static int equal_rate_adjust_pitch(void *obj, snd_pcm_rate_info_t *info)
+{
+	snd_pcm_rate_equal_t *rate = obj;
+	equal_resample_set_ratio(rate->rs, info->in.period_size,
+			info->out.period_size);
+	return 0;
+}
+
+static void equal_rate_reset(void *obj)
+{
+	snd_pcm_rate_equal_t *rate = obj;
+	if(rate->rs != NULL) {
+		equal_resample_reset(rate->rs);
+	}
+}
+
+static void equal_rate_convert_s16(void *obj, int16_t *dst,
+		unsigned int dst_frames, const int16_t *src, unsigned int src_frames)
+{
+	snd_pcm_rate_equal_t *rate = obj;
+	equal_resample_run_s16(rate->rs, src, src_frames, dst, dst_frames);
+}
+
+static void equal_rate_areas(equal_resample_area_t *dst,
+		const snd_pcm_channel_area_t *areas, snd_pcm_uframes_t offset,
+		unsigned int channels)
+{
+	unsigned int j;
+
+	for(j = 0; j < channels; j++) {
+		dst[j].addr = (char *)areas[j].addr + areas[j].first/8 +
+				offset*(areas[j].step/8);
+		dst[j].step = areas[j].step/8;
+	}
+}
+
+static void equal_rate_convert(void *obj,
+		const snd_pcm_channel_area_t *dst_areas, snd_pcm_uframes_t dst_offset,
+		unsigned int dst_frames, const snd_pcm_channel_area_t *src_areas,
+		snd_pcm_uframes_t src_offset, unsigned int src_frames)
+{
+	snd_pcm_rate_equal_t *rate = obj;
+	equal_resample_area_t src[16], dst[16];
+
+	equal_rate_areas(src, src_areas, src_offset, rate->channels);
+	equal_rate_areas(dst, dst_areas, dst_offset, rate->channels);
+	equal_resample_run(rate->rs, src, rate->in_format, src_frames, dst,
+			rate->out_format, dst_frames);
+}
+
+static void equal_rate_close(void *obj)
+{
+	equal_rate_free(obj);
+	free(obj);
+}
+
+#if SND_PCM_RATE_PLUGIN_VERSION >= 0x010002
+static int equal_rate_get_supported_rates(void *obj, unsigned int *rate_min,
+		unsigned int *rate_max)
+{
+	*rate_min = 4000;
+	*rate_max = 768000;
+	return 0;
+}
+
+static void equal_rate_dump(void *obj, snd_output_t *out)
+{
+	snd_pcm_rate_equal_t *rate = obj;
+
+	snd_output_printf(out, "Converter: alsaequal polyphase FIR (%s)\n",
+			equal_resample_quality_name(rate->quality));
+	if(rate->rs != NULL) {
+		snd_output_printf(out, "%u taps, %u phases, %s\n", rate->rs->taps,
+				rate->rs->phases, rate->s16 ? "S16 only" : "in place");
+	}
+}
+#endif
+
+#if SND_PCM_RATE_PLUGIN_VERSION >= 0x010003
+static int equal_rate_get_supported_formats(void *obj, uint64_t *in_formats,
+		uint64_t *out_formats, unsigned int *flags)
+{
+	*in_formats = *out_formats = (1ULL << SND_PCM_FORMAT_S16) |
+			(1ULL << SND_PCM_FORMAT_S32) | (1ULL << SND_PCM_FORMAT_FLOAT);
+	*flags = 0;
+	return 0;
+}
+#endif
+
+/* For alsa-libs that only know convert_s16 */
+static const snd_pcm_rate_ops_t equal_rate_s16_ops = {
+	.close = equal_rate_close,
+	.init = equal_rate_init,
+	.free = equal_rate_free,
+	.reset = equal_rate_reset,
+	.adjust_pitch = equal_rate_adjust_pitch,
+	.convert_s16 = equal_rate_convert_s16,
+	.input_frames = equal_rate_input_frames,
+	.output_frames = equal_rate_output_frames,
+#if SND_PCM_RATE_PLUGIN_VERSION >= 0x010002
+	.version = 0x010002,
+	.get_supported_rates = equal_rate_get_supported_rates,
+	.dump = equal_rate_dump,
+#endif
+};
+
+#if SND_PCM_RATE_PLUGIN_VERSION >= 0x010003
+static const snd_pcm_rate_ops_t equal_rate_ops = {
+	.close = equal_rate_close,
+	.init = equal_rate_init,
+	.free = equal_rate_free,
+	.reset = equal_rate_reset,
+	.adjust_pitch = equal_rate_adjust_pitch,
+	.convert = equal_rate_convert,
+	.input_frames = equal_rate_input_frames,
+	.output_frames = equal_rate_output_frames,
+	.version = SND_PCM_RATE_PLUGIN_VERSION,
+	.get_supported_rates = equal_rate_get_supported_rates,
+	.dump = equal_rate_dump,
+	.get_supported_formats = equal_rate_get_supported_formats,
+};
+#endif
+
+static int equal_rate_open(unsigned int version, void **objp,
+		snd_pcm_rate_ops_t *ops, int quality)
+{
+	snd_pcm_rate_equal_t *rate;
+
+#if SND_PCM_RATE_PLUGIN_VERSION < 0x010002
+	if(version != SND_PCM_RATE_PLUGIN_VERSION) {
+		fprintf(stderr, "Invalid rate plugin version %x\n", version);
+		return -EINVAL;
+	}
+#endif
+	rate = calloc(1, sizeof(*rate));
+	if(rate == NULL) {
+		return -ENOMEM;
+	}
+	rate->quality = quality;
+
+	*objp = rate;
+	/* An alsa-lib older than these headers has a shorter ops struct */
+#if SND_PCM_RATE_PLUGIN_VERSION >= 0x010003
+	if(version >= 0x010003) {
+		*ops = equal_rate_ops;
+		return 0;
+	}
+#endif
+	rate->s16 = 1;
+#if SND_PCM_RATE_PLUGIN_VERSION >= 0x010003
+	if(version == 0x010002) {
+		memcpy(ops, &equal_rate_s16_ops,
+				offsetof(snd_pcm_rate_ops_t, get_supported_formats));
+	} else
+#endif
+#if SND_PCM_RATE_PLUGIN_VERSION >= 0x010002
+	if(version == 0x010001) {
+		memcpy(ops, &equal_rate_s16_ops, sizeof(snd_pcm_rate_old_ops_t));
+	} else
+#endif
+		*ops = equal_rate_s16_ops;
+	return 0;
+}
+
+int SND_PCM_RATE_PLUGIN_ENTRY(equal)(unsigned int version, void **objp,
+		snd_pcm_rate_ops_t *ops)
+{
+	return equal_rate_open(version, objp, ops, EQUAL_RESAMPLE_MEDIUM);
+}
+
+int SND_PCM_RATE_PLUGIN_ENTRY(equal_fast)(unsigned int version, void **objp,
+		snd_pcm_rate_ops_t *ops)
+{
+	return equal_rate_open(version, objp, ops, EQUAL_RESAMPLE_FAST);
+}
+
+int SND_PCM_RATE_PLUGIN_ENTRY(equal_best)(unsigned int version, void **objp,
+		snd_pcm_rate_ops_t *ops)
+{
+	return equal_rate_open(version, objp, ops, EQUAL_RESAMPLE_BEST);
+}
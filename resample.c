@@ -0,0 +1,356 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "resample.h"
+
+/* Input frames held besides the filter window */
+#define RS_CHUNK 8192
+
+typedef float rs_v4sf __attribute__((vector_size(16)));
+typedef float rs_v4sf_u __attribute__((vector_size(16), aligned(4)));
+
+/* Taps and phases per preset. The Kaiser beta sets the stopband (about
+   60, 80 and 100 dB) and the cutoff puts the transition band just below
+   Nyquist, the phases keep the interpolation error under the stopband. */
+static const struct {
+	const char *name;
+	unsigned int taps;
+	unsigned int phases;
+	double beta;
+	double cutoff;
+} rs_presets[] = {
+	{ "fast", 24, 64, 5.65, 0.85 },
+	{ "medium", 48, 128, 7.86, 0.895 },
+	{ "best", 96, 256, 10.06, 0.93 },
+};
+
+static unsigned long rs_gcd(unsigned long a, unsigned long b)
+{
+	unsigned long t;
+	while(b != 0) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/* Zeroth order modified Bessel function, for the Kaiser window */
+static double rs_bessel_i0(double x)
+{
+	double sum = 1, term = 1;
+	int k;
+
+	for(k = 1; k < 50; k++) {
+		term *= (x/(2*k))*(x/(2*k));
+		sum += term;
+		if(term < sum*1e-12) {
+			break;
+		}
+	}
+	return sum;
+}
+
+/* Row p holds the taps for an output p/phases of an input sample past
+   the centre of the window, each row summing to 1. Row phases is row 0
+   a tap along, for interpolating past the last phase. */
+static void rs_design(equal_resample_t *rs, double cutoff, double beta)
+{
+	const unsigned int taps = rs->taps, half = taps/2;
+	double h[256], d, r, sum;
+	unsigned int p, k;
+
+	for(p = 0; p <= rs->phases; p++) {
+		sum = 0;
+		for(k = 0; k < taps; k++) {
+			d = (double)k - (half - 1) - (double)p/rs->phases;
+			r = d/half;
+			h[k] = r*r >= 1 ? 0 : rs_bessel_i0(beta*sqrt(1 - r*r));
+			if(d != 0) {
+				h[k] *= sin(M_PI*cutoff*d)/(M_PI*d);
+			} else {
+				h[k] *= cutoff;
+			}
+			sum += h[k];
+		}
+		for(k = 0; k < taps; k++) {
+			rs->coef[p*taps + k] = h[k]/sum;
+		}
+	}
+}
+
+equal_resample_t *equal_resample_create(unsigned int channels,
+		unsigned long in_rate, unsigned long out_rate, int quality)
+{
+	equal_resample_t *rs;
+	double cutoff;
+	void *mem;
+
+	if(channels < 1 || channels > 16 || in_rate == 0 || out_rate == 0 ||
+			quality < EQUAL_RESAMPLE_FAST || quality > EQUAL_RESAMPLE_BEST) {
+		return NULL;
+	}
+	rs = calloc(1, sizeof(*rs));
+	if(rs == NULL) {
+		return NULL;
+	}
+	rs->channels = channels;
+	rs->quality = quality;
+	rs->taps = rs_presets[quality].taps;
+	rs->phases = rs_presets[quality].phases;
+	rs->history = rs->taps + RS_CHUNK;
+	if(posix_memalign(&mem, sizeof(rs_v4sf),
+			(rs->phases + 1)*rs->taps*sizeof(float)) != 0) {
+		free(rs);
+		return NULL;
+	}
+	rs->coef = mem;
+	rs->hist = malloc(channels*rs->history*sizeof(float));
+	if(rs->hist == NULL) {
+		equal_resample_destroy(rs);
+		return NULL;
+	}
+
+	/* Cut off below the Nyquist frequency of the lower rate */
+	cutoff = rs_presets[quality].cutoff;
+	if(out_rate < in_rate) {
+		cutoff *= (double)out_rate/in_rate;
+	}
+	rs_design(rs, cutoff, rs_presets[quality].beta);
+	rs->ratio_in = 1;
+	rs->ratio_out = 1;
+	equal_resample_set_ratio(rs, in_rate, out_rate);
+	equal_resample_reset(rs);
+	return rs;
+}
+
+void equal_resample_destroy(equal_resample_t *rs)
+{
+	if(rs == NULL) {
+		return;
+	}
+	free(rs->coef);
+	free(rs->hist);
+	free(rs);
+}
+
+void equal_resample_set_ratio(equal_resample_t *rs, unsigned long in_frames,
+		unsigned long out_frames)
+{
+	unsigned long g = rs_gcd(in_frames, out_frames);
+
+	if(g == 0) {
+		return;
+	}
+	/* Keep the position within the current input sample */
+	rs->rem = (unsigned long long)rs->rem*(out_frames/g)/rs->ratio_out;
+	rs->ratio_in = in_frames/g;
+	rs->ratio_out = out_frames/g;
+}
+
+void equal_resample_reset(equal_resample_t *rs)
+{
+	/* A window of silence ahead of the input, so that output can start
+	   with the first input frame */
+	memset(rs->hist, 0, rs->channels*rs->history*sizeof(float));
+	memset(rs->last, 0, sizeof(rs->last));
+	rs->fill = rs->taps - 1;
+	rs->base = 0;
+	rs->rem = 0;
+}
+
+static inline float rs_dot(const float *x, const float *c, unsigned int taps)
+{
+	rs_v4sf a = { 0, 0, 0, 0 };
+	unsigned int k;
+
+	for(k = 0; k < taps; k += 4) {
+		a += *(const rs_v4sf_u *)(x + k)*(*(const rs_v4sf *)(c + k));
+	}
+	return a[0] + a[1] + a[2] + a[3];
+}
+
+static inline float rs_dot2(const float *x, const float *c0, const float *c1,
+		unsigned int taps, float frac)
+{
+	rs_v4sf a = { 0, 0, 0, 0 }, b = { 0, 0, 0, 0 }, v;
+	unsigned int k;
+
+	for(k = 0; k < taps; k += 4) {
+		v = *(const rs_v4sf_u *)(x + k);
+		a += v*(*(const rs_v4sf *)(c0 + k));
+		b += v*(*(const rs_v4sf *)(c1 + k));
+	}
+	a += frac*(b - a);
+	return a[0] + a[1] + a[2] + a[3];
+}
+
+/* Append n samples of one channel from area, starting at frame pos */
+static void rs_load(float *h, const equal_resample_area_t *area, int format,
+		unsigned int pos, unsigned int n)
+{
+	const char *p = (const char *)area->addr + (size_t)pos*area->step;
+	unsigned int i;
+
+	switch(format) {
+	case EQUAL_RESAMPLE_S16:
+		for(i = 0; i < n; i++, p += area->step) {
+			h[i] = *(const int16_t *)p*(1.0f/32768.0f);
+		}
+		break;
+	case EQUAL_RESAMPLE_S32:
+		for(i = 0; i < n; i++, p += area->step) {
+			h[i] = *(const int32_t *)p*(1.0f/2147483648.0f);
+		}
+		break;
+	default:
+		if(area->step == sizeof(float)) {
+			memcpy(h, p, n*sizeof(float));
+			break;
+		}
+		for(i = 0; i < n; i++, p += area->step) {
+			h[i] = *(const float *)p;
+		}
+		break;
+	}
+}
+
+static inline void rs_store(const equal_resample_area_t *area, int format,
+		unsigned int pos, float y)
+{
+	char *p = (char *)area->addr + (size_t)pos*area->step;
+	long v;
+
+	switch(format) {
+	case EQUAL_RESAMPLE_S16:
+		v = lrintf(y*32768.0f);
+		*(int16_t *)p = v > INT16_MAX ? INT16_MAX :
+				v < INT16_MIN ? INT16_MIN : v;
+		break;
+	case EQUAL_RESAMPLE_S32:
+		/* Clamped in float, 2^31 is the first value out of range */
+		y *= 2147483648.0f;
+		*(int32_t *)p = y >= 2147483648.0f ? INT32_MAX :
+				y <= -2147483648.0f ? INT32_MIN : (int32_t)lrintf(y);
+		break;
+	default:
+		*(float *)p = y;
+		break;
+	}
+}
+
+void equal_resample_run(equal_resample_t *rs,
+		const equal_resample_area_t *src, int src_format,
+		unsigned int src_frames, const equal_resample_area_t *dst,
+		int dst_format, unsigned int dst_frames)
+{
+	const unsigned int channels = rs->channels, taps = rs->taps;
+	const float *c0, *c1;
+	unsigned long long t;
+	unsigned int j, n, p, pos = 0, done = 0;
+	float frac, y;
+
+	while(1) {
+		/* Move the window back to the start and take in what fits. When
+		   decimating the window may have stepped past the end. */
+		if(rs->base >= rs->fill) {
+			rs->base -= rs->fill;
+			rs->fill = 0;
+		} else if(rs->base > 0) {
+			for(j = 0; j < channels; j++) {
+				memmove(rs->hist + j*rs->history,
+						rs->hist + j*rs->history + rs->base,
+						(rs->fill - rs->base)*sizeof(float));
+			}
+			rs->fill -= rs->base;
+			rs->base = 0;
+		}
+		n = rs->history - rs->fill;
+		if(n > src_frames - pos) {
+			n = src_frames - pos;
+		}
+		for(j = 0; j < channels; j++) {
+			rs_load(rs->hist + j*rs->history + rs->fill, &src[j], src_format,
+					pos, n);
+		}
+		rs->fill += n;
+		pos += n;
+
+		for(; done < dst_frames && rs->base + taps <= rs->fill; done++) {
+			t = ((unsigned long long)rs->rem*rs->phases << 16)/rs->ratio_out;
+			p = t >> 16;
+			frac = (t & 0xffff)*(1.0f/65536.0f);
+			c0 = rs->coef + p*taps;
+			c1 = c0 + taps;
+			for(j = 0; j < channels; j++) {
+				if(frac == 0) {
+					y = rs_dot(rs->hist + j*rs->history + rs->base, c0, taps);
+				} else {
+					y = rs_dot2(rs->hist + j*rs->history + rs->base, c0, c1,
+							taps, frac);
+				}
+				rs->last[j] = y;
+				rs_store(&dst[j], dst_format, done, y);
+			}
+			rs->rem += rs->ratio_in;
+			rs->base += rs->rem/rs->ratio_out;
+			rs->rem %= rs->ratio_out;
+		}
+
+		if(pos == src_frames || (n == 0 && rs->base == 0)) {
+			break;
+		}
+	}
+
+	/* Ran out of input, which only happens if the caller's frame counts
+	   stray from the ratio: hold the last output */
+	for(; done < dst_frames; done++) {
+		for(j = 0; j < channels; j++) {
+			rs_store(&dst[j], dst_format, done, rs->last[j]);
+		}
+	}
+}
+
+void equal_resample_run_s16(equal_resample_t *rs, const int16_t *src,
+		unsigned int src_frames, int16_t *dst, unsigned int dst_frames)
+{
+	equal_resample_area_t src_areas[16], dst_areas[16];
+	unsigned int j;
+
+	for(j = 0; j < rs->channels; j++) {
+		src_areas[j].addr = (int16_t *)src + j;
+		src_areas[j].step = rs->channels*sizeof(int16_t);
+		dst_areas[j].addr = dst + j;
+		dst_areas[j].step = rs->channels*sizeof(int16_t);
+	}
+	equal_resample_run(rs, src_areas, EQUAL_RESAMPLE_S16, src_frames,
+			dst_areas, EQUAL_RESAMPLE_S16, dst_frames);
+}
+
+const char *equal_resample_quality_name(int quality)
+{
+	if(quality < EQUAL_RESAMPLE_FAST || quality > EQUAL_RESAMPLE_BEST) {
+		return "unknown";
+	}
+	return rs_presets[quality].name;
+}
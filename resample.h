@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#ifndef EQUAL_RESAMPLE_H
+#define EQUAL_RESAMPLE_H
+
+#include <stdint.h>
+
+/* Polyphase FIR sample rate converter.
+
+   The prototype filter is a Kaiser windowed sinc cut off just below the
+   lower of the two Nyquist frequencies, tabulated at a number of phases
+   between two input samples. An output sample is the inner product of
+   the input history with the table row for its position, interpolated
+   linearly between the two nearest rows unless the conversion ratio
+   lands exactly on them. The position advances by in/out input samples
+   per output sample, kept as an exact fraction so it never drifts. */
+
+enum {
+	EQUAL_RESAMPLE_FAST,
+	EQUAL_RESAMPLE_MEDIUM,
+	EQUAL_RESAMPLE_BEST
+};
+
+/* Sample formats, native endian */
+enum {
+	EQUAL_RESAMPLE_S16,
+	EQUAL_RESAMPLE_S32,
+	EQUAL_RESAMPLE_FLOAT
+};
+
+/* One channel of samples, the first at addr and each next one step
+   bytes on */
+typedef struct equal_resample_area {
+	void *addr;
+	unsigned int step;
+} equal_resample_area_t;
+
+typedef struct equal_resample {
+	unsigned int channels;
+	int quality;
+	unsigned int taps;		/* Per phase, a multiple of 4 */
+	unsigned int phases;
+	float *coef;			/* [phases + 1][taps] */
+	/* Input samples per output sample is ratio_in/ratio_out */
+	unsigned long ratio_in;
+	unsigned long ratio_out;
+	unsigned long rem;		/* Position past base, in 1/ratio_out */
+	/* Input history per channel, [channels][history] floats */
+	float *hist;
+	unsigned int history;
+	unsigned int base;		/* First sample of the next window */
+	unsigned int fill;		/* Samples in the history */
+	float last[16];		/* Last output per channel */
+} equal_resample_t;
+
+/* Convert between in_rate and out_rate. The prototype filter is fixed by
+   the rates, set_ratio() only fine tunes the step. */
+equal_resample_t *equal_resample_create(unsigned int channels,
+		unsigned long in_rate, unsigned long out_rate, int quality);
+void equal_resample_destroy(equal_resample_t *rs);
+
+/* Step in_frames input frames for every out_frames output frames, e.g.
+   the period sizes either side of the converter. */
+void equal_resample_set_ratio(equal_resample_t *rs, unsigned long in_frames,
+		unsigned long out_frames);
+
+/* Forget the history, the next output starts from silence. */
+void equal_resample_reset(equal_resample_t *rs);
+
+/* Read src_frames frames from the src areas and write dst_frames to the
+   dst areas, one area per channel in either format. The ratio should
+   match the two on average, any difference is absorbed by the history.
+   The input is converted to float on its way into the history, which
+   the filter needs anyway, and the output is written in place, so no
+   format takes a pass of its own. */
+void equal_resample_run(equal_resample_t *rs,
+		const equal_resample_area_t *src, int src_format,
+		unsigned int src_frames, const equal_resample_area_t *dst,
+		int dst_format, unsigned int dst_frames);
+
+/* The same for interleaved S16 frames */
+void equal_resample_run_s16(equal_resample_t *rs, const int16_t *src,
+		unsigned int src_frames, int16_t *dst, unsigned int dst_frames);
+
+/* Name of a quality preset */
+const char *equal_resample_quality_name(int quality);
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ringbuffer.h"
+
+static size_t ring_round_up(size_t size)
+{
+	size_t n = 1;
+	while(n < size) {
+		n <<= 1;
+	}
+	return n;
+}
+
+size_t equal_ring_footprint(size_t size)
+{
+	return sizeof(equal_ring_t) + ring_round_up(size);
+}
+
+void equal_ring_init(equal_ring_t *ring, size_t size)
+{
+	ring->size = ring_round_up(size);
+	__atomic_store_n(&ring->head, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&ring->tail, 0, __ATOMIC_RELAXED);
+}
+
+equal_ring_t *equal_ring_create(size_t size)
+{
+	equal_ring_t *ring;
+
+	ring = malloc(equal_ring_footprint(size));
+	if(ring == NULL) {
+		return NULL;
+	}
+	equal_ring_init(ring, size);
+	return ring;
+}
+
+void equal_ring_free(equal_ring_t *ring)
+{
+	free(ring);
+}
+
+void equal_ring_reset(equal_ring_t *ring)
+{
+	__atomic_store_n(&ring->head, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->tail, 0, __ATOMIC_RELEASE);
+}
+
+size_t equal_ring_read_space(const equal_ring_t *ring)
+{
+	return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) -
+		__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+size_t equal_ring_write_space(const equal_ring_t *ring)
+{
+	return ring->size - equal_ring_read_space(ring);
+}
+
+size_t equal_ring_write(equal_ring_t *ring, const void *src, size_t bytes)
+{
+	uint64_t head, tail;
+	size_t offset, first;
+
+	head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if(bytes > ring->size - (head - tail)) {
+		bytes = ring->size - (head - tail);
+	}
+
+	offset = head & (ring->size - 1);
+	first = ring->size - offset;
+	if(first > bytes) {
+		first = bytes;
+	}
+	memcpy(ring->data + offset, src, first);
+	memcpy(ring->data, (const char *)src + first, bytes - first);
+
+	__atomic_store_n(&ring->head, head + bytes, __ATOMIC_RELEASE);
+	return bytes;
+}
+
+size_t equal_ring_read(equal_ring_t *ring, void *dst, size_t bytes)
+{
+	uint64_t head, tail;
+	size_t offset, first;
+
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	if(bytes > head - tail) {
+		bytes = head - tail;
+	}
+
+	offset = tail & (ring->size - 1);
+	first = ring->size - offset;
+	if(first > bytes) {
+		first = bytes;
+	}
+	memcpy(dst, ring->data + offset, first);
+	memcpy((char *)dst + first, ring->data, bytes - first);
+
+	__atomic_store_n(&ring->tail, tail + bytes, __ATOMIC_RELEASE);
+	return bytes;
+}
+
+size_t equal_ring_skip(equal_ring_t *ring, size_t bytes)
+{
+	uint64_t head, tail;
+
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	if(bytes > head - tail) {
+		bytes = head - tail;
+	}
+
+	__atomic_store_n(&ring->tail, tail + bytes, __ATOMIC_RELEASE);
+	return bytes;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#ifndef EQUAL_RINGBUFFER_H
+#define EQUAL_RINGBUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Lock-free single-producer/single-consumer byte ring. The data lives
+   directly behind the header so a ring can be placed in shared memory
+   as well as on the heap. The size is always a power of two and the
+   head/tail counters run freely, masked on access. */
+typedef struct equal_ring {
+	uint64_t size;
+	uint64_t head;	/* Written by the producer only */
+	uint64_t tail;	/* Written by the consumer only */
+	char data[];
+} equal_ring_t;
+
+/* Number of bytes needed to hold a ring of at least size bytes. */
+size_t equal_ring_footprint(size_t size);
+
+/* Initialise a ring in caller provided memory of equal_ring_footprint()
+   bytes. */
+void equal_ring_init(equal_ring_t *ring, size_t size);
+
+/* Allocate and free a ring on the heap. */
+equal_ring_t *equal_ring_create(size_t size);
+void equal_ring_free(equal_ring_t *ring);
+
+/* Discard any data in the ring, neither side may be active. */
+void equal_ring_reset(equal_ring_t *ring);
+
+size_t equal_ring_read_space(const equal_ring_t *ring);
+size_t equal_ring_write_space(const equal_ring_t *ring);
+
+/* Copy up to bytes into or out of the ring, returns the number of bytes
+   actually transferred. Neither call ever blocks. */
+size_t equal_ring_write(equal_ring_t *ring, const void *src, size_t bytes);
+size_t equal_ring_read(equal_ring_t *ring, void *dst, size_t bytes);
+
+/* Discard up to bytes on the consumer side, returns the number of bytes
+   actually discarded. */
+size_t equal_ring_skip(equal_ring_t *ring, size_t bytes);
+
+#endif
@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tap.h"
+
+static size_t tap_length(unsigned int channels, unsigned int frames)
+{
+	return sizeof(equal_tap_t) + 2*(size_t)frames*channels*sizeof(float);
+}
+
+/* Claim the tap for this process unless a live one has it. */
+static int tap_claim(equal_tap_t *tap)
+{
+	int32_t owner, self = getpid();
+
+	owner = __atomic_load_n(&tap->producer, __ATOMIC_ACQUIRE);
+	do {
+		if(owner != 0 && (kill(owner, 0) == 0 || errno != ESRCH)) {
+			return 0;
+		}
+	} while(!__atomic_compare_exchange_n(&tap->producer, &owner, self, 0,
+			__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+	return 1;
+}
+
+equal_tap_t *equal_tap_create(const char *name, unsigned int channels,
+		unsigned int frames, size_t *length)
+{
+	equal_tap_t *tap;
+	struct stat st;
+	size_t size;
+	unsigned int n;
+	uint32_t magic;
+	int fd;
+
+	for(n = 1; n < frames; n <<= 1);
+	frames = n;
+	size = tap_length(channels, frames);
+
+	for(;;) {
+		fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+		if(fd < 0) {
+			return NULL;
+		}
+		if(fstat(fd, &st) < 0) {
+			close(fd);
+			return NULL;
+		}
+		/* A new object only grows, its pages stay unallocated until
+		   used. An existing one keeps its size, which readers mapped. */
+		if(st.st_size == 0 && ftruncate(fd, size) < 0) {
+			close(fd);
+			return NULL;
+		}
+		*length = st.st_size == 0 ? size : (size_t)st.st_size;
+		if(*length < sizeof(equal_tap_t)) {
+			close(fd);
+			shm_unlink(name);
+			continue;
+		}
+		tap = mmap(NULL, *length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if(tap == MAP_FAILED) {
+			close(fd);
+			return NULL;
+		}
+
+		magic = __atomic_load_n(&tap->magic, __ATOMIC_ACQUIRE);
+		if(magic != 0 && magic != EQUAL_TAP_MAGIC) {
+			/* Another layout, nothing in it can be trusted */
+			munmap(tap, *length);
+			close(fd);
+			shm_unlink(name);
+			continue;
+		}
+		if(!tap_claim(tap)) {
+			munmap(tap, *length);
+			close(fd);
+			return NULL;
+		}
+		if(fstat(fd, &st) == 0 && st.st_nlink == 0) {
+			/* Replaced while we were opening it */
+			equal_tap_destroy(tap, *length);
+			close(fd);
+			continue;
+		}
+		if(*length < size || (magic == EQUAL_TAP_MAGIC &&
+				(tap->channels != channels || tap->frames != frames))) {
+			/* Readers may still map the old geometry, publish ours in a
+			   new object */
+			__atomic_store_n(&tap->magic, 0, __ATOMIC_RELEASE);
+			shm_unlink(name);
+			equal_tap_destroy(tap, *length);
+			close(fd);
+			continue;
+		}
+		close(fd);
+		break;
+	}
+
+	/* Readers check the magic last */
+	__atomic_store_n(&tap->magic, 0, __ATOMIC_RELEASE);
+	tap->channels = channels;
+	tap->frames = frames;
+	tap->rate = 0;
+	__atomic_store_n(&tap->write_pos, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&tap->magic, EQUAL_TAP_MAGIC, __ATOMIC_RELEASE);
+
+	return tap;
+}
+
+void equal_tap_destroy(equal_tap_t *tap, size_t length)
+{
+	int32_t self = getpid();
+
+	__atomic_compare_exchange_n(&tap->producer, &self, 0, 0,
+			__ATOMIC_RELEASE, __ATOMIC_RELAXED);
+	munmap(tap, length);
+}
+
+const equal_tap_t *equal_tap_open(const char *name, size_t *length)
+{
+	const equal_tap_t *tap;
+	struct stat st;
+	int fd;
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if(fd < 0) {
+		return NULL;
+	}
+	if(fstat(fd, &st) < 0 || st.st_size < sizeof(equal_tap_t)) {
+		close(fd);
+		return NULL;
+	}
+	tap = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(tap == MAP_FAILED) {
+		return NULL;
+	}
+	if(!equal_tap_valid(tap) ||
+			tap_length(tap->channels, tap->frames) > st.st_size) {
+		munmap((void *)tap, st.st_size);
+		return NULL;
+	}
+	*length = st.st_size;
+	return tap;
+}
+
+void equal_tap_close(const equal_tap_t *tap, size_t length)
+{
+	munmap((void *)tap, length);
+}
+
+int equal_tap_valid(const equal_tap_t *tap)
+{
+	return __atomic_load_n(&tap->magic, __ATOMIC_ACQUIRE) == EQUAL_TAP_MAGIC;
+}
+
+void equal_tap_put(equal_tap_t *tap, int side, const float *src,
+		unsigned int frames)
+{
+	float *base = tap->data + (size_t)side*tap->frames*tap->channels;
+	unsigned int offset, first;
+
+	if(frames > tap->frames) {
+		src += (frames - tap->frames)*tap->channels;
+		frames = tap->frames;
+	}
+	offset = __atomic_load_n(&tap->write_pos, __ATOMIC_RELAXED) &
+			(tap->frames - 1);
+	first = tap->frames - offset;
+	if(first > frames) {
+		first = frames;
+	}
+	memcpy(base + offset*tap->channels, src,
+			first*tap->channels*sizeof(float));
+	memcpy(base, src + first*tap->channels,
+			(frames - first)*tap->channels*sizeof(float));
+}
+
+void equal_tap_commit(equal_tap_t *tap, unsigned int frames)
+{
+	__atomic_add_fetch(&tap->write_pos, frames, __ATOMIC_RELEASE);
+}
+
+int equal_tap_read_at(const equal_tap_t *tap, int side, float *dst,
+		uint64_t pos, unsigned int frames)
+{
+	const float *base = tap->data + (size_t)side*tap->frames*tap->channels;
+	uint64_t after;
+	unsigned int offset, first;
+
+	offset = pos & (tap->frames - 1);
+	first = tap->frames - offset;
+	if(first > frames) {
+		first = frames;
+	}
+	memcpy(dst, base + offset*tap->channels,
+			first*tap->channels*sizeof(float));
+	memcpy(dst + first*tap->channels, base,
+			(frames - first)*tap->channels*sizeof(float));
+
+	/* The producer writes ahead of write_pos, so it must not have come
+	   within a chunk of the frames we copied */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	after = __atomic_load_n(&tap->write_pos, __ATOMIC_RELAXED);
+	return after - pos <= tap->frames/2 &&
+			__atomic_load_n(&tap->magic, __ATOMIC_RELAXED) == EQUAL_TAP_MAGIC;
+}
+
+uint64_t equal_tap_read(const equal_tap_t *tap, int side, float *dst,
+		unsigned int frames)
+{
+	uint64_t end;
+
+	if(frames > tap->frames/2) {
+		return 0;
+	}
+	end = __atomic_load_n(&tap->write_pos, __ATOMIC_ACQUIRE);
+	if(end < frames) {
+		return 0;
+	}
+	if(!equal_tap_read_at(tap, side, dst, end - frames, frames)) {
+		return 0;
+	}
+	return end;
+}
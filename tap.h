@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#ifndef EQUAL_TAP_H
+#define EQUAL_TAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Audio tap, a single-producer ring in shared memory holding the
+   interleaved pre-EQ and post-EQ samples of the last frames processed.
+   The PCM never waits for readers: old frames are simply overwritten and
+   a reader detects that it was lapped by checking the write position
+   again after copying.
+
+   Only one PCM writes a tap: the first to open its controls claims it
+   by setting producer to its pid, later PCMs run without one until the
+   claim is released or its process died. A tap's geometry never changes
+   once it is published; a producer that needs another one clears the
+   magic, which readers take as the tap having gone away, and replaces
+   the object. */
+
+#define EQUAL_TAP_MAGIC 0x32544145	/* "EAT2" */
+#define EQUAL_TAP_PRE	0
+#define EQUAL_TAP_POST	1
+
+typedef struct equal_tap {
+	uint32_t magic;
+	uint32_t channels;
+	uint32_t rate;
+	uint32_t frames;	/* Capacity, a power of two */
+	uint64_t write_pos;	/* Frames published so far */
+	int32_t producer;	/* pid of the PCM writing, 0 for none */
+	uint32_t reserved;
+	float data[];		/* [2][frames][channels] */
+} equal_tap_t;
+
+/* Suffix of the tap's shared memory object, see LADSPAcontrolShmName() */
+#define EQUAL_TAP_SUFFIX "-tap"
+
+/* Create or claim the tap for the producer. Returns NULL if another live
+   PCM has it. *length is set to the size mapped, for equal_tap_destroy(). */
+equal_tap_t *equal_tap_create(const char *name, unsigned int channels,
+		unsigned int frames, size_t *length);
+
+/* Release the producer's claim and unmap the tap. */
+void equal_tap_destroy(equal_tap_t *tap, size_t length);
+
+/* Map an existing tap read-only, *length is set to the size mapped. */
+const equal_tap_t *equal_tap_open(const char *name, size_t *length);
+
+void equal_tap_close(const equal_tap_t *tap, size_t length);
+
+/* Reader: whether the tap is still published. */
+int equal_tap_valid(const equal_tap_t *tap);
+
+/* Producer: store frames of one side at the current write position, then
+   publish both sides with equal_tap_commit(). */
+void equal_tap_put(equal_tap_t *tap, int side, const float *src,
+		unsigned int frames);
+void equal_tap_commit(equal_tap_t *tap, unsigned int frames);
+
+/* Reader: copy the newest frames of one side into dst. Returns the write
+   position the copy ends at, or 0 if there is not enough data yet or the
+   producer overwrote the frames while they were being copied. */
+uint64_t equal_tap_read(const equal_tap_t *tap, int side, float *dst,
+		unsigned int frames);
+
+/* Reader: copy frames of one side starting at stream position pos, for
+   readers following the whole stream. pos + frames must not be past
+   write_pos. Returns 1, or 0 if the producer overwrote the frames before
+   or while they were being copied. */
+int equal_tap_read_at(const equal_tap_t *tap, int side, float *dst,
+		uint64_t pos, unsigned int frames);
+
+#endif
@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+
+/* Checks libalsaequal-core end to end on the Gain test plugin: the gain
+   reaches the audio, a timestamped change splits the run at exactly its
+   frame, also across the core's internal blocks, and the stream position
+   and rate are published with the controls. Then times a run through it.
+   Run by make check, which passes the path of test-gain.so. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "alsaequal_core.h"
+#include "alsaequal_control.h"
+
+#define TEST_CHANNELS 2
+#define TEST_RATE 48000
+#define TEST_FRAMES 5000
+/* Period and length of the throughput run */
+#define TEST_PERIOD 256
+#define TEST_SECONDS 60
+
+static float test_in[TEST_FRAMES*TEST_CHANNELS];
+static float test_out[TEST_FRAMES*TEST_CHANNELS];
+
+static uint64_t test_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+/* Samples whose products with the gains used are exact */
+static void test_fill(void)
+{
+	unsigned long k;
+
+	for(k = 0; k < TEST_FRAMES*TEST_CHANNELS; k++) {
+		test_in[k] = (float)(k % 64)/64 - 0.5f;
+	}
+}
+
+/* Whether frames from..to of test_out are test_in times the gain of each
+   channel */
+static int test_expect(const char *what, unsigned long from,
+		unsigned long to, const float *gain)
+{
+	unsigned long i;
+	unsigned int j;
+
+	for(i = from; i < to; i++) {
+		for(j = 0; j < TEST_CHANNELS; j++) {
+			if(test_out[i*TEST_CHANNELS + j] !=
+					test_in[i*TEST_CHANNELS + j]*gain[j]) {
+				fprintf(stderr, "FAIL %s: frame %lu channel %u is %g, "
+						"expected %g\n", what, i, j,
+						test_out[i*TEST_CHANNELS + j],
+						test_in[i*TEST_CHANNELS + j]*gain[j]);
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+static int test_position(alsaequal_control_t *ctl, const char *what,
+		uint64_t expect)
+{
+	uint64_t frame;
+	unsigned int rate;
+
+	if(alsaequal_control_position(ctl, &frame, &rate) < 0 ||
+			frame != expect || rate != TEST_RATE) {
+		fprintf(stderr, "FAIL %s: position %llu at %u Hz, expected %llu "
+				"at %u Hz\n", what, (unsigned long long)frame, rate,
+				(unsigned long long)expect, TEST_RATE);
+		return 1;
+	}
+	return 0;
+}
+
+static int test_run(alsaequal_core_t *core, alsaequal_control_t *ctl,
+		int control)
+{
+	const float unity[TEST_CHANNELS] = { 1, 1 };
+	const float split[TEST_CHANNELS] = { 2, 0.5f };
+	const float later[TEST_CHANNELS] = { 3, 3 };
+	const float last[TEST_CHANNELS] = { 0.25f, 0.25f };
+	alsaequal_control_update_t update[TEST_CHANNELS];
+	int failed = 0;
+
+	/* Gain straight away, position back at 0 */
+	alsaequal_control_set(ctl, control, -1, 1);
+	if(alsaequal_core_prepare(core, TEST_RATE) < 0) {
+		fprintf(stderr, "FAIL prepare\n");
+		return 1;
+	}
+	failed |= test_position(ctl, "prepare", 0);
+	alsaequal_core_process(core, test_in, test_out, 1000);
+	failed |= test_expect("unity", 0, 1000, unity);
+	failed |= test_position(ctl, "advance", 1000);
+
+	/* A change at frame 1300 splits the next call 300 frames in */
+	update[0].control = control;
+	update[0].channel = 0;
+	update[0].value = 2;
+	update[1].control = control;
+	update[1].channel = 1;
+	update[1].value = 0.5f;
+	alsaequal_control_schedule(ctl, update, 2, 1300);
+	alsaequal_core_process(core, test_in + 1000*TEST_CHANNELS,
+			test_out + 1000*TEST_CHANNELS, 1000);
+	failed |= test_expect("before change", 1000, 1300, unity);
+	failed |= test_expect("after change", 1300, 2000, split);
+
+	/* One in a later internal block of a long call, which also runs in
+	   place */
+	update[0].channel = -1;
+	update[0].value = 3;
+	alsaequal_control_schedule(ctl, update, 1, 3500);
+	memcpy(test_out + 2000*TEST_CHANNELS, test_in + 2000*TEST_CHANNELS,
+			2500*TEST_CHANNELS*sizeof(float));
+	alsaequal_core_process(core, test_out + 2000*TEST_CHANNELS,
+			test_out + 2000*TEST_CHANNELS, 2500);
+	failed |= test_expect("before later change", 2000, 3500, split);
+	failed |= test_expect("after later change", 3500, 4500, later);
+	failed |= test_position(ctl, "long call", 4500);
+
+	/* A plain write takes effect with the next call */
+	alsaequal_control_set(ctl, control, -1, 0.25f);
+	alsaequal_core_process(core, test_in + 4500*TEST_CHANNELS,
+			test_out + 4500*TEST_CHANNELS, 500);
+	failed |= test_expect("write", 4500, 5000, last);
+	return failed;
+}
+
+/* Periods of silence through the core for TEST_SECONDS of audio */
+static void test_throughput(alsaequal_core_t *core)
+{
+	const unsigned long frames = (unsigned long)TEST_RATE*TEST_SECONDS;
+	unsigned long done;
+	uint64_t start, ns;
+
+	memset(test_in, 0, sizeof(test_in));
+	alsaequal_core_prepare(core, TEST_RATE);
+	start = test_now();
+	for(done = 0; done < frames; done += TEST_PERIOD) {
+		alsaequal_core_process(core, test_in, test_out, TEST_PERIOD);
+	}
+	ns = test_now() - start;
+	printf("test-core: %u channels in %u frame periods, %.2f ns per frame, "
+			"%.0fx real time\n", TEST_CHANNELS, TEST_PERIOD,
+			(double)ns/frames, frames*1e9/TEST_RATE/(ns ? ns : 1));
+}
+
+int main(int argc, char *argv[])
+{
+	char dir[] = "/tmp/alsaequal-test-XXXXXX";
+	char controls[64];
+	alsaequal_core_t *core;
+	alsaequal_control_t *ctl;
+	int control, failed;
+
+	if(argc != 2) {
+		fprintf(stderr, "Usage: %s /path/to/test-gain.so\n", argv[0]);
+		return 1;
+	}
+	if(mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	snprintf(controls, sizeof(controls), "%s/test-core.bin", dir);
+
+	core = alsaequal_core_create(controls, argv[1], "Gain", TEST_CHANNELS);
+	if(core == NULL) {
+		perror("alsaequal_core_create");
+		rmdir(dir);
+		return 1;
+	}
+	ctl = alsaequal_control_open(controls, NULL, NULL, 0);
+	control = ctl != NULL ? alsaequal_control_find(ctl, "Gain") : -1;
+	if(control < 0) {
+		fprintf(stderr, "FAIL can't find the Gain control\n");
+		failed = 1;
+	} else {
+		test_fill();
+		failed = test_run(core, ctl, control);
+		if(!failed) {
+			test_throughput(core);
+		}
+	}
+
+	if(ctl != NULL) {
+		alsaequal_control_close(ctl);
+	}
+	alsaequal_core_destroy(core);
+	unlink(controls);
+	rmdir(dir);
+	printf("test-core: %s\n", failed ? "FAILED" : "ok");
+	return failed;
+}
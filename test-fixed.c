@@ -0,0 +1,332 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+
+/* Checks that the SSE4.2 and AVX2 filters produce the same bits as the
+   scalar reference: random input through random bands, both as set from
+   random gains and with random coefficients, states and Q formats, which
+   drives the accumulator into wrapping and the output into saturation.
+   Paths the CPU lacks are reported and skipped. Then checks multirate
+   against the full rate: flat bands must pass the input through as it
+   is, only delayed, and each band run decimated must boost its centre
+   frequency by what it does at the full rate. Run by make check. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "fixed.h"
+
+#define TEST_FRAMES 3000
+#define TEST_ROUNDS 50
+#define TEST_SEED 0x5eed
+
+/* Multirate: third octave bands from 20 Hz, those below the split run
+   decimated. Each of them is boosted and cut on its own and measured
+   with a tone at its centre once settled, where the design gives exactly
+   the gain. Decimated, a band must come within TEST_MR_DB of the full
+   rate, or of the design where the full rate is further off than that:
+   at 192 kHz the full rate coefficients of the lowest bands lose enough
+   precision to miss a cut by up to 0.8 dB. */
+#define TEST_MR_BANDS 31
+#define TEST_MR_SPLIT 300
+#define TEST_MR_GAIN 12
+#define TEST_MR_SETTLE 1.0
+#define TEST_MR_MEASURE 1.0
+#define TEST_MR_DB 0.05
+
+static const int test_isas[] = {
+	EQUAL_FIXED_SCALAR,
+	EQUAL_FIXED_SSE4,
+	EQUAL_FIXED_AVX2
+};
+#define TEST_NUM_ISAS (sizeof(test_isas)/sizeof(test_isas[0]))
+
+static int32_t test_random32(void)
+{
+	return (int32_t)((uint32_t)rand() << 16 ^ (uint32_t)rand());
+}
+
+/* Replace what equal_fixed_set() computed by anything a band can hold */
+static void test_scramble(equal_fixed_t *fx)
+{
+	equal_fixed_band_t *bd;
+	unsigned int b, j, k;
+
+	for(b = 0; b < fx->bands; b++) {
+		bd = &fx->band[b];
+		bd->shift = 2 + rand() % 29;
+		bd->active = 1;
+		for(j = 0; j < fx->channels; j++) {
+			for(k = 0; k < 5; k++) {
+				bd->coef[k][j] = test_random32();
+			}
+			for(k = 0; k < 4; k++) {
+				bd->state[k][j] = test_random32();
+			}
+		}
+	}
+}
+
+/* One round: the same filter and input through every path, whose output,
+   levels and filter state must match the scalar ones bit for bit */
+static int test_round(unsigned int round, int scramble)
+{
+	const unsigned int channels = 1 + rand() % EQUAL_FIXED_MAX_CHANNELS;
+	const unsigned int bands = 1 + rand() % 10;
+	const int format = rand() % 2 ? EQUAL_FIXED_S16 : EQUAL_FIXED_S32;
+	const size_t bytes = TEST_FRAMES*channels*(format == EQUAL_FIXED_S16 ?
+			sizeof(int16_t) : sizeof(int32_t));
+	float freq[EQUAL_FIXED_MAX_BANDS];
+	float gain[EQUAL_FIXED_MAX_BANDS*EQUAL_FIXED_MAX_CHANNELS];
+	equal_fixed_levels_t in[TEST_NUM_ISAS], out[TEST_NUM_ISAS];
+	equal_fixed_t *fx[TEST_NUM_ISAS];
+	unsigned char *src, *dst[TEST_NUM_ISAS];
+	unsigned int i, b, done, n;
+	size_t k;
+	int failed = 0;
+
+	for(b = 0; b < bands; b++) {
+		freq[b] = 31.25f*(1 << b);
+	}
+	for(k = 0; k < bands*channels; k++) {
+		gain[k] = rand() % 49 - 24;
+	}
+	src = malloc(bytes);
+	for(k = 0; k < bytes; k++) {
+		src[k] = rand();
+	}
+	for(i = 0; i < TEST_NUM_ISAS; i++) {
+		fx[i] = equal_fixed_create(channels, bands, freq);
+		dst[i] = malloc(bytes);
+		if(fx[i] == NULL || src == NULL || dst[i] == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+	}
+	equal_fixed_reset(fx[0], 48000);
+	equal_fixed_set(fx[0], gain);
+	if(scramble) {
+		test_scramble(fx[0]);
+	}
+
+	for(i = 1; i < TEST_NUM_ISAS; i++) {
+		memcpy(fx[i], fx[0], sizeof(equal_fixed_t));
+	}
+	for(i = 0; i < TEST_NUM_ISAS; i++) {
+		equal_fixed_set_isa(fx[i], test_isas[i]);
+		memset(&in[i], 0, sizeof(in[i]));
+		memset(&out[i], 0, sizeof(out[i]));
+		/* Uneven pieces, so blocks end mid-vector now and then */
+		for(done = 0; done < TEST_FRAMES; done += n) {
+			n = 1 + (done*7919 + round) % 700;
+			if(n > TEST_FRAMES - done) {
+				n = TEST_FRAMES - done;
+			}
+			equal_fixed_run(fx[i], src + done*bytes/TEST_FRAMES, format,
+					dst[i] + done*bytes/TEST_FRAMES, format, n, &in[i],
+					&out[i]);
+		}
+	}
+
+	for(i = 1; i < TEST_NUM_ISAS; i++) {
+		if(fx[i]->isa != test_isas[i]) {
+			continue;
+		}
+		if(memcmp(dst[0], dst[i], bytes) != 0 ||
+				memcmp(&in[0], &in[i], sizeof(in[0])) != 0 ||
+				memcmp(&out[0], &out[i], sizeof(out[0])) != 0 ||
+				memcmp(fx[0]->band, fx[i]->band, sizeof(fx[0]->band)) != 0) {
+			fprintf(stderr, "FAIL round %u: %s differs from scalar "
+					"(%u channels, %u bands, %s%s)\n", round,
+					equal_fixed_isa_name(test_isas[i]), channels, bands,
+					format == EQUAL_FIXED_S16 ? "S16" : "S32",
+					scramble ? ", random coefficients" : "");
+			failed = 1;
+		}
+	}
+
+	for(i = 0; i < TEST_NUM_ISAS; i++) {
+		equal_fixed_destroy(fx[i]);
+		free(dst[i]);
+	}
+	free(src);
+	return failed;
+}
+
+/* Gain in dB fx applies to a tone of freq at rate, S32 in and out */
+static double test_tone(equal_fixed_t *fx, unsigned long rate, double freq)
+{
+	const unsigned long settle = TEST_MR_SETTLE*rate;
+	const unsigned long frames = settle + TEST_MR_MEASURE*rate;
+	int32_t src[EQUAL_FIXED_BLOCK], dst[EQUAL_FIXED_BLOCK];
+	equal_fixed_levels_t in, out;
+	double sum_in = 0, sum_out = 0;
+	unsigned long done, k, n;
+
+	for(done = 0; done < frames; done += n) {
+		n = frames - done < EQUAL_FIXED_BLOCK ? frames - done :
+				EQUAL_FIXED_BLOCK;
+		for(k = 0; k < n; k++) {
+			/* -18 dBFS, so the boost doesn't clip */
+			src[k] = lrint(268435456.0*
+					sin(2*M_PI*freq*(done + k)/rate));
+		}
+		equal_fixed_run(fx, src, EQUAL_FIXED_S32, dst, EQUAL_FIXED_S32,
+				n, &in, &out);
+		for(k = 0; k < n; k++) {
+			if(done + k >= settle) {
+				sum_in += (double)src[k]*src[k];
+				sum_out += (double)dst[k]*dst[k];
+			}
+		}
+	}
+	return 10*log10(sum_out/sum_in);
+}
+
+/* Start fx over at rate with gain, split multirate or 0 */
+static void test_setup(equal_fixed_t *fx, unsigned long rate, float split,
+		const float *gain)
+{
+	equal_fixed_set_multirate(fx, split);
+	equal_fixed_reset(fx, rate);
+	equal_fixed_set(fx, gain);
+}
+
+/* Run frames of src through fx set up like that */
+static void test_run(equal_fixed_t *fx, unsigned long rate, float split,
+		const float *gain, const int32_t *src, int32_t *dst,
+		unsigned long frames)
+{
+	equal_fixed_levels_t in, out;
+	unsigned long done, n;
+
+	test_setup(fx, rate, split, gain);
+	for(done = 0; done < frames; done += n) {
+		n = frames - done < EQUAL_FIXED_BLOCK ? frames - done :
+				EQUAL_FIXED_BLOCK;
+		equal_fixed_run(fx, src + done, EQUAL_FIXED_S32, dst + done,
+				EQUAL_FIXED_S32, n, &in, &out);
+	}
+}
+
+/* Multirate at rate against the full rate, on the best path */
+static int test_multirate(unsigned long rate)
+{
+	float freq[TEST_MR_BANDS], gain[TEST_MR_BANDS];
+	double full, multi, worst = 0, design = 0;
+	int32_t *src, *dst[2];
+	equal_fixed_t *fx;
+	unsigned int b, low, stages, latency;
+	unsigned long k;
+	int sign, failed = 0;
+
+	for(b = 0; b < TEST_MR_BANDS; b++) {
+		freq[b] = 20*powf(2, b/3.0f);
+		gain[b] = 0;
+	}
+	fx = equal_fixed_create(1, TEST_MR_BANDS, freq);
+	src = malloc(rate*sizeof(int32_t));
+	dst[0] = malloc(rate*sizeof(int32_t));
+	dst[1] = malloc(rate*sizeof(int32_t));
+	if(fx == NULL || src == NULL || dst[0] == NULL || dst[1] == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+
+	/* Flat, multirate must give the full rate output bit for bit, only
+	   later by the latency */
+	for(k = 0; k < rate; k++) {
+		src[k] = test_random32();
+	}
+	test_run(fx, rate, 0, gain, src, dst[0], rate);
+	test_run(fx, rate, TEST_MR_SPLIT, gain, src, dst[1], rate);
+	low = equal_fixed_set_multirate(fx, TEST_MR_SPLIT);
+	stages = fx->stages;
+	latency = fx->latency;
+	if(stages == 0 || memcmp(dst[0], dst[1] + latency,
+			(rate - latency)*sizeof(int32_t)) != 0) {
+		fprintf(stderr, "FAIL multirate at %lu Hz: flat output differs "
+				"from the full rate\n", rate);
+		failed = 1;
+	}
+
+	for(b = 0; b < low; b++) {
+		for(sign = -1; sign <= 1; sign += 2) {
+			gain[b] = sign*TEST_MR_GAIN;
+			test_setup(fx, rate, 0, gain);
+			full = test_tone(fx, rate, freq[b]);
+			test_setup(fx, rate, TEST_MR_SPLIT, gain);
+			multi = test_tone(fx, rate, freq[b]);
+			if(fabs(multi - full) > worst) {
+				worst = fabs(multi - full);
+			}
+			if(fabs(multi - gain[b]) > design) {
+				design = fabs(multi - gain[b]);
+			}
+			if(!(fabs(multi - full) <= TEST_MR_DB ||
+					fabs(multi - gain[b]) <= TEST_MR_DB)) {
+				fprintf(stderr, "FAIL multirate at %lu Hz: "
+						"%g Hz at %+g dB gives %+.3f dB, "
+						"%+.3f dB at the full rate\n", rate,
+						freq[b], gain[b], multi, full);
+				failed = 1;
+			}
+		}
+		gain[b] = 0;
+	}
+	printf("test-fixed: multirate %d Hz at %lu Hz, %u bands in %u "
+			"stages, up to %.2f dB from the full rate and %.2f dB from "
+			"the design\n", TEST_MR_SPLIT, rate, low, stages, worst,
+			design);
+
+	equal_fixed_destroy(fx);
+	free(src);
+	free(dst[0]);
+	free(dst[1]);
+	return failed;
+}
+
+int main(void)
+{
+	equal_fixed_t *fx;
+	float freq = 1000;
+	unsigned int i, round;
+	int failed = 0;
+
+	fx = equal_fixed_create(1, 1, &freq);
+	for(i = 1; i < TEST_NUM_ISAS; i++) {
+		if(equal_fixed_set_isa(fx, test_isas[i]) != test_isas[i]) {
+			printf("test-fixed: no %s on this CPU, skipped\n",
+					equal_fixed_isa_name(test_isas[i]));
+		}
+	}
+	equal_fixed_destroy(fx);
+
+	srand(TEST_SEED);
+	for(round = 0; round < TEST_ROUNDS; round++) {
+		failed |= test_round(round, 0);
+		failed |= test_round(round, 1);
+	}
+	failed |= test_multirate(96000);
+	failed |= test_multirate(192000);
+	printf("test-fixed: %s\n", failed ? "FAILED" : "ok");
+	return failed;
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2008 Cooper Street Innovations
+ * 		<charles@cooper-street.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+
+/* A LADSPA plugin that multiplies its input by its Gain control, for the
+   tests and benchmarks. It has the ports the PCM expects of an
+   equalizer: controls, one audio input and one audio output. */
+
+#include <stdlib.h>
+
+#include "ladspa.h"
+
+#define GAIN_ID 0x6741
+#define GAIN_PORT_GAIN 0
+#define GAIN_PORT_INPUT 1
+#define GAIN_PORT_OUTPUT 2
+
+typedef struct gain {
+	LADSPA_Data *gain;
+	LADSPA_Data *input;
+	LADSPA_Data *output;
+} gain_t;
+
+static LADSPA_Handle gain_instantiate(const LADSPA_Descriptor *descriptor,
+		unsigned long rate)
+{
+	return calloc(1, sizeof(gain_t));
+}
+
+static void gain_connect_port(LADSPA_Handle handle, unsigned long port,
+		LADSPA_Data *data)
+{
+	gain_t *gain = handle;
+
+	switch(port) {
+	case GAIN_PORT_GAIN:
+		gain->gain = data;
+		break;
+	case GAIN_PORT_INPUT:
+		gain->input = data;
+		break;
+	case GAIN_PORT_OUTPUT:
+		gain->output = data;
+		break;
+	}
+}
+
+static void gain_run(LADSPA_Handle handle, unsigned long frames)
+{
+	gain_t *gain = handle;
+	const LADSPA_Data g = *gain->gain;
+	unsigned long i;
+
+	for(i = 0; i < frames; i++) {
+		gain->output[i] = gain->input[i]*g;
+	}
+}
+
+static void gain_cleanup(LADSPA_Handle handle)
+{
+	free(handle);
+}
+
+static const LADSPA_PortDescriptor gain_port_descriptors[] = {
+	LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL,
+	LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO,
+	LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO,
+};
+
+static const char * const gain_port_names[] = {
+	"Gain",
+	"Input",
+	"Output",
+};
+
+static const LADSPA_PortRangeHint gain_port_hints[] = {
+	{ LADSPA_HINT_BOUNDED_BELOW | LADSPA_HINT_BOUNDED_ABOVE |
+			LADSPA_HINT_DEFAULT_1, 0, 4 },
+	{ 0, 0, 0 },
+	{ 0, 0, 0 },
+};
+
+static const LADSPA_Descriptor gain_descriptor = {
+	.UniqueID = GAIN_ID,
+	.Label = "Gain",
+	.Properties = LADSPA_PROPERTY_HARD_RT_CAPABLE,
+	.Name = "Test gain",
+	.Maker = "alsaequal",
+	.Copyright = "LGPL",
+	.PortCount = 3,
+	.PortDescriptors = gain_port_descriptors,
+	.PortNames = gain_port_names,
+	.PortRangeHints = gain_port_hints,
+	.instantiate = gain_instantiate,
+	.connect_port = gain_connect_port,
+	.run = gain_run,
+	.cleanup = gain_cleanup,
+};
+
+const LADSPA_Descriptor *ladspa_descriptor(unsigned long index)
+{
+	return index == 0 ? &gain_descriptor : NULL;
+}